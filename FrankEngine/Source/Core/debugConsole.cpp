@@ -785,7 +785,7 @@ void DebugConsole::Render()
 		const float l = (float)g_textHelper->GetLineHeight();
 		const Vector2 pos(w/2, posY - consoleHeight/2 + l + 4);
 		const Vector2 size(w/2, consoleHeight/2);
-		DXUTGetD3D9Device()->SetRenderState(D3DRS_LIGHTING, TRUE);
+		g_render->SetRenderState(D3DRS_LIGHTING, TRUE);
 		g_render->RenderScreenSpaceQuad(pos, size, consoleColorBack);
 
 		Vector2 bottomPos = pos + Vector2(0, size.y+2);
@@ -838,7 +838,7 @@ void DebugConsole::Render()
 			const float h = (findMatches.size()-1) * (float)g_textHelper->GetLineHeight();
 			const Vector2 pos(30 + w/2, posY + h/2 + 4);
 			const Vector2 size(w/2 + 6, h/2 + 4);
-			DXUTGetD3D9Device()->SetRenderState(D3DRS_LIGHTING, TRUE);
+			g_render->SetRenderState(D3DRS_LIGHTING, TRUE);
 			g_render->RenderScreenSpaceQuad(pos, size, consoleColorBack);
 		}
 
@@ -17,6 +17,8 @@
 #error frankPlatformWeb.h is web-build only
 #endif
 
+#include <cstddef>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -214,6 +216,8 @@ inline HANDLE FindFirstFile(const WCHAR*, WIN32_FIND_DATA*) { return INVALID_HAN
 inline BOOL FindNextFile(HANDLE, WIN32_FIND_DATA*) { return FALSE; }
 inline BOOL FindClose(HANDLE) { return TRUE; }
 inline BOOL DeleteFile(const WCHAR*) { return FALSE; }
+#define MOVEFILE_REPLACE_EXISTING 0x1
+inline BOOL MoveFileEx(const WCHAR* from, const WCHAR* to, DWORD) { const std::string narrowFrom = FrankTempNarrow(from); return rename(narrowFrom.c_str(), FrankTempNarrow(to)) == 0; }
 typedef void* HRSRC;
 typedef void* HMODULE;
 #define MAKEINTRESOURCE(i) ((const WCHAR*)(UINT_PTR)(i))
@@ -735,6 +739,7 @@ typedef int D3DFORMAT;
 typedef int D3DPRIMITIVETYPE;
 typedef int D3DTRANSFORMSTATETYPE;
 typedef int D3DRENDERSTATETYPE;
+typedef int D3DTEXTURESTAGESTATETYPE;
 typedef int D3DPOOL;
 enum { D3DFMT_UNKNOWN = 0, D3DFMT_A8R8G8B8 = 21 };
 enum { D3DPT_POINTLIST = 1, D3DPT_LINELIST = 2, D3DPT_LINESTRIP = 3, D3DPT_TRIANGLELIST = 4, D3DPT_TRIANGLESTRIP = 5, D3DPT_TRIANGLEFAN = 6 };
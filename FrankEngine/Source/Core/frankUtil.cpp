@@ -341,6 +341,17 @@ void PasteFromClipboard(WCHAR* text, int maxLength)
     CloseClipboard();
 }
 
+UINT64 HashData(const void* data, size_t size, UINT64 hash)
+{
+	const BYTE* bytes = (const BYTE*)data;
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
 };	// namespace FrankUtil
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -348,6 +359,8 @@ void PasteFromClipboard(WCHAR* text, int maxLength)
 // Object Attributes Parser
 //
 
+UINT ObjectAttributesParser::cacheVersion = 0;
+
 bool ObjectAttributesParser::SkipToNextValue(char stringMarker)
 {
 	// skips over the next value, returns true if a value was found
@@ -9,6 +9,7 @@
 
 #pragma once
 
+#include <unordered_map>
 #include "../core/frankMath.h"
 
 #define DEBUG_OUTPUT( v ) _DEBUG_OUTPUT( #v, v )
@@ -53,6 +54,9 @@ namespace FrankUtil
 	void CopyToClipboard(const WCHAR* text, int maxLength = -1);
 	void PasteFromClipboard(WCHAR* text, int maxLength);
 
+	// fast non cryptographic hash of a block of memory (64 bit fnv-1a)
+	UINT64 HashData(const void* data, size_t size, UINT64 hash = 14695981039346656037ull);
+
 };	// namespace FrankUtil
 
 struct ObjectAttributesParser
@@ -87,8 +91,52 @@ struct ObjectAttributesParser
 	void MoveBack() { if (string > stringStart) --string; }
 	bool IsAtEnd() { ASSERT(string); return *string == 0 || *string == '#'; }
 
+	// clear all cached attribute blobs, called when the editor changes a stub
+	static void InvalidateCache() { ++cacheVersion; }
+	static UINT GetCacheVersion() { return cacheVersion; }
+
 private:
 
 	const char* string;
 	const char* stringStart;
+
+	static UINT cacheVersion;
+};
+
+// cache of pre parsed attributes, one entry per unique attribute string
+// each parsed type gets its own cache so the same string can map to different blobs
+template <class T>
+class ObjectAttributesCache
+{
+public:
+
+	typedef void (*ParseFunction)(const char* attributes, T& data);
+
+	ObjectAttributesCache(ParseFunction _parseFunction) : parseFunction(_parseFunction), cacheVersion(0) {}
+
+	const T& Get(const char* attributes)
+	{
+		ASSERT(attributes);
+		if (cacheVersion != ObjectAttributesParser::GetCacheVersion())
+		{
+			// editor changed something, throw out everything
+			cache.clear();
+			cacheVersion = ObjectAttributesParser::GetCacheVersion();
+		}
+
+		const string key(attributes);
+		typename unordered_map<string, T>::iterator it = cache.find(key);
+		if (it != cache.end())
+			return it->second;
+
+		T& data = cache[key];
+		parseFunction(attributes, data);
+		return data;
+	}
+
+private:
+
+	unordered_map<string, T> cache;
+	ParseFunction parseFunction;
+	UINT cacheVersion;
 };
\ No newline at end of file
@@ -262,7 +262,7 @@ void InputControl::Render()
 	if (!gamepadDebug)
 		return;
 	
-	DXUTGetD3D9Device()->SetRenderState(D3DRS_LIGHTING, TRUE);
+	g_render->SetRenderState(D3DRS_LIGHTING, TRUE);
 	const float w = (float)g_backBufferWidth;
 	const float h = (float)g_backBufferHeight;
 	Vector2 pos, size;
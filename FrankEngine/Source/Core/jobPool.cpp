@@ -0,0 +1,119 @@
+////////////////////////////////////////////////////////////////////////////////////////
+/*
+	Job Pool
+	Copyright 2013 Frank Force - http://www.frankforce.com
+*/
+////////////////////////////////////////////////////////////////////////////////////////
+
+#include "frankEngine.h"
+#include "../core/jobPool.h"
+
+// the one and only job pool
+JobPool g_jobPool;
+
+JobPool::JobPool() :
+	runJob(NULL),
+	runJobCount(0),
+	runWorkerCount(0),
+	busyWorkers(0),
+	runIndex(0),
+	nextJob(0),
+	stopping(false)
+{
+}
+
+JobPool::~JobPool()
+{
+	Shutdown();
+}
+
+int JobPool::GetThreadCount(int threadCount)
+{
+#if defined(FRANK_PLATFORM_WEB) && !defined(FRANK_WEB_HEADLESS)
+	// the web build has no worker threads
+	return 1;
+#else
+	if (threadCount <= 0)
+		threadCount = thread::hardware_concurrency();
+	return Max(threadCount, 1);
+#endif
+}
+
+void JobPool::Run(int jobCount, const function<void(int)>& job, int threadCount)
+{
+	threadCount = Min(GetThreadCount(threadCount), jobCount);
+	if (threadCount <= 1)
+	{
+		for (int i = 0; i < jobCount; ++i)
+			job(i);
+		return;
+	}
+
+	StartWorkers(threadCount - 1);
+	{
+		lock_guard<mutex> lock(poolMutex);
+		runJob = &job;
+		runJobCount = jobCount;
+		runWorkerCount = threadCount - 1;
+		busyWorkers = runWorkerCount;
+		nextJob = 0;
+		++runIndex;
+	}
+	wakeCondition.notify_all();
+
+	// the calling thread does work too
+	DoJobs();
+
+	unique_lock<mutex> lock(poolMutex);
+	doneCondition.wait(lock, [this]() { return busyWorkers == 0; });
+	runJob = NULL;
+}
+
+void JobPool::Shutdown()
+{
+	{
+		lock_guard<mutex> lock(poolMutex);
+		stopping = true;
+	}
+	wakeCondition.notify_all();
+	for (vector<thread>::iterator it = workers.begin(); it != workers.end(); ++it)
+		it->join();
+	workers.clear();
+	stopping = false;
+}
+
+void JobPool::StartWorkers(int workerCount)
+{
+	while ((int)workers.size() < workerCount)
+		workers.push_back(thread(&JobPool::WorkerLoop, this, (int)workers.size(), runIndex));
+}
+
+void JobPool::WorkerLoop(int workerIndex, UINT lastRunIndex)
+{
+	while (true)
+	{
+		{
+			// sleep until there is a run this worker takes part in
+			unique_lock<mutex> lock(poolMutex);
+			wakeCondition.wait(lock, [this, workerIndex, &lastRunIndex]() { return stopping || (runIndex != lastRunIndex && workerIndex < runWorkerCount); });
+			if (stopping)
+				return;
+			lastRunIndex = runIndex;
+		}
+
+		DoJobs();
+
+		{
+			lock_guard<mutex> lock(poolMutex);
+			if (--busyWorkers == 0)
+				doneCondition.notify_one();
+		}
+	}
+}
+
+void JobPool::DoJobs()
+{
+	// each thread grabs the next job until they are all done
+	for (int i = nextJob++; i < runJobCount; i = nextJob++)
+		(*runJob)(i);
+}
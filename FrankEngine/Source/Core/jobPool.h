@@ -0,0 +1,60 @@
+////////////////////////////////////////////////////////////////////////////////////////
+/*
+	Job Pool
+	Copyright 2013 Frank Force - http://www.frankforce.com
+
+	- persistent worker threads for splitting work across cores
+	- workers are started the first time they are needed and sleep between runs
+	- the calling thread works too and Run returns when every job is done
+	- only call Run from the main thread, jobs must not call it
+	- the web build has no worker threads so jobs run on the calling thread
+*/
+////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+extern class JobPool g_jobPool;
+
+class JobPool
+{
+public:
+
+	JobPool();
+	~JobPool();
+
+	// calls job(i) for every i in [0, jobCount), threadCount includes the calling thread, 0 uses all cores
+	void Run(int jobCount, const function<void(int)>& job, int threadCount = 0);
+
+	// how many threads a run will use, 1 when worker threads are not supported
+	static int GetThreadCount(int threadCount = 0);
+
+	// stop and join all the workers, they will restart if Run is called again
+	void Shutdown();
+
+	int GetWorkerCount() const { return (int)workers.size(); }
+
+private:
+
+	void StartWorkers(int workerCount);
+	void WorkerLoop(int workerIndex, UINT lastRunIndex);
+	void DoJobs();
+
+	vector<thread> workers;
+	mutex poolMutex;
+	condition_variable wakeCondition;
+	condition_variable doneCondition;
+
+	const function<void(int)>* runJob;
+	int runJobCount;
+	int runWorkerCount;		// how many workers take part in this run
+	int busyWorkers;		// workers that have not finished this run
+	UINT runIndex;			// changes every run so workers know to wake up
+	atomic<int> nextJob;
+	bool stopping;
+};
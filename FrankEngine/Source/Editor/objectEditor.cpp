@@ -174,7 +174,15 @@ void ObjectEditor::Update(bool isActive)
 
 			// update attributes box in real time
 			LPCWSTR attributes = g_editorGui.GetEditBoxText();
-			wcstombs_s(NULL, stub.attributes, GameObjectStub::attributesLength, attributes, GameObjectStub::attributesLength-1);	
+			char newAttributes[GameObjectStub::attributesLength];
+			wcstombs_s(NULL, newAttributes, GameObjectStub::attributesLength, attributes, GameObjectStub::attributesLength-1);
+			if (strcmp(newAttributes, stub.attributes) != 0)
+			{
+				// stub was edited, cached attributes may be stale
+				strncpy_s(stub.attributes, GameObjectStub::attributesLength, newAttributes, GameObjectStub::attributesLength-1);
+				ObjectAttributesParser::InvalidateCache();
+				g_terrain->MarkSaveDirty(stub.xf.position);
+			}
 		}
 
 		for (list<GameObjectStub*>::iterator it = selectedStubs.begin(); it != selectedStubs.end(); ) 
@@ -332,8 +340,11 @@ void ObjectEditor::UpdateSelected(GameObjectStub* stub)
 		}
 	}
 		
-	if (stubCopy.xf != stub->xf || stub->size != stub->size)
+	if (stubCopy.xf != stub->xf || stubCopy.size != stub->size)
+	{
+		g_terrain->MarkSaveDirty(stub->xf.position);
 		g_editor.SetStateChanged();
+	}
 }
 
 void ObjectEditor::MoveSelectedStubs(const Vector2& offset)
@@ -360,6 +371,9 @@ GameObjectStub& ObjectEditor::MoveStub(GameObjectStub& stub, const Vector2& offs
 		g_terrain->GetStub(stub.handle, &patchOld);
 	}
 
+	// the stub may have been rotated or mirrored before it was moved
+	patchOld->MarkSaveDirty();
+
 	const Vector2 newPos = stub.xf.position + offset;
 	TerrainPatch* patchNew = g_terrain->GetPatch(newPos);
 	if (!patchNew)
@@ -159,7 +159,10 @@ void TileEditor::Update(bool isActive)
 				// erase tool
 				TerrainTile* tile = g_terrain->GetTile(mousePos, terrainLayer);
 				if (tile)
+				{
 					tile->MakeClear();
+					g_terrain->MarkSaveDirty(mousePos);
+				}
 				g_editor.SetStateChanged();
 			}
 			else if 
@@ -378,6 +381,7 @@ void TileEditor::Select(Box2AABB& box, bool allLayers)
 
 		selectedTile = *terrainTile;
 		terrainTile->MakeClear();
+		g_terrain->MarkSaveDirty(terrainTilePos.x, terrainTilePos.y);
 	}
 
 	selectedTilesPos = Vector2(pos0) * TerrainTile::GetSize() + g_terrain->GetPosWorld();
@@ -480,7 +484,10 @@ void TileEditor::ClearSelection(bool anchor)
 			const IntVector2 terrainTilePos = IntVector2(x, y) + terrainTilePosOffset;
 			TerrainTile* terrainTile = g_terrain->GetTile(terrainTilePos.x, terrainTilePos.y, firstSelectedLayer + l);
 			if (terrainTile)
+			{
 				*terrainTile = selectedTile;
+				g_terrain->MarkSaveDirty(terrainTilePos.x, terrainTilePos.y);
+			}
 		}
 
 		g_editor.SetStateChanged();
@@ -678,7 +685,10 @@ void TileEditor::Resurface(TerrainPatch& patch, const Vector2& posA, const Vecto
 	}
 
 	if (stateChanged)
+	{
+		patch.MarkSaveDirty();
 		g_editor.SetStateChanged();
+	}
 }
 
 // 0 == left, 1 == up, 2 == right, 3 == down, 
@@ -696,6 +706,7 @@ void TileEditor::FloodFill(TerrainPatch& patch, const Vector2& testPos, BYTE sur
 		return;
 
 	FloodFillInternal(patch, x, y, surfaceData, startSurfaceSide, startSurfaceData);
+	patch.MarkSaveDirty();
 }
 
 // 0 == left, 1 == up, 2 == right, 3 == down, 
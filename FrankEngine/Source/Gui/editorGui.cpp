@@ -838,7 +838,7 @@ HRESULT EditorGui::Render(float delta)
 	
 	mainDialog.OnRender(delta);
 
-	DXUTGetD3D9Device()->SetRenderState(D3DRS_LIGHTING, TRUE);
+	g_render->SetRenderState(D3DRS_LIGHTING, TRUE);
 
 	// render the terrain edit texture
 	if (g_gameControlBase->IsTileEditMode())
@@ -1047,7 +1047,7 @@ void EditorGui::RenderObjectAttributes()
 		mainDialog.DrawText( stub->GetObjectInfo().GetAttributesDescription(), 0, r, Color::White(), DT_TOP | DT_LEFT);
 		mainDialog.EndSprite();
 		g_render->SetFiltering();
-		DXUTGetD3D9Device()->SetRenderState(D3DRS_LIGHTING, TRUE);
+		g_render->SetRenderState(D3DRS_LIGHTING, TRUE);
 		return;
 	}
 
@@ -1151,7 +1151,7 @@ void EditorGui::RenderObjectAttributes()
 	}
 	mainDialog.EndSprite();
 	g_render->SetFiltering();
-	DXUTGetD3D9Device()->SetRenderState(D3DRS_LIGHTING, TRUE);
+	g_render->SetRenderState(D3DRS_LIGHTING, TRUE);
 }
 
 //--------------------------------------------------------------------------------------
@@ -421,23 +421,42 @@ void TileImageDecal::Render()
 {
 	if (GetRenderGroup() >= 10000)
 		return;
-
-	if (!attributes.castShadows && DeferredRender::GetRenderPassIsShadow() && !DeferredRender::GetRenderPassIsDirectionalShadow())
-		return;
 	
 	TextureID tileSheet = g_render->GetTextureTileSheet(attributes.texture);
 	if (tileSheet != Texture_Invalid)
 		return;
 
-	DeferredRender::EmissiveRenderBlock emissiveRenderBlock(attributes.emissive > 0);
-	DeferredRender::TransparentRenderBlock transparentRenderBlock(attributes.transparent);
-	DeferredRender::BackgroundRenderBlock backgroundRenderBlock(!attributes.castShadows);
+	const XForm2 xf = GetXFInterpolated();
+	if (g_renderCommands.CanRecord())
+	{
+		BYTE flags = 0;
+		if (attributes.emissive > 0)
+			flags |= RenderCommand_Emissive;
+		if (attributes.transparent)
+			flags |= RenderCommand_Transparent;
+		if (!attributes.castShadows)
+			flags |= RenderCommand_Background;
+
+		// the same command works for every pass so decals can be recorded once per frame
+		RenderCommand& command = g_renderCommands.AddTile(GetRenderGroup(), attributes.tilePos, attributes.tileSize, xf, size, attributes.color, attributes.texture, flags);
+		command.passMask = RenderCommand::passMaskAll;
+		if (!attributes.castShadows)
+			command.passMask &= ~(RenderCommand::GetPassBit(DeferredRender::RenderPass_lightShadow) | RenderCommand::GetPassBit(DeferredRender::RenderPass_vision));
+		if (attributes.emissive > 0)
+			command.emissiveScale = attributes.emissive;
+		return;
+	}
+
+	if (!attributes.castShadows && DeferredRender::GetRenderPassIsShadow() && !DeferredRender::GetRenderPassIsDirectionalShadow())
+		return;
 
 	Color color = attributes.color;
-	if (DeferredRender::GetRenderPassIsEmissive() && emissiveRenderBlock.IsActive())
+	if (DeferredRender::GetRenderPassIsEmissive() && attributes.emissive > 0)
 		color *= attributes.emissive;
 
-	const XForm2 xf = GetXFInterpolated();
+	DeferredRender::EmissiveRenderBlock emissiveRenderBlock(attributes.emissive > 0);
+	DeferredRender::TransparentRenderBlock transparentRenderBlock(attributes.transparent);
+	DeferredRender::BackgroundRenderBlock backgroundRenderBlock(!attributes.castShadows);
 	g_render->RenderTile(attributes.tilePos, attributes.tileSize, xf, size, color, attributes.texture);
 }
 
@@ -632,10 +651,16 @@ void ShootTrigger::Update()
 void ShootTrigger::Render()
 {
 	const XForm2 xf = GetXFInterpolated();
+	Color color = IsActive()? Color::Yellow() : Color::Green();
+	if (g_renderCommands.CanRecord())
+	{
+		RenderCommand& command = g_renderCommands.AddQuad(GetRenderGroup(), xf, size, color, Texture_Circle, RenderCommand_Emissive | RenderCommand_Specular);
+		command.passMask = RenderCommand::passMaskAll;
+		return;
+	}
 	
 	DeferredRender::EmissiveRenderBlock emissiveRenderBlock;
 	DeferredRender::SpecularRenderBlock specularRenderBlock;
-	Color color = IsActive()? Color::Yellow() : Color::Green();
 	g_render->RenderQuad(xf, size, color, Texture_Circle);
 }
 
@@ -398,7 +398,21 @@ bool Camera::CameraTest(const Vector2& pos, float radius) const
 	);
 	
 	//Line2(pos, xfView.Inverse().TransformCoord(nearestPos)).RenderDebug();
-	return ((localPos - nearestPos).LengthSquared() <= Square(radius));
+	if ((localPos - nearestPos).LengthSquared() > Square(radius))
+		return false;
+
+	// skip shadow casters that no light will use
+	return DeferredRender::ShadowCasterTest(Box2AABB(pos).Inflate(radius));
+}
+
+// returns true if box is at least partially on screen
+bool Camera::CameraTest(const Box2AABB& aabbox) const
+{
+	if (!aabbox.PartiallyContains(cameraWorldAABBox))
+		return false;
+
+	// skip shadow casters that no light will use
+	return DeferredRender::ShadowCasterTest(aabbox);
 }
 
 // returns true if circle is at least partially on screen
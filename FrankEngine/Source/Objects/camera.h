@@ -38,7 +38,7 @@ public:
 	bool CameraTest(const Line2& line) const;
 	bool CameraConeTest(const XForm2& xf, float radius = 0, float coneAngle = 0) const;
 	bool CameraGameTest(const Vector2& pos, float radius = 0) const;
-	bool CameraTest(const Box2AABB& aabbox) const { return aabbox.PartiallyContains(cameraWorldAABBox); }
+	bool CameraTest(const Box2AABB& aabbox) const;
 	const Box2AABB& GetCameraBBox() const { return cameraWorldAABBox; }
 
 	float CameraWindowDistance(const Vector2& pos) const;
@@ -41,6 +41,8 @@ GameObject::GameObject(const GameObjectStub& stub, GameObject* _parent, bool add
 	xfLocal(stub.xf),
 	xfWorld(stub.xf),
 	xfWorldLast(stub.xf),
+	streamPatchIndex(0),
+	streamSlot(0),
 	parent(NULL),
 	flags(ObjectFlag_JustAdded|ObjectFlag_Visible|ObjectFlag_Gravity),
 	physicsBody(NULL),
@@ -76,6 +78,8 @@ GameObject::GameObject(const XForm2& xf, GameObject* _parent, GameObjectType _ga
 	xfLocal(xf),
 	xfWorld(xf),
 	xfWorldLast(xf),
+	streamPatchIndex(0),
+	streamSlot(0),
 	parent(NULL),
 	handle(nextUniqueHandleValue++),
 	flags(ObjectFlag_JustAdded|ObjectFlag_Visible|ObjectFlag_Gravity),
@@ -435,6 +435,8 @@ private: // private stuff
 	XForm2 xfLocal;						// transform in local space
 	XForm2 xfWorld;						// transform from local to world space (only updated once per frame)
 	XForm2 xfWorldLast;					// world space transform from last frame, used for interpolation
+	IntVector2 streamPatchIndex;		// terrain patch this object is indexed in for streaming
+	int streamSlot;						// where this object is in that patch's stream list
 
 	list<GameObject*> children;			// list of children	
 	GameObject* parent;					// parent if it has one
@@ -447,6 +449,8 @@ private: // private stuff
 		ObjectFlag_JustAdded			= 0x04,		// was just created this frame
 		ObjectFlag_Gravity				= 0x08,		// should gravity be applied
 		ObjectFlag_IgnoreExplosions		= 0x10,		// should not be effected by explosions
+		ObjectFlag_StreamIndexed		= 0x20,		// is in the terrain stream index
+		ObjectFlag_StreamCheck			= 0x40,		// is queued for a stream out check
 	};
 	UINT flags;								// bit field of flags for the object
 	
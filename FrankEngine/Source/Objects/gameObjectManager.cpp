@@ -162,13 +162,21 @@ void GameObjectManager::UpdateTransforms()
 		{	
 			ASSERT(!obj.parent && obj.children.empty());
 			ASSERT(GetObjectFromHandle(obj.GetHandle())); // make sure object is in table
+			if (g_terrain)
+				g_terrain->RemoveStreamIndex(obj);
 			it = objects.erase(it);
 			delete &obj;
 		} 
 		else
 		{
 			if (!obj.HasParent())
+			{
 				obj.UpdateTransforms();
+
+				// let terrain know if the object may need to stream out
+				if (g_terrain)
+					g_terrain->UpdateStreamIndex(obj);
+			}
 			++it;
 		}
 	}
@@ -208,29 +216,65 @@ void GameObjectManager::CreateRenderList()
 
 void GameObjectManager::Render()
 {
+	// let quads from consecutive objects share draw calls
+	FrankRender::SpriteBatchBlock spriteBatchBlock;
+	RenderCommandBuffer::RecordBlock recordBlock;
+
+	// objects are rendered once per frame, later passes replay the ones that only emitted commands
+	const RenderCommandBuffer::FrameMode frameMode = g_renderCommands.BeginFrameRender(g_gameControlBase->GetRenderFrameCount());
+	if (frameMode == RenderCommandBuffer::FrameMode_Record)
+		renderObjectReplayed.assign(sortedRenderObjects.size(), false);
+
 	int renderGroup = sortedRenderObjects.empty()? 0 : (*sortedRenderObjects.front()).GetRenderGroup();
+	int objectIndex = -1;
 	for (GameObject* obj : sortedRenderObjects )
 	{
+		++objectIndex;
 		if (obj->IsDestroyed())
 			continue;
 
 		if (renderGroup != obj->GetRenderGroup())
 		{
-			// always render simple verts and disable additive at the end of each group
+			// always render commands, simple verts and disable additive at the end of each group
+			g_renderCommands.Execute(renderGroup);
 			g_render->RenderSimpleVerts();
 			g_render->SetSimpleVertsAreAdditive(false);
 		}
 
 		renderGroup = obj->GetRenderGroup();
-		obj->Render();
+		UINT64 shadowCasterKey = 0;
+		if (DeferredRender::IsGatheringShadowCasters())
+		{
+			// let cached lights notice objects that rotate in place
+			const XForm2 xf = obj->GetXFInterpolated();
+			shadowCasterKey = FrankUtil::HashData(&xf, sizeof(xf));
+		}
+		DeferredRender::BeginShadowCaster(shadowCasterKey);
+
+		if (frameMode == RenderCommandBuffer::FrameMode_Record)
+		{
+			const UINT renderCallCount = g_render->GetRenderCallCount();
+			const int firstCommand = g_renderCommands.GetCommandCount();
+			obj->Render();
+			renderObjectReplayed[objectIndex] = g_renderCommands.KeepForReplay(renderGroup, firstCommand, g_render->GetRenderCallCount() != renderCallCount);
+		}
+		else if (frameMode == RenderCommandBuffer::FrameMode_Replay && objectIndex < int(renderObjectReplayed.size()) && renderObjectReplayed[objectIndex])
+			++g_renderCommands.replayedObjectCount;
+		else
+			obj->Render();
+		DeferredRender::EndShadowCaster();
 	}
 
+	g_renderCommands.Execute(renderGroup);
 	g_render->RenderSimpleVerts();
 	g_render->SetSimpleVertsAreAdditive(false);
 }
 
 void GameObjectManager::RenderPost()
 {
+	FrankRender::SpriteBatchBlock spriteBatchBlock;
+	RenderCommandBuffer::RecordBlock recordBlock;
+
 	int renderGroup = sortedRenderObjects.empty()? 0 : (*sortedRenderObjects.front()).GetRenderGroup();
 	for (GameObject* obj : sortedRenderObjects )
 	{
@@ -239,7 +283,8 @@ void GameObjectManager::RenderPost()
 
 		if (renderGroup != obj->GetRenderGroup())
 		{
-			// always render simple verts and disable additive at the end of each group
+			// always render commands, simple verts and disable additive at the end of each group
+			g_renderCommands.Execute();
 			g_render->RenderSimpleVerts();
 			g_render->SetSimpleVertsAreAdditive(false);
 		}
@@ -249,6 +294,7 @@ void GameObjectManager::RenderPost()
 		obj->RenderPost();
 	}
 
+	g_renderCommands.Execute();
 	g_render->RenderSimpleVerts();
 	g_render->SetSimpleVertsAreAdditive(false);
 }
@@ -291,6 +337,8 @@ void GameObjectManager::Reset()
 		if (obj.IsDestroyed())
 		{	
 			ASSERT(!obj.parent && obj.children.empty());
+			if (g_terrain)
+				g_terrain->RemoveStreamIndex(obj);
 			it = objects.erase(it);
 			delete &obj;
 		} 
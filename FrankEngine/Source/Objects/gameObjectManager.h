@@ -63,6 +63,7 @@ private:
 
 	GameObjectHashTable objects;					// hash map of all objects
 	list<GameObject *> sortedRenderObjects;			// list of objects to render sorted by render group
+	vector<bool> renderObjectReplayed;				// objects in the render list that are replayed from recorded commands this frame
 	static bool lockDeleteObjects;					// to prevent improperly deleting objects
 	
 	BYTE* memPool = NULL;							// use block allocator for objects
@@ -40,6 +40,15 @@ Light::Light(const GameObjectStub& stub) :
 	wasRendered(false),
 	wasCreatedFromStub(true),
 	isActive(true),
+	shadowCasterCount(-1),
+	shadowCasterHash(0),
+	shadowCasterTracked(false),
+	wasTextureCached(false),
+	refreshDue(true),
+	refreshInterval(1),
+	textureLevel(DeferredRender::lightTextureDefaultLevel),
+	refreshFrame(0),
+	refreshXF(XForm2::Identity()),
 	gelTexture(Texture_Invalid),
 	haloTexture(defaultHaloTexture)
 {
@@ -90,6 +99,15 @@ Light::Light(const XForm2& xf, GameObject* _parent, float _radius, const Color&
 	wasRendered(false),
 	wasCreatedFromStub(false),
 	isActive(true),
+	shadowCasterCount(-1),
+	shadowCasterHash(0),
+	shadowCasterTracked(false),
+	wasTextureCached(false),
+	refreshDue(true),
+	refreshInterval(1),
+	textureLevel(DeferredRender::lightTextureDefaultLevel),
+	refreshFrame(0),
+	refreshXF(XForm2::Identity()),
 	gelTexture(Texture_Invalid),
 	haloTexture(defaultHaloTexture)
 {
@@ -97,6 +115,13 @@ Light::Light(const XForm2& xf, GameObject* _parent, float _radius, const Color&
 	SetRenderGroup(10000);
 }
 
+void Light::Destroy()
+{
+	// free the cached light texture
+	DeferredRender::RemoveLightCacheEntry(*this);
+	GameObject::Destroy();
+}
+
 void Light::Update()
 {
 	if (fadeTimer.HasElapsed())
@@ -124,6 +149,11 @@ void Light::Update()
 		{
 			Circle(xf.position, radius).RenderDebug(color);
 		}
+
+		if (shadowCasterCount >= 0)
+			g_debugRender.RenderTextFormatted(xf.position, color, true, 0, L"casters: %d%s", shadowCasterCount, wasTextureCached? L" cached" : L"");
+		if (!IsSimpleLight() && DeferredRender::lightScheduleEnable)
+			g_debugRender.RenderTextFormatted(xf.position - Vector2(0, 1), color, true, 0, L"refresh: %d", refreshInterval);
 	}
 }
 
@@ -136,10 +166,17 @@ void Light::Render()
 	{
 		// render a light halo texture
 		const XForm2 xf = GetXFInterpolated();
-		DeferredRender::EmissiveRenderBlock emissiveRenderBlock;
-		DeferredRender::AdditiveRenderBlock additiveRenderBlock;
 		Color haloColor = color;
 		haloColor.a *= GetFadeAlpha() * haloAlpha;
+		if (g_renderCommands.CanRecord())
+		{
+			RenderCommand& command = g_renderCommands.AddQuad(GetRenderGroup(), XForm2(xf.position), Vector2(haloRadius), haloColor, haloTexture, RenderCommand_Emissive | RenderCommand_Additive);
+			command.passMask = RenderCommand::passMaskAll;
+			return;
+		}
+
+		DeferredRender::EmissiveRenderBlock emissiveRenderBlock;
+		DeferredRender::AdditiveRenderBlock additiveRenderBlock;
 		g_render->RenderQuad(xf.position, Vector2(haloRadius), haloColor, haloTexture);
 	}
 }
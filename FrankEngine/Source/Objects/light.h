@@ -45,6 +45,7 @@ public:
 	bool  GetIsActive() const						{ return isActive; }
 	
 	bool IsLight() const { return true; }
+	void Destroy() override;
 	bool IsSimpleLight() const;
 
 	static float haloAlpha;
@@ -81,6 +82,15 @@ private:
 	bool wasRendered;
 	bool wasCreatedFromStub;
 	bool isActive;
+	int shadowCasterCount;
+	UINT64 shadowCasterHash;
+	bool shadowCasterTracked;
+	bool wasTextureCached;
+	bool refreshDue;
+	int refreshInterval;
+	int textureLevel;
+	UINT refreshFrame;
+	XForm2 refreshXF;
 	TextureID gelTexture;
 	TextureID haloTexture;
 	GameTimerPercent fadeTimer;
@@ -10,10 +10,12 @@
 #include "../objects/particleSystem.h"
 
 int ParticleEmitter::totalEmitterCount = 0;
+int ParticleEmitter::totalParticleCount = 0;
+int ParticleEmitter::totalParticleCapacity = 0;
+int ParticleEmitter::droppedParticleCount[int(ParticlePriority::Count)] = {0};
+vector<ParticleEmitter*> ParticleEmitter::simulateList;
 int ParticleEmitter::defaultRenderGroup = -20;
 int ParticleEmitter::defaultAdditiveRenderGroup = -10;
-DWORD Particle::simpleVertsLastColor = 0;
-bool Particle::simpleVertsNeedsCap = false;
 
 bool ParticleEmitter::enableParticles = true;
 ConsoleCommand(ParticleEmitter::enableParticles, particleEnable);
@@ -27,6 +29,38 @@ ConsoleCommand(ParticleEmitter::particleAlphaEffectsEnable, particleAlphaEffects
 float ParticleEmitter::shadowRenderAlpha = 0.6f;
 ConsoleCommand(ParticleEmitter::shadowRenderAlpha, particleShadowRenderAlpha);
 
+// new particles are not spawned when there are this many
+int ParticleEmitter::maxParticles = 4000;
+ConsoleCommand(ParticleEmitter::maxParticles, particleMaxCount);
+
+// kilobytes of particle storage all emitters can use together
+int ParticleEmitter::particleMemoryBudget = 1024;
+ConsoleCommand(ParticleEmitter::particleMemoryBudget, particleMemoryBudget);
+
+// storage an emitter starts with, small so many emitters can share the budget
+int ParticleEmitter::particleStartCapacity = 8;
+ConsoleCommand(ParticleEmitter::particleStartCapacity, particleStartCapacity);
+
+// most particles an emitter can have unless its def sets a quota (0 = no limit)
+int ParticleEmitter::particleEmitterQuota = 1000;
+ConsoleCommand(ParticleEmitter::particleEmitterQuota, particleEmitterQuota);
+
+// portion of the count and memory limits ambient effects can use
+float ParticleEmitter::particleAmbientShare = 0.5f;
+ConsoleCommand(ParticleEmitter::particleAmbientShare, particleAmbientShare);
+
+// portion of the count and memory limits normal effects can use
+float ParticleEmitter::particleNormalShare = 0.9f;
+ConsoleCommand(ParticleEmitter::particleNormalShare, particleNormalShare);
+
+// how many threads simulate particles, 0 uses all cores
+int ParticleEmitter::particleThreadCount = 0;
+ConsoleCommand(ParticleEmitter::particleThreadCount, particleThreadCount);
+
+// most particles in each simulation job, also how many it takes to start another thread
+int ParticleEmitter::particleJobSize = 512;
+ConsoleCommand(ParticleEmitter::particleJobSize, particleJobSize);
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 ParticleEmitter::ParticleEmitter(const ParticleSystemDef& _systemDef, const XForm2& xf, GameObject* _parent, float scale) :
@@ -54,8 +88,9 @@ ParticleEmitter::ParticleEmitter(const ParticleSystemDef& _systemDef, const XFor
 
 ParticleEmitter::~ParticleEmitter()
 {
-	for (list<Particle*>::iterator it = particles.begin(); it != particles.end(); ++it)
-		DeleteParticle(*it);
+	if (simulateQueued)
+		simulateList.erase(find(simulateList.begin(), simulateList.end(), this));
+	ClearParticles();
 	--totalEmitterCount;
 }
 
@@ -66,10 +101,12 @@ void ParticleEmitter::WarmUp(float time)
 		time -= GAME_TIME_STEP;
 		Update();
 	}
+	FlushParticleUpdate();
 }
 
 void ParticleEmitter::SpawnParticle()
 {
+	FlushParticleUpdate();
 	if (systemDef.HasFlags(ParticleFlags::LocalSpace))
 		AddParticle(XForm2::Identity());
 	else
@@ -100,6 +137,7 @@ void ParticleEmitter::SetPaused(bool _paused,  bool fade)
 	if (paused == _paused)
 		return;
 
+	FlushParticleUpdate();
 	paused = _paused;
 	if (!fade)
 		pauseFade = paused? 0.0f : 1.0f;
@@ -109,11 +147,12 @@ void ParticleEmitter::SetPaused(bool _paused,  bool fade)
 
 void ParticleEmitter::Update()
 {
+	// finish the last update if it is still waiting to be simulated
+	FlushParticleUpdate();
+
 	if (!enableParticles)
 	{
-		for (list<Particle*>::iterator it = particles.begin(); it != particles.end(); ++it)
-			DeleteParticle(*it);
-		particles.clear();
+		ClearParticles();
 		if (IsDead())
 		{
 			Destroy();
@@ -125,7 +164,7 @@ void ParticleEmitter::Update()
 	if (IsDead())
 	{
 		// self destruct if we are past life time and have no particles
-		if (particles.empty())
+		if (particles.Empty())
 			Destroy();
 	}
 	else if (systemDef.emitRate > 0 && (pauseFade > 0 || !paused))
@@ -153,79 +192,65 @@ void ParticleEmitter::Update()
 			pauseFade = pauseFadeNext;
 	}
 	
-	Vector2 lastParticlePos;
-	bool firstParticle = true;
-
 	// update particles
-	for (list<Particle*>::iterator it = particles.begin(); it != particles.end();) 
-	{
-		Particle& particle = **it;
+	RemoveDeadParticles();
+	ApplyParticleGravity();
 
-		if (particle.IsDead())
-		{ 
-			bool canRemove = true;
-			if (systemDef.HasFlags(ParticleFlags::TrailLine|ParticleFlags::TrailRibbon) && it != --particles.end())
-			{
-				// hack: peek at the next particle
-				// we must wait for the next one to die to avoid a glich when we are destroyed
-				const Particle& nextParticle = **next(it);
-				if (!nextParticle.IsDead())
-					canRemove = false;
-			}
+	// integration runs later with the other emitters in SimulateParticles
+	simulateQueued = true;
+	simulateList.push_back(this);
 
-			if (canRemove)
-			{
-				// remove dead particle
-				it = particles.erase(it);
-				DeleteParticle(&particle);
-				continue;
-			}
-		}
+	CapSpeed(maxSpeed);
+}
 
-		particle.Update();
-		
-		if (particleDebug)
-		{
-			const XForm2 xfEmitter = systemDef.HasFlags(ParticleFlags::LocalSpace)? GetXFWorld() : XForm2::Identity();
-			const Vector2 particlePos = (particle.GetXForm()*xfEmitter).position;
-			if (!firstParticle)
-				Line2(particlePos, lastParticlePos).RenderDebug(Color::White(1 - particle.GetLifetimePercent()));
-			lastParticlePos = particlePos;
-			firstParticle = false;
-		}
+void ParticleEmitter::FinishParticleUpdate()
+{
+	particles.cachedFrame = 0;
 
-		++it;
-	}
-	
 	if (systemDef.HasFlags(ParticleFlags::TrailLine|ParticleFlags::TrailRibbon))
 	{
-		if ((!IsDead() || setTrailEnd) && particles.size() > 1 && pauseFade > 0)
+		if ((!IsDead() || setTrailEnd) && particles.Size() > 1 && pauseFade > 0)
 		{
+			// the newest particle stays attached to the emitter
 			setTrailEnd = false;
-			Particle& particle = *particles.back();
-			if (systemDef.HasFlags(ParticleFlags::LocalSpace))
-			{
-				particle.xf.position = Vector2::Zero();
-				particle.xfDelta.position = Vector2::Zero();
-			}
-			else
+			const int i = particles.Size() - 1;
+			Vector2 position = Vector2::Zero();
+			Vector2 delta = Vector2::Zero();
+			if (!systemDef.HasFlags(ParticleFlags::LocalSpace))
 			{
-				particle.xf.position = GetXFWorld().position;
-				particle.xfDelta.position = GetXFDelta().position;
+				position = GetXFWorld().position;
+				delta = GetXFDelta().position;
 			}
 
 			if (IsDead() && !systemDef.HasFlags(ParticleFlags::LocalSpace))
 			{
-				particle.xf.position += g_cameraBase->GetXFDelta().position;
-				particle.xfDelta.position += g_cameraBase->GetXFDelta().position;
+				position += g_cameraBase->GetXFDelta().position;
+				delta += g_cameraBase->GetXFDelta().position;
 			}
+
+			particles.positionX[i] = position.x;
+			particles.positionY[i] = position.y;
+			particles.deltaX[i] = delta.x;
+			particles.deltaY[i] = delta.y;
 		}
 	}
 	
-	if (particleDebug && particles.size() > 1)
+	if (particleDebug && particles.Size() > 1)
 	{
-		Particle* particle = particles.back();
-		Line2(GetPosWorld(), lastParticlePos).RenderDebug(Color::White(1 - particle->GetLifetimePercent()));
+		const XForm2 xfEmitter = systemDef.HasFlags(ParticleFlags::LocalSpace)? GetXFWorld() : XForm2::Identity();
+		Vector2 lastParticlePos;
+		for (int i = 0; i < particles.Size(); ++i)
+		{
+			const XForm2 xfWorld = XForm2(Vector2(particles.positionX[i], particles.positionY[i]), particles.angle[i]) * xfEmitter;
+			const float percent = GetParticleLifetimePercent(i);
+			const float size = Max(0.01f, Lerp(percent, fabs(particles.sizeStart[i]), fabs(particles.sizeEnd[i])));
+			g_debugRender.RenderBox(xfWorld, Vector2(size), Color::White(1 - percent));
+			if (i > 0)
+				Line2(xfWorld.position, lastParticlePos).RenderDebug(Color::White(1 - percent));
+			lastParticlePos = xfWorld.position;
+		}
+
+		Line2(GetPosWorld(), lastParticlePos).RenderDebug(Color::White(1 - GetParticleLifetimePercent(particles.Size() - 1)));
 		
 		const float percentTimeLeft = 1 - (systemDef.emitLifeTime > 0 ? lifeTimer / systemDef.emitLifeTime : 0);
 		Circle(GetPosWorld(), systemDef.emitSize).RenderDebug(Color::Red(percentTimeLeft), 0, 12);
@@ -234,33 +259,30 @@ void ParticleEmitter::Update()
 			emitBox.RenderDebug(GetXFWorld(), Color::Red(percentTimeLeft));
 			
 		wstringstream s;
-		s << particles.size();
+		s << particles.Size();
+		if (droppedCount > 0)
+			s << L" dropped " << droppedCount;
 		g_debugRender.RenderText(GetPosWorld(), s.str(), Color::White());
 	}
-
-	CapSpeed(maxSpeed);
 }
 
 // some effects may need this for when there is no parent or the parent dies
 void ParticleEmitter::SetTrailEnd(const Vector2& trailEndPos)
 {
+	FlushParticleUpdate();
 	DetachParent();
 	Kill();
 	SetPosLocal(trailEndPos);
 	setTrailEnd = true;
 
-	if (particles.size() > 1)
+	if (particles.Size() > 1)
 	{
 		// set the first particle to be emiter position
-		Particle& particle = *particles.back();
-		particle.xfDelta.position += trailEndPos - particle.xf.position;
-		particle.xf.position = trailEndPos;// - g_cameraBase->GetXFDelta().position;
-	}
-	if (particles.size() > 1)
-	{
-		// set the first particle to be emiter position
-		Particle& particle = *particles.back();
-		particle.xf.position = trailEndPos;
+		const int i = particles.Size() - 1;
+		particles.deltaX[i] += trailEndPos.x - particles.positionX[i];
+		particles.deltaY[i] += trailEndPos.y - particles.positionY[i];
+		particles.positionX[i] = trailEndPos.x;
+		particles.positionY[i] = trailEndPos.y;
 	}
 }
 	
@@ -277,40 +299,55 @@ void ParticleEmitter::RenderInternal(bool allowAdditive)
 
 	if (systemDef.HasFlags(ParticleFlags::TrailLine))
 	{
-		if (particles.size() > 1)
+		if (particles.Size() > 1)
 		{
 			// set additive rendering for simple verts
 			g_render->SetSimpleVertsAreAdditive(allowAdditive && systemDef.HasFlags(ParticleFlags::Additive));
 
-			Particle::simpleVertsNeedsCap = true;
-			for (list<Particle*>::iterator it = particles.begin(); it != particles.end(); ++it) 
-				(**it).RenderTrail(xfEmitter);
+			UpdateRenderCache(xfEmitter);
+			g_render->CapLineVerts(particles.cachedPos1[0]);
+			DWORD lastColor = 0;
+			for (int i = 0; i < particles.Size(); ++i)
+			{
+				Color color = particles.cachedColor[i];
+				color.a *= alphaScale;
+				if (DeferredRender::GetRenderPassIsShadow())
+					color.a *= shadowRenderAlpha;
+
+				lastColor = color;
+				g_render->AddPointToLineVerts(particles.cachedPos1[i], lastColor);
+			}
    
 			// connect to the end and cap it off
 			const Vector2 endPos = xf.position;
-			g_render->AddPointToLineVerts(endPos, Particle::simpleVertsLastColor);
+			g_render->AddPointToLineVerts(endPos, lastColor);
 			g_render->CapLineVerts(endPos);
 		}
 	}
 	else if (systemDef.HasFlags(ParticleFlags::TrailRibbon))
 	{
-		if (particles.size() > 1)
+		if (particles.Size() > 1)
 		{
 			// set additive rendering for simple verts
 			g_render->SetSimpleVertsAreAdditive(allowAdditive && systemDef.HasFlags(ParticleFlags::Additive));
 
-			Vector2 previousPos = (**particles.begin()).GetXFInterpolated(xfEmitter).position;
-			if (particles.size() > 1)
+			UpdateRenderCache(xfEmitter);
+			g_render->CapTriVerts(particles.cachedPos1[0]);
+			DWORD lastColor = 0;
+			for (int i = 0; i < particles.Size(); ++i)
 			{
-				// if ribbion has more then 1 particle, create a fake previous pos based on where the next particle is
-				// this used to orient the ribbon properly
-				const Vector2 nextPos = (**(++particles.begin())).GetXFInterpolated(xfEmitter).position;
-				previousPos = previousPos - (nextPos - previousPos);
+				Color color = particles.cachedColor[i];
+				color.a *= alphaScale;
+				if (DeferredRender::GetRenderPassIsShadow())
+					color.a *= shadowRenderAlpha;
+
+				lastColor = color;
+				g_render->AddPointToTriVerts(particles.cachedPos1[i], lastColor);
+				g_render->AddPointToTriVerts(particles.cachedPos2[i], lastColor);
 			}
 
-			Particle::simpleVertsNeedsCap = true;
-			for (list<Particle*>::iterator it = particles.begin(); it != particles.end(); ++it) 
-				(**it).RenderRibbon(xfEmitter, previousPos);
+			const int last = particles.Size() - 1;
+			const Vector2 previousPos = 0.5f*(particles.cachedPos1[last] + particles.cachedPos2[last]);
 		
 			if (IsDead() && systemDef.HasFlags(ParticleFlags::CameraSpace))
 			{
@@ -322,7 +359,7 @@ void ParticleEmitter::RenderInternal(bool allowAdditive)
 			{
 				// connect to the end and cap it off
 				const Vector2 endPos = xf.position;
-				g_render->AddPointToTriVerts(endPos, Particle::simpleVertsLastColor);
+				g_render->AddPointToTriVerts(endPos, lastColor);
 				g_render->CapTriVerts(endPos);
 				//endPos.RenderDebug();
 			}
@@ -332,12 +369,31 @@ void ParticleEmitter::RenderInternal(bool allowAdditive)
 	{
 		const bool transparent = systemDef.HasFlags(ParticleFlags::Transparent);
 		const bool additive = systemDef.HasFlags(ParticleFlags::Additive);
-		DeferredRender::AdditiveRenderBlock additiveRenderBlock(allowAdditive && additive);
-		DeferredRender::EmissiveRenderBlock emissiveRenderBlock(allowAdditive && additive);
-		DeferredRender::TransparentRenderBlock transparentRenderBlock(transparent);
 
-		for (list<Particle*>::iterator it = particles.begin(); it != particles.end(); ++it) 
-			(**it).Render(xfEmitter);
+		// particles that change device state per particle must draw immediately
+		const bool hasAlphaEffects = particleAlphaEffectsEnable && (systemDef.HasFlags(ParticleFlags::FakeAlpha) || systemDef.HasFlags(ParticleFlags::DisableAlphaBlend));
+		if (g_renderCommands.CanRecord() && !hasAlphaEffects)
+		{
+			BYTE commandFlags = 0;
+			if (allowAdditive && additive)
+				commandFlags |= RenderCommand_Additive | RenderCommand_Emissive;
+			if (transparent)
+				commandFlags |= RenderCommand_Transparent;
+
+			UpdateRenderCache(xfEmitter);
+			for (int i = 0; i < particles.Size(); ++i)
+				RenderParticle(i, true, commandFlags);
+		}
+		else
+		{
+			DeferredRender::AdditiveRenderBlock additiveRenderBlock(allowAdditive && additive);
+			DeferredRender::EmissiveRenderBlock emissiveRenderBlock(allowAdditive && additive);
+			DeferredRender::TransparentRenderBlock transparentRenderBlock(transparent);
+
+			UpdateRenderCache(xfEmitter);
+			for (int i = 0; i < particles.Size(); ++i)
+				RenderParticle(i);
+		}
 	}
 
 	{
@@ -471,119 +527,348 @@ inline void ParticleEmitter::AddParticle(const XForm2& xf, float startTime)
 	if (!systemDef.HasFlags(ParticleFlags::DontFlipAngular))
 		angularSpeed *= RAND_SIGN;
 
-	Particle *particle = NewParticle();
-	if (!particle)
+	if (!ReserveParticle())
+	{
+		// ran out of particles
+		++droppedCount;
+		++droppedParticleCount[int(systemDef.priority)];
 		return;
+	}
 	
-	const float particleAngle = systemDef.HasFlags(ParticleFlags::DontUseEmitAngle) ? xf.angle : angle;
-	particle->Init(this, XForm2(particlePosition, particleAngle), direction*speed, angularSpeed, startTime);
+	const Vector2 velocity = direction*speed;
+	float particleAngle = systemDef.HasFlags(ParticleFlags::DontUseEmitAngle) ? xf.angle : angle;
+
+	// randomize particle values
+	const float lifeTime = systemDef.particleLifeTime * (1 + systemDef.particleLifeTimeRandomness*RAND_BETWEEN(-1.0f,1.0f));
+
+	// randomly flip the texture for more randomness
+	const float randomFlip = systemDef.HasFlags(ParticleFlags::TrailLine|ParticleFlags::TrailRibbon|ParticleFlags::DontFlip)? 1 : (float)RAND_SIGN;
+	const float sizeRandomness = (1 + systemDef.particleSizeRandomness*RAND_BETWEEN(-1, 1));
+	particleAngle += RAND_BETWEEN(-systemDef.particleConeAngle, systemDef.particleConeAngle);
+
+	Color colorStart = Color::RandBetween(systemDef.colorStart1, systemDef.colorStart2);
+	const Color colorEnd = Color::RandBetween(systemDef.colorEnd1, systemDef.colorEnd2);
+	Color colorDelta = (colorEnd - colorStart);
 	if (pauseFade < 1)
 	{
-		particle->colorStart.a *= pauseFade;
-		particle->colorDelta.a *= pauseFade;
+		colorStart.a *= pauseFade;
+		colorDelta.a *= pauseFade;
 	}
 
-	particles.push_back(particle);
+	particles.positionX.push_back(particlePosition.x);
+	particles.positionY.push_back(particlePosition.y);
+	particles.angle.push_back(particleAngle);
+	particles.deltaX.push_back(0);
+	particles.deltaY.push_back(0);
+	particles.deltaAngle.push_back(0);
+	particles.velocityX.push_back(velocity.x);
+	particles.velocityY.push_back(velocity.y);
+	particles.angularSpeed.push_back(angularSpeed);
+	particles.time.push_back(startTime);
+	particles.lifeTime.push_back(lifeTime);
+	particles.sizeStart.push_back(randomFlip * systemDef.particleSizeStart * sizeRandomness);
+	particles.sizeEnd.push_back(randomFlip * systemDef.particleSizeEnd * sizeRandomness);
+	particles.colorStart.push_back(colorStart);
+	particles.colorDelta.push_back(colorDelta);
+	particles.cachedFrame = 0;
+	++totalParticleCount;
 }
 
 ///////////////////////////////////////////////////////////
-// particle member functions
+// particle array functions
 ///////////////////////////////////////////////////////////
 
-void Particle::Init(const ParticleEmitter* _emitter, const XForm2& _xf, const Vector2& _velocity, float _angularSpeed, float _startTime)
+void ParticleEmitter::SimulateParticles()
 {
-	cachedFrame = 0;
-	systemDef = &_emitter->GetDef();
-	emitter = _emitter;
-	xf = _xf;
-	xfDelta = XForm2::Identity();
-	velocity = _velocity;
-	angularSpeed = _angularSpeed;
-	time = _startTime;
+	FrankProfilerEntryDefine(L"ParticleEmitter::SimulateParticles()", Color::White(), 5);
 
-	// randomize particle values
-	lifeTime = systemDef->particleLifeTime * (1 + systemDef->particleLifeTimeRandomness*RAND_BETWEEN(-1.0f,1.0f));
+	struct SimulateJob
+	{
+		ParticleEmitter* emitter;
+		int start;
+		int end;
+	};
+
+	// split large emitters so one big effect can spread across threads
+	static vector<SimulateJob> jobs;
+	jobs.clear();
+	const int jobSize = Max(particleJobSize, 1);
+	int particleCount = 0;
+	for (ParticleEmitter* emitter : simulateList)
+	{
+		const int count = emitter->particles.Size();
+		for (int start = 0; start < count; start += jobSize)
+			jobs.push_back({emitter, start, Min(start + jobSize, count)});
+		particleCount += count;
+	}
 
-	// randomly flip the texture for more randomness
-	const float randomFlip = systemDef->HasFlags(ParticleFlags::TrailLine|ParticleFlags::TrailRibbon|ParticleFlags::DontFlip)? 1 : (float)RAND_SIGN;
-	const float sizeRandomness = (1 + systemDef->particleSizeRandomness*RAND_BETWEEN(-1, 1));
-	sizeStart = randomFlip * systemDef->particleSizeStart * sizeRandomness;
-	sizeEnd = randomFlip * systemDef->particleSizeEnd * sizeRandomness;
-	xf.angle += RAND_BETWEEN(-systemDef->particleConeAngle, systemDef->particleConeAngle);
-
-	colorStart = Color::RandBetween(systemDef->colorStart1, systemDef->colorStart2);
-	const Color colorEnd = Color::RandBetween(systemDef->colorEnd1, systemDef->colorEnd2);
-	colorDelta = (colorEnd - colorStart);
+	// emitters only touch their own particles so jobs can run in any order
+	const int threadCount = Min(JobPool::GetThreadCount(particleThreadCount), particleCount / jobSize + 1);
+	g_jobPool.Run((int)jobs.size(), [](int i)
+	{
+		jobs[i].emitter->UpdateParticles(jobs[i].start, jobs[i].end);
+	}, threadCount);
+
+	// bookkeeping that touches other objects happens in update order
+	for (ParticleEmitter* emitter : simulateList)
+	{
+		emitter->simulateQueued = false;
+		emitter->FinishParticleUpdate();
+	}
+	simulateList.clear();
 }
 
-inline void Particle::Update()
+void ParticleEmitter::FlushParticleUpdate()
 {
+	if (!simulateQueued)
+		return;
+
+	simulateQueued = false;
+	simulateList.erase(find(simulateList.begin(), simulateList.end(), this));
+	UpdateParticles(0, particles.Size());
+	FinishParticleUpdate();
+}
+
+void ParticleEmitter::ApplyParticleGravity()
+{
+	// gravity can be overridden by the game so it is looked up on the main thread
+	if (!systemDef.particleGravity)
+		return;
+
+	const float gravityScale = GAME_TIME_STEP * systemDef.particleGravity;
+	for (int i = 0; i < particles.Size(); ++i)
+	{
+		const Vector2 gravity = g_gameControlBase->GetGravity(Vector2(particles.positionX[i], particles.positionY[i]));
+		particles.velocityX[i] -= gravityScale * gravity.x;
+		particles.velocityY[i] -= gravityScale * gravity.y;
+	}
+}
+
+void ParticleEmitter::UpdateParticles(int start, int end)
+{
+	// runs on worker threads, only touches this emitter's particles in the range
+	float* positionX = particles.positionX.data();
+	float* positionY = particles.positionY.data();
+	float* angle = particles.angle.data();
+	float* deltaX = particles.deltaX.data();
+	float* deltaY = particles.deltaY.data();
+	float* deltaAngle = particles.deltaAngle.data();
+	const float* velocityX = particles.velocityX.data();
+	const float* velocityY = particles.velocityY.data();
+	const float* angularSpeed = particles.angularSpeed.data();
+	float* time = particles.time.data();
+
 	// update time
-	time += GAME_TIME_STEP;
+	for (int i = start; i < end; ++i)
+		time[i] += GAME_TIME_STEP;
 
-	const XForm2 xfLast = xf;
+	if (systemDef.HasFlags(ParticleFlags::CameraSpace))
+	{
+		// camera space particles move along with the camera
+		const XForm2 xfCameraDelta = g_cameraBase->GetXFDelta();
+		for (int i = start; i < end; ++i)
+		{
+			const XForm2 xfLast(Vector2(positionX[i], positionY[i]), angle[i]);
+			XForm2 xf(xfLast.position + GAME_TIME_STEP * Vector2(velocityX[i], velocityY[i]), xfLast.angle + angularSpeed[i] * GAME_TIME_STEP);
+			xf *= xfCameraDelta;
+
+			const XForm2 xfDelta = xf - xfLast;
+			positionX[i] = xf.position.x;
+			positionY[i] = xf.position.y;
+			angle[i] = xf.angle;
+			deltaX[i] = xfDelta.position.x;
+			deltaY[i] = xfDelta.position.y;
+			deltaAngle[i] = xfDelta.angle;
+		}
+	}
+	else
+	{
+		// update transform
+		for (int i = start; i < end; ++i)
+		{
+			deltaX[i] = velocityX[i] * GAME_TIME_STEP;
+			deltaY[i] = velocityY[i] * GAME_TIME_STEP;
+			deltaAngle[i] = angularSpeed[i] * GAME_TIME_STEP;
+			positionX[i] += deltaX[i];
+			positionY[i] += deltaY[i];
+			angle[i] += deltaAngle[i];
+		}
+	}
+}
 
-	// update gravity
-	if (systemDef->particleGravity)
-		velocity -= GAME_TIME_STEP * systemDef->particleGravity * g_gameControlBase->GetGravity(xf.position);
+void ParticleEmitter::RemoveDeadParticles()
+{
+	// compact living particles to the front so they stay in spawn order
+	const bool isTrail = systemDef.HasFlags(ParticleFlags::TrailLine|ParticleFlags::TrailRibbon);
+	const int count = particles.Size();
+	int liveCount = 0;
+	for (int i = 0; i < count; ++i)
+	{
+		// trails must wait for the next particle to die to avoid a glich when we are destroyed
+		if (IsParticleDead(i) && (!isTrail || i == count - 1 || IsParticleDead(i + 1)))
+			continue;
 
-	// update transform
-	xf.position += velocity * GAME_TIME_STEP;
-	xf.angle += angularSpeed * GAME_TIME_STEP;
+		if (liveCount != i)
+			particles.Move(i, liveCount);
+		++liveCount;
+	}
 
-	// camera space particles move along with the camera
-	if (systemDef->HasFlags(ParticleFlags::CameraSpace))
-		xf *= g_cameraBase->GetXFDelta();
-	
-	xfDelta = xf - xfLast;
+	if (liveCount == count)
+		return;
+
+	totalParticleCount -= count - liveCount;
+	particles.Resize(liveCount);
+	particles.cachedFrame = 0;
 
-	if (ParticleEmitter::particleDebug)
+	// give back storage when most of it is unused, halving leaves room so it doesn't grow right back
+	const int startCapacity = Max(particleStartCapacity, 1);
+	if (particles.capacity > startCapacity && liveCount <= particles.capacity / 4)
 	{
-		const XForm2 xfEmitter = systemDef->HasFlags(ParticleFlags::LocalSpace)? emitter->GetXFWorld() : XForm2::Identity();
-		const XForm2 xfWorld = GetXForm() * xfEmitter;
+		const int capacity = Max(startCapacity, 2*liveCount);
+		totalParticleCapacity -= particles.capacity - capacity;
+		particles.SetCapacity(capacity);
+	}
+}
+
+void ParticleEmitter::ClearParticles()
+{
+	totalParticleCount -= particles.Size();
+	totalParticleCapacity -= particles.capacity;
+	particles.Clear();
+	particles.SetCapacity(0);
+	particles.cachedFrame = 0;
+}
 
-		const float percent = GetLifetimePercent();
-		const float size = Max(0.01f, Lerp(percent, fabs(sizeStart), fabs(sizeEnd)));
-		g_debugRender.RenderBox(xfWorld, Vector2(size), Color::White(1 - percent));
+float ParticleEmitter::GetPriorityShare(ParticlePriority priority)
+{
+	switch (priority)
+	{
+		case ParticlePriority::Ambient:	return particleAmbientShare;
+		case ParticlePriority::Normal:	return particleNormalShare;
+		default:						return 1;
 	}
 }
 
-inline void Particle::Render(const XForm2& xfParent)
+bool ParticleEmitter::ReserveParticle()
 {
-	if (cachedFrame != g_gameControlBase->GetRenderFrameCount())
+	// check the emitter quota
+	const int quota = systemDef.particleQuota > 0 ? systemDef.particleQuota : particleEmitterQuota;
+	if (quota > 0 && particles.Size() >= quota)
+		return false;
+
+	// lower priority effects can only use part of the global limits
+	const float share = GetPriorityShare(systemDef.priority);
+	if (totalParticleCount >= int(share * maxParticles))
+		return false;
+
+	if (particles.Size() < particles.capacity)
+		return true;
+
+	// start small and double the storage, using whatever is left of the memory budget if doubling doesn't fit
+	int growth = particles.capacity > 0 ? particles.capacity : Max(particleStartCapacity, 1);
+	if (quota > 0)
+		growth = Min(growth, quota - particles.capacity);
+	const int capacityBudget = int(share * particleMemoryBudget * 1024.0f / ParticleArrays::GetBytesPerParticle());
+	growth = Min(growth, capacityBudget - totalParticleCapacity);
+	if (growth <= 0)
+		return false;
+
+	totalParticleCapacity += growth;
+	particles.SetCapacity(particles.capacity + growth);
+	return true;
+}
+
+float ParticleEmitter::GetParticleLifetimePercent(int i) const
+{
+	const float lifeTime = particles.lifeTime[i];
+	return CapPercent((lifeTime == 0) ? 0 : (particles.time[i] - g_interpolatePercent * GAME_TIME_STEP) / lifeTime);
+}
+
+XForm2 ParticleEmitter::GetParticleXFInterpolated(int i, const XForm2& xfParent) const
+{
+	const XForm2 xf(Vector2(particles.positionX[i], particles.positionY[i]), particles.angle[i]);
+	const XForm2 xfDelta(Vector2(particles.deltaX[i], particles.deltaY[i]), particles.deltaAngle[i]);
+	return xf.Interpolate(xfDelta, g_interpolatePercent) * xfParent;
+}
+
+void ParticleEmitter::UpdateRenderCache(const XForm2& xfParent)
+{
+	const UINT renderFrame = g_gameControlBase->GetRenderFrameCount();
+	if (particles.cachedFrame == renderFrame)
+		return;
+
+	// cache the particle info for this render frame
+	particles.cachedFrame = renderFrame;
+	const int count = particles.Size();
+	particles.cachedColor.resize(count);
+	particles.cachedPos1.resize(count);
+	particles.cachedPos2.resize(count);
+	particles.cachedAngle.resize(count);
+	particles.cachedSize.resize(count);
+
+	const bool isRibbon = systemDef.HasFlags(ParticleFlags::TrailRibbon);
+	Vector2 previousPos = Vector2::Zero();
+	if (isRibbon && count > 1)
 	{
-		// cache data for faster rendering
-		cachedFrame = g_gameControlBase->GetRenderFrameCount();
+		// create a fake previous pos based on where the next particle is
+		// this used to orient the ribbon properly
+		previousPos = GetParticleXFInterpolated(0, xfParent).position;
+		const Vector2 nextPos = GetParticleXFInterpolated(1, xfParent).position;
+		previousPos = previousPos - (nextPos - previousPos);
+	}
 
+	for (int i = 0; i < count; ++i)
+	{
 		// caluculate percent of particle life time
-		const float percent = GetLifetimePercent();
+		const float percent = GetParticleLifetimePercent(i);
 
-		// cache the particle info for this render frame
-		const XForm2 xfWorld = GetXFInterpolated(xfParent);
-		cachedSize = sizeStart + percent * (sizeEnd - sizeStart);
+		Color color = particles.colorStart[i] + percent * particles.colorDelta[i];
+		if (percent < systemDef.particleFadeInTime)
+			color.a *= (percent / systemDef.particleFadeInTime);
+		particles.cachedColor[i] = color;
 
-		cachedColor = colorStart + percent * colorDelta;
-		if (percent < systemDef->particleFadeInTime)
-			cachedColor.a *= (percent / systemDef->particleFadeInTime);
-
-		cachedPos1 = xfWorld.position;
-		cachedAngle = xfWorld.angle;
+		const XForm2 xfWorld = GetParticleXFInterpolated(i, xfParent);
+		const float size = particles.sizeStart[i] + percent * (particles.sizeEnd[i] - particles.sizeStart[i]);
+		if (isRibbon)
+		{
+			const Vector2 offset = size*(xfWorld.position - previousPos).Normalize().RotateRightAngle();
+			particles.cachedPos1[i] = xfWorld.position - offset;
+			particles.cachedPos2[i] = xfWorld.position + offset;
+			previousPos = 0.5f*(particles.cachedPos1[i] + particles.cachedPos2[i]);
+		}
+		else
+		{
+			particles.cachedPos1[i] = xfWorld.position;
+			particles.cachedAngle[i] = xfWorld.angle;
+			particles.cachedSize[i] = size;
+		}
 	}
+}
 
-	if (!g_cameraBase->CameraTest(cachedPos1, fabs(cachedSize) * ROOT_2))
+void ParticleEmitter::RenderParticle(int i, bool recordCommand, BYTE commandFlags) const
+{
+	const float cachedSize = particles.cachedSize[i];
+	const Vector2& cachedPos = particles.cachedPos1[i];
+	if (!g_cameraBase->CameraTest(cachedPos, fabs(cachedSize) * ROOT_2))
 		return;
 
-	const XForm2 xfWorld(cachedPos1, cachedAngle);
+	const XForm2 xfWorld(cachedPos, particles.cachedAngle[i]);
 	const Vector2 size(cachedSize);
-	Color color = cachedColor;
-	color.a *= emitter->alphaScale;
+	Color color = particles.cachedColor[i];
+	color.a *= alphaScale;
 	if (DeferredRender::GetRenderPassIsShadow())
-		color.a *= ParticleEmitter::shadowRenderAlpha;
+		color.a *= shadowRenderAlpha;
+
+	if (recordCommand)
+	{
+		g_renderCommands.AddQuad(GetRenderGroup(), xfWorld, size, color, systemDef.texture, commandFlags);
+		return;
+	}
 
-	if (systemDef->HasFlags(ParticleFlags::DisableAlphaBlend) && ParticleEmitter::particleAlphaEffectsEnable)
-		DXUTGetD3D9Device()->SetRenderState(D3DRS_ALPHABLENDENABLE, FALSE);
+	if (systemDef.HasFlags(ParticleFlags::DisableAlphaBlend) && particleAlphaEffectsEnable)
+		g_render->SetRenderState(D3DRS_ALPHABLENDENABLE, FALSE);
 
-	if (systemDef->HasFlags(ParticleFlags::FakeAlpha) && ParticleEmitter::particleAlphaEffectsEnable)
+	if (systemDef.HasFlags(ParticleFlags::FakeAlpha) && particleAlphaEffectsEnable)
 	{
 		// todo: cache this caps for performance?
 		const D3DCAPS9* caps = DXUTGetD3D9DeviceCaps();
@@ -593,127 +878,104 @@ inline void Particle::Render(const XForm2& xfParent)
 			// can make some effects like blood look better
 			const DWORD a = (DWORD)(255 * CapPercent(1 - color.a));
 			color.a = 1;
-			DXUTGetD3D9Device()->SetRenderState(D3DRS_ALPHAREF, a);
-			DXUTGetD3D9Device()->SetRenderState(D3DRS_ALPHATESTENABLE, TRUE);
-			DXUTGetD3D9Device()->SetRenderState(D3DRS_ALPHAFUNC, D3DCMP_GREATEREQUAL);
+			g_render->SetRenderState(D3DRS_ALPHAREF, a);
+			g_render->SetRenderState(D3DRS_ALPHATESTENABLE, TRUE);
+			g_render->SetRenderState(D3DRS_ALPHAFUNC, D3DCMP_GREATEREQUAL);
 		}
 	}
 
-	g_render->RenderQuad(xfWorld, size, color, systemDef->texture);
+	g_render->RenderQuad(xfWorld, size, color, systemDef.texture);
 	
-	if (systemDef->HasFlags(ParticleFlags::FakeAlpha) && ParticleEmitter::particleAlphaEffectsEnable)
-		DXUTGetD3D9Device()->SetRenderState(D3DRS_ALPHATESTENABLE, FALSE);
+	if (systemDef.HasFlags(ParticleFlags::FakeAlpha) && particleAlphaEffectsEnable)
+		g_render->SetRenderState(D3DRS_ALPHATESTENABLE, FALSE);
 
-	if (systemDef->HasFlags(ParticleFlags::DisableAlphaBlend) && ParticleEmitter::particleAlphaEffectsEnable)
-		DXUTGetD3D9Device()->SetRenderState(D3DRS_ALPHABLENDENABLE, TRUE);
+	if (systemDef.HasFlags(ParticleFlags::DisableAlphaBlend) && particleAlphaEffectsEnable)
+		g_render->SetRenderState(D3DRS_ALPHABLENDENABLE, TRUE);
 }
 
-inline void Particle::RenderTrail(const XForm2& xfParent)
+void ParticleArrays::Resize(int count)
 {
-	if (cachedFrame != g_gameControlBase->GetRenderFrameCount())
-	{
-		// cache data for faster rendering
-		cachedFrame = g_gameControlBase->GetRenderFrameCount();
-
-		// caluculate percent of particle life time
-		const float percent = GetLifetimePercent();
-
-		cachedColor = colorStart + percent * colorDelta;
-		if (percent < systemDef->particleFadeInTime)
-			cachedColor.a *= (percent / systemDef->particleFadeInTime);
-
-		cachedPos1 = GetXFInterpolated(xfParent).position;
-	}
-
-	Color color = cachedColor;
-	color.a *= emitter->alphaScale;
-	if (DeferredRender::GetRenderPassIsShadow())
-		color.a *= ParticleEmitter::shadowRenderAlpha;
-
-	if (Particle::simpleVertsNeedsCap)
-	{
-		g_render->CapLineVerts(cachedPos1);
-		Particle::simpleVertsNeedsCap = false;
-	}
-
-	const DWORD colorDword = color;
-	g_render->AddPointToLineVerts(cachedPos1, colorDword);
-	simpleVertsLastColor = colorDword;
+	positionX.resize(count);
+	positionY.resize(count);
+	angle.resize(count);
+	deltaX.resize(count);
+	deltaY.resize(count);
+	deltaAngle.resize(count);
+	velocityX.resize(count);
+	velocityY.resize(count);
+	angularSpeed.resize(count);
+	time.resize(count);
+	lifeTime.resize(count);
+	sizeStart.resize(count);
+	sizeEnd.resize(count);
+	colorStart.resize(count);
+	colorDelta.resize(count);
 }
 
-inline void Particle::RenderRibbon(const XForm2& xfParent, Vector2& previousPos)
+template <class T>
+static void SetVectorCapacity(vector<T>& v, int count)
 {
-	if (cachedFrame != g_gameControlBase->GetRenderFrameCount())
-	{
-		// cache data for faster rendering
-		cachedFrame = g_gameControlBase->GetRenderFrameCount();
-
-		// caluculate percent of particle life time
-		const float percent = GetLifetimePercent();
-
-		cachedColor = colorStart + percent * colorDelta;
-		if (percent < systemDef->particleFadeInTime)
-			cachedColor.a *= (percent / systemDef->particleFadeInTime);
-
-		const XForm2 xfWorld = GetXFInterpolated(xfParent);
-		const float size = sizeStart + percent * (sizeEnd - sizeStart);
-
-		const Vector2 offset = size*(xfWorld.position - previousPos).Normalize().RotateRightAngle();
-
-		cachedPos1 = xfWorld.position - offset;
-		cachedPos2 = xfWorld.position + offset;
-		//cachedPos1.RenderDebug();
-	}
-	
-	// pass out the position of the particle
-	previousPos = 0.5f*(cachedPos1 + cachedPos2);
-	
-	Color color = cachedColor;
-	color.a *= emitter->alphaScale;
-	if (DeferredRender::GetRenderPassIsShadow())
-		color.a *= ParticleEmitter::shadowRenderAlpha;
-
-	if (Particle::simpleVertsNeedsCap)
-	{
-		g_render->CapTriVerts(cachedPos1);
-		Particle::simpleVertsNeedsCap = false;
-	}
+	// keep the vectors at exactly the tracked capacity so the memory budget is accurate
+	if (int(v.capacity()) == count)
+		return;
 
-	const DWORD colorDword = color;
-	g_render->AddPointToTriVerts(cachedPos1, colorDword);
-	g_render->AddPointToTriVerts(cachedPos2, colorDword);
-	simpleVertsLastColor = colorDword;
+	// copy into a new vector so shrinking actually frees memory
+	vector<T> resized;
+	resized.reserve(count);
+	resized.assign(v.begin(), v.end());
+	v.swap(resized);
 }
 
-///////////////////////////////////////////////////////////
-// particle memory management
-///////////////////////////////////////////////////////////
-
-// global particle pools
-list<Particle*> ParticleEmitter::freeParticleList;
-Particle ParticleEmitter::particlePool[maxParticles];
-
-void ParticleEmitter::InitParticleSystem()
+void ParticleArrays::SetCapacity(int count)
 {
-	// prep the free particle list
-	freeParticleList.clear();
-	for(int i = 0; i < maxParticles; ++i)
-		freeParticleList.push_back(&particlePool[i]);
+	capacity = count;
+	SetVectorCapacity(positionX, count);
+	SetVectorCapacity(positionY, count);
+	SetVectorCapacity(angle, count);
+	SetVectorCapacity(deltaX, count);
+	SetVectorCapacity(deltaY, count);
+	SetVectorCapacity(deltaAngle, count);
+	SetVectorCapacity(velocityX, count);
+	SetVectorCapacity(velocityY, count);
+	SetVectorCapacity(angularSpeed, count);
+	SetVectorCapacity(time, count);
+	SetVectorCapacity(lifeTime, count);
+	SetVectorCapacity(sizeStart, count);
+	SetVectorCapacity(sizeEnd, count);
+	SetVectorCapacity(colorStart, count);
+	SetVectorCapacity(colorDelta, count);
+	SetVectorCapacity(cachedColor, count);
+	SetVectorCapacity(cachedPos1, count);
+	SetVectorCapacity(cachedPos2, count);
+	SetVectorCapacity(cachedAngle, count);
+	SetVectorCapacity(cachedSize, count);
 }
 
-Particle* ParticleEmitter::NewParticle()
+void ParticleArrays::Move(int from, int to)
 {
-	if (freeParticleList.empty())
-		return NULL; // ran out of particles
-
-	Particle* particle = freeParticleList.back();
-	freeParticleList.pop_back();
-	return particle;
+	positionX[to] = positionX[from];
+	positionY[to] = positionY[from];
+	angle[to] = angle[from];
+	deltaX[to] = deltaX[from];
+	deltaY[to] = deltaY[from];
+	deltaAngle[to] = deltaAngle[from];
+	velocityX[to] = velocityX[from];
+	velocityY[to] = velocityY[from];
+	angularSpeed[to] = angularSpeed[from];
+	time[to] = time[from];
+	lifeTime[to] = lifeTime[from];
+	sizeStart[to] = sizeStart[from];
+	sizeEnd[to] = sizeEnd[from];
+	colorStart[to] = colorStart[from];
+	colorDelta[to] = colorDelta[from];
 }
 
-void ParticleEmitter::DeleteParticle(Particle* particle)
+void ParticleEmitter::InitParticleSystem()
 {
-	freeParticleList.push_back(particle);
+	totalParticleCount = 0;
+	totalParticleCapacity = 0;
+	for (int i = 0; i < int(ParticlePriority::Count); ++i)
+		droppedParticleCount[i] = 0;
 }
 
 ///////////////////////////////////////////////////////////
@@ -887,7 +1149,7 @@ ParticleSystemDef ParticleSystemDef::BuildRibbonTrail
 // lerp between two particle systems
 ParticleSystemDef ParticleSystemDef::Lerp(float percent, const ParticleSystemDef& p1, const ParticleSystemDef& p2)
 {
-	return ParticleSystemDef
+	ParticleSystemDef systemDef
 	(
 		p1.texture,
 		FrankMath::Lerp(percent, p1.colorStart1,						p2.colorStart1),					
@@ -912,6 +1174,9 @@ ParticleSystemDef ParticleSystemDef::Lerp(float percent, const ParticleSystemDef
 		FrankMath::Lerp(percent, p1.particleGravity,					p2.particleGravity),
 		p1.particleFlags
 	);
+	systemDef.priority = p1.priority;
+	systemDef.particleQuota = p1.particleQuota;
+	return systemDef;
 }
 
 ParticleSystemDef& ParticleSystemDef::Scale(float scale)
@@ -945,8 +1210,15 @@ ParticleSystemDef& ParticleSystemDef::SetRandomValues( float lifeTimeRandomness,
 // stub functions
 ///////////////////////////////////////////////////////////
 
-// constructor to build particle def from attributes string
-ParticleSystemDef ParticleSystemDef::BuildFromAttributes(const char* attributes, float emitLifeTime, int* _renderGroup, bool* _warmUp)
+// pre parsed stub attributes, cached so stubs streaming in don't need to parse the string again
+struct ParticleSystemAttributes
+{
+	ParticleSystemDef systemDef;
+	int renderGroup;
+	bool warmUp;
+};
+
+static void ParseParticleSystemAttributes(const char* attributes, ParticleSystemAttributes& data)
 {
 	float life = 1.0f;
 	float fade = 0.2f;
@@ -994,12 +1266,9 @@ ParticleSystemDef ParticleSystemDef::BuildFromAttributes(const char* attributes,
 	texture = (TextureID)Cap((int)(texture), 0, MAX_TEXTURE_COUNT-1);
 	life = Min(life, 10.0f);
 
-	if (_renderGroup)
-		*_renderGroup = renderGroup;
-	if (_warmUp)
-		*_warmUp = warmUp;
-
-	return ParticleSystemDef
+	data.renderGroup = renderGroup;
+	data.warmUp = warmUp;
+	data.systemDef = ParticleSystemDef
 	(
 		texture,
 		c1, c2,
@@ -1007,13 +1276,30 @@ ParticleSystemDef ParticleSystemDef::BuildFromAttributes(const char* attributes,
 		life, fade,
 		sizeStart, sizeEnd,
 		speed, angular,
-		emitRate, emitLifeTime, emitSize, 
+		emitRate, 0, emitSize, 
 		randomness, randomness, randomness, randomness,
 		DegreesToRadians(emitConeDegrees), DegreesToRadians(particleConeDegrees),
 		gravity, ParticleFlags(flags)
 	);
 }
 
+static ObjectAttributesCache<ParticleSystemAttributes> particleSystemAttributesCache(ParseParticleSystemAttributes);
+
+// constructor to build particle def from attributes string
+ParticleSystemDef ParticleSystemDef::BuildFromAttributes(const char* attributes, float emitLifeTime, int* _renderGroup, bool* _warmUp)
+{
+	const ParticleSystemAttributes& data = particleSystemAttributesCache.Get(attributes);
+
+	if (_renderGroup)
+		*_renderGroup = data.renderGroup;
+	if (_warmUp)
+		*_warmUp = data.warmUp;
+
+	ParticleSystemDef systemDef = data.systemDef;
+	systemDef.emitLifeTime = emitLifeTime;
+	return systemDef;
+}
+
 
 ParticleEmitter::ParticleEmitter(const GameObjectStub& stub) : 
 	GameObject(stub),
@@ -1025,6 +1311,7 @@ ParticleEmitter::ParticleEmitter(const GameObjectStub& stub) :
 	int renderGroup;
 	bool warmUp;
 	systemDef = ParticleSystemDef::BuildFromAttributes(stub.attributes, 0, &renderGroup, &warmUp);
+	systemDef.priority = ParticlePriority::Ambient; // emitters placed in the level are background effects
 	emitBox = Box2AABB(-stub.size, stub.size);
 
 	SetPaused(systemDef.HasFlags(ParticleFlags::StartPaused), false);
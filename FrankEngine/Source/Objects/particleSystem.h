@@ -34,6 +34,15 @@ enum class ParticleFlags
 	DontUseEmitAngle		= (1 << 15), // don't pass along emit angle to particles
 };
 
+// when particles run low lower priorities stop spawning first
+enum class ParticlePriority
+{
+	Ambient,		// background effects that nobody will miss
+	Normal,			// most effects
+	Critical,		// gameplay effects the player must see
+	Count
+};
+
 inline ParticleFlags operator | (ParticleFlags a, ParticleFlags b) { return static_cast<ParticleFlags>(static_cast<int>(a) | static_cast<int>(b)); }
 inline ParticleFlags operator & (ParticleFlags a, ParticleFlags b) { return static_cast<ParticleFlags>(static_cast<int>(a) & static_cast<int>(b)); }
 
@@ -172,15 +181,53 @@ public:
 	float particleConeAngle = PI;				// how much to rotate angle by
 	float emitConeAngle = PI;					// angle in radians of the emit cone in local space (0 = directional, PI = omnidirectional)
 	ParticleFlags particleFlags;				// list of flags for the system
+
+	ParticlePriority priority = ParticlePriority::Normal;	// how important this effect is when particles run low
+	int particleQuota = 0;						// most particles the emitter can have alive (0 = use particleEmitterQuota)
 };
 
-class Particle;
+// particle state is kept in seperate arrays so the update loops run over contiguous memory and vectorize
+struct ParticleArrays
+{
+	int Size() const		{ return int(time.size()); }
+	bool Empty() const		{ return time.empty(); }
+	void Resize(int count);
+	void Move(int from, int to);
+	void Clear()			{ Resize(0); }
+	void SetCapacity(int count);
+
+	// storage counted against the memory budget, every vector is reserved to exactly this
+	int capacity = 0;
+	static int GetBytesPerParticle() { return int(15*sizeof(float) + 3*sizeof(Color) + 2*sizeof(Vector2)); }
+
+	vector<float> positionX;
+	vector<float> positionY;
+	vector<float> angle;
+	vector<float> deltaX;			// change in transform during the last update used for interpolation
+	vector<float> deltaY;
+	vector<float> deltaAngle;
+	vector<float> velocityX;
+	vector<float> velocityY;
+	vector<float> angularSpeed;
+	vector<float> time;
+	vector<float> lifeTime;
+	vector<float> sizeStart;
+	vector<float> sizeEnd;
+	vector<Color> colorStart;
+	vector<Color> colorDelta;
+
+	// render data is cached for all particles once per frame because they are rendered in several passes
+	UINT cachedFrame = 0;
+	vector<Color> cachedColor;
+	vector<Vector2> cachedPos1;
+	vector<Vector2> cachedPos2;
+	vector<float> cachedAngle;
+	vector<float> cachedSize;
+};
 
 class ParticleEmitter : public GameObject
 {
 public:
-
-	friend Particle;
 	
 	ParticleEmitter(const GameObjectStub& stub);
 	ParticleEmitter(const ParticleSystemDef& _systemDef, const XForm2& xf = XForm2::Identity(), GameObject* _parent = NULL, float scale = 1.0f);
@@ -259,8 +306,14 @@ public: // static functions
 	static void EnableParticles(bool enable) { enableParticles = enable; }
 	static bool AreParticlesEnabled() { return enableParticles; }
 
-	static int GetTotalParticleCount() { return maxParticles - freeParticleList.size(); }
+	// integrate the particles of every emitter updated this frame, call once after objects update
+	static void SimulateParticles();
+
+	static int GetTotalParticleCount() { return totalParticleCount; }
+	static int GetTotalParticleCapacity() { return totalParticleCapacity; }
 	static int GetTotalEmitterCount() { return totalEmitterCount; }
+	static int GetDroppedParticleCount(ParticlePriority priority) { return droppedParticleCount[int(priority)]; }
+	int GetDroppedCount() const { return droppedCount; }
 
 	static bool enableParticles;
 	static bool particleDebug;
@@ -269,16 +322,35 @@ public: // static functions
 	static int defaultAdditiveRenderGroup;
 	static float particleStopRadius;		// does and on screen test with this radius and won't emit particles from offscreen (0 = always spawn)
 	static float shadowRenderAlpha;
+	static int maxParticles;				// particles are not spawned when there are this many
+	static int particleMemoryBudget;		// kilobytes of particle storage all emitters can use together
+	static int particleStartCapacity;		// storage an emitter starts with, it doubles as the emitter grows
+	static int particleEmitterQuota;		// most particles an emitter can have unless its def sets a quota
+	static float particleAmbientShare;		// portion of the limits ambient effects can use
+	static float particleNormalShare;		// portion of the limits normal effects can use
+	static int particleThreadCount;			// how many threads simulate particles, 0 uses all cores
+	static int particleJobSize;				// most particles in each simulation job
 
 protected:
 
-	static Particle* NewParticle();
-	static void DeleteParticle(Particle* particle);
-
 	void Render() override;
 	void Update() override;
 	void RenderInternal(bool allowAdditive = true);
 
+	void UpdateParticles(int start, int end);
+	void ApplyParticleGravity();
+	void FinishParticleUpdate();
+	void FlushParticleUpdate();
+	void RemoveDeadParticles();
+	void ClearParticles();
+	bool ReserveParticle();
+	static float GetPriorityShare(ParticlePriority priority);
+	void UpdateRenderCache(const XForm2& xfParent);
+	void RenderParticle(int i, bool recordCommand = false, BYTE commandFlags = 0) const;
+	bool IsParticleDead(int i) const { return particles.time[i] >= particles.lifeTime[i] + GAME_TIME_STEP; }
+	float GetParticleLifetimePercent(int i) const;
+	XForm2 GetParticleXFInterpolated(int i, const XForm2& xfParent) const;
+
 private:
 
 	bool setTrailEnd = false;
@@ -292,62 +364,13 @@ private:
 	ParticleSystemDef systemDef;
 	Box2AABB emitBox = Box2AABB(Vector2(0));
 
-	list<Particle*> particles;
+	ParticleArrays particles;
+	int droppedCount = 0;
+	bool simulateQueued = false;
 
 	static int totalEmitterCount;
-	
-	static const UINT32 maxParticles = 2000;
-	static list<Particle*> freeParticleList;
-	static Particle particlePool[maxParticles];
-};
-
-class Particle : private Uncopyable
-{
-public:
-
-	friend ParticleEmitter;
-
-	Particle() {}
-	void Init(const ParticleEmitter* _emitter, const XForm2& _xf, const Vector2& _velocity, float _angularSpeed, float _startTime);
-
-	void Update();
-
-	void Render(const XForm2& xfParent);
-	void RenderTrail(const XForm2& xfParent);
-	void RenderRibbon(const XForm2& xfParent, Vector2& previousPos);
-
-	bool IsDead() const { return time >= lifeTime + GAME_TIME_STEP; }
-
-	XForm2 GetXFInterpolated(const XForm2& xfParent) const { return xf.Interpolate(xfDelta, g_interpolatePercent) * xfParent; }
-	XForm2 GetXForm() const { return xf; }
-	float GetLifetimePercent() const { return CapPercent((lifeTime == 0) ? 0 : (time - g_interpolatePercent * GAME_TIME_STEP) / lifeTime); }
-
-private:
-
-	XForm2 xf;
-	XForm2 xfDelta;
-
-	Vector2 velocity;
-	float angularSpeed;
-	float time;
-
-	float lifeTime;
-	float sizeStart;
-	float sizeEnd;
-	Color colorStart;
-	Color colorDelta;
-
-	// cache some particle data for faster rendering
-	UINT cachedFrame;
-	Color cachedColor;
-	Vector2 cachedPos1;
-	Vector2 cachedPos2;
-	float cachedAngle;
-	float cachedSize;
-
-	const ParticleSystemDef* systemDef;
-	const ParticleEmitter* emitter;
-
-	static DWORD simpleVertsLastColor;
-	static bool simpleVertsNeedsCap;
+	static int totalParticleCount;
+	static int totalParticleCapacity;
+	static int droppedParticleCount[int(ParticlePriority::Count)];
+	static vector<ParticleEmitter*> simulateList;
 };
@@ -587,7 +587,7 @@ GameObject* Physics::PointcastSimple(const Vector2& point, SimpleRaycastResult*
 		result->lambda = 0;
 		result->hitFixture = queryCallback.hitFixture;
 		if (queryCallback.hitFixture)
-			result->hitSurface = (int)queryCallback.hitFixture->GetUserData();
+			result->hitSurface = (int)(intptr_t)queryCallback.hitFixture->GetUserData();
 	}
 
 	if (!queryCallback.hitFixture)
@@ -623,7 +623,7 @@ GameObject* Physics::RaycastSimple(const Line2& line, SimpleRaycastResult* resul
 				result->normal = (line.p1 - line.p2).Normalize();
 				result->hitFixture = queryCallback.hitFixture;
 				if (queryCallback.hitFixture)
-					result->hitSurface = (int)queryCallback.hitFixture->GetUserData();
+					result->hitSurface = (int)(intptr_t)queryCallback.hitFixture->GetUserData();
 			}
 		
 			if (showRaycasts)
@@ -645,7 +645,7 @@ GameObject* Physics::RaycastSimple(const Line2& line, SimpleRaycastResult* resul
 			result->lambda = raycastResult.lambda;
 			result->hitFixture = raycastResult.hitFixture;
 			if (raycastResult.hitFixture)
-				result->hitSurface = (int)raycastResult.hitFixture->GetUserData();
+				result->hitSurface = (int)(intptr_t)raycastResult.hitFixture->GetUserData();
 		}
 		else
 		{
@@ -0,0 +1,549 @@
+////////////////////////////////////////////////////////////////////////////////////////
+/*
+	Visibility Polygon
+	Copyright 2013 Frank Force - http://www.frankforce.com
+*/
+////////////////////////////////////////////////////////////////////////////////////////
+
+#include "frankEngine.h"
+#include "../physics/visibilityPolygon.h"
+#include <algorithm>
+#include <chrono>
+
+////////////////////////////////////////////////////////////////////////////////////////
+/*
+	Globals
+*/
+////////////////////////////////////////////////////////////////////////////////////////
+
+int VisibilityPolygon::threadCount = 0;		// how many threads build polygons, 0 uses all cores
+ConsoleCommand(VisibilityPolygon::threadCount, visibilityThreadCount);
+
+int VisibilityPolygon::boundarySides = 32;	// how many sides are used for the edge of the radius
+ConsoleCommand(VisibilityPolygon::boundarySides, visibilityBoundarySides);
+
+static void BenchmarkReport(const WCHAR* name, vector<VisibilityPolygon>& polygons)
+{
+	if (polygons.empty())
+		return;
+
+	int edgeCount = 0;
+	for (vector<VisibilityPolygon>::const_iterator it = polygons.begin(); it != polygons.end(); ++it)
+		edgeCount += it->GetEdgeCount();
+
+	// compare a single thread to all worker threads
+	const int threadCount = JobPool::GetThreadCount(VisibilityPolygon::threadCount);
+	const double singleTime = VisibilityPolygon::Benchmark(polygons, 1);
+	const double threadedTime = VisibilityPolygon::Benchmark(polygons, threadCount);
+	if (singleTime <= 0 || threadedTime <= 0)
+		return;
+
+	const int polygonCount = polygons.size();
+	GetDebugConsole().AddFormatted(L"%s: %d polygons, %.0f edges each", name, polygonCount, edgeCount / float(polygonCount));
+	GetDebugConsole().AddFormatted(L"1 thread: %.0f polygons/s", polygonCount / singleTime);
+	GetDebugConsole().AddFormatted(L"%d threads: %.0f polygons/s, %.0f per core", threadCount, polygonCount / threadedTime, polygonCount / (threadedTime * threadCount));
+}
+
+ConsoleFunction(visibilityBenchmark)
+{
+	const int polygonCount = 64;
+	const float radius = 20;
+	vector<VisibilityPolygon> polygons(polygonCount);
+
+	if (g_physics && g_cameraBase)
+	{
+		// polygons around the camera from the real terrain and static objects
+		const Vector2 cameraPos = g_cameraBase->GetXFWorld().position;
+		for (int i = 0; i < polygonCount; ++i)
+		{
+			const Vector2 offset(4.0f * (i % 8 - 3.5f), 4.0f * (i / 8 - 3.5f));
+			polygons[i] = VisibilityPolygon(cameraPos + offset, radius);
+			polygons[i].GatherEdges();
+		}
+		BenchmarkReport(L"World", polygons);
+		polygons[0].Build();
+		polygons[0].RenderDebug(Color::Yellow(0.5f), 5);
+	}
+
+	// use a fixed seed so the layouts are the same every run
+	FrankRand::SaveSeedBlock randomSeedBlock(1);
+	const float areaSize = 72;
+
+	{
+		// grid of box rooms with doors in each wall and a pillar in the middle
+		vector<Vector2> boxes;
+		const float roomSize = 12;
+		const float wallSize = 0.25f;
+		const float doorSize = 1.5f;
+		const int roomCount = int(areaSize / roomSize);
+		for (int x = 0; x < roomCount; ++x)
+		for (int y = 0; y < roomCount; ++y)
+		{
+			const Vector2 roomPos = roomSize * Vector2(x + 0.5f, y + 0.5f);
+			const float wallLength = 0.5f * (0.5f * roomSize - doorSize);
+			const float wallOffset = doorSize + wallLength;
+			boxes.push_back(roomPos + Vector2(-wallOffset, 0.5f * roomSize));	boxes.push_back(Vector2(wallLength, wallSize));
+			boxes.push_back(roomPos + Vector2(wallOffset, 0.5f * roomSize));	boxes.push_back(Vector2(wallLength, wallSize));
+			boxes.push_back(roomPos + Vector2(0.5f * roomSize, -wallOffset));	boxes.push_back(Vector2(wallSize, wallLength));
+			boxes.push_back(roomPos + Vector2(0.5f * roomSize, wallOffset));	boxes.push_back(Vector2(wallSize, wallLength));
+			boxes.push_back(roomPos);											boxes.push_back(Vector2(0.5f));
+		}
+
+		for (int i = 0; i < polygonCount; ++i)
+		{
+			polygons[i] = VisibilityPolygon(FrankRand::GetRandomInBox(Box2AABB(Vector2(0), Vector2(areaSize))), radius);
+			for (int j = 0; j < int(boxes.size()); j += 2)
+			{
+				const Vector2& pos = boxes[j];
+				const Vector2& size = boxes[j+1];
+				const Vector2 loop[4] = { pos - size, pos + Vector2(size.x, -size.y), pos + size, pos + Vector2(-size.x, size.y) };
+				polygons[i].AddPolygon(loop, 4);
+			}
+		}
+		BenchmarkReport(L"Rooms", polygons);
+	}
+
+	{
+		// irregular rocks scattered around like a cave
+		const int rockCount = 150;
+		const int rockSides = 10;
+		vector<Vector2> rocks;
+		for (int i = 0; i < rockCount; ++i)
+		{
+			const Vector2 rockPos = FrankRand::GetRandomInBox(Box2AABB(Vector2(0), Vector2(areaSize)));
+			const float rockSize = RAND_BETWEEN(1.0f, 4.0f);
+			for (int j = 0; j < rockSides; ++j)
+				rocks.push_back(rockPos + RAND_BETWEEN(0.6f, 1.0f) * rockSize * Vector2::BuildFromAngle(2*PI*j / rockSides));
+		}
+
+		for (int i = 0; i < polygonCount; ++i)
+		{
+			polygons[i] = VisibilityPolygon(FrankRand::GetRandomInBox(Box2AABB(Vector2(0), Vector2(areaSize))), radius);
+			for (int j = 0; j < rockCount; ++j)
+				polygons[i].AddPolygon(&rocks[j * rockSides], rockSides);
+		}
+		BenchmarkReport(L"Cave", polygons);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+/*
+	Member functions
+*/
+////////////////////////////////////////////////////////////////////////////////////////
+
+VisibilityPolygon::VisibilityPolygon(const Vector2& _center, float _radius) :
+	center(_center),
+	radius(_radius)
+{
+}
+
+class VisibilityQueryCallback : public b2QueryCallback
+{
+public:
+
+	VisibilityQueryCallback(VisibilityPolygon& _polygon, const GameObject* _ignoreObject) :
+		polygon(_polygon),
+		ignoreObject(_ignoreObject)
+	{}
+
+	/// Called for each fixture found in the query AABB.
+	/// @return false to terminate the query.
+	bool ReportFixture(b2Fixture* fixture) override
+	{
+		if (fixture->IsSensor())
+			return true;
+
+		// only static fixtures are used, moving objects change too often
+		b2Body* body = fixture->GetBody();
+		if (body->GetType() != b2_staticBody)
+			return true;
+
+		const GameObject* object = GameObject::GetFromPhysicsBody(*body);
+		if (!object || object == ignoreObject || !object->ShouldCollideSight())
+			return true;
+
+		polygon.AddShape(*fixture->GetShape(), body->GetTransform());
+		return true;
+	}
+
+	VisibilityPolygon& polygon;
+	const GameObject* ignoreObject;
+};
+
+void VisibilityPolygon::GatherEdges(const GameObject* ignoreObject)
+{
+	ClearEdges();
+	if (!g_physics || radius <= 0)
+		return;
+
+	VisibilityQueryCallback queryCallback(*this, ignoreObject);
+	g_physics->GetPhysicsWorld()->QueryAABB(&queryCallback, Box2AABB(XForm2(center), Vector2(radius)));
+}
+
+void VisibilityPolygon::AddEdge(const Vector2& p1, const Vector2& p2)
+{
+	// clip the edge to the circle so every end point is in range
+	const Vector2 start = p1 - center;
+	const Vector2 delta = p2 - p1;
+	const float a = delta.LengthSquared();
+	if (a == 0)
+		return;
+
+	const float b = start.Dot(delta);
+	const float c = start.LengthSquared() - radius*radius;
+	const float discriminant = b*b - a*c;
+	if (discriminant <= 0)
+		return;
+
+	const float root = sqrtf(discriminant);
+	const float s1 = Max((-b - root) / a, 0.0f);
+	const float s2 = Min((-b + root) / a, 1.0f);
+	if (s1 >= s2)
+		return;
+
+	const Vector2 clippedStart = start + s1 * delta;
+	const Vector2 clippedDelta = (s2 - s1) * delta;
+	edgeX.push_back(clippedStart.x);
+	edgeY.push_back(clippedStart.y);
+	edgeDeltaX.push_back(clippedDelta.x);
+	edgeDeltaY.push_back(clippedDelta.y);
+}
+
+void VisibilityPolygon::AddPolygon(const Vector2* polygonVertices, int vertexCount)
+{
+	// skip edges facing away from the center, they are always hidden behind the front edges
+	for (int i = 0; i < vertexCount; ++i)
+	{
+		const Vector2& p1 = polygonVertices[i];
+		const Vector2& p2 = polygonVertices[(i + 1) % vertexCount];
+		if ((p2 - p1).Cross(center - p1) < 0)
+			AddEdge(p1, p2);
+	}
+}
+
+void VisibilityPolygon::AddShape(const b2Shape& shape, const b2Transform& xf)
+{
+	switch (shape.GetType())
+	{
+		case b2Shape::e_polygon:
+		{
+			const b2PolygonShape& polygonShape = static_cast<const b2PolygonShape&>(shape);
+			Vector2 polygonVertices[b2_maxPolygonVertices];
+			for (int i = 0; i < polygonShape.m_count; ++i)
+				polygonVertices[i] = b2Mul(xf, polygonShape.m_vertices[i]);
+			AddPolygon(polygonVertices, polygonShape.m_count);
+			break;
+		}
+		case b2Shape::e_edge:
+		{
+			const b2EdgeShape& edgeShape = static_cast<const b2EdgeShape&>(shape);
+			AddEdge(b2Mul(xf, edgeShape.m_vertex1), b2Mul(xf, edgeShape.m_vertex2));
+			break;
+		}
+		case b2Shape::e_chain:
+		{
+			const b2ChainShape& chainShape = static_cast<const b2ChainShape&>(shape);
+			for (int i = 0; i < chainShape.GetChildCount(); ++i)
+			{
+				b2EdgeShape edgeShape;
+				chainShape.GetChildEdge(&edgeShape, i);
+				AddEdge(b2Mul(xf, edgeShape.m_vertex1), b2Mul(xf, edgeShape.m_vertex2));
+			}
+			break;
+		}
+		case b2Shape::e_circle:
+		{
+			// use an octagon for circles
+			const b2CircleShape& circleShape = static_cast<const b2CircleShape&>(shape);
+			const Vector2 circleCenter = b2Mul(xf, circleShape.m_p);
+			Vector2 polygonVertices[8];
+			for (int i = 0; i < 8; ++i)
+				polygonVertices[i] = circleCenter + circleShape.m_radius * Vector2::BuildFromAngle(2*PI*i / 8);
+			AddPolygon(polygonVertices, 8);
+			break;
+		}
+		default:
+			break;
+	}
+}
+
+void VisibilityPolygon::ClearEdges()
+{
+	edgeX.clear();
+	edgeY.clear();
+	edgeDeltaX.clear();
+	edgeDeltaY.clear();
+}
+
+void VisibilityPolygon::Build(const Vector2& _center, float _radius, const GameObject* ignoreObject)
+{
+	center = _center;
+	radius = _radius;
+	GatherEdges(ignoreObject);
+	Build();
+}
+
+float VisibilityPolygon::GetEdgeDistance(int edge, const Vector2& direction) const
+{
+	// distance along the ray from the center to where it crosses the edge's line
+	return (edgeX[edge] * edgeDeltaY[edge] - edgeY[edge] * edgeDeltaX[edge]) / (direction.x * edgeDeltaY[edge] - direction.y * edgeDeltaX[edge]);
+}
+
+bool VisibilityPolygon::GetEdgeCrossingAngle(int a, int b, float& angle) const
+{
+	// where two edges cross each other, touching at the ends does not count
+	const float denominator = edgeDeltaX[a] * edgeDeltaY[b] - edgeDeltaY[a] * edgeDeltaX[b];
+	if (denominator == 0)
+		return false;
+
+	const float offsetX = edgeX[b] - edgeX[a];
+	const float offsetY = edgeY[b] - edgeY[a];
+	const float s = (offsetX * edgeDeltaY[b] - offsetY * edgeDeltaX[b]) / denominator;
+	const float t = (offsetX * edgeDeltaY[a] - offsetY * edgeDeltaX[a]) / denominator;
+	const float endEpsilon = 0.0001f;
+	if (s <= endEpsilon || s >= 1 - endEpsilon || t <= endEpsilon || t >= 1 - endEpsilon)
+		return false;
+
+	angle = Vector2(edgeX[a] + s * edgeDeltaX[a], edgeY[a] + s * edgeDeltaY[a]).GetAngle();
+	return true;
+}
+
+void VisibilityPolygon::Build()
+{
+	vertices.clear();
+	vertexAngles.clear();
+	rayAngles.clear();
+	sweepEvents.clear();
+	crossingEvents.clear();
+	if (radius <= 0)
+		return;
+
+	// cast rays at each edge end and just to either side of it to see past corners
+	const float angleEpsilon = 0.0001f;
+	const int edgeCount = GetEdgeCount();
+	rayAngles.reserve(boundarySides + 6*edgeCount);
+	for (int i = 0; i < boundarySides; ++i)
+		rayAngles.push_back(CapAngle(2*PI*i / boundarySides));
+	for (int i = 0; i < edgeCount; ++i)
+	{
+		const float angle1 = Vector2(edgeX[i], edgeY[i]).GetAngle();
+		const float angle2 = Vector2(edgeX[i] + edgeDeltaX[i], edgeY[i] + edgeDeltaY[i]).GetAngle();
+		rayAngles.push_back(CapAngle(angle1 - angleEpsilon));
+		rayAngles.push_back(angle1);
+		rayAngles.push_back(CapAngle(angle1 + angleEpsilon));
+		rayAngles.push_back(CapAngle(angle2 - angleEpsilon));
+		rayAngles.push_back(angle2);
+		rayAngles.push_back(CapAngle(angle2 + angleEpsilon));
+
+		// sweep each edge from its lower angle end, edges that point at the center do not block anything
+		if (angle1 == angle2)
+			continue;
+		const bool reversed = CapAngle(angle2 - angle1) < 0;
+		const float distance1 = Vector2(edgeX[i], edgeY[i]).Length();
+		const float distance2 = Vector2(edgeX[i] + edgeDeltaX[i], edgeY[i] + edgeDeltaY[i]).Length();
+		const float startAngle = reversed? angle2 : angle1;
+		const float endAngle = reversed? angle1 : angle2;
+		const bool wraps = endAngle < startAngle;
+		const SweepEvent startEvent = { startAngle, reversed? distance2 : distance1, i, true, wraps };
+		const SweepEvent endEvent = { endAngle, reversed? distance1 : distance2, i, false, wraps };
+		sweepEvents.push_back(startEvent);
+		sweepEvents.push_back(endEvent);
+	}
+
+	// edges share end points so remove duplicate rays
+	sort(rayAngles.begin(), rayAngles.end());
+	rayAngles.erase(unique(rayAngles.begin(), rayAngles.end(), [angleEpsilon](float a, float b) { return b - a < 0.1f*angleEpsilon; }), rayAngles.end());
+
+	// ends come before starts at the same angle so edges are removed before new ones are sorted in
+	sort(sweepEvents.begin(), sweepEvents.end(), [](const SweepEvent& a, const SweepEvent& b)
+	{
+		return a.angle < b.angle || (a.angle == b.angle && !a.isStart && b.isStart);
+	});
+
+	// edges the sweep is crossing, closest first along the sweep direction
+	float sweepAngle = -PI;
+	Vector2 sweepDirection = Vector2::BuildFromAngle(sweepAngle);
+	auto edgeCompare = [this, &sweepDirection](int a, int b)
+	{
+		const float distanceA = GetEdgeDistance(a, sweepDirection);
+		const float distanceB = GetEdgeDistance(b, sweepDirection);
+		return distanceA < distanceB || (distanceA == distanceB && a < b);
+	};
+	typedef set<int, decltype(edgeCompare)> ActiveEdgeSet;
+	ActiveEdgeSet activeEdges(edgeCompare);
+	vector<ActiveEdgeSet::iterator> activeIterators(edgeCount, activeEdges.end());
+
+	// edges from seperate fixtures can overlap, neighbors in the set that cross ahead of the sweep are swapped there
+	auto crossingCompare = [](const CrossingEvent& a, const CrossingEvent& b) { return a.angle > b.angle; };
+	auto checkCrossing = [&](ActiveEdgeSet::iterator nearIt)
+	{
+		if (nearIt == activeEdges.end() || next(nearIt) == activeEdges.end())
+			return;
+
+		const int nearEdge = *nearIt;
+		const int farEdge = *next(nearIt);
+		float angle;
+		if (!GetEdgeCrossingAngle(nearEdge, farEdge, angle) || angle <= sweepAngle)
+			return;
+
+		const CrossingEvent crossing = { angle, nearEdge, farEdge };
+		crossingEvents.push_back(crossing);
+		push_heap(crossingEvents.begin(), crossingEvents.end(), crossingCompare);
+	};
+	auto insertEdge = [&](int edge)
+	{
+		const ActiveEdgeSet::iterator edgeIt = activeEdges.insert(edge).first;
+		activeIterators[edge] = edgeIt;
+		if (edgeIt != activeEdges.begin())
+			checkCrossing(prev(edgeIt));
+		checkCrossing(edgeIt);
+	};
+	auto removeEdge = [&](int edge)
+	{
+		if (activeIterators[edge] == activeEdges.end())
+			return;
+
+		const ActiveEdgeSet::iterator nextIt = activeEdges.erase(activeIterators[edge]);
+		activeIterators[edge] = activeEdges.end();
+		if (nextIt != activeEdges.begin())
+			checkCrossing(prev(nextIt));
+	};
+	auto setSweepAngle = [&](float angle, float nextAngle)
+	{
+		// sort just past the angle so edges that share an end are not tied
+		sweepAngle = angle;
+		sweepDirection = Vector2::BuildFromAngle(angle + Max(Min(0.5f*(nextAngle - angle), 0.1f*angleEpsilon), 0.0f));
+	};
+
+	// edges that wrap around from PI to -PI are already being crossed when the sweep starts
+	int eventIndex = 0;
+	const int eventCount = sweepEvents.size();
+	if (eventCount > 0)
+	{
+		setSweepAngle(-PI, sweepEvents.front().angle);
+		for (vector<SweepEvent>::const_iterator it = sweepEvents.begin(); it != sweepEvents.end(); ++it)
+		{
+			if (it->isStart && it->wraps)
+				insertEdge(it->edge);
+		}
+	}
+
+	vertices.reserve(rayAngles.size());
+	vertexAngles.reserve(rayAngles.size());
+	for (vector<float>::const_iterator it = rayAngles.begin(); it != rayAngles.end(); ++it)
+	{
+		const float rayAngle = *it;
+		float distance = radius;
+
+		// handle events up to this ray in angle order
+		while (true)
+		{
+			const float eventAngle = eventIndex < eventCount? sweepEvents[eventIndex].angle : 2*PI;
+			const float crossingAngle = crossingEvents.empty()? 2*PI : crossingEvents.front().angle;
+			if (Min(eventAngle, crossingAngle) > rayAngle)
+				break;
+
+			if (crossingAngle < eventAngle)
+			{
+				const CrossingEvent crossing = crossingEvents.front();
+				pop_heap(crossingEvents.begin(), crossingEvents.end(), crossingCompare);
+				crossingEvents.pop_back();
+
+				// skip crossings between edges that are no longer neighbors
+				const ActiveEdgeSet::iterator nearIt = activeIterators[crossing.nearEdge];
+				if (nearIt == activeEdges.end() || next(nearIt) == activeEdges.end() || *next(nearIt) != crossing.farEdge)
+					continue;
+
+				// take both out and sort them back in past where they cross
+				removeEdge(crossing.nearEdge);
+				removeEdge(crossing.farEdge);
+				setSweepAngle(crossingAngle, crossingEvents.empty()? eventAngle : Min(eventAngle, crossingEvents.front().angle));
+				insertEdge(crossing.farEdge);
+				insertEdge(crossing.nearEdge);
+				continue;
+			}
+
+			// add and remove edges at this angle, ends come first so new edges are sorted against the rest
+			int groupEnd = eventIndex;
+			while (groupEnd < eventCount && sweepEvents[groupEnd].angle == eventAngle)
+				++groupEnd;
+			setSweepAngle(eventAngle, Min(groupEnd < eventCount? sweepEvents[groupEnd].angle : PI, crossingAngle));
+
+			for (; eventIndex < groupEnd; ++eventIndex)
+			{
+				const SweepEvent& event = sweepEvents[eventIndex];
+				if (event.isStart)
+					insertEdge(event.edge);
+				else
+					removeEdge(event.edge);
+
+				// edges that end right on the ray still block it
+				if (eventAngle == rayAngle)
+					distance = Min(distance, event.distance);
+			}
+		}
+
+		// the closest edge being crossed blocks the ray
+		const Vector2 direction = Vector2::BuildFromAngle(rayAngle);
+		if (!activeEdges.empty())
+		{
+			const float edgeDistance = GetEdgeDistance(*activeEdges.begin(), direction);
+			if (edgeDistance > 0 && edgeDistance < distance)
+				distance = edgeDistance;
+		}
+
+		vertices.push_back(center + distance * direction);
+		vertexAngles.push_back(rayAngle);
+	}
+}
+
+void VisibilityPolygon::BuildPolygons(vector<VisibilityPolygon>& polygons, int threadCount)
+{
+	FrankProfilerEntryDefine(L"VisibilityPolygon::BuildPolygons()", Color::White(), 5);
+
+	// each polygon is a job for the persistent worker threads
+	g_jobPool.Run(polygons.size(), [&polygons](int i) { polygons[i].Build(); }, threadCount);
+}
+
+double VisibilityPolygon::Benchmark(vector<VisibilityPolygon>& polygons, int threadCount)
+{
+	// the web build has no dxut timer
+	const chrono::steady_clock::time_point startTime = chrono::steady_clock::now();
+	BuildPolygons(polygons, threadCount);
+	return chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+}
+
+bool VisibilityPolygon::IsVisible(const Vector2& pos) const
+{
+	const Vector2 delta = pos - center;
+	if (delta.LengthSquared() > radius*radius || vertices.size() < 3)
+		return false;
+
+	// find the edge of the polygon in the direction of the point
+	const int vertexCount = vertices.size();
+	const int index = int(upper_bound(vertexAngles.begin(), vertexAngles.end(), delta.GetAngle()) - vertexAngles.begin());
+	const Vector2& p1 = vertices[(index + vertexCount - 1) % vertexCount];
+	const Vector2& p2 = vertices[index % vertexCount];
+
+	// the point is visible if it is on the same side of that edge as the center
+	const Vector2 edge = p2 - p1;
+	return edge.Cross(pos - p1) * edge.Cross(center - p1) >= 0;
+}
+
+void VisibilityPolygon::Render(const Color& color) const
+{
+	const int vertexCount = vertices.size();
+	for (int i = 0; i < vertexCount; ++i)
+	{
+		const Vector2 triangle[3] = { center, vertices[i], vertices[(i + 1) % vertexCount] };
+		g_render->DrawSolidPolygon(triangle, 3, color);
+	}
+}
+
+void VisibilityPolygon::RenderDebug(const Color& color, float time) const
+{
+	const int vertexCount = vertices.size();
+	for (int i = 0; i < vertexCount; ++i)
+		g_debugRender.RenderLine(Line2(vertices[i], vertices[(i + 1) % vertexCount]), color, time);
+}
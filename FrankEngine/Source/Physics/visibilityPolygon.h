@@ -0,0 +1,98 @@
+////////////////////////////////////////////////////////////////////////////////////////
+/*
+	Visibility Polygon
+	Copyright 2013 Frank Force - http://www.frankforce.com
+
+	- builds the area visible from a point by sweeping rays around it
+	- edges are swept in angle order with the edges being crossed kept sorted by distance
+	- edges come from static physics fixtures, terrain and static objects
+	- gathering uses the physics world so it must happen on the main thread
+	- building only touches the polygon so many can be built on worker threads
+	- the sweep is plain scalar code, speed comes from the sweep and from threading across polygons
+	- nothing uses it yet besides visibilityBenchmark, the vision pass still renders its shadows on the gpu
+*/
+////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+class VisibilityPolygon
+{
+public:
+
+	VisibilityPolygon(const Vector2& _center = Vector2(0), float _radius = 0);
+
+	void SetCenter(const Vector2& _center)		{ center = _center; }
+	void SetRadius(float _radius)				{ radius = _radius; }
+	Vector2 GetCenter() const					{ return center; }
+	float GetRadius() const						{ return radius; }
+
+	// gather edges from static fixtures that block sight within the radius
+	void GatherEdges(const GameObject* ignoreObject = NULL);
+	void AddEdge(const Vector2& p1, const Vector2& p2);
+	void AddPolygon(const Vector2* polygonVertices, int vertexCount);	// counter clockwise
+	void AddShape(const b2Shape& shape, const b2Transform& xf);
+	void ClearEdges();
+	int GetEdgeCount() const					{ return int(edgeX.size()); }
+
+	// sweep the gathered edges to build the polygon, safe to call from worker threads
+	void Build();
+
+	// gather and build in one step
+	void Build(const Vector2& _center, float _radius, const GameObject* ignoreObject = NULL);
+
+	// build a list of polygons that have already gathered their edges
+	static void BuildPolygons(vector<VisibilityPolygon>& polygons, int threadCount = 0);
+
+	// check if a point can be seen from the center
+	bool IsVisible(const Vector2& pos) const;
+
+	// outline of the visible area sorted by angle around the center
+	const vector<Vector2>& GetVertices() const	{ return vertices; }
+
+	void Render(const Color& color = Color::White()) const;
+	void RenderDebug(const Color& color = Color::White(0.5f), float time = 0.0f) const;
+
+	static double Benchmark(vector<VisibilityPolygon>& polygons, int threadCount);
+
+public: // settings
+
+	static int threadCount;					// how many threads build polygons, 0 uses all cores
+	static int boundarySides;				// how many sides are used for the edge of the radius
+
+private:
+
+	Vector2 center;
+	float radius;
+
+	// where a ray from the center crosses an edge's line
+	float GetEdgeDistance(int edge, const Vector2& direction) const;
+	bool GetEdgeCrossingAngle(int a, int b, float& angle) const;
+
+	struct SweepEvent
+	{
+		float angle;
+		float distance;		// how far the end of the edge is from the center
+		int edge;
+		bool isStart;
+		bool wraps;			// edge crosses the angle where PI wraps to -PI
+	};
+
+	struct CrossingEvent
+	{
+		float angle;
+		int nearEdge;
+		int farEdge;
+	};
+
+	// edges relative to the center
+	vector<float> edgeX;
+	vector<float> edgeY;
+	vector<float> edgeDeltaX;
+	vector<float> edgeDeltaY;
+
+	vector<float> rayAngles;
+	vector<SweepEvent> sweepEvents;
+	vector<CrossingEvent> crossingEvents;
+	vector<float> vertexAngles;
+	vector<Vector2> vertices;
+};
@@ -21,7 +21,7 @@
 #include "deferredRender.h"
 
 LPDIRECT3DTEXTURE9 DeferredRender::textureSwapArray[textureSwapArraySize] = {NULL};
-LPDIRECT3DTEXTURE9 DeferredRender::texture = NULL;
+LPDIRECT3DTEXTURE9 DeferredRender::lightTextures[lightTextureLevelCount] = {NULL};
 LPDIRECT3DTEXTURE9 DeferredRender::textureNormalMap = NULL;
 LPDIRECT3DTEXTURE9 DeferredRender::textureSpecularMap = NULL;
 LPDIRECT3DTEXTURE9 DeferredRender::textureShadowMap = NULL;
@@ -31,6 +31,8 @@ LPDIRECT3DTEXTURE9 DeferredRender::textureFinal = NULL;
 LPDIRECT3DTEXTURE9 DeferredRender::textureEmissive = NULL;
 LPDIRECT3DPIXELSHADER9 DeferredRender::deferredLightShader = NULL;
 LPD3DXCONSTANTTABLE DeferredRender::shadowLightConstantTable = NULL;
+LPDIRECT3DPIXELSHADER9 DeferredRender::deferredLightBatchShader = NULL;
+LPD3DXCONSTANTTABLE DeferredRender::lightBatchConstantTable = NULL;
 LPDIRECT3DPIXELSHADER9 DeferredRender::visionShader = NULL;
 LPD3DXCONSTANTTABLE DeferredRender::visionConstantTable = NULL;
 LPDIRECT3DPIXELSHADER9 DeferredRender::directionalLightShader = NULL;
@@ -38,6 +40,7 @@ LPD3DXCONSTANTTABLE DeferredRender::directionalLightConstantTable = NULL;
 LPDIRECT3DPIXELSHADER9 DeferredRender::blurShader = NULL;
 LPD3DXCONSTANTTABLE DeferredRender::blurConstantTable = NULL;
 FrankRender::RenderPrimitive DeferredRender::primitiveLightMask;
+FrankRender::RenderPrimitive DeferredRender::primitiveLightBatch;
 
 TextureID DeferredRender::overbrightTexture = Texture_Circle;
 DeferredRender::RenderPass DeferredRender::renderPass = DeferredRender::RenderPass_diffuse;
@@ -58,6 +61,7 @@ static const float halfTexelCorrection = 1;
 bool DeferredRender::SpecularRenderBlock::active = false;
 bool DeferredRender::BackgroundRenderBlock::active = false;
 bool DeferredRender::TransparentRenderBlock::active = false;
+bool DeferredRender::AdditiveRenderBlock::active = false;
 bool DeferredRender::EmissiveRenderBlock::active = false;
 bool DeferredRender::NoTextureRenderBlock::active = false;
 float DeferredRender::DiffuseNormalAlphaRenderBlock::alphaScale = 1;
@@ -95,7 +99,8 @@ ConsoleCommandSimple(bool, webEmissiveBlur, true);
 #endif
 
 // if any more dynamic lights then this are needed per frame they will be skipped
-int DeferredRender::maxDynamicLights = 24;
+// how many of them render a new texture each frame is limited by lightScheduleBudget
+int DeferredRender::maxDynamicLights = 48;
 ConsoleCommand(DeferredRender::maxDynamicLights, maxDynamicLights);
 
 // if any more simple lights then this are needed per frame they will be skipped
@@ -114,6 +119,18 @@ ConsoleCommand(DeferredRender::ambientLightColor, ambientLightColor);
 float DeferredRender::textureSize = 256;
 ConsoleCommand(DeferredRender::textureSize, lightTextureSize);
 
+// lights that cover less of the screen use smaller textures, the largest are twice lightTextureSize
+bool DeferredRender::lightTextureAdaptive = true;
+ConsoleCommand(DeferredRender::lightTextureAdaptive, lightTextureAdaptive);
+
+// light texels wanted for each texel of the final texture a light covers
+float DeferredRender::lightTextureResolutionScale = 0.25f;
+ConsoleCommand(DeferredRender::lightTextureResolutionScale, lightTextureResolutionScale);
+
+// how far past a size boundary a light must go before it changes size, prevents flicker
+float DeferredRender::lightTextureHysteresis = 0.2f;
+ConsoleCommand(DeferredRender::lightTextureHysteresis, lightTextureHysteresis);
+
 // texture size used by lights
 float DeferredRender::shadowMapTextureSize = 1024;
 ConsoleCommand(DeferredRender::shadowMapTextureSize, shadowMapTextureSize);
@@ -194,6 +211,94 @@ ConsoleCommand(DeferredRender::shadowPassStartSize, shadowPassStartSize);
 float DeferredRender::shadowLightHeightDefault = 4.0f;
 ConsoleCommand(DeferredRender::shadowLightHeightDefault, shadowLightHeightDefault);
 
+// only render shadow casters that overlap a shadow casting light
+bool DeferredRender::shadowCasterCull = true;
+ConsoleCommand(DeferredRender::shadowCasterCull, shadowCasterCull);
+
+bool DeferredRender::shadowCasterCullActive = false;
+bool DeferredRender::shadowCasterGatherActive = false;
+bool DeferredRender::shadowCasterTrackActive = false;
+UINT64 DeferredRender::shadowCasterKey = 0;
+UINT DeferredRender::shadowCasterTestStamp = 0;
+UINT DeferredRender::shadowCasterId = 0;
+UINT DeferredRender::shadowCasterNextId = 0;
+vector<Light*> DeferredRender::shadowCasterLights;
+vector<Box2AABB> DeferredRender::shadowCasterLightBoxes;
+vector<UINT> DeferredRender::shadowCasterLightStamps;
+vector<UINT> DeferredRender::shadowCasterLightCasters;
+vector<int> DeferredRender::shadowCasterGrid[shadowCasterGridSize*shadowCasterGridSize];
+Box2AABB DeferredRender::shadowCasterGridBox;
+Vector2 DeferredRender::shadowCasterCellSize(1);
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// reuse light textures when the light and the shadow casters around it have not changed
+bool DeferredRender::lightCacheEnable = true;
+ConsoleCommand(DeferredRender::lightCacheEnable, lightCacheEnable);
+
+// megabytes of cached light textures to keep
+float DeferredRender::lightCacheBudget = 16;
+ConsoleCommand(DeferredRender::lightCacheBudget, lightCacheBudget);
+
+vector<DeferredRender::LightCacheEntry> DeferredRender::lightCache;
+vector<Light*> DeferredRender::simpleLights;
+vector<Light*> DeferredRender::dynamicLights;
+vector<DeferredRender::SimpleLightInstance> DeferredRender::simpleLightInstances;
+const int DeferredRender::maxLightBatchQuads;
+const int DeferredRender::maxSimpleLightCopies;	// Cap takes it by reference, so it needs storage
+int DeferredRender::lightCacheHitCount = 0;
+int DeferredRender::lightCacheMissCount = 0;
+
+ConsoleFunction(lightCacheClear)
+{
+	DeferredRender::ClearLightCache();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// lights that cover less of the screen and move less reuse their cached texture for a few frames
+bool DeferredRender::lightScheduleEnable = true;
+ConsoleCommand(DeferredRender::lightScheduleEnable, lightScheduleEnable);
+
+// how many lights are in each tier, the first tier refreshes every frame and each tier after half as often
+int DeferredRender::lightScheduleTierSize = 4;
+ConsoleCommand(DeferredRender::lightScheduleTierSize, lightScheduleTierSize);
+
+// most frames a light can go before refreshing
+int DeferredRender::lightScheduleMaxInterval = 8;
+ConsoleCommand(DeferredRender::lightScheduleMaxInterval, lightScheduleMaxInterval);
+
+// lights that moved this fraction of their radius since they refreshed are due right away
+float DeferredRender::lightScheduleMotionLimit = 0.1f;
+ConsoleCommand(DeferredRender::lightScheduleMotionLimit, lightScheduleMotionLimit);
+
+// millions of light texels that can be rendered per frame, a shadowed light at the default settings is about 2.3
+float DeferredRender::lightScheduleBudget = 16;
+ConsoleCommand(DeferredRender::lightScheduleBudget, lightScheduleBudget);
+
+vector<DeferredRender::LightScheduleEntry> DeferredRender::lightSchedule;
+int DeferredRender::lightRefreshCount = 0;
+int DeferredRender::lightRefreshStaleCount = 0;
+int DeferredRender::lightRefreshDeferredCount = 0;
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// test terrain between lights and query points
+bool DeferredRender::lightQueryOcclusion = true;
+ConsoleCommand(DeferredRender::lightQueryOcclusion, lightQueryOcclusion);
+
+// how far to look for terrain blocking directional light
+float DeferredRender::lightQueryDirectionalDistance = 20;
+ConsoleCommand(DeferredRender::lightQueryDirectionalDistance, lightQueryDirectionalDistance);
+
+ConsoleFunction(lightQueryTest)
+{
+	float value = 0;
+	const Vector2 pos = g_input->GetMousePosWorldSpace();
+	const bool isValid = DeferredRender::GetLightValue(pos, value);
+	GetDebugConsole().AddFormatted(L"light value at (%.2f, %.2f): %.3f%s", pos.x, pos.y, value, isValid? L"" : L" (lighting disabled)");
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////
 
 // enable emsisive lighting pass
@@ -301,7 +406,7 @@ ConsoleCommand(DeferredRender::use32BitTextures, lightsUse32BitTextures);
 
 ////////////////////////////////////////////////////////////////////////////////////////
 
-void DeferredRender::UpdateSimpleLights(list<Light*> simpleLights)
+void DeferredRender::UpdateSimpleLights()
 {
 	FrankProfilerEntryDefine(L"DeferredRender::UpdateSimpleLights()", Color::White(), 10);
 
@@ -320,32 +425,34 @@ void DeferredRender::UpdateSimpleLights(list<Light*> simpleLights)
 	g_cameraBase->PrepareForRender(xfFinal, finalTextureCameraScale*GetShadowMapZoom());
 		
 	// set up additive blending
-	pd3dDevice->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
-	pd3dDevice->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_ONE);
-	pd3dDevice->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD);
+	g_render->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
+	g_render->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_ONE);
+	g_render->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD);
 
-	// batch render for simple lights
+	// pack the visible lights then draw them all together
+	simpleLightInstances.clear();
 	for (Light* light : simpleLights)
-		UpdateSimpleLight(*light, xfFinal, cameraSize);
+		AddSimpleLightInstance(*light);
+	RenderSimpleLightInstances(xfFinal, cameraSize);
 	
 	g_render->EndRender();
 	SAFE_RELEASE(renderSurface);
 	
 	// set stuf back the way it was
-	pd3dDevice->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
-	pd3dDevice->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
-	pd3dDevice->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD );
-	pd3dDevice->SetTextureStageState( 0, D3DTSS_COLOROP,   D3DTOP_MODULATE );
-	pd3dDevice->SetTextureStageState( 0, D3DTSS_COLORARG1, D3DTA_TEXTURE );
-	pd3dDevice->SetTextureStageState( 0, D3DTSS_COLORARG2, D3DTA_DIFFUSE );
-	pd3dDevice->SetTextureStageState( 0, D3DTSS_ALPHAOP,   D3DTOP_MODULATE );
-	pd3dDevice->SetTextureStageState( 0, D3DTSS_ALPHAARG1, D3DTA_TEXTURE );
-	pd3dDevice->SetTextureStageState( 0, D3DTSS_ALPHAARG2, D3DTA_DIFFUSE );
-	pd3dDevice->SetTextureStageState( 1, D3DTSS_COLOROP,   D3DTOP_DISABLE );
-	pd3dDevice->SetTextureStageState( 1, D3DTSS_ALPHAOP,   D3DTOP_DISABLE );
+	g_render->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
+	g_render->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
+	g_render->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD );
+	g_render->SetTextureStageState( 0, D3DTSS_COLOROP,   D3DTOP_MODULATE );
+	g_render->SetTextureStageState( 0, D3DTSS_COLORARG1, D3DTA_TEXTURE );
+	g_render->SetTextureStageState( 0, D3DTSS_COLORARG2, D3DTA_DIFFUSE );
+	g_render->SetTextureStageState( 0, D3DTSS_ALPHAOP,   D3DTOP_MODULATE );
+	g_render->SetTextureStageState( 0, D3DTSS_ALPHAARG1, D3DTA_TEXTURE );
+	g_render->SetTextureStageState( 0, D3DTSS_ALPHAARG2, D3DTA_DIFFUSE );
+	g_render->SetTextureStageState( 1, D3DTSS_COLOROP,   D3DTOP_DISABLE );
+	g_render->SetTextureStageState( 1, D3DTSS_ALPHAOP,   D3DTOP_DISABLE );
 }
 
-void DeferredRender::UpdateSimpleLight(Light& light, const XForm2& xfFinal, const Vector2& cameraSize)
+void DeferredRender::AddSimpleLightInstance(Light& light)
 {
 	ASSERT(light.IsSimpleLight());
 	
@@ -362,72 +469,193 @@ void DeferredRender::UpdateSimpleLight(Light& light, const XForm2& xfFinal, cons
 
 	light.wasRendered = true;
 	++simpleLightCount;
-	
-	IDirect3DDevice9* pd3dDevice = DXUTGetD3D9Device();
-	const Vector2 halfPixelOffset = halfPixel / textureSize;
 
-	// render this light onto the final map
-	Color finalColor = light.color;
-	finalColor.a *= light.GetFadeAlpha() * alphaScale;
-		
+	SimpleLightInstance instance;
+	instance.xf = xf;
+	instance.radius = light.radius;
+	instance.height = light.height;
+	instance.color = light.color;
+	instance.color.a *= light.GetFadeAlpha() * alphaScale;
+	instance.texture = light.gelTexture? light.gelTexture : Texture_LightMask;
+	simpleLightInstances.push_back(instance);
+}
+
+void DeferredRender::RenderSimpleLightInstances(const XForm2& xfFinal, const Vector2& cameraSize)
+{
+	if (simpleLightInstances.empty())
+		return;
+
+	// group lights by texture so each texture is one batch, blending is additive so order does not matter
+	stable_sort(simpleLightInstances.begin(), simpleLightInstances.end(), SimpleLightInstance::SortCompare);
+
+	const Vector2 halfPixelOffset = halfPixel / textureSize;
 	if (!normalMappingEnable || !deferredLightShader)
 	{
-		g_render->RenderQuad(XForm2(halfPixelOffset * light.radius)*xf, Vector2(light.radius), finalColor, g_render->GetTexture(light.gelTexture? light.gelTexture : Texture_LightMask, false));
+		// all the quads go into sprite batches, one draw for each texture
+		FrankRender::SpriteBatchBlock spriteBatchBlock;
+		for (const SimpleLightInstance& instance : simpleLightInstances)
+		{
+			// vertex colors clamp at 1, so brighter lights are split into dimmer copies that add back up
+			// only the color of the final texture is used so splitting does not change anything else
+			const float brightness = Max(instance.color.r, Max(instance.color.g, instance.color.b));
+			const int copyCount = Cap(int(ceilf(brightness)), 1, maxSimpleLightCopies);
+			const Color color(instance.color.r / copyCount, instance.color.g / copyCount, instance.color.b / copyCount, instance.color.a);
+			for (int i = 0; i < copyCount; ++i)
+				g_render->RenderQuad(XForm2(halfPixelOffset * instance.radius)*instance.xf, Vector2(instance.radius), color, instance.texture, false);
+		}
+		return;
 	}
-	else
-	{
-		{	
-			// create a transform to convert texture space to normal map space
-			const Vector2 size = Vector2(light.radius)/cameraSize;
-			Vector2 offset = 0.5f*(xf.position - xfFinal.position)/cameraSize;
-			offset = 0.5f*(Vector2(1) - size) + offset * Vector2(1,-1);
 
-			// adjust for half pixel offset (d3d9 only, see halfTexelCorrection)
-			offset -= halfTexelCorrection * 0.5f * size / textureSize;
+#ifndef FRANK_PLATFORM_WEB
+	if (deferredLightBatchShader && primitiveLightBatch.vb)
+	{
+		RenderSimpleLightBatches(xfFinal, cameraSize);
+		return;
+	}
+#endif
 
-			D3DXMATRIX m4
-			(
-				size.x,		0,			0,		0,
-				0,			size.y,		0,		0,
-				offset.x,	offset.y,	1,		0,
-				0,			0,			0,		1
-			);
-
-			D3DXMATRIX m1; 
-			D3DXMatrixTranslation(&m1, -0.5f, -0.5f, 0);
-			D3DXMATRIX m2; 
-			D3DXMatrixRotationZ(&m2, -xf.angle);
-			D3DXMATRIX m3; 
-			D3DXMatrixTranslation(&m3, 0.5f, 0.5f, 0);
-			D3DXMATRIX m5;
-			D3DXMatrixScaling(&m5, -1, -1, 1);
-
-			D3DXMATRIX lightMatrix = m1*m5*m2;
-			D3DXMATRIX normalMatrix = m1*m2*m3*m4;
-			
+	// the light shader takes each light as constants, so set up everything else once for all of them
+	IDirect3DDevice9* pd3dDevice = DXUTGetD3D9Device();
+	g_render->SetTexture(0, textureNormalMap);
+	g_render->SetTextureStageState( 0, D3DTSS_TEXCOORDINDEX, 0 );
+	g_render->SetTexture(1, textureSpecularMap);
+	g_render->SetTextureStageState( 1, D3DTSS_TEXCOORDINDEX, 0 );
+	g_render->SetTextureStageState( 2, D3DTSS_TEXCOORDINDEX, 0 );
+	pd3dDevice->SetPixelShader(deferredLightShader);
+
+	// the web build has no vertex path for the batch shader, so each light sets its constants and draws on its own
+	for (const SimpleLightInstance& instance : simpleLightInstances)
+	{
+		const XForm2& xf = instance.xf;
+		{	
+			D3DXMATRIX lightMatrix, normalMatrix;
+			GetSimpleLightMatrices(instance, xfFinal, cameraSize, lightMatrix, normalMatrix);
 			shadowLightConstantTable->SetMatrix(pd3dDevice, "lightMatrix", &lightMatrix);
 			shadowLightConstantTable->SetMatrix(pd3dDevice, "normalMatrix", &normalMatrix);
 		}
 
-		pd3dDevice->SetTexture(0, textureNormalMap);
-		pd3dDevice->SetTextureStageState( 0, D3DTSS_TEXCOORDINDEX, 0 );
-		pd3dDevice->SetTexture(1, textureSpecularMap);
-		pd3dDevice->SetTextureStageState( 1, D3DTSS_TEXCOORDINDEX, 0 );
-		pd3dDevice->SetTexture(2, g_render->GetTexture(light.gelTexture? light.gelTexture : Texture_LightMask, false));
-		pd3dDevice->SetTextureStageState( 2, D3DTSS_TEXCOORDINDEX, 0 );
+		g_render->SetTexture(2, g_render->GetTexture(instance.texture, false));
 			
-		D3DXVECTOR4 finalColorVector = finalColor;
+		D3DXVECTOR4 finalColorVector = instance.color;
 		shadowLightConstantTable->SetVector(pd3dDevice, "lightColor", &finalColorVector);
-		shadowLightConstantTable->SetFloat(pd3dDevice, "lightHeight", light.height/light.radius);
+		shadowLightConstantTable->SetFloat(pd3dDevice, "lightHeight", instance.height/instance.radius);
+
+		g_render->RenderQuadSimple(XForm2(halfPixelOffset * instance.radius)*xf, Vector2(instance.radius));
+	}
+
+	pd3dDevice->SetPixelShader(NULL);
+	g_render->SetTexture(1, NULL);
+	g_render->SetTexture(2, NULL);
+}
+
+void DeferredRender::GetSimpleLightMatrices(const SimpleLightInstance& instance, const XForm2& xfFinal, const Vector2& cameraSize, D3DXMATRIX& lightMatrix, D3DXMATRIX& normalMatrix)
+{
+	D3DXMATRIX m1; 
+	D3DXMatrixTranslation(&m1, -0.5f, -0.5f, 0);
+	D3DXMATRIX m3; 
+	D3DXMatrixTranslation(&m3, 0.5f, 0.5f, 0);
+	D3DXMATRIX m5;
+	D3DXMatrixScaling(&m5, -1, -1, 1);
+
+	// create a transform to convert texture space to normal map space
+	const XForm2& xf = instance.xf;
+	const Vector2 size = Vector2(instance.radius)/cameraSize;
+	Vector2 offset = 0.5f*(xf.position - xfFinal.position)/cameraSize;
+	offset = 0.5f*(Vector2(1) - size) + offset * Vector2(1,-1);
+
+	// adjust for half pixel offset (d3d9 only, see halfTexelCorrection)
+	offset -= halfTexelCorrection * 0.5f * size / textureSize;
+
+	D3DXMATRIX m4
+	(
+		size.x,		0,			0,		0,
+		0,			size.y,		0,		0,
+		offset.x,	offset.y,	1,		0,
+		0,			0,			0,		1
+	);
+
+	D3DXMATRIX m2; 
+	D3DXMatrixRotationZ(&m2, -xf.angle);
+
+	lightMatrix = m1*m5*m2;
+	normalMatrix = m1*m2*m3*m4;
+}
+
+#ifndef FRANK_PLATFORM_WEB
+void DeferredRender::RenderSimpleLightBatches(const XForm2& xfFinal, const Vector2& cameraSize)
+{
+	// the batch shader reads each light's settings from its verts so lights with the same texture share a draw
+	IDirect3DDevice9* pd3dDevice = DXUTGetD3D9Device();
+	g_render->SetTextureStageState( 1, D3DTSS_TEXCOORDINDEX, 1 );
+	g_render->SetTextureStageState( 2, D3DTSS_TEXCOORDINDEX, 2 );
+	pd3dDevice->SetPixelShader(deferredLightBatchShader);
+	lightBatchConstantTable->SetFloat(pd3dDevice, "specularPower", specularPower);
+	lightBatchConstantTable->SetFloat(pd3dDevice, "specularHeight", specularHeight);
+	lightBatchConstantTable->SetFloat(pd3dDevice, "specularAmount", specularAmount);
+
+	// verts are built in world space
+	pd3dDevice->SetTransform(D3DTS_WORLD, &Matrix44::Identity().GetD3DXMatrix());
+	pd3dDevice->SetStreamSource(0, primitiveLightBatch.vb, 0, primitiveLightBatch.stride);
+	pd3dDevice->SetFVF(primitiveLightBatch.fvf);
+
+	// two triangles per quad to match the quad primitive's strip order
+	static const Vector2 corners[4] = { Vector2(-1, 1), Vector2(1, 1), Vector2(-1, -1), Vector2(1, -1) };
+	static const Vector2 uvs[4] = { Vector2(0, 0), Vector2(1, 0), Vector2(0, 1), Vector2(1, 1) };
+	static const int quadIndices[6] = { 0, 1, 2, 2, 1, 3 };
+
+	const Vector2 halfPixelOffset = halfPixel / textureSize;
+	vector<SimpleLightInstance>::const_iterator it = simpleLightInstances.begin();
+	while (it != simpleLightInstances.end())
+	{
+		// fill a batch with lights that use the same texture
+		const TextureID texture = it->texture;
+		LightBatchVertex* vertices;
+		if (FAILED(primitiveLightBatch.vb->Lock(0, 0, (VOID**)&vertices, D3DLOCK_DISCARD)))
+			break;
 
-		pd3dDevice->SetPixelShader(deferredLightShader);
-		g_render->RenderQuadSimple(XForm2(halfPixelOffset * light.radius)*xf, Vector2(light.radius));
+		int quadCount = 0;
+		for (; it != simpleLightInstances.end() && it->texture == texture && quadCount < maxLightBatchQuads; ++it, ++quadCount)
+		{
+			const SimpleLightInstance& instance = *it;
+			D3DXMATRIX lightMatrix, normalMatrix;
+			GetSimpleLightMatrices(instance, xfFinal, cameraSize, lightMatrix, normalMatrix);
+			const XForm2 xf = XForm2(halfPixelOffset * instance.radius) * instance.xf;
+
+			// the light and normal transforms are affine so they can be done per vertex and interpolated
+			LightBatchVertex quadVertices[4];
+			for (int i = 0; i < 4; ++i)
+			{
+				const Vector2& uv = uvs[i];
+				LightBatchVertex& vertex = quadVertices[i];
+				vertex.position = Vector3(xf.TransformCoord(instance.radius * corners[i]));
+				vertex.u = uv.x;
+				vertex.v = uv.y;
+				vertex.lightX = uv.x * lightMatrix._11 + uv.y * lightMatrix._21 + lightMatrix._41;
+				vertex.lightY = uv.x * lightMatrix._12 + uv.y * lightMatrix._22 + lightMatrix._42;
+				vertex.normalU = uv.x * normalMatrix._11 + uv.y * normalMatrix._21 + normalMatrix._31 + normalMatrix._41;
+				vertex.normalV = uv.x * normalMatrix._12 + uv.y * normalMatrix._22 + normalMatrix._32 + normalMatrix._42;
+				vertex.height = instance.height / instance.radius;
+				vertex.r = instance.color.r;
+				vertex.g = instance.color.g;
+				vertex.b = instance.color.b;
+				vertex.a = instance.color.a;
+			}
+			for (int i = 0; i < 6; ++i)
+				vertices[6*quadCount + i] = quadVertices[quadIndices[i]];
+		}
+		primitiveLightBatch.vb->Unlock();
 
-		pd3dDevice->SetPixelShader(NULL);
-		pd3dDevice->SetTexture(1, NULL);
-		pd3dDevice->SetTexture(2, NULL);
+		g_render->SetTexture(2, g_render->GetTexture(texture, false));
+		pd3dDevice->DrawPrimitive(primitiveLightBatch.primitiveType, 0, 2*quadCount);
 	}
+
+	pd3dDevice->SetPixelShader(NULL);
+	g_render->SetTextureStageState( 1, D3DTSS_TEXCOORDINDEX, 0 );
+	g_render->SetTextureStageState( 2, D3DTSS_TEXCOORDINDEX, 0 );
+	g_render->SetTexture(1, NULL);
+	g_render->SetTexture(2, NULL);
 }
+#endif
 
 void DeferredRender::UpdateDynamicLight(Light& light)
 {
@@ -435,38 +663,87 @@ void DeferredRender::UpdateDynamicLight(Light& light)
 	ASSERT(!light.IsSimpleLight());
 
 	light.wasRendered = false;
+	light.wasTextureCached = false;
 
-	if (!lightEnable || dynamicLightCount >= maxDynamicLights || light.radius == 0 || (light.coneAngle == 0 && light.coneFadeAngle == 0) || light.color.a == 0)
+	if (!lightEnable || dynamicLightCount >= maxDynamicLights || !DynamicLightTest(light))
 		return;
 
 	const XForm2 xfInterpolated = light.GetXFInterpolated();
 	const XForm2 xf(xfInterpolated.position);	// wipe out angle from light calculations
 	
-	// check if light is on screen
-	if (light.coneAngle < 2*PI)
-	{
-		if (!g_cameraBase->CameraConeTest(xfInterpolated, light.radius*lightCullScale, light.coneAngle + light.coneFadeAngle))
-			return;
-	}
-	else if (!g_cameraBase->CameraTest(xf.position, light.radius*lightCullScale))
-		return;
-
-	{
-		// hack: make sure the patch is cached
-		// fixes issue with shadow casting lights flashing when streamed in because their patch isn't being rendered yet
-		TerrainPatch* patch = g_terrain->GetPatch(xfInterpolated.position);
-		if (patch && !g_terrainRender.IsPatchCached(*patch))
-			return;
-	}
+	// create the light texture with shadows and cone rendering
+	// static lights reuse their cached texture until the light or a caster near it changes
+	// scheduled lights reuse their cached texture until the scheduler says they are due
+	// lights that cover less of the screen render to smaller textures
+	const bool scheduleActive = lightScheduleEnable && lightCacheEnable;
+	const int textureLevel = GetLightTextureLevel(light);
+	LPDIRECT3DTEXTURE9& levelTexture = lightTextures[textureLevel];
+	LightCacheEntry* cacheEntry = light.shadowCasterTracked || scheduleActive? GetLightCacheEntry(light) : NULL;
+	if (!(cacheEntry && cacheEntry->isValid))
+		light.refreshDue = true; // nothing to reuse so it must refresh or it would not be drawn at all
 
 	light.wasRendered = true;
 	++dynamicLightCount;
 	
 	IDirect3DDevice9* pd3dDevice = DXUTGetD3D9Device();
-	const Vector2 halfPixelOffset = halfPixel / textureSize;
-	
-	// create the light texture with shadows and cone rendering
-	RenderLightTexture(light);
+
+	LPDIRECT3DTEXTURE9 lightTexture = levelTexture;
+	if (cacheEntry)
+	{
+		const UINT64 lightHash = GetLightTextureHash(light);
+		if (cacheEntry->isValid && light.shadowCasterTracked && light.textureLevel == textureLevel && cacheEntry->lightHash == lightHash && cacheEntry->casterHash == light.shadowCasterHash)
+		{
+			++lightCacheHitCount;
+			light.wasTextureCached = true;
+		}
+		else if (cacheEntry->isValid && !light.refreshDue)
+		{
+			++lightRefreshStaleCount;
+			light.wasTextureCached = true;
+		}
+		else
+		{
+			++lightCacheMissCount;
+			++lightRefreshCount;
+			RenderLightTexture(light, levelTexture);
+			light.textureLevel = textureLevel;
+			light.refreshFrame = g_gameControlBase->GetRenderFrameCount();
+			light.refreshXF = xfInterpolated;
+
+			// cached textures match the size of the level they were rendered at
+			const IntVector2 levelSize = g_render->GetTextureSize(levelTexture);
+			if (cacheEntry->texture && g_render->GetTextureSize(cacheEntry->texture) != levelSize)
+			{
+				SAFE_RELEASE(cacheEntry->texture);
+				cacheEntry->isValid = false;
+			}
+
+			// check the budget when the texture is created since its size depends on the light
+			if (!cacheEntry->texture && ReserveLightCacheBytes(GetLightTextureBytes(levelSize), *cacheEntry))
+				CreateTexture(levelSize, cacheEntry->texture, g_render->GetTextureFormat(levelTexture));
+
+			if (cacheEntry->texture)
+			{
+				// keep the new texture and give its old one to the light texture
+				SwapTextures(cacheEntry->texture, levelTexture);
+				cacheEntry->lightHash = lightHash;
+				cacheEntry->casterHash = light.shadowCasterHash;
+				cacheEntry->bounds = Box2AABB(xfInterpolated.position).Inflate(fabs(light.radius));
+				cacheEntry->isValid = true;
+			}
+		}
+		if (cacheEntry->isValid)
+			lightTexture = cacheEntry->texture;
+	}
+	else
+	{
+		++lightRefreshCount;
+		RenderLightTexture(light, levelTexture);
+		light.textureLevel = textureLevel;
+	}
+
+	const float lightTextureSize = float(g_render->GetTextureSize(lightTexture).x);
+	const Vector2 halfPixelOffset = halfPixel / lightTextureSize;
 
 	// render to final shadow texture
 	LPDIRECT3DSURFACE9 renderSurface = NULL;
@@ -480,9 +757,9 @@ void DeferredRender::UpdateDynamicLight(Light& light)
 		g_cameraBase->PrepareForRender(xfFinal, finalTextureCameraScale*GetShadowMapZoom());
 		
 		// set up additive blending
-		pd3dDevice->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
-		pd3dDevice->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_ONE);
-		pd3dDevice->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD);
+		g_render->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
+		g_render->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_ONE);
+		g_render->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD);
 		
 		// render this light onto the final map
 		Color finalColor = light.color;
@@ -490,7 +767,7 @@ void DeferredRender::UpdateDynamicLight(Light& light)
 		
 		if (!normalMappingEnable || !deferredLightShader || !shadowLightConstantTable)
 		{
-			g_render->RenderQuad(XForm2(halfPixelOffset * light.radius)*xf, Vector2(light.radius), finalColor, texture);
+			g_render->RenderQuad(XForm2(halfPixelOffset * light.radius)*xf, Vector2(light.radius), finalColor, lightTexture);
 		}
 		else
 		{
@@ -502,7 +779,7 @@ void DeferredRender::UpdateDynamicLight(Light& light)
 				offset = 0.5f*(Vector2(1) - size) + offset * Vector2(1,-1);
 
 				// adjust for half pixel offset (d3d9 only, see halfTexelCorrection)
-				offset -= halfTexelCorrection * 0.5f * size / textureSize;
+				offset -= halfTexelCorrection * 0.5f * size / lightTextureSize;
 
 				D3DXMATRIX m4
 				(
@@ -528,12 +805,12 @@ void DeferredRender::UpdateDynamicLight(Light& light)
 				shadowLightConstantTable->SetMatrix(pd3dDevice, "normalMatrix", &normalMatrix);
 			}
 
-			pd3dDevice->SetTexture(0, textureNormalMap);
-			pd3dDevice->SetTextureStageState( 0, D3DTSS_TEXCOORDINDEX, 0 );
-			pd3dDevice->SetTexture(1, textureSpecularMap);
-			pd3dDevice->SetTextureStageState( 1, D3DTSS_TEXCOORDINDEX, 0 );
-			pd3dDevice->SetTexture(2, texture);
-			pd3dDevice->SetTextureStageState( 2, D3DTSS_TEXCOORDINDEX, 0 );
+			g_render->SetTexture(0, textureNormalMap);
+			g_render->SetTextureStageState( 0, D3DTSS_TEXCOORDINDEX, 0 );
+			g_render->SetTexture(1, textureSpecularMap);
+			g_render->SetTextureStageState( 1, D3DTSS_TEXCOORDINDEX, 0 );
+			g_render->SetTexture(2, lightTexture);
+			g_render->SetTextureStageState( 2, D3DTSS_TEXCOORDINDEX, 0 );
 			
 			D3DXVECTOR4 finalColorVector = finalColor;
 			shadowLightConstantTable->SetVector(pd3dDevice, "lightColor", &finalColorVector);
@@ -547,35 +824,190 @@ void DeferredRender::UpdateDynamicLight(Light& light)
 			g_render->RenderQuadSimple(XForm2(halfPixelOffset * light.radius)*xf, Vector2(light.radius));
 
 			pd3dDevice->SetPixelShader(NULL);
-			pd3dDevice->SetTexture(1, NULL);
-			pd3dDevice->SetTexture(2, NULL);
+			g_render->SetTexture(1, NULL);
+			g_render->SetTexture(2, NULL);
 		}
 	}
 	g_render->EndRender();
 	SAFE_RELEASE(renderSurface);
 	
 	// set stuf back the way it was
-	pd3dDevice->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
-	pd3dDevice->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
-	pd3dDevice->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD );
-	pd3dDevice->SetTextureStageState( 0, D3DTSS_COLOROP,   D3DTOP_MODULATE );
-	pd3dDevice->SetTextureStageState( 0, D3DTSS_COLORARG1, D3DTA_TEXTURE );
-	pd3dDevice->SetTextureStageState( 0, D3DTSS_COLORARG2, D3DTA_DIFFUSE );
-	pd3dDevice->SetTextureStageState( 0, D3DTSS_ALPHAOP,   D3DTOP_MODULATE );
-	pd3dDevice->SetTextureStageState( 0, D3DTSS_ALPHAARG1, D3DTA_TEXTURE );
-	pd3dDevice->SetTextureStageState( 0, D3DTSS_ALPHAARG2, D3DTA_DIFFUSE );
-	pd3dDevice->SetTextureStageState( 1, D3DTSS_COLOROP,   D3DTOP_DISABLE );
-	pd3dDevice->SetTextureStageState( 1, D3DTSS_ALPHAOP,   D3DTOP_DISABLE );
+	g_render->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
+	g_render->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
+	g_render->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD );
+	g_render->SetTextureStageState( 0, D3DTSS_COLOROP,   D3DTOP_MODULATE );
+	g_render->SetTextureStageState( 0, D3DTSS_COLORARG1, D3DTA_TEXTURE );
+	g_render->SetTextureStageState( 0, D3DTSS_COLORARG2, D3DTA_DIFFUSE );
+	g_render->SetTextureStageState( 0, D3DTSS_ALPHAOP,   D3DTOP_MODULATE );
+	g_render->SetTextureStageState( 0, D3DTSS_ALPHAARG1, D3DTA_TEXTURE );
+	g_render->SetTextureStageState( 0, D3DTSS_ALPHAARG2, D3DTA_DIFFUSE );
+	g_render->SetTextureStageState( 1, D3DTSS_COLOROP,   D3DTOP_DISABLE );
+	g_render->SetTextureStageState( 1, D3DTSS_ALPHAOP,   D3DTOP_DISABLE );
 	
 	// hack: return camera to normal
 	// this is so the camera extents are set when checking if next light is on screen
 	g_cameraBase->PrepareForRender();
 }
 
-void DeferredRender::RenderLightTexture(Light& light)
+bool DeferredRender::DynamicLightTest(const Light& light)
+{
+	if (light.radius == 0 || (light.coneAngle == 0 && light.coneFadeAngle == 0) || light.color.a == 0)
+		return false;
+
+	const XForm2 xfInterpolated = light.GetXFInterpolated();
+	
+	// check if light is on screen
+	if (light.coneAngle < 2*PI)
+	{
+		if (!g_cameraBase->CameraConeTest(xfInterpolated, light.radius*lightCullScale, light.coneAngle + light.coneFadeAngle))
+			return false;
+	}
+	else if (!g_cameraBase->CameraTest(xfInterpolated.position, light.radius*lightCullScale))
+		return false;
+
+	{
+		// hack: make sure the patch is cached
+		// fixes issue with shadow casting lights flashing when streamed in because their patch isn't being rendered yet
+		TerrainPatch* patch = g_terrain->GetPatch(xfInterpolated.position);
+		if (patch && !g_terrainRender.IsPatchCached(*patch))
+			return false;
+	}
+
+	return true;
+}
+
+void DeferredRender::ScheduleDynamicLights()
+{
+	// without scheduling every light refreshes every frame
+	const bool scheduleActive = lightEnable && lightScheduleEnable && lightCacheEnable;
+	for (Light* light : dynamicLights)
+		light->refreshDue = !scheduleActive;
+
+	if (!scheduleActive)
+		return;
+
+	FrankProfilerEntryDefine(L"DeferredRender::ScheduleDynamicLights()", Color::White(), 10);
+
+	const UINT frame = g_gameControlBase->GetRenderFrameCount();
+	const Box2AABB& cameraBox = g_cameraBase->GetCameraBBox();
+	const Vector2 cameraSize = cameraBox.upperBound - cameraBox.lowerBound;
+	const float cameraArea = Max(cameraSize.x*cameraSize.y, 0.01f);
+
+	// score the lights that will be drawn by screen coverage and how far they moved since they refreshed
+	// lights come in already sorted by priority so that breaks ties, fading lights also score lower
+	lightSchedule.clear();
+	for (Light* light : dynamicLights)
+	{
+		if (int(lightSchedule.size()) >= maxDynamicLights)
+			break;
+		if (!DynamicLightTest(*light))
+			continue;
+
+		const XForm2 xf = light->GetXFInterpolated();
+		const float radius = Max(fabs(light->radius), 0.01f);
+		const float coneSize = Min((light->coneAngle + light->coneFadeAngle) / PI, 1.0f);
+		const float coverage = Min(PI*radius*radius*coneSize / cameraArea, 1.0f);
+		float motion = (xf.position - light->refreshXF.position).Length() / radius;
+		if (coneSize < 1)
+			motion += fabs(CapAngle(xf.angle - light->refreshXF.angle)) / PI;
+
+		LightScheduleEntry entry;
+		entry.light = light;
+		entry.motion = motion;
+		entry.score = (coverage + motion) * light->GetFadeAlpha();
+		entry.urgency = 0;
+
+		// each shadow pass softens, stretches and copies the whole texture
+		const int levelSize = GetLightTextureSize(GetLightTextureLevel(*light));
+		entry.cost = float(levelSize*levelSize) * (light->castShadows && shadowEnable? 2 + 3*shadowPassCount : 1);
+		lightSchedule.push_back(entry);
+	}
+
+	// higher scoring lights go in earlier tiers, each tier refreshes half as often as the one before it
+	stable_sort(lightSchedule.begin(), lightSchedule.end(), LightScheduleEntry::ScoreSortCompare);
+	const int tierSize = Max(lightScheduleTierSize, 1);
+	const int maxInterval = Max(lightScheduleMaxInterval, 1);
+	for (int i = 0; i < int(lightSchedule.size()); ++i)
+	{
+		LightScheduleEntry& entry = lightSchedule[i];
+		Light& light = *entry.light;
+		light.refreshInterval = Min(1 << Min(i / tierSize, 16), maxInterval);
+
+		LightCacheEntry* cacheEntry = FindLightCacheEntry(light);
+		if (!cacheEntry || !cacheEntry->isValid)
+		{
+			// nothing to reuse so these go first
+			entry.urgency = FLT_MAX;
+			continue;
+		}
+
+		// keep this texture from being given to another light this frame
+		cacheEntry->lastUsedFrame = frame;
+
+		// static lights that have not changed can be drawn for free
+		const bool unchanged = light.shadowCasterTracked && light.textureLevel == GetLightTextureLevel(light) && cacheEntry->lightHash == GetLightTextureHash(light) && cacheEntry->casterHash == light.shadowCasterHash;
+		const int age = int(frame - light.refreshFrame);
+		if (unchanged || age < light.refreshInterval && entry.motion < lightScheduleMotionLimit)
+		{
+			entry.urgency = -1;
+			continue;
+		}
+
+		entry.urgency = float(age) / float(light.refreshInterval) + entry.motion / Max(lightScheduleMotionLimit, 0.001f);
+	}
+
+	// refresh the most overdue lights that fit in the budget, the rest reuse their old texture
+	// lights with nothing to reuse always refresh, they still use up the budget for the others
+	stable_sort(lightSchedule.begin(), lightSchedule.end(), LightScheduleEntry::UrgencySortCompare);
+	const float budget = lightScheduleBudget * 1000000;
+	float spent = 0;
+	for (const LightScheduleEntry& entry : lightSchedule)
+	{
+		if (entry.urgency < 0)
+			break;
+
+		if (entry.urgency < FLT_MAX && budget > 0 && spent > 0 && spent + entry.cost > budget)
+		{
+			++lightRefreshDeferredCount;
+			continue;
+		}
+
+		entry.light->refreshDue = true;
+		spent += entry.cost;
+	}
+}
+
+int DeferredRender::GetLightTextureSize(int level)
+{
+	// the swap textures only go down to twice their start size
+	return Max(int(textureSize) * 2 >> level, 2*textureSwapStartSize);
+}
+
+int DeferredRender::GetLightTextureLevel(const Light& light)
+{
+	if (!lightTextureAdaptive)
+		return lightTextureDefaultLevel;
+
+	// a light covers this many texels of the final texture, more light texels than that are wasted
+	Vector2 cameraSize;
+	GetFinalTransform(finalTextureSize, &cameraSize);
+	const float finalTexels = fabs(light.radius) / Max(cameraSize.x, 0.01f) * finalTextureSize.x;
+	const float wantedSize = finalTexels * lightTextureResolutionScale;
+
+	// start from the size it has now and only change when well past a boundary
+	int level = Cap(light.textureLevel, 0, lightTextureLevelCount - 1);
+	while (level > 0 && wantedSize > GetLightTextureSize(level) * (1 + lightTextureHysteresis))
+		--level;
+	while (level < lightTextureLevelCount - 1 && wantedSize < GetLightTextureSize(level + 1) * (1 - lightTextureHysteresis))
+		++level;
+	return level;
+}
+
+void DeferredRender::RenderLightTexture(Light& light, LPDIRECT3DTEXTURE9& texture)
 {
 	IDirect3DDevice9* pd3dDevice = DXUTGetD3D9Device();
-	const Vector2 halfPixelOffset = halfPixel / textureSize;
+	const float levelSize = float(g_render->GetTextureSize(texture).x);
+	const Vector2 halfPixelOffset = halfPixel / levelSize;
 		
 	const XForm2 xfInterpolated = light.GetXFInterpolated();
 	const XForm2 xf(xfInterpolated.position);	// wipe out angle from light calculations
@@ -586,9 +1018,9 @@ void DeferredRender::RenderLightTexture(Light& light)
 
 	// set up default render states
 	SetFiltering(true);
-	pd3dDevice->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
-	pd3dDevice->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
-	pd3dDevice->SetRenderState( D3DRS_BLENDOP, D3DBLENDOP_ADD );
+	g_render->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
+	g_render->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
+	g_render->SetRenderState( D3DRS_BLENDOP, D3DBLENDOP_ADD );
 
 	// prepare render to shadow texture
 	LPDIRECT3DTEXTURE9& textureSwap = GetSwapTexture(texture);
@@ -616,17 +1048,17 @@ void DeferredRender::RenderLightTexture(Light& light)
 			Vector2 offset = cameraSize * halfPixelOffset;
 
 			// disable alpha to prevent blending
-			pd3dDevice->SetTextureStageState( 0, D3DTSS_ALPHAOP,   D3DTOP_DISABLE );
+			g_render->SetTextureStageState( 0, D3DTSS_ALPHAOP,   D3DTOP_DISABLE );
 			g_render->RenderQuad(offset + xf.position, cameraSize, Color::White(), textureShadowMap);
-			pd3dDevice->SetTextureStageState( 0, D3DTSS_ALPHAOP,   D3DTOP_MODULATE );
+			g_render->SetTextureStageState( 0, D3DTSS_ALPHAOP,   D3DTOP_MODULATE );
 		}
 		
 		if (overbrightRadius > 0)
 		{
 			// use the light mask for the overbright
-			pd3dDevice->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
-			pd3dDevice->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_ONE);
-			pd3dDevice->SetRenderState( D3DRS_BLENDOP, D3DBLENDOP_ADD );
+			g_render->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
+			g_render->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_ONE);
+			g_render->SetRenderState( D3DRS_BLENDOP, D3DBLENDOP_ADD );
 			g_render->RenderQuad(xf, Vector2(overbrightRadius), Color::White(), overbrightTexture, false);
 		}
 
@@ -658,9 +1090,9 @@ void DeferredRender::RenderLightTexture(Light& light)
 				g_render->RenderQuad(halfPixelOffset, Vector2(2), Color::White());
 			
 				// use subtractive blending
-				pd3dDevice->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
-				pd3dDevice->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_ONE);
-				pd3dDevice->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_REVSUBTRACT);
+				g_render->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
+				g_render->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_ONE);
+				g_render->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_REVSUBTRACT);
 
 				for (int i=0; i < shadowPassCount; ++i)
 				{
@@ -668,20 +1100,20 @@ void DeferredRender::RenderLightTexture(Light& light)
 					float a = 1 - float(i) / float(shadowPassCount);
 					g_render->RenderQuad(halfPixelOffset, Vector2(scale), Color::White(a), textureSwap);
 				}
-				pd3dDevice->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
-				pd3dDevice->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_ONE);
-				pd3dDevice->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD);
+				g_render->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
+				g_render->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_ONE);
+				g_render->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD);
 			*/
 
 			// render out many passes of the shadow stretching it each time
-			const float inverseTextureSize = 1.0f / textureSize;
+			const float inverseLevelSize = 1.0f / levelSize;
 			float scale = shadowPassStartSize; // start size
 			int passCount = 0;
 			while (1)
 			{
 				// soften the shadow
-				pd3dDevice->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
-				pd3dDevice->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_ONE);
+				g_render->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
+				g_render->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_ONE);
 
 				float brightness = 1;
 				if (shadowSoftening <= 1)
@@ -699,9 +1131,9 @@ void DeferredRender::RenderLightTexture(Light& light)
 				g_render->RenderQuad(halfPixelOffset, Vector2(1), Color::Grey(1, brightness), Texture_LightMask, false);
 
 				// stretch out the shadow
-				pd3dDevice->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_ZERO);
-				pd3dDevice->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_SRCCOLOR);
-				const Vector2 actualScale = Vector2((textureSize + scale) * inverseTextureSize);
+				g_render->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_ZERO);
+				g_render->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_SRCCOLOR);
+				const Vector2 actualScale = Vector2((levelSize + scale) * inverseLevelSize);
 				g_render->RenderQuad(halfPixelOffset, actualScale, Color::White(), textureSwap);
 
 				if (++passCount >= shadowPassCount)
@@ -731,8 +1163,8 @@ void DeferredRender::RenderLightTexture(Light& light)
 		}
 		{
 			// render a light mask around the outside so it won't have square corners
-			pd3dDevice->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_ZERO);
-			pd3dDevice->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_SRCCOLOR);
+			g_render->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_ZERO);
+			g_render->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_SRCCOLOR);
 
 			XForm2 xfGel(Vector2(halfPixelOffset), xfInterpolated.angle);
 
@@ -770,10 +1202,9 @@ void DeferredRender::RenderCone(Light& light, float lightAngle)
 		return;
 	
 	// render a cone for spot lights
-	IDirect3DDevice9* pd3dDevice = DXUTGetD3D9Device();
-	pd3dDevice->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_ZERO);
-	pd3dDevice->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_SRCCOLOR);
-	pd3dDevice->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD);
+	g_render->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_ZERO);
+	g_render->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_SRCCOLOR);
+	g_render->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD);
 
 	const float insideBlurStep = Max(coneFadeAngle/32, 0.01f);
 	const float outsideBlurStep = PI/4;
@@ -903,12 +1334,23 @@ void DeferredRender::InitDeviceObjects()
 	// use smaller texture format to make lighting faster
 	D3DFORMAT lightTextureFormat = use32BitTextures? D3DFMT_X8R8G8B8 : D3DFMT_A1R5G5B5;
 
-	if (!CreateTexture(IntVector2(int(textureSize)), texture, lightTextureFormat))
+	if (!CreateTexture(IntVector2(GetLightTextureSize(0)), lightTextures[0], lightTextureFormat))
 	{
 		// fall back to more common format
 		lightTextureFormat = D3DFMT_X8R8G8B8;
 
-		if (!CreateTexture(IntVector2(int(textureSize)), texture, lightTextureFormat))
+		if (!CreateTexture(IntVector2(GetLightTextureSize(0)), lightTextures[0], lightTextureFormat))
+		{
+			g_debugMessageSystem.AddError(L"Light map texture failed to create! Lights disabled.");
+			lightEnable = false;
+			return;
+		}
+	}
+
+	// smaller light textures for lights that cover less of the screen
+	for (int i = 1; i < lightTextureLevelCount; ++i)
+	{
+		if (!CreateTexture(IntVector2(GetLightTextureSize(i)), lightTextures[i], lightTextureFormat))
 		{
 			g_debugMessageSystem.AddError(L"Light map texture failed to create! Lights disabled.");
 			lightEnable = false;
@@ -973,7 +1415,7 @@ void DeferredRender::InitDeviceObjects()
 
 	{
 		int maxSize = 0;
-		maxSize = Max(maxSize, int(textureSize));
+		maxSize = Max(maxSize, GetLightTextureSize(0));
 		maxSize = Max(maxSize, int(shadowMapTextureSize));
 		maxSize = Max(maxSize, int(emissiveTextureSize));
 		maxSize = Max(maxSize, int(visionTextureSize));
@@ -1045,6 +1487,24 @@ void DeferredRender::InitDeviceObjects()
 			normalMappingEnable = false;
 			return;
 		}
+
+#ifndef FRANK_PLATFORM_WEB
+		// simple lights fall back to drawing one at a time without the batch shader
+		if (!g_render->LoadPixelShader(L"deferredLightBatchShader.psh", deferredLightBatchShader, lightBatchConstantTable, false))
+		if (!g_render->LoadPixelShader(L"data/shaders/deferredLightBatchShader.psh", deferredLightBatchShader, lightBatchConstantTable, false))
+		if (!g_render->LoadPixelShader(L"deferredLightBatchShader.psh", deferredLightBatchShader, lightBatchConstantTable))
+			g_debugMessageSystem.AddError(L"Deferred light batch shader failed to create.");
+
+		primitiveLightBatch.Create
+		(
+			2*maxLightBatchQuads,			// primitiveCount
+			6*maxLightBatchQuads,			// vertexCount
+			D3DPT_TRIANGLELIST,				// primitiveType
+			sizeof(LightBatchVertex),		// stride
+			D3DFVF_XYZ|D3DFVF_TEX3|D3DFVF_TEXCOORDSIZE4(0)|D3DFVF_TEXCOORDSIZE3(1)|D3DFVF_TEXCOORDSIZE4(2),	// fvf
+			true							// dynamic
+		);
+#endif
 	}
 }
 
@@ -1052,7 +1512,8 @@ void DeferredRender::DestroyDeviceObjects()
 {
 	for(int i = 0; i < textureSwapArraySize; ++i)
 		SAFE_RELEASE(textureSwapArray[i]);
-	SAFE_RELEASE(texture);
+	for(int i = 0; i < lightTextureLevelCount; ++i)
+		SAFE_RELEASE(lightTextures[i]);
 	SAFE_RELEASE(textureNormalMap);
 	SAFE_RELEASE(textureSpecularMap);
 	SAFE_RELEASE(textureShadowMap);
@@ -1061,14 +1522,18 @@ void DeferredRender::DestroyDeviceObjects()
 	SAFE_RELEASE(textureFinal);
 	SAFE_RELEASE(shadowLightConstantTable);
 	SAFE_RELEASE(deferredLightShader);
+	SAFE_RELEASE(lightBatchConstantTable);
+	SAFE_RELEASE(deferredLightBatchShader);
 	SAFE_RELEASE(textureEmissive);
 	SAFE_RELEASE(visionConstantTable);
 	SAFE_RELEASE(visionShader);
 	SAFE_RELEASE(blurShader);
 	SAFE_RELEASE(blurConstantTable);
+	ClearLightCache();
 	SAFE_RELEASE(directionalLightConstantTable);
 	SAFE_RELEASE(directionalLightShader);
 	primitiveLightMask.SafeRelease();
+	primitiveLightBatch.SafeRelease();
 }
 
 void DeferredRender::GlobalUpdate()
@@ -1079,6 +1544,11 @@ void DeferredRender::GlobalUpdate()
 
 		dynamicLightCount = 0;
 		simpleLightCount = 0;
+		lightCacheHitCount = 0;
+		lightCacheMissCount = 0;
+		lightRefreshCount = 0;
+		lightRefreshStaleCount = 0;
+		lightRefreshDeferredCount = 0;
 
 		if (g_gameControlBase->IsEditMode() && !g_gameControlBase->IsEditPreviewMode() || !lightEnable)
 			return;
@@ -1120,8 +1590,8 @@ void DeferredRender::GlobalUpdate()
 		
 		{
 			// update all the lights
-			list<Light*> simpleLights;
-			list<Light*> dynamicLights;
+			simpleLights.clear();
+			dynamicLights.clear();
 			GameObjectHashTable& objects = g_objectManager.GetObjects();
 			for (GameObjectHashTable::iterator it = objects.begin(); it != objects.end(); ++it)
 			{
@@ -1140,7 +1610,7 @@ void DeferredRender::GlobalUpdate()
 			}
 		
 			// sort dynamic lights so higher priority lights are first
-			dynamicLights.sort(Light::SortCompare);
+			stable_sort(dynamicLights.begin(), dynamicLights.end(), Light::SortCompare);
 #ifdef FRANK_PLATFORM_WEB
 			// flicker bisection (webStripMask): strip systems AROUND the shadow pass while
 			// its chunk detector keeps counting drops (RETRIES) as an objective sensor
@@ -1148,9 +1618,10 @@ void DeferredRender::GlobalUpdate()
 			if (!(webStripMask & 1))
 #endif
 			{
+				ScheduleDynamicLights();
 				for (Light* dynamicLight : dynamicLights)
 						UpdateDynamicLight(*dynamicLight);
-				UpdateSimpleLights(simpleLights);
+				UpdateSimpleLights();
 			}
 		}
 
@@ -1193,7 +1664,7 @@ LPDIRECT3DTEXTURE9& DeferredRender::GetSwapTexture(LPDIRECT3DTEXTURE9& texture)
 void DeferredRender::SwapTextures(LPDIRECT3DTEXTURE9& texture1, LPDIRECT3DTEXTURE9& texture2)
 {
 	ASSERT(g_render->GetTextureSize(texture1) == g_render->GetTextureSize(texture2));
-	ASSERT(g_render->GetTextureFormat(texture) == g_render->GetTextureFormat(texture2));
+	ASSERT(g_render->GetTextureFormat(texture1) == g_render->GetTextureFormat(texture2));
 	swap(texture1, texture2);
 }
 
@@ -1228,9 +1699,9 @@ void DeferredRender::GlobalRender()
 	pd3dDevice->SetTransform(D3DTS_VIEW, &matrixIdentity);
 	SetFiltering(true);
 	
-	pd3dDevice->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_ZERO);
-	pd3dDevice->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_SRCCOLOR);
-	pd3dDevice->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD );
+	g_render->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_ZERO);
+	g_render->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_SRCCOLOR);
+	g_render->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD );
 	
 	LPDIRECT3DTEXTURE9 textureRender = textureFinal;
 	Color color = Color::White();
@@ -1242,9 +1713,9 @@ void DeferredRender::GlobalRender()
 
 	if (showTexture > 0)
 	{
-		pd3dDevice->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
-		pd3dDevice->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
-		pd3dDevice->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD );
+		g_render->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
+		g_render->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
+		g_render->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD );
 
 		if (showTexture == 7)
 		{
@@ -1283,7 +1754,7 @@ void DeferredRender::GlobalRender()
 			const float shadowMapZoom = GetShadowMapZoom();
 			xf = GetFinalTransform(Vector2(shadowMapTextureSize), &cameraSize, &shadowMapZoom);
 			cameraSize *= shadowMapScale;
-			pd3dDevice->SetTextureStageState( 0, D3DTSS_ALPHAOP,   D3DTOP_DISABLE );
+			g_render->SetTextureStageState( 0, D3DTSS_ALPHAOP,   D3DTOP_DISABLE );
 		}
 		else if (showTexture == 6)
 		{
@@ -1293,7 +1764,7 @@ void DeferredRender::GlobalRender()
 			const float shadowMapZoom = GetShadowMapZoom();
 			xf = GetFinalTransform(Vector2(shadowMapTextureSize), &cameraSize, &shadowMapZoom);
 			cameraSize *= shadowMapScale;
-			pd3dDevice->SetTextureStageState( 0, D3DTSS_ALPHAOP,   D3DTOP_DISABLE );
+			g_render->SetTextureStageState( 0, D3DTSS_ALPHAOP,   D3DTOP_DISABLE );
 		}
 		else if (showTexture == 8)
 		{
@@ -1303,7 +1774,7 @@ void DeferredRender::GlobalRender()
 			const float shadowMapZoom = GetShadowMapZoom();
 			xf = GetFinalTransform(Vector2(shadowMapTextureSize), &cameraSize, &shadowMapZoom);
 			cameraSize *= shadowMapScale;
-			pd3dDevice->SetTextureStageState( 0, D3DTSS_ALPHAOP,   D3DTOP_DISABLE );
+			g_render->SetTextureStageState( 0, D3DTSS_ALPHAOP,   D3DTOP_DISABLE );
 		}
 	}
 
@@ -1328,9 +1799,9 @@ void DeferredRender::GlobalRender()
 		// channel of these targets any more. That matters on gl, where "no alpha
 		// channel" has to be faked, and faking it with a write mask is what was dropping
 		// draws (see WebApplyAlphaPin).
-		pd3dDevice->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_ONE);
-		pd3dDevice->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_ONE);
-		pd3dDevice->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD );
+		g_render->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_ONE);
+		g_render->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_ONE);
+		g_render->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD );
 		const float oldAspect = camera.GetAspectRatio();
 		const float oldLockedAspect = camera.GetLockedAspectRatio();
 		camera.SetAspectRatio(1);
@@ -1349,21 +1820,21 @@ void DeferredRender::GlobalRender()
 
 		/*if (visionShader)
 		{
-			pd3dDevice->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
-			pd3dDevice->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
-			pd3dDevice->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD );
+			g_render->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
+			g_render->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
+			g_render->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD );
 
 			pd3dDevice->SetPixelShader(visionShader);
 			g_render->RenderQuad(xf.TransformCoord(halfPixelOffset), Vector2(visionRadius), Color::White(), texture);
 			pd3dDevice->SetPixelShader(NULL);
 			
-			pd3dDevice->SetTexture(1, NULL);
+			g_render->SetTexture(1, NULL);
 		}
 		else*/
 		{
-			pd3dDevice->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_ZERO);
-			pd3dDevice->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_SRCCOLOR);
-			pd3dDevice->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD );
+			g_render->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_ZERO);
+			g_render->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_SRCCOLOR);
+			g_render->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD );
 		
 			//const Vector2 halfPixelOffset = cameraSize * halfPixel / visionTextureSize;
 			g_render->RenderQuad(XForm2(halfPixel * visionRadius / finalTextureSize) * xfPlayer.position, Vector2(visionRadius), Color::White(), textureVision);
@@ -1374,10 +1845,10 @@ void DeferredRender::GlobalRender()
 	// set stuff back to normal
 	pd3dDevice->SetTransform(D3DTS_VIEW, &viewMatrixOld);
 	pd3dDevice->SetTransform(D3DTS_PROJECTION, &projectionMatrixOld);
-	pd3dDevice->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
-	pd3dDevice->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
-	pd3dDevice->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD );
-	pd3dDevice->SetTextureStageState( 0, D3DTSS_ALPHAOP,   D3DTOP_MODULATE );
+	g_render->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
+	g_render->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
+	g_render->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD );
+	g_render->SetTextureStageState( 0, D3DTSS_ALPHAOP,   D3DTOP_MODULATE );
 	shadowSaveTextures = false;
 }
 
@@ -1388,9 +1859,9 @@ void DeferredRender::Invert(LPDIRECT3DTEXTURE9& texture, const Vector2& invertTe
 	IDirect3DDevice9* pd3dDevice = DXUTGetD3D9Device();
 	const Vector2 halfPixelOffset = halfPixel / invertTextureSize;
 	
-	pd3dDevice->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_ONE);
-	pd3dDevice->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_ONE);
-	pd3dDevice->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_REVSUBTRACT);
+	g_render->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_ONE);
+	g_render->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_ONE);
+	g_render->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_REVSUBTRACT);
 
 	// set up camera transforms
 	D3DXMATRIX matrixIdentity;
@@ -1415,9 +1886,9 @@ void DeferredRender::Invert(LPDIRECT3DTEXTURE9& texture, const Vector2& invertTe
 	}
 	pd3dDevice->SetPixelShader(NULL);
 	
-	pd3dDevice->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
-	pd3dDevice->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
-	pd3dDevice->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD);
+	g_render->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
+	g_render->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
+	g_render->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD);
 }
 
 void DeferredRender::ApplyBlur(LPDIRECT3DTEXTURE9& texture, const Vector2& blurTextureSize, float brightness, float blurSize, int passCount)
@@ -1537,89 +2008,171 @@ void DeferredRender::SetFiltering(bool forceLinear)
 
 bool DeferredRender::GetLightValue(const Vector2& pos, float& value, float sampleRadius)
 {
-	#ifdef FRANK_PLATFORM_WEB
-	// gpu readback not supported on the web build (unused by shipping games)
-	value = 0;
-	return false;
-	#else
-	// warning: this function is very slow
-    HRESULT hr;
-
-	if (!textureFinal)
-		return false;
-	
-	IDirect3DDevice9* pd3dDevice = DXUTGetD3D9Device();
-
-	LPDIRECT3DSURFACE9 renderSurface = NULL;
-	hr = textureFinal->GetSurfaceLevel(0, &renderSurface);
-    if (FAILED(hr))
-        return false;
+	static vector<Vector2> positions(1);
+	static vector<float> values;
+	positions[0] = pos;
+	const bool isValid = GetLightValues(positions, values, sampleRadius);
+	value = values[0];
+	return isValid;
+}
 
-    D3DSURFACE_DESC rtDesc;
-    renderSurface->GetDesc( &rtDesc );
+bool DeferredRender::GetLightValues(const vector<Vector2>& positions, vector<float>& values, float sampleRadius)
+{
+	// evaluates light objects on the cpu so gameplay can query light without reading back from the gpu
+	FrankProfilerEntryDefine(L"DeferredRender::GetLightValues()", Color::White(), 10);
 
-	// todo: pre-create the surface in init device objects and only copy once per frame
-    LPDIRECT3DSURFACE9 plainSurface;
-    hr = pd3dDevice->CreateOffscreenPlainSurface( rtDesc.Width, rtDesc.Height, rtDesc.Format, D3DPOOL_SYSTEMMEM, &plainSurface, NULL );
-    if (FAILED(hr))
-        return false;
+	values.resize(positions.size());
+	if (positions.empty())
+		return lightEnable;
 
-	hr = pd3dDevice->GetRenderTargetData( renderSurface, plainSurface );
-    if (FAILED(hr))
+	if (!lightEnable)
 	{
-		SAFE_RELEASE(plainSurface);
+		// everything is fully lit when lighting is disabled
+		for (vector<float>::iterator it = values.begin(); it != values.end(); ++it)
+			*it = 1;
 		return false;
 	}
 
-    D3DLOCKED_RECT lockedRect;
-    RECT rect;
-    rect.left = 0;
-    rect.right = rtDesc.Width;
-    rect.top = 0;
-    rect.bottom = rtDesc.Height;
+	// get bounding box of all the query points
+	Box2AABB queryBox(positions.front());
+	for (vector<Vector2>::const_iterator it = positions.begin(); it != positions.end(); ++it)
+		queryBox += *it;
+	queryBox = queryBox.Inflate(sampleRadius);
+
+	// gather lights that can reach any of the query points
+	static vector<LightQuerySource> sources;
+	sources.clear();
+	GameObjectHashTable& objects = g_objectManager.GetObjects();
+	for (GameObjectHashTable::iterator it = objects.begin(); it != objects.end(); ++it)
+	{
+		GameObject& object = *((*it).second);
+		if (!object.IsLight() || object.IsDestroyed())
+			continue;
+
+		const Light& light = static_cast<const Light&>(object);
+		if (!light.GetIsActive() || light.radius == 0 || (light.coneAngle == 0 && light.coneFadeAngle == 0))
+			continue;
+
+		// negative radius lights still light the same area
+		const float radius = fabs(light.radius);
+		const Color& color = light.color;
+		const float alpha = color.a * light.GetFadeAlpha() * alphaScale;
+		if (alpha <= 0)
+			continue;
+
+		const XForm2 xf = light.GetXFWorld();
+		if (!queryBox.PartiallyContains(Box2AABB(xf, Vector2(radius))))
+			continue;
+
+		LightQuerySource source;
+		source.position = xf.position;
+		source.angle = xf.angle;
+		source.radius = radius;
+		source.overbrightRadius = light.overbrightRadius;
+		source.coneAngle = light.coneAngle;
+		source.coneFadeAngle = light.coneFadeAngle;
+		source.coneFadeColor = light.coneFadeColor;
+		source.color = Color(color.r * alpha, color.g * alpha, color.b * alpha);
+		source.castShadows = light.castShadows && shadowEnable && !light.IsSimpleLight();
+		sources.push_back(source);
+	}
 
-    hr = plainSurface->LockRect( &lockedRect, &rect, D3DLOCK_READONLY );
-    if (FAILED(hr))
+	// sample around each point to soften the result the way the light texture is filtered
+	static const Vector2 sampleOffsets[] = { Vector2(0), Vector2(1,0), Vector2(-1,0), Vector2(0,1), Vector2(0,-1) };
+	const int sampleCount = (sampleRadius > 0)? 5 : 1;
+	for (int i = 0; i < int(positions.size()); ++i)
 	{
-		SAFE_RELEASE(plainSurface);
-		return false;
+		float value = 0;
+		for (int j = 0; j < sampleCount; ++j)
+		{
+			const Color color = GetLightQueryColor(positions[i] + sampleRadius * sampleOffsets[j], sources).CapValues();
+			value += (color.r + color.g + color.b) / 3;
+		}
+		values[i] = value / sampleCount;
 	}
 
-	LPDIRECT3DTEXTURE9 texture = textureFinal;
-	Vector2 cameraSize;
-	XForm2 xfFinal = GetFinalTransform(finalTextureSize, &cameraSize);
-	XForm2 xfInverse = xfFinal.Inverse();
-	
-	bool isValid = false;
-	value = 0;
-	int valueCount = 0;
-	for(int i = 0; i < 20; ++i)
-	{
-		Vector2 samplePos = pos + Vector2::BuildRandomUnitVector() * sampleRadius;
-		Vector2 localPos = xfInverse.TransformCoord(pos) + cameraSize;
-		localPos *= finalTextureSize/(2*cameraSize);
-		IntVector2 texturePos = localPos;
-		if (texturePos.x >= 0 && texturePos.y >= 0 && texturePos.x < finalTextureSize.x && texturePos.y < finalTextureSize.y)
+	return true;
+}
+
+Color DeferredRender::GetLightQueryColor(const Vector2& pos, const vector<LightQuerySource>& sources)
+{
+	Color color = ambientLightColor;
+	color.a = 0;
+
+	for (vector<LightQuerySource>::const_iterator it = sources.begin(); it != sources.end(); ++it)
+	{
+		const LightQuerySource& source = *it;
+		const Vector2 delta = pos - source.position;
+		const float distanceSquared = delta.LengthSquared();
+		if (distanceSquared >= Square(source.radius))
+			continue;
+
+		// match the light mask falloff
+		const float distance = sqrtf(distanceSquared);
+		float intensity = 1 - distance / source.radius;
+
+		// lights outside the cone are scaled by the cone fade color
+		if (source.coneAngle < PI)
+		{
+			const float angle = fabs(CapAngle(delta.GetAngle() - source.angle));
+			if (angle > source.coneAngle + source.coneFadeAngle)
+				intensity *= source.coneFadeColor;
+			else if (angle > source.coneAngle)
+				intensity *= PercentLerp(angle, source.coneAngle + source.coneFadeAngle, source.coneAngle, source.coneFadeColor, 1.0f);
+		}
+
+		if (intensity <= 0)
+			continue;
+
+		if (source.castShadows && lightQueryOcclusion)
 		{
-			const DWORD valueDword = *(reinterpret_cast<LPDWORD>(lockedRect.pBits) + (rtDesc.Height - texturePos.y - 1) * (lockedRect.Pitch / 4) + texturePos.x);
-			const D3DXCOLOR pixelColor = D3DXCOLOR(valueDword);
-			value += (pixelColor.r + pixelColor.g + pixelColor.b) / 3;
-			++valueCount;
+			// overbright is added on top of the shadows
+			float transmission = GetTerrainTransmission(source.position, pos);
+			if (distance < source.overbrightRadius)
+				transmission += 1 - distance / source.overbrightRadius;
+			intensity *= Min(transmission, 1.0f);
 		}
+
+		color.r += intensity * source.color.r;
+		color.g += intensity * source.color.g;
+		color.b += intensity * source.color.b;
 	}
 
-	if (valueCount > 0)
+	if (directionalLightEnable)
 	{
-		value = value / float(valueCount);
-		isValid = true;
+		const Vector2 lightDirection = -directionalLightDirection.Normalize();
+		const float transmission = lightQueryOcclusion? GetTerrainTransmission(pos, pos + lightQueryDirectionalDistance * lightDirection) : 1;
+		color.r += transmission * directionalLightColor.r * directionalLightColor.a;
+		color.g += transmission * directionalLightColor.g * directionalLightColor.a;
+		color.b += transmission * directionalLightColor.b * directionalLightColor.a;
 	}
 
-	SAFE_RELEASE(renderSurface);
-	plainSurface->UnlockRect();
-	SAFE_RELEASE(plainSurface);
+	return color;
+}
 
-	return isValid;
-	#endif // !FRANK_PLATFORM_WEB
+float DeferredRender::GetTerrainTransmission(const Vector2& start, const Vector2& end)
+{
+	// march across the foreground layer and keep the darkest shadow color crossed
+	if (!g_terrain)
+		return 1;
+
+	const Vector2 delta = end - start;
+	const int stepCount = int(2 * delta.Length() / TerrainTile::GetSize());
+	float transmission = 1;
+	for (int i = 1; i < stepCount; ++i)
+	{
+		const Vector2 pos = start + delta * (float(i) / stepCount);
+		const BYTE surfaceIndex = g_terrain->GetSurfaceIndex(pos, 0);
+		if (!surfaceIndex)
+			continue;
+
+		const Color& shadowColor = GameSurfaceInfo::Get(surfaceIndex).shadowColor;
+		transmission = Min(transmission, Lerp(shadowColor.a, 1.0f, (shadowColor.r + shadowColor.g + shadowColor.b) / 3));
+		if (transmission <= 0)
+			break;
+	}
+
+	return transmission;
 }
 
 void DeferredRender::CycleShowTexture()
@@ -1667,9 +2220,9 @@ void DeferredRender::RenderNormalMap()
 	
 	// set up default render states
 	SetFiltering();
-	pd3dDevice->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
-	pd3dDevice->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
-	pd3dDevice->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD );
+	g_render->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
+	g_render->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
+	g_render->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD );
 	
 	// setup camera to render normal map
 	XForm2 xf = GetFinalTransform(finalTextureSize);
@@ -1691,9 +2244,9 @@ void DeferredRender::RenderNormalMap()
 		D3DXSaveSurfaceToFile( L"normalMapBuffer.jpg", D3DXIFF_JPG, renderSurface, NULL, NULL );
 	SAFE_RELEASE(renderSurface);
 	
-	pd3dDevice->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
-	pd3dDevice->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
-	pd3dDevice->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD );
+	g_render->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
+	g_render->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
+	g_render->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD );
 }
 
 void DeferredRender::RenderSpecularMap()
@@ -1705,9 +2258,9 @@ void DeferredRender::RenderSpecularMap()
 	
 	// set up default render states
 	SetFiltering();
-	pd3dDevice->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
-	pd3dDevice->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
-	pd3dDevice->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD );
+	g_render->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
+	g_render->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
+	g_render->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD );
 	
 	// setup camera to render specular map
 	XForm2 xf = GetFinalTransform(finalTextureSize);
@@ -1729,9 +2282,408 @@ void DeferredRender::RenderSpecularMap()
 		D3DXSaveSurfaceToFile( L"specularMapBuffer.jpg", D3DXIFF_JPG, renderSurface, NULL, NULL );
 	SAFE_RELEASE(renderSurface);
 	
-	pd3dDevice->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
-	pd3dDevice->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
-	pd3dDevice->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD );
+	g_render->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
+	g_render->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
+	g_render->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD );
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+//
+//	Shadow Caster Culling
+//
+//	All shadow casters are drawn once per frame into the shared screen space shadow map,
+//	but each dynamic light only samples the part of it covered by its radius. When the
+//	directional pass is off nothing else reads the lightShadow pass, so casters that
+//	overlap no visible shadow casting light can be skipped. The lights are bucketed into
+//	a uniform grid over their combined bounds and every camera test made during the
+//	lightShadow pass is checked against it.
+//
+//	The same tests build a signature of the casters around each light, which the light
+//	cache compares to know when a static light's texture must be rendered again.
+//
+////////////////////////////////////////////////////////////////////////////////////////
+
+void DeferredRender::GatherShadowCasterLights(const XForm2& xfShadowMap, const Vector2& shadowMapSize)
+{
+	FrankProfilerEntryDefine(L"DeferredRender::GatherShadowCasterLights()", Color::White(), 10);
+
+	shadowCasterCullActive = false;
+	shadowCasterTrackActive = false;
+	shadowCasterKey = 0;
+	shadowCasterId = 0;
+	shadowCasterLights.clear();
+	shadowCasterLightBoxes.clear();
+	for (int i = 0; i < shadowCasterGridSize*shadowCasterGridSize; ++i)
+		shadowCasterGrid[i].clear();
+
+	// the directional pass needs casters from the entire shadow map
+	const bool cullEnable = shadowCasterCull && !directionalLightEnable;
+
+	// light textures are only cached during gameplay because the editor changes tiles directly
+	const bool trackEnable = lightCacheEnable && shadowEnable && g_gameControlBase->IsGameplayMode();
+	if (cullEnable || trackEnable)
+	{
+		// use the normal camera to match the visibility test in UpdateDynamicLight
+		g_cameraBase->PrepareForRender();
+	}
+
+	const XForm2 xfShadowMapInverse = xfShadowMap.Inverse();
+	GameObjectHashTable& objects = g_objectManager.GetObjects();
+	for (GameObjectHashTable::iterator it = objects.begin(); it != objects.end(); ++it)
+	{
+		GameObject& object = *((*it).second);
+		if (!object.IsLight() || object.IsDestroyed())
+			continue;
+
+		Light& light = static_cast<Light&>(object);
+		light.shadowCasterCount = -1;
+		light.shadowCasterHash = 0;
+		light.shadowCasterTracked = false;
+		if (!cullEnable && !trackEnable || !light.GetIsActive() || light.IsSimpleLight() || !light.castShadows || !shadowEnable)
+			continue;
+		if (light.radius == 0 || (light.coneAngle == 0 && light.coneFadeAngle == 0) || light.color.a == 0)
+			continue;
+
+		const XForm2 xfInterpolated = light.GetXFInterpolated();
+		if (light.coneAngle < 2*PI)
+		{
+			if (!g_cameraBase->CameraConeTest(xfInterpolated, light.radius*lightCullScale, light.coneAngle + light.coneFadeAngle))
+				continue;
+		}
+		else if (!g_cameraBase->CameraTest(xfInterpolated.position, light.radius*lightCullScale))
+			continue;
+
+		// a light partly outside the shadow map would cache a texture with missing shadows
+		const float radius = fabs(light.radius);
+		const Vector2 shadowMapPos = xfShadowMapInverse.TransformCoord(xfInterpolated.position);
+		light.shadowCasterTracked = trackEnable && fabs(shadowMapPos.x) + radius < shadowMapSize.x && fabs(shadowMapPos.y) + radius < shadowMapSize.y;
+
+		// cones use their full radius, the light texture covers the whole circle
+		light.shadowCasterCount = 0;
+		shadowCasterLights.push_back(&light);
+		shadowCasterLightBoxes.push_back(Box2AABB(xfInterpolated.position).Inflate(radius));
+	}
+
+	shadowCasterCullActive = cullEnable;
+	shadowCasterTrackActive = trackEnable;
+	shadowCasterTestStamp = 0;
+	shadowCasterLightStamps.assign(shadowCasterLights.size(), 0);
+	shadowCasterLightCasters.assign(shadowCasterLights.size(), 0);
+	if (shadowCasterLights.empty())
+		return;
+
+	// fit the grid to the lights
+	shadowCasterGridBox = shadowCasterLightBoxes.front();
+	for (vector<Box2AABB>::const_iterator it = shadowCasterLightBoxes.begin(); it != shadowCasterLightBoxes.end(); ++it)
+		shadowCasterGridBox += *it;
+	const Vector2 gridSize = shadowCasterGridBox.GetSize();
+	shadowCasterCellSize = Vector2(Max(gridSize.x, 0.01f), Max(gridSize.y, 0.01f)) / float(shadowCasterGridSize);
+
+	for (int i = 0; i < int(shadowCasterLightBoxes.size()); ++i)
+	{
+		const IntVector2 cellMin = GetShadowCasterCell(shadowCasterLightBoxes[i].lowerBound);
+		const IntVector2 cellMax = GetShadowCasterCell(shadowCasterLightBoxes[i].upperBound);
+		for (int x = cellMin.x; x <= cellMax.x; ++x)
+		for (int y = cellMin.y; y <= cellMax.y; ++y)
+			shadowCasterGrid[x + y*shadowCasterGridSize].push_back(i);
+	}
+}
+
+IntVector2 DeferredRender::GetShadowCasterCell(const Vector2& pos)
+{
+	const Vector2 cell = (pos - Vector2(shadowCasterGridBox.lowerBound)) / shadowCasterCellSize;
+	return IntVector2
+	(
+		Cap(int(cell.x), 0, shadowCasterGridSize - 1),
+		Cap(int(cell.y), 0, shadowCasterGridSize - 1)
+	);
+}
+
+void DeferredRender::BeginShadowCaster(UINT64 key, UINT id)
+{
+	// render commands pass in the id of the caster that recorded them
+	if (!id)
+	{
+		id = ++shadowCasterNextId;
+		if (!id)
+			id = ++shadowCasterNextId;
+	}
+
+	shadowCasterKey = key;
+	shadowCasterId = id;
+}
+
+bool DeferredRender::ShadowCasterTest(const Box2AABB& box)
+{
+	if (renderPass != RenderPass_lightShadow || !shadowCasterCullActive && !shadowCasterGatherActive)
+		return true;
+
+	if (shadowCasterLights.empty() || !box.PartiallyContains(shadowCasterGridBox))
+		return !shadowCasterCullActive;
+
+	++shadowCasterTestStamp;
+	bool result = !shadowCasterCullActive;
+	const IntVector2 cellMin = GetShadowCasterCell(box.lowerBound);
+	const IntVector2 cellMax = GetShadowCasterCell(box.upperBound);
+	for (int x = cellMin.x; x <= cellMax.x; ++x)
+	for (int y = cellMin.y; y <= cellMax.y; ++y)
+	{
+		const vector<int>& cell = shadowCasterGrid[x + y*shadowCasterGridSize];
+		for (vector<int>::const_iterator it = cell.begin(); it != cell.end(); ++it)
+		{
+			const int i = *it;
+			if (shadowCasterLightStamps[i] == shadowCasterTestStamp || !box.PartiallyContains(shadowCasterLightBoxes[i]))
+				continue;
+
+			// counts and signatures are only built by the first lightShadow pass
+			if (!shadowCasterGatherActive || !lightDebug && !shadowCasterTrackActive)
+				return true;
+
+			// visit each light once per caster
+			shadowCasterLightStamps[i] = shadowCasterTestStamp;
+			result = true;
+
+			// a caster can be tested more than once, it only counts the first time
+			Light& light = *shadowCasterLights[i];
+			if (!shadowCasterId || shadowCasterLightCasters[i] != shadowCasterId)
+			{
+				shadowCasterLightCasters[i] = shadowCasterId;
+				++light.shadowCasterCount;
+			}
+
+			// additive draws are black in the shadow map and add nothing, so they can't change the light
+			if (light.shadowCasterTracked && (!AdditiveRenderBlock::IsActive() || TransparentRenderBlock::IsActive()))
+			{
+				// summed so the signature does not depend on draw order
+				light.shadowCasterHash += FrankUtil::HashData(&box, sizeof(box), shadowCasterKey);
+			}
+		}
+	}
+
+	return result;
+}
+
+void DeferredRender::AddShadowCasterHash(const Box2AABB& box, UINT64 key)
+{
+	if (shadowCasterLights.empty() || !box.PartiallyContains(shadowCasterGridBox))
+		return;
+
+	// additive draws are black in the shadow map and add nothing, so they can't change the light
+	if (AdditiveRenderBlock::IsActive() && !TransparentRenderBlock::IsActive())
+		return;
+
+	++shadowCasterTestStamp;
+	const IntVector2 cellMin = GetShadowCasterCell(box.lowerBound);
+	const IntVector2 cellMax = GetShadowCasterCell(box.upperBound);
+	for (int x = cellMin.x; x <= cellMax.x; ++x)
+	for (int y = cellMin.y; y <= cellMax.y; ++y)
+	{
+		const vector<int>& cell = shadowCasterGrid[x + y*shadowCasterGridSize];
+		for (vector<int>::const_iterator it = cell.begin(); it != cell.end(); ++it)
+		{
+			const int i = *it;
+			if (shadowCasterLightStamps[i] == shadowCasterTestStamp || !box.PartiallyContains(shadowCasterLightBoxes[i]))
+				continue;
+
+			shadowCasterLightStamps[i] = shadowCasterTestStamp;
+			Light& light = *shadowCasterLights[i];
+			if (light.shadowCasterTracked)
+				light.shadowCasterHash += FrankUtil::HashData(&box, sizeof(box), key);
+		}
+	}
+}
+
+void DeferredRender::TrackShadowCasterDraw(const Matrix44& matrix, const Color& color, TextureID ti, const IntVector2& tilePos, int tileRotation, bool tileMirror)
+{
+	if (!IsGatheringShadowCasters())
+		return;
+
+	// primitives fit in the unit square so the bounds come from the matrix axes
+	const Vector3 right = matrix.GetRight();
+	const Vector3 up = matrix.GetUp();
+	const Vector2 center = matrix.GetPosXY();
+	const Vector2 extent(fabs(right.x) + fabs(up.x), fabs(right.y) + fabs(up.y));
+
+	UINT64 key = FrankUtil::HashData(&matrix, sizeof(matrix));
+	key = FrankUtil::HashData(&color, sizeof(color), key);
+	key = FrankUtil::HashData(&ti, sizeof(ti), key);
+	key = FrankUtil::HashData(&tilePos, sizeof(tilePos), key);
+	key = FrankUtil::HashData(&tileRotation, sizeof(tileRotation), key);
+	key = FrankUtil::HashData(&tileMirror, sizeof(tileMirror), key);
+	AddShadowCasterHash(Box2AABB(center - extent, center + extent), key);
+}
+
+void DeferredRender::TrackShadowCasterVerts(const void* verts, int vertexCount, int stride)
+{
+	if (!IsGatheringShadowCasters() || vertexCount <= 0)
+		return;
+
+	// each vert starts with its position
+	const BYTE* vertData = (const BYTE*)verts;
+	const Vector3& firstPosition = *(const Vector3*)vertData;
+	Box2AABB box(Vector2(firstPosition.x, firstPosition.y));
+	for (int i = 1; i < vertexCount; ++i)
+	{
+		const Vector3& position = *(const Vector3*)(vertData + i*stride);
+		box += Box2AABB(Vector2(position.x, position.y));
+	}
+
+	AddShadowCasterHash(box, FrankUtil::HashData(verts, vertexCount*stride));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+//
+//	Light Cache
+//
+//	Shadow casting lights that are fully inside the shadow map keep their light texture
+//	in a budgeted pool. The texture is rendered again only when the light's own settings
+//	change, the signature of the casters inside its bounds changes, or the terrain
+//	inside its bounds is rebuilt.
+//
+////////////////////////////////////////////////////////////////////////////////////////
+
+UINT64 DeferredRender::GetLightTextureHash(const Light& light)
+{
+	// everything RenderLightTexture depends on except the shadow casters
+	// color and fade are applied when the texture is added to the final map
+	const XForm2 xf = light.GetXFInterpolated();
+	UINT64 hash = FrankUtil::HashData(&xf, sizeof(xf));
+	hash = FrankUtil::HashData(&light.radius, sizeof(light.radius), hash);
+	hash = FrankUtil::HashData(&light.overbrightRadius, sizeof(light.overbrightRadius), hash);
+	hash = FrankUtil::HashData(&light.coneAngle, sizeof(light.coneAngle), hash);
+	hash = FrankUtil::HashData(&light.coneFadeAngle, sizeof(light.coneFadeAngle), hash);
+	hash = FrankUtil::HashData(&light.coneFadeColor, sizeof(light.coneFadeColor), hash);
+	hash = FrankUtil::HashData(&light.gelTexture, sizeof(light.gelTexture), hash);
+	hash = FrankUtil::HashData(&light.castShadows, sizeof(light.castShadows), hash);
+	hash = FrankUtil::HashData(&shadowEnable, sizeof(shadowEnable), hash);
+	hash = FrankUtil::HashData(&shadowSoftening, sizeof(shadowSoftening), hash);
+	hash = FrankUtil::HashData(&shadowCastScale, sizeof(shadowCastScale), hash);
+	hash = FrankUtil::HashData(&shadowPassCount, sizeof(shadowPassCount), hash);
+	hash = FrankUtil::HashData(&shadowPassStartSize, sizeof(shadowPassStartSize), hash);
+	return hash;
+}
+
+DeferredRender::LightCacheEntry* DeferredRender::GetLightCacheEntry(const Light& light)
+{
+	const UINT frame = g_gameControlBase->GetRenderFrameCount();
+	LightCacheEntry* oldestEntry = NULL;
+	for (vector<LightCacheEntry>::iterator it = lightCache.begin(); it != lightCache.end(); ++it)
+	{
+		LightCacheEntry& entry = *it;
+		if (entry.handle == light.GetHandle())
+		{
+			entry.lastUsedFrame = frame;
+			return &entry;
+		}
+
+		if (entry.lastUsedFrame != frame && (!oldestEntry || entry.lastUsedFrame < oldestEntry->lastUsedFrame))
+			oldestEntry = &entry;
+	}
+
+	// the budget decides how many light textures can be kept
+	// textures are created when the light renders because their size depends on the light
+	const int cacheBytes = GetLightCacheBytes() + GetLightTextureBytes(IntVector2(GetLightTextureSize(lightTextureDefaultLevel)));
+	LightCacheEntry* entry = oldestEntry;
+	if (cacheBytes <= int(lightCacheBudget * 1024 * 1024))
+	{
+		LightCacheEntry newEntry;
+		newEntry.texture = NULL;
+		lightCache.push_back(newEntry);
+		entry = &lightCache.back();
+	}
+	else if (!entry)
+		return NULL;
+
+	entry->handle = light.GetHandle();
+	entry->lastUsedFrame = frame;
+	entry->isValid = false;
+	return entry;
+}
+
+DeferredRender::LightCacheEntry* DeferredRender::FindLightCacheEntry(const Light& light)
+{
+	for (vector<LightCacheEntry>::iterator it = lightCache.begin(); it != lightCache.end(); ++it)
+	{
+		if (it->handle == light.GetHandle())
+			return &*it;
+	}
+	return NULL;
+}
+
+int DeferredRender::GetLightTextureBytes(const IntVector2& size)
+{
+	const int bytesPerPixel = g_render->GetTextureFormat(lightTextures[0]) == D3DFMT_A1R5G5B5? 2 : 4;
+	return size.x*size.y*bytesPerPixel;
+}
+
+int DeferredRender::GetLightCacheBytes()
+{
+	int cacheBytes = 0;
+	for (vector<LightCacheEntry>::const_iterator it = lightCache.begin(); it != lightCache.end(); ++it)
+	{
+		if (it->texture)
+			cacheBytes += GetLightTextureBytes(g_render->GetTextureSize(it->texture));
+	}
+	return cacheBytes;
+}
+
+bool DeferredRender::ReserveLightCacheBytes(int bytes, const LightCacheEntry& keepEntry)
+{
+	// free the least recently used textures until a new one fits in the budget
+	// textures that were used this frame are kept
+	const UINT frame = g_gameControlBase->GetRenderFrameCount();
+	const int budgetBytes = int(lightCacheBudget * 1024 * 1024);
+	int cacheBytes = GetLightCacheBytes();
+	while (cacheBytes + bytes > budgetBytes)
+	{
+		LightCacheEntry* oldestEntry = NULL;
+		for (vector<LightCacheEntry>::iterator it = lightCache.begin(); it != lightCache.end(); ++it)
+		{
+			LightCacheEntry& entry = *it;
+			if (&entry == &keepEntry || !entry.texture || entry.lastUsedFrame == frame)
+				continue;
+			if (!oldestEntry || entry.lastUsedFrame < oldestEntry->lastUsedFrame)
+				oldestEntry = &entry;
+		}
+
+		if (!oldestEntry)
+			return false;
+
+		cacheBytes -= GetLightTextureBytes(g_render->GetTextureSize(oldestEntry->texture));
+		SAFE_RELEASE(oldestEntry->texture);
+		oldestEntry->isValid = false;
+	}
+
+	return true;
+}
+
+void DeferredRender::RemoveLightCacheEntry(const Light& light)
+{
+	for (vector<LightCacheEntry>::iterator it = lightCache.begin(); it != lightCache.end(); ++it)
+	{
+		if (it->handle == light.GetHandle())
+		{
+			SAFE_RELEASE(it->texture);
+			lightCache.erase(it);
+			return;
+		}
+	}
+}
+
+void DeferredRender::InvalidateLightCache(const Box2AABB& box)
+{
+	for (vector<LightCacheEntry>::iterator it = lightCache.begin(); it != lightCache.end(); ++it)
+	{
+		if (it->bounds.PartiallyContains(box))
+			it->isValid = false;
+	}
+}
+
+void DeferredRender::ClearLightCache()
+{
+	for (vector<LightCacheEntry>::iterator it = lightCache.begin(); it != lightCache.end(); ++it)
+		SAFE_RELEASE(it->texture);
+	lightCache.clear();
 }
 
 void DeferredRender::RenderShadowMap()
@@ -1743,15 +2695,16 @@ void DeferredRender::RenderShadowMap()
 	
 	// set up default render states
 	SetFiltering();
-	pd3dDevice->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
-	pd3dDevice->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
-	pd3dDevice->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD );
+	g_render->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
+	g_render->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
+	g_render->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD );
 
 	// setup camera to render shadow objects
 	Vector2 cameraSize;
 	const float shadowMapZoom = GetShadowMapZoom();
 	XForm2 xf = GetFinalTransform(Vector2(shadowMapTextureSize), &cameraSize, &shadowMapZoom);
 	cameraSize *= shadowMapScale;
+	GatherShadowCasterLights(xf, cameraSize);
 	g_cameraBase->PrepareForRender(xf, shadowMapScale*finalTextureCameraScale*shadowMapZoom);
 	
 	// prepare render to shadow texture
@@ -1762,7 +2715,9 @@ void DeferredRender::RenderShadowMap()
 	{
 		// render the shadow objects
 		renderPass = RenderPass_lightShadow;
+		shadowCasterGatherActive = true;
 		g_gameControlBase->RenderInterpolatedObjects();
+		shadowCasterGatherActive = false;
 		renderPass = RenderPass_diffuse;
 	}
 	g_render->EndRender();
@@ -1816,6 +2771,7 @@ void DeferredRender::RenderShadowMap()
 		}
 	}
 #endif
+	shadowCasterCullActive = false;
 	if (shadowSaveTextures)
 		D3DXSaveSurfaceToFile( L"shadowMapBuffer.jpg", D3DXIFF_JPG, renderSurface, NULL, NULL );
 	SAFE_RELEASE(renderSurface);
@@ -1836,9 +2792,9 @@ void DeferredRender::RenderShadowMap()
 			renderPass = RenderPass_diffuse;
 		}
 		g_render->EndRender();
-		pd3dDevice->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
-		pd3dDevice->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
-		pd3dDevice->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD );
+		g_render->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
+		g_render->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
+		g_render->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD );
 		if (shadowSaveTextures)
 			D3DXSaveSurfaceToFile( L"shadowMapBufferDirectional.jpg", D3DXIFF_JPG, renderSurfaceDirectional, NULL, NULL );
 		SAFE_RELEASE(renderSurfaceDirectional);
@@ -1862,10 +2818,10 @@ void DeferredRender::RenderShadowMap()
 	}
 #endif
 
-	pd3dDevice->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
-	pd3dDevice->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
-	pd3dDevice->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD );
-	pd3dDevice->SetRenderState( D3DRS_AMBIENT, 0x00FFFFFF );
+	g_render->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
+	g_render->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
+	g_render->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD );
+	g_render->SetRenderState( D3DRS_AMBIENT, 0x00FFFFFF );
 }
 
 void DeferredRender::RenderEmissivePass()
@@ -1878,9 +2834,9 @@ void DeferredRender::RenderEmissivePass()
 	
 	// set up default render states
 	SetFiltering();
-	pd3dDevice->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
-	pd3dDevice->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
-	pd3dDevice->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD);
+	g_render->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
+	g_render->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
+	g_render->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD);
 	
 	// correct for flicker by rounding to nearest pixel
 	// round camera xf to nearest pixel pos
@@ -1904,10 +2860,10 @@ void DeferredRender::RenderEmissivePass()
 	g_render->BeginRender(true, emissiveBackgroundColor);
 	{
 		// render the shadow objects
-		pd3dDevice->SetRenderState( D3DRS_AMBIENT, 0x00000000 );	// force everything to black
+		g_render->SetRenderState( D3DRS_AMBIENT, 0x00000000 );	// force everything to black
 		renderPass = RenderPass_emissive;
 		g_gameControlBase->RenderInterpolatedObjects();
-		pd3dDevice->SetRenderState( D3DRS_AMBIENT, 0x00FFFFFF );
+		g_render->SetRenderState( D3DRS_AMBIENT, 0x00FFFFFF );
 		renderPass = RenderPass_diffuse;
 	}
 	g_render->EndRender();
@@ -1936,9 +2892,9 @@ void DeferredRender::RenderEmissivePass()
 			XForm2 xfFinal = GetFinalTransform(finalTextureSize);
 			g_cameraBase->PrepareForRender(xfFinal, finalTextureCameraScale*GetShadowMapZoom());
 
-			pd3dDevice->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_ONE);
-			pd3dDevice->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_ONE);
-			pd3dDevice->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD);
+			g_render->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_ONE);
+			g_render->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_ONE);
+			g_render->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD);
 		
 			Vector2 offset = cameraSize * halfPixelOffset / finalTextureSize;
 			Vector2 scale = cameraSize;
@@ -1948,9 +2904,9 @@ void DeferredRender::RenderEmissivePass()
 		SAFE_RELEASE(renderSurface);
 	}
 	
-	pd3dDevice->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
-	pd3dDevice->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
-	pd3dDevice->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD );
+	g_render->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
+	g_render->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
+	g_render->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD );
 }
 
 void DeferredRender::RenderDirectionalPass()
@@ -1962,7 +2918,7 @@ void DeferredRender::RenderDirectionalPass()
 	
 	// set up default render states
 	SetFiltering(true);
-	pd3dDevice->SetRenderState( D3DRS_AMBIENT, 0x00FFFFFF );
+	g_render->SetRenderState( D3DRS_AMBIENT, 0x00FFFFFF );
 	
 	Vector2 cameraSize;
 	const float shadowMapZoom = GetShadowMapZoom();
@@ -1970,6 +2926,7 @@ void DeferredRender::RenderDirectionalPass()
 	cameraSize *= finalTextureCameraScale;
 
 	// render to final shadow texture
+	LPDIRECT3DTEXTURE9& texture = lightTextures[lightTextureDefaultLevel];
 	LPDIRECT3DTEXTURE9& textureSwap = GetSwapTexture(texture);
 	LPDIRECT3DSURFACE9 renderSurface = NULL;
 	texture->GetSurfaceLevel(0, &renderSurface);
@@ -1986,15 +2943,15 @@ void DeferredRender::RenderDirectionalPass()
 			Vector2 offset = cameraSize * halfPixelOffset;
 
 			// disable alpha to prevent blending
-			pd3dDevice->SetTextureStageState( 0, D3DTSS_ALPHAOP,   D3DTOP_DISABLE );
+			g_render->SetTextureStageState( 0, D3DTSS_ALPHAOP,   D3DTOP_DISABLE );
 			g_render->RenderQuad(offset + xf.position, cameraSize, Color::White(), textureShadowMapDirectional);
 
 			// multiply by foreground shadow map
-			pd3dDevice->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_ZERO);
-			pd3dDevice->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_SRCCOLOR);
-			pd3dDevice->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD);
+			g_render->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_ZERO);
+			g_render->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_SRCCOLOR);
+			g_render->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD);
 			g_render->RenderQuad(offset + xf.position, cameraSize, Color::White(), textureShadowMap);
-			pd3dDevice->SetTextureStageState( 0, D3DTSS_ALPHAOP,   D3DTOP_MODULATE );
+			g_render->SetTextureStageState( 0, D3DTSS_ALPHAOP,   D3DTOP_MODULATE );
 		}
 		
 		// setup camera for the shadow casting
@@ -2004,9 +2961,9 @@ void DeferredRender::RenderDirectionalPass()
 		pd3dDevice->SetTransform(D3DTS_VIEW, &matrixIdentity);
 		
 		// set up additive blending
-		pd3dDevice->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_ONE);
-		pd3dDevice->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_ONE);
-		pd3dDevice->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD);
+		g_render->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_ONE);
+		g_render->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_ONE);
+		g_render->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD);
 
 		{
 			// end the render and copy the texture to the swap texture
@@ -2049,9 +3006,9 @@ void DeferredRender::RenderDirectionalPass()
 				g_cameraBase->PrepareForRender(xf, finalTextureCameraScale*shadowMapZoom);
 
 				// set up blending
-				pd3dDevice->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_ZERO);
-				pd3dDevice->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_SRCCOLOR);
-				pd3dDevice->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD);
+				g_render->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_ZERO);
+				g_render->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_SRCCOLOR);
+				g_render->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD);
 
 				// render the shadow objects
 				const Vector2 halfPixelOffset = halfPixel / shadowMapTextureSize;
@@ -2062,9 +3019,9 @@ void DeferredRender::RenderDirectionalPass()
 				g_render->RenderQuad(offset + xf.position, cameraSize, Color::White(), textureShadowMap);
 				
 				// set up additive blending
-				pd3dDevice->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_ONE);
-				pd3dDevice->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_ONE);
-				pd3dDevice->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD);
+				g_render->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_ONE);
+				g_render->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_ONE);
+				g_render->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD);
 			
 				// setup camera for the shadow casting
 				D3DXMATRIX matrixIdentity;
@@ -2103,8 +3060,8 @@ void DeferredRender::RenderDirectionalPass()
 
 	{
 		// apply an additive blur to erode the light texture
-		pd3dDevice->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
-		pd3dDevice->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_ONE);
+		g_render->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
+		g_render->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_ONE);
 		ApplyBlur(texture, Vector2(textureSize), directionalLightBlurBrightness, 1.0, directionalLightBlurPassCount);
 	}
 
@@ -2117,9 +3074,9 @@ void DeferredRender::RenderDirectionalPass()
 		XForm2 xfFinal = GetFinalTransform(finalTextureSize);
 		g_cameraBase->PrepareForRender(xfFinal, finalTextureCameraScale*GetShadowMapZoom());
 
-		pd3dDevice->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_ONE);
-		pd3dDevice->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_ONE);
-		pd3dDevice->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD);
+		g_render->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_ONE);
+		g_render->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_ONE);
+		g_render->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD);
 		
 		const Vector2 halfPixelOffset = halfPixel / textureSize;
 		Color color = directionalLightColor * (directionalLightColor.a);
@@ -2160,12 +3117,12 @@ void DeferredRender::RenderDirectionalPass()
 				directionalLightConstantTable->SetMatrix(pd3dDevice, "normalMatrix", &matrix);
 			}
 
-			pd3dDevice->SetTexture(0, textureNormalMap);
-			pd3dDevice->SetTextureStageState( 0, D3DTSS_TEXCOORDINDEX, 0 );
-			pd3dDevice->SetTexture(1, textureSpecularMap);
-			pd3dDevice->SetTextureStageState( 1, D3DTSS_TEXCOORDINDEX, 0 );
-			pd3dDevice->SetTexture(2, texture);
-			pd3dDevice->SetTextureStageState( 2, D3DTSS_TEXCOORDINDEX, 0 );
+			g_render->SetTexture(0, textureNormalMap);
+			g_render->SetTextureStageState( 0, D3DTSS_TEXCOORDINDEX, 0 );
+			g_render->SetTexture(1, textureSpecularMap);
+			g_render->SetTextureStageState( 1, D3DTSS_TEXCOORDINDEX, 0 );
+			g_render->SetTexture(2, texture);
+			g_render->SetTextureStageState( 2, D3DTSS_TEXCOORDINDEX, 0 );
 			
 			D3DXVECTOR4 lightDirection(-directionalLightDirection.x, directionalLightDirection.y, directionalLightHeight, 1);
 			D3DXVec4Normalize(&lightDirection, &lightDirection);
@@ -2180,16 +3137,16 @@ void DeferredRender::RenderDirectionalPass()
 			g_render->RenderQuadSimple(offset + xf.position, Vector2(cameraSize));
 
 			pd3dDevice->SetPixelShader(NULL);
-			pd3dDevice->SetTexture(1, NULL);
-			pd3dDevice->SetTexture(2, NULL);
+			g_render->SetTexture(1, NULL);
+			g_render->SetTexture(2, NULL);
 		}
 	}
 	g_render->EndRender();
 	SAFE_RELEASE(renderSurface);
 	
-	pd3dDevice->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
-	pd3dDevice->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
-	pd3dDevice->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD );
+	g_render->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
+	g_render->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
+	g_render->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD );
 }
 
 void DeferredRender::RenderVisionShadowMap()
@@ -2201,9 +3158,9 @@ void DeferredRender::RenderVisionShadowMap()
 	
 	// set up default render states
 	SetFiltering();
-	pd3dDevice->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
-	pd3dDevice->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
-	pd3dDevice->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD );
+	g_render->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
+	g_render->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
+	g_render->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD );
 	
 	// setup camera to render shadow objects
 	Vector2 cameraSize;
@@ -2232,10 +3189,10 @@ void DeferredRender::RenderVisionShadowMap()
 	SetFiltering(true);
 	ApplyBlur(textureShadowMap, Vector2(shadowMapTextureSize), 1, 1, 2);
 
-	pd3dDevice->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
-	pd3dDevice->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
-	pd3dDevice->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD );
-	pd3dDevice->SetRenderState( D3DRS_AMBIENT, 0x00FFFFFF );
+	g_render->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
+	g_render->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
+	g_render->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD );
+	g_render->SetRenderState( D3DRS_AMBIENT, 0x00FFFFFF );
 }
 
 void DeferredRender::RenderVisionPass(const XForm2& xfInterpolated, LPDIRECT3DTEXTURE9& texture)
@@ -2254,9 +3211,9 @@ void DeferredRender::RenderVisionPass(const XForm2& xfInterpolated, LPDIRECT3DTE
 	
 	// set up default render states
 	SetFiltering(true);
-	pd3dDevice->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
-	pd3dDevice->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
-	pd3dDevice->SetRenderState( D3DRS_BLENDOP, D3DBLENDOP_ADD );
+	g_render->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
+	g_render->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
+	g_render->SetRenderState( D3DRS_BLENDOP, D3DBLENDOP_ADD );
 
 	// prepare render to shadow texture
 	LPDIRECT3DTEXTURE9& textureSwap = GetSwapTexture(texture);
@@ -2285,9 +3242,9 @@ void DeferredRender::RenderVisionPass(const XForm2& xfInterpolated, LPDIRECT3DTE
 			if (visionOverbrightRadius > 0)
 			{
 				// use the light mask as a gel for the overbright
-				pd3dDevice->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
-				pd3dDevice->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_ONE);
-				pd3dDevice->SetRenderState( D3DRS_BLENDOP, D3DBLENDOP_ADD );
+				g_render->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
+				g_render->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_ONE);
+				g_render->SetRenderState( D3DRS_BLENDOP, D3DBLENDOP_ADD );
 				g_render->RenderQuad(XForm2(0.5f*visionOverbrightRadius*cameraSize * halfPixelOffset)*xf, Vector2(visionOverbrightRadius), Color::White(1.0f), overbrightTexture, false);
 			}
 		}
@@ -2300,8 +3257,8 @@ void DeferredRender::RenderVisionPass(const XForm2& xfInterpolated, LPDIRECT3DTE
 
 				{
 					// apply an additive blur to erode the vision texture
-					pd3dDevice->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
-					pd3dDevice->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_ONE);
+					g_render->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
+					g_render->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_ONE);
 					ApplyBlur(texture, Vector2(visionTextureSize), 1.2f, 2, visionPreBlurPassCount);
 				}
 
@@ -2334,15 +3291,15 @@ void DeferredRender::RenderVisionPass(const XForm2& xfInterpolated, LPDIRECT3DTE
 			while (1)
 			{
 				// soften the shadow
-				pd3dDevice->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
-				pd3dDevice->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_ONE);
+				g_render->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
+				g_render->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_ONE);
 				float passPercent = Percent((float)passCount, visionPassCount-6.0f, 4.0f);
 				passPercent = passPercent*passPercent;
 				g_render->RenderQuad(halfPixelOffset, Vector2(1.0f), Color::Grey(1, passPercent*visionSoftening), Texture_Invalid, false);
 
 				// stretch out the shadow
-				pd3dDevice->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_ZERO);
-				pd3dDevice->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_SRCCOLOR);
+				g_render->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_ZERO);
+				g_render->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_SRCCOLOR);
 				const Vector2 actualScale = (Vector2(visionTextureSize) + Vector2(scale)) / visionTextureSize;
 				g_render->RenderQuad(halfPixelOffset, actualScale, Color::Grey(1, 1), textureSwap);
 
@@ -2377,8 +3334,8 @@ void DeferredRender::RenderVisionPass(const XForm2& xfInterpolated, LPDIRECT3DTE
 		}
 		//{
 		//	// render a light mask around the outside so it won't have square corners
-		//	pd3dDevice->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_ZERO);
-		//	pd3dDevice->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_SRCCOLOR);
+		//	g_render->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_ZERO);
+		//	g_render->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_SRCCOLOR);
 		//	g_render->RenderQuad(halfPixelOffset, Vector2(1), Color::White(), Texture_LightMask, false);
 		//}
 		g_render->EndRender();
@@ -2390,21 +3347,21 @@ void DeferredRender::RenderVisionPass(const XForm2& xfInterpolated, LPDIRECT3DTE
 	
 	{
 		// apply an additive blur to erode the vision texture
-		pd3dDevice->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
-		pd3dDevice->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_ONE);
+		g_render->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
+		g_render->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_ONE);
 		ApplyBlur(texture, Vector2(visionTextureSize), 1.8f, 2, visionPostBlurPassCount);
 	}
 
 	// set stuf back the way it was
-	pd3dDevice->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
-	pd3dDevice->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
-	pd3dDevice->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD );
-	pd3dDevice->SetTextureStageState( 0, D3DTSS_COLOROP,   D3DTOP_MODULATE );
-	pd3dDevice->SetTextureStageState( 0, D3DTSS_COLORARG1, D3DTA_TEXTURE );
-	pd3dDevice->SetTextureStageState( 0, D3DTSS_COLORARG2, D3DTA_DIFFUSE );
-	pd3dDevice->SetTextureStageState( 0, D3DTSS_ALPHAOP,   D3DTOP_MODULATE );
-	pd3dDevice->SetTextureStageState( 0, D3DTSS_ALPHAARG1, D3DTA_TEXTURE );
-	pd3dDevice->SetTextureStageState( 0, D3DTSS_ALPHAARG2, D3DTA_DIFFUSE );
+	g_render->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
+	g_render->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
+	g_render->SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD );
+	g_render->SetTextureStageState( 0, D3DTSS_COLOROP,   D3DTOP_MODULATE );
+	g_render->SetTextureStageState( 0, D3DTSS_COLORARG1, D3DTA_TEXTURE );
+	g_render->SetTextureStageState( 0, D3DTSS_COLORARG2, D3DTA_DIFFUSE );
+	g_render->SetTextureStageState( 0, D3DTSS_ALPHAOP,   D3DTOP_MODULATE );
+	g_render->SetTextureStageState( 0, D3DTSS_ALPHAARG1, D3DTA_TEXTURE );
+	g_render->SetTextureStageState( 0, D3DTSS_ALPHAARG2, D3DTA_DIFFUSE );
 }
 
 DeferredRender::ScrollingTextureRenderBlock::ScrollingTextureRenderBlock(const Vector2& offset, const Vector2& scale, bool enable)
@@ -2412,9 +3369,12 @@ DeferredRender::ScrollingTextureRenderBlock::ScrollingTextureRenderBlock(const V
 	if (!enable)
 		return;
 
+	// texture transform is not tracked by the sprite batch
+	g_render->FlushSprites(FrankRender::SpriteFlush_State);
+
 	IDirect3DDevice9* pd3dDevice = DXUTGetD3D9Device();
-	pd3dDevice->SetTextureStageState(0, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_COUNT2);
-	pd3dDevice->SetTextureStageState(1, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_COUNT2);
+	g_render->SetTextureStageState(0, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_COUNT2);
+	g_render->SetTextureStageState(1, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_COUNT2);
 
 	// set up the texture transform
 	Matrix44 matrix = Matrix44::BuildScale(scale.x, scale.y, 0);
@@ -2427,9 +3387,10 @@ DeferredRender::ScrollingTextureRenderBlock::ScrollingTextureRenderBlock(const V
 
 DeferredRender::ScrollingTextureRenderBlock::~ScrollingTextureRenderBlock()
 {
-	IDirect3DDevice9* pd3dDevice = DXUTGetD3D9Device();
-	pd3dDevice->SetTextureStageState(0, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_DISABLE);
-	pd3dDevice->SetTextureStageState(1, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_DISABLE);
+	g_render->FlushSprites(FrankRender::SpriteFlush_State);
+
+	g_render->SetTextureStageState(0, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_DISABLE);
+	g_render->SetTextureStageState(1, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_DISABLE);
 }
 
 DeferredRender::AlphaOnlyRenderBlock::AlphaOnlyRenderBlock(bool enable)
@@ -2437,12 +3398,12 @@ DeferredRender::AlphaOnlyRenderBlock::AlphaOnlyRenderBlock(bool enable)
 	if (!enable)
 		return;
 
-	DXUTGetD3D9Device()->SetTextureStageState( 0, D3DTSS_COLORARG1, D3DTA_DIFFUSE );
+	g_render->SetTextureStageState( 0, D3DTSS_COLORARG1, D3DTA_DIFFUSE );
 }
 
 DeferredRender::AlphaOnlyRenderBlock::~AlphaOnlyRenderBlock()
 {
-	DXUTGetD3D9Device()->SetTextureStageState( 0, D3DTSS_COLORARG1, D3DTA_TEXTURE );
+	g_render->SetTextureStageState( 0, D3DTSS_COLORARG1, D3DTA_TEXTURE );
 }
 
 DeferredRender::PointFilterRenderBlock::PointFilterRenderBlock(bool enable)
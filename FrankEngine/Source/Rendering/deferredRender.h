@@ -18,7 +18,14 @@ public:
 	static void GlobalUpdate();
 	static int GetDynamicLightCount()				{ return dynamicLightCount; }
 	static int GetSimpleLightCount()				{ return simpleLightCount; }
+	static int GetLightCacheSize()					{ return int(lightCache.size()); }
+	static int GetLightCacheHitCount()				{ return lightCacheHitCount; }
+	static int GetLightCacheMissCount()				{ return lightCacheMissCount; }
+	static int GetLightRefreshCount()				{ return lightRefreshCount; }
+	static int GetLightRefreshStaleCount()			{ return lightRefreshStaleCount; }
+	static int GetLightRefreshDeferredCount()		{ return lightRefreshDeferredCount; }
 	static bool GetLightValue(const Vector2& pos, float& value, float sampleRadius = 1.0f);
+	static bool GetLightValues(const vector<Vector2>& positions, vector<float>& values, float sampleRadius = 1.0f);
 
 	static void CycleShowTexture();
 	static WCHAR* GetShowTextureModeString();
@@ -47,8 +54,8 @@ public:
 
 	struct EmissiveRenderBlock
 	{
-		EmissiveRenderBlock(bool enable = true) { active = enable; if (enable && GetRenderPassIsEmissive()) DXUTGetD3D9Device()->SetRenderState( D3DRS_AMBIENT, 0x00FFFFFF ); }
-		~EmissiveRenderBlock() { active = false; if (GetRenderPassIsEmissive()) DXUTGetD3D9Device()->SetRenderState( D3DRS_AMBIENT, 0x00000000 ); }
+		EmissiveRenderBlock(bool enable = true) { active = enable; if (enable && GetRenderPassIsEmissive()) g_render->SetRenderState( D3DRS_AMBIENT, 0x00FFFFFF ); }
+		~EmissiveRenderBlock() { active = false; if (GetRenderPassIsEmissive()) g_render->SetRenderState( D3DRS_AMBIENT, 0x00000000 ); }
 		static bool IsActive() { return active; }
 
 		private:
@@ -57,8 +64,8 @@ public:
 	
 	struct NoTextureRenderBlock
 	{
-		NoTextureRenderBlock(bool enable = true) { active = enable; if (enable) DXUTGetD3D9Device()->SetTextureStageState( 0, D3DTSS_COLOROP, D3DTOP_SELECTARG2 ); }
-		~NoTextureRenderBlock() { active = false; DXUTGetD3D9Device()->SetTextureStageState( 0, D3DTSS_COLOROP, D3DTOP_MODULATE ); }
+		NoTextureRenderBlock(bool enable = true) { active = enable; if (enable) g_render->SetTextureStageState( 0, D3DTSS_COLOROP, D3DTOP_SELECTARG2 ); }
+		~NoTextureRenderBlock() { active = false; g_render->SetTextureStageState( 0, D3DTSS_COLOROP, D3DTOP_MODULATE ); }
 		static bool IsActive() { return active; }
 
 		private:
@@ -109,8 +116,12 @@ public:
 	
 	struct AdditiveRenderBlock
 	{
-		AdditiveRenderBlock(bool enable = true) { if (enable && !(GetRenderPassIsNormalMap() || GetRenderPassIsSpecular())) DXUTGetD3D9Device()->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_ONE); }
-		~AdditiveRenderBlock() { DXUTGetD3D9Device()->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA); }
+		AdditiveRenderBlock(bool enable = true) { active = enable; if (enable && !(GetRenderPassIsNormalMap() || GetRenderPassIsSpecular())) g_render->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_ONE); }
+		~AdditiveRenderBlock() { active = false; g_render->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA); }
+		static bool IsActive() { return active; }
+
+		private:
+		static bool active;
 	};
 	
 	struct ScrollingTextureRenderBlock
@@ -131,12 +142,20 @@ public:
 		~PointFilterRenderBlock();
 	};
 
+	// light textures come in a few sizes, each level is half the size of the one before
+	// the default level is textureSize and the level before it is used for the largest lights
+	static const int lightTextureLevelCount = 4;
+	static const int lightTextureDefaultLevel = 1;
+
 	// global light settings
 	static bool lightEnable;				// enable lighting
 	static int maxDynamicLights;			// max limit on how many shadow and cone lights lights per frame
 	static int maxSimpleLights;				// max limit on how many simple lights per frame
 	static float alphaScale;				// globaly scales alpha of all light colors
 	static float textureSize;				// size of texture used for lightmapping
+	static bool lightTextureAdaptive;		// pick light texture size by how much of the final texture a light covers
+	static float lightTextureResolutionScale;	// light texels wanted for each final texel a light covers
+	static float lightTextureHysteresis;	// how far past a size boundary a light must go before changing size
 	static float shadowMapTextureSize;		// size of texture used for texture maps
 	static Color ambientLightColor;			// color of ambient light
 	static float shadowMapScale;			// how much bigger to make the shadow map
@@ -164,6 +183,22 @@ public:
 	static float shadowPassStartSize;		// how big to start stretching shadow by, 1 for best results 
 	static float shadowLightHeightDefault;	// default height used for normal mapping
 	static Color defaultShadowColor;		// default shadow color to use for objects
+	static bool shadowCasterCull;			// only render shadow casters that overlap a shadow casting light
+
+	// light cache settings
+	static bool lightCacheEnable;			// reuse light textures for lights and casters that have not changed
+	static float lightCacheBudget;			// megabytes of light textures to keep cached
+
+	// light refresh scheduling settings
+	static bool lightScheduleEnable;		// lower priority lights reuse their last texture for a few frames
+	static int lightScheduleTierSize;		// how many lights are in each tier, each tier refreshes half as often
+	static int lightScheduleMaxInterval;	// most frames a light can go before refreshing
+	static float lightScheduleMotionLimit;	// lights that moved this fraction of their radius refresh right away
+	static float lightScheduleBudget;		// millions of light texels that can be rendered per frame, 0 is unlimited
+
+	// light query settings
+	static bool lightQueryOcclusion;		// test terrain between lights and query points
+	static float lightQueryDirectionalDistance;	// how far to look for terrain blocking directional light
 
 	// emissive pass settings
 	static bool emissiveLightEnable;		// enable emsisive lighting pass
@@ -210,12 +245,38 @@ public:
 	// hack: to allow custom textures
 	static bool CreateTexture(const IntVector2& size, LPDIRECT3DTEXTURE9& texture, D3DFORMAT format = D3DFMT_X8R8G8B8);
 
+	// camera tests use this to skip shadow casters no light will sample
+	static bool ShadowCasterTest(const Box2AABB& box);
+
+	// identifies what is being drawn so cached lights notice casters that change in place
+	// and each caster is only counted once no matter how many camera tests it makes
+	static bool IsGatheringShadowCasters()			{ return shadowCasterGatherActive && shadowCasterTrackActive; }
+	// draws outside a caster have an id of 0 and are each counted on their own
+	static void BeginShadowCaster(UINT64 key = 0, UINT id = 0);
+	static void EndShadowCaster()					{ shadowCasterKey = 0; shadowCasterId = 0; }
+	static UINT GetShadowCasterId()					{ return shadowCasterId; }
+
+	// draws report their bounds and render state so cached lights notice casters that skip
+	// the camera test or change tile, size or alpha without moving
+	static void TrackShadowCasterDraw(const Matrix44& matrix, const Color& color, TextureID ti, const IntVector2& tilePos = IntVector2(0), int tileRotation = 0, bool tileMirror = false);
+	static void TrackShadowCasterVerts(const void* verts, int vertexCount, int stride);
+
+	// cached light textures must be rendered again when terrain in their bounds changes
+	static void InvalidateLightCache(const Box2AABB& box);
+	static void ClearLightCache();
+	static void RemoveLightCacheEntry(const Light& light);
+
 private:
 
-	static void RenderLightTexture(Light& light);
+	static void RenderLightTexture(Light& light, LPDIRECT3DTEXTURE9& texture);
+	static int GetLightTextureLevel(const Light& light);
+	static int GetLightTextureSize(int level);
 	static void RenderCone(Light& light, float angle);
-	static void UpdateSimpleLight(Light& light, const XForm2& xfFinal, const Vector2& cameraSize);
+	static void AddSimpleLightInstance(Light& light);
+	static void RenderSimpleLightInstances(const XForm2& xfFinal, const Vector2& cameraSize);
 	static void UpdateDynamicLight(Light& light);
+	static bool DynamicLightTest(const Light& light);
+	static void ScheduleDynamicLights();
 
 	static XForm2 GetFinalTransform(const Vector2& textureRoundSize, Vector2* cameraSize = NULL, const float* zoomOverride = NULL);
 	static void SetFiltering(bool forceLinear = false);
@@ -223,7 +284,7 @@ private:
 	static void SwapTextures(LPDIRECT3DTEXTURE9& texture1, LPDIRECT3DTEXTURE9& texture2);
 	
 	static float GetShadowMapZoom();
-	static void UpdateSimpleLights(list<Light*> simpleLights);
+	static void UpdateSimpleLights();
 	static void Invert(LPDIRECT3DTEXTURE9& texture, const Vector2& invertTextureSize);
 	static void ApplyBlur(LPDIRECT3DTEXTURE9& texture, const Vector2& blurTextureSize, float brightness, float blurSize, int passCount = 1);
 	static void RenderShadowMap();
@@ -232,11 +293,88 @@ private:
 	static void RenderEmissivePass();
 	static void RenderDirectionalPass();
 	static void RenderVisionShadowMap();
+	static void GatherShadowCasterLights(const XForm2& xfShadowMap, const Vector2& shadowMapSize);
+	static IntVector2 GetShadowCasterCell(const Vector2& pos);
+
+	struct LightCacheEntry
+	{
+		GameObjectHandle handle;
+		LPDIRECT3DTEXTURE9 texture;
+		UINT64 lightHash;
+		UINT64 casterHash;
+		Box2AABB bounds;
+		UINT lastUsedFrame;
+		bool isValid;
+	};
+
+	static UINT64 GetLightTextureHash(const Light& light);
+
+	struct LightQuerySource
+	{
+		Vector2 position;
+		float angle;
+		float radius;
+		float overbrightRadius;
+		float coneAngle;
+		float coneFadeAngle;
+		float coneFadeColor;
+		Color color;
+		bool castShadows;
+	};
+
+	static Color GetLightQueryColor(const Vector2& pos, const vector<LightQuerySource>& sources);
+	static float GetTerrainTransmission(const Vector2& start, const Vector2& end);
+	static LightCacheEntry* GetLightCacheEntry(const Light& light);
+	static LightCacheEntry* FindLightCacheEntry(const Light& light);
+	static int GetLightCacheBytes();
+	static int GetLightTextureBytes(const IntVector2& size);
+	static bool ReserveLightCacheBytes(int bytes, const LightCacheEntry& keepEntry);
+	static void AddShadowCasterHash(const Box2AABB& box, UINT64 key);
+
+	struct LightScheduleEntry
+	{
+		Light* light;
+		float score;
+		float motion;
+		float urgency;
+		float cost;
+
+		static bool ScoreSortCompare(const LightScheduleEntry& first, const LightScheduleEntry& second) { return first.score > second.score; }
+		static bool UrgencySortCompare(const LightScheduleEntry& first, const LightScheduleEntry& second) { return first.urgency > second.urgency; }
+	};
+
+	// everything needed to draw a visible simple light, packed so they can be drawn together
+	struct SimpleLightInstance
+	{
+		XForm2 xf;
+		float radius;
+		float height;
+		Color color;
+		TextureID texture;
+
+		static bool SortCompare(const SimpleLightInstance& first, const SimpleLightInstance& second) { return first.texture < second.texture; }
+	};
+
+	// vertex for drawing many normal mapped simple lights at once, each light's shader settings are in its verts
+	struct LightBatchVertex
+	{
+		Vector3 position;
+		float u, v;						// light texture coords
+		float lightX, lightY;			// light direction
+		float normalU, normalV;			// normal map coords
+		float height;					// light height
+		float r, g, b, a;				// light color, kept as floats so it can go above 1
+	};
+	static const int maxLightBatchQuads = 256;
+	static const int maxSimpleLightCopies = 8;		// how many times an overbright simple light can be drawn
+
+	static void RenderSimpleLightBatches(const XForm2& xfFinal, const Vector2& cameraSize);
+	static void GetSimpleLightMatrices(const SimpleLightInstance& instance, const XForm2& xfFinal, const Vector2& cameraSize, D3DXMATRIX& lightMatrix, D3DXMATRIX& normalMatrix);
 
 	static const int textureSwapStartSize = 32;
 	static const int textureSwapArraySize = 10;
 	static LPDIRECT3DTEXTURE9 textureSwapArray[textureSwapArraySize];
-	static LPDIRECT3DTEXTURE9 texture;
+	static LPDIRECT3DTEXTURE9 lightTextures[lightTextureLevelCount];
 	static LPDIRECT3DTEXTURE9 textureVision;
 	static LPDIRECT3DTEXTURE9 textureShadowMap;
 	static LPDIRECT3DTEXTURE9 textureShadowMapDirectional;
@@ -246,6 +384,8 @@ private:
 	static LPDIRECT3DTEXTURE9 textureFinal;
 	static LPDIRECT3DPIXELSHADER9 deferredLightShader;
 	static LPD3DXCONSTANTTABLE shadowLightConstantTable;
+	static LPDIRECT3DPIXELSHADER9 deferredLightBatchShader;
+	static LPD3DXCONSTANTTABLE lightBatchConstantTable;
 	static LPDIRECT3DPIXELSHADER9 visionShader;
 	static LPD3DXCONSTANTTABLE visionConstantTable;
 	static LPDIRECT3DPIXELSHADER9 blurShader;
@@ -253,4 +393,34 @@ private:
 	static LPDIRECT3DPIXELSHADER9 directionalLightShader;
 	static LPD3DXCONSTANTTABLE directionalLightConstantTable;
     static FrankRender::RenderPrimitive primitiveLightMask;
+	static FrankRender::RenderPrimitive primitiveLightBatch;
+
+	static const int shadowCasterGridSize = 16;
+	static bool shadowCasterCullActive;
+	static bool shadowCasterGatherActive;
+	static bool shadowCasterTrackActive;
+	static UINT64 shadowCasterKey;
+	static UINT shadowCasterTestStamp;
+	static UINT shadowCasterId;
+	static UINT shadowCasterNextId;
+	static vector<Light*> shadowCasterLights;
+	static vector<Box2AABB> shadowCasterLightBoxes;
+	static vector<UINT> shadowCasterLightStamps;
+	static vector<UINT> shadowCasterLightCasters;	// last caster counted for each light
+	static vector<int> shadowCasterGrid[shadowCasterGridSize*shadowCasterGridSize];
+	static Box2AABB shadowCasterGridBox;
+	static Vector2 shadowCasterCellSize;
+
+	static vector<LightCacheEntry> lightCache;
+
+	// reused each frame to avoid reallocating
+	static vector<Light*> simpleLights;
+	static vector<Light*> dynamicLights;
+	static vector<SimpleLightInstance> simpleLightInstances;
+	static vector<LightScheduleEntry> lightSchedule;
+	static int lightRefreshCount;
+	static int lightRefreshStaleCount;
+	static int lightRefreshDeferredCount;
+	static int lightCacheHitCount;
+	static int lightCacheMissCount;
 };
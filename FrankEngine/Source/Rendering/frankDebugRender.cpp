@@ -123,23 +123,21 @@ void DebugRender::Render()
 	
 	CDXUTPerfEventGenerator( DXUT_PERFEVENTCOLOR, L"DebugRender::Render()" );
 
-	IDirect3DDevice9* pd3dDevice = DXUTGetD3D9Device();
-
-	pd3dDevice->SetRenderState(D3DRS_ALPHABLENDENABLE, TRUE);
-	pd3dDevice->SetRenderState(D3DRS_ALPHATESTENABLE, FALSE); 
-	pd3dDevice->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
-	pd3dDevice->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
-	pd3dDevice->SetRenderState(D3DRS_ZENABLE, FALSE);
-	pd3dDevice->SetRenderState(D3DRS_ZWRITEENABLE, FALSE);
-	pd3dDevice->SetRenderState(D3DRS_CULLMODE, D3DCULL_NONE);
-	pd3dDevice->SetRenderState(D3DRS_LIGHTING, TRUE);
+	g_render->SetRenderState(D3DRS_ALPHABLENDENABLE, TRUE);
+	g_render->SetRenderState(D3DRS_ALPHATESTENABLE, FALSE); 
+	g_render->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
+	g_render->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
+	g_render->SetRenderState(D3DRS_ZENABLE, FALSE);
+	g_render->SetRenderState(D3DRS_ZWRITEENABLE, FALSE);
+	g_render->SetRenderState(D3DRS_CULLMODE, D3DCULL_NONE);
+	g_render->SetRenderState(D3DRS_LIGHTING, TRUE);
 
 	for (DebugRenderItemPoint* renderItem : activeRenderItemPoints)
 		g_render->RenderCircle(renderItem->matrix, renderItem->color);
 
 	UpdatePrimitiveLineList();
 
-	pd3dDevice->SetRenderState(D3DRS_LIGHTING, FALSE);
+	g_render->SetRenderState(D3DRS_LIGHTING, FALSE);
 
 	if (primitiveLineList.primitiveCount > 0)
 		g_render->Render(Matrix44::Identity(), Color::White(), Texture_Invalid, primitiveLineList);
@@ -152,7 +150,7 @@ void DebugRender::Render()
 			ImmediateRenderText(renderItem->position, renderItem->text, renderItem->color, renderItem->center);
 	}
 
-	pd3dDevice->SetRenderState( D3DRS_LIGHTING, TRUE);
+	g_render->SetRenderState( D3DRS_LIGHTING, TRUE);
 }
 
 void DebugRender::InitDeviceObjects()
@@ -15,6 +15,16 @@ ConsoleCommand(fontDebug, fontDebug);
 
 FrankRender::RenderPrimitive FrankFont::primitiveTris;
 unordered_map<string, string> FrankFont::tokenReplaceMap;
+UINT FrankFont::tokenVersion = 0;
+
+bool FrankFont::meshCacheEnable = true;
+ConsoleCommand(FrankFont::meshCacheEnable, fontMeshCache);
+
+int FrankFont::meshCacheSize = 256;
+ConsoleCommand(FrankFont::meshCacheSize, fontMeshCacheSize);
+
+int FrankFont::meshCacheHitCount = 0;
+int FrankFont::meshCacheMissCount = 0;
 
 const char FrankFont::tokenStart = '{';
 const char FrankFont::tokenEnd   = '}';
@@ -84,13 +94,19 @@ FrankFont::FrankFont(TextureID _texture, WCHAR* dataFilenameWide) :
 	ParseFont( dataStream, charSet );
 }
 
-Box2AABB FrankFont::GetLocalBBox(const char* _text, float size, FontFlags flags) const
+Box2AABB FrankFont::GetLocalBBox(const char* text, float size, FontFlags flags) const
 {
-	const char* text = PreProcess(_text);
-
 	const float fontScale = size/charSet.lineHeight;
 	Vector2 minPos, maxPos;
-	GetBounds(text, minPos, maxPos);
+	if (meshCacheEnable)
+	{
+		// the mesh is usually needed to render this text anyway
+		const FontMesh& mesh = GetMesh(text, flags);
+		minPos = mesh.minPos;
+		maxPos = mesh.maxPos;
+	}
+	else
+		GetBounds(PreProcess(text), minPos, maxPos);
 
 	if (flags & FontFlag_CenterY)
 	{
@@ -180,23 +196,18 @@ void FrankFont::Render(const char* _text, const Matrix44& matrix, const Color& c
 			return;
 	}
 	
-	const char* text = PreProcess(_text);
+	const FontMesh& mesh = GetMesh(_text, flags);
 
 	Vector2 offset(0);
 
 	if (flags & FontFlag_CenterY)
-	{
-		Vector2 minPos, maxPos;
-		GetBounds(text, minPos, maxPos);
-		offset.y = (maxPos.y - minPos.y) / 2;
-	}
+		offset.y = (mesh.maxPos.y - mesh.minPos.y) / 2;
 	
 	// disable lighting for screen space fonts, so custom colors can be used
-	IDirect3DDevice9* pd3dDevice = DXUTGetD3D9Device();
-	pd3dDevice->SetRenderState( D3DRS_LIGHTING, FALSE );
+	g_render->SetRenderState( D3DRS_LIGHTING, FALSE );
 	DeferredRender::PointFilterRenderBlock pointFilterDisable(usePointFilter);
 
-	BuildTriStrip(text, color, flags);
+	FillTriStrip(mesh, color);
 
 	const Matrix44 finalMatrix = Matrix44(offset) * matrix;
 	if (screenSpace)
@@ -204,7 +215,7 @@ void FrankFont::Render(const char* _text, const Matrix44& matrix, const Color& c
 	else
 		g_render->Render(finalMatrix, Color::White(), texture, primitiveTris);
 
-	pd3dDevice->SetRenderState( D3DRS_LIGHTING, TRUE );
+	g_render->SetRenderState( D3DRS_LIGHTING, TRUE );
 }
 
 void FrankFont::InitDeviceObjects()
@@ -226,7 +237,53 @@ void FrankFont::DestroyDeviceObjects()
 	primitiveTris.SafeRelease();
 }
 
-void FrankFont::BuildTriStrip(const char* text, const Color& _color, FontFlags flags)
+const FrankFont::FontMesh& FrankFont::GetMesh(const char* text, FontFlags flags) const
+{
+	// only the alignment flags change the layout
+	flags = flags & (FontFlag_Center | FontFlag_AlignRight);
+	if (!meshCacheEnable || meshCacheSize <= 0)
+	{
+		BuildMesh(text, flags, uncachedMesh);
+		return uncachedMesh;
+	}
+
+	string key(text);
+	key.append(1, 0);
+	key.append(1, char(flags));
+
+	unordered_map<string, list<FontMesh>::iterator>::iterator it = meshCacheMap.find(key);
+	if (it != meshCacheMap.end())
+	{
+		meshCache.splice(meshCache.begin(), meshCache, it->second);
+		FontMesh& mesh = *it->second;
+		if (!mesh.animated && (!mesh.hasTokens || mesh.tokenVersion == tokenVersion))
+		{
+			++meshCacheHitCount;
+			return mesh;
+		}
+
+		++meshCacheMissCount;
+		BuildMesh(text, flags, mesh);
+		return mesh;
+	}
+
+	++meshCacheMissCount;
+	meshCache.push_front(FontMesh());
+	FontMesh& mesh = meshCache.front();
+	mesh.key = key;
+	meshCacheMap[key] = meshCache.begin();
+	BuildMesh(text, flags, mesh);
+
+	while (int(meshCache.size()) > meshCacheSize)
+	{
+		meshCacheMap.erase(meshCache.back().key);
+		meshCache.pop_back();
+	}
+
+	return mesh;
+}
+
+void FrankFont::FillTriStrip(const FontMesh& mesh, const Color& _color)
 {
 	Color color = _color;
 
@@ -238,18 +295,52 @@ void FrankFont::BuildTriStrip(const char* text, const Color& _color, FontFlags f
 		color = Color::Black();
 	}
 
+	FontVertex* verts;
+	primitiveTris.vb->Lock(0, 0, (VOID**)&verts, D3DLOCK_DISCARD);
+
+	const int vertCount = Min(int(mesh.verts.size()), maxTextLength * 6);
+	DWORD vertColor = color;
+	vector<FontColorChange>::const_iterator colorChange = mesh.colorChanges.begin();
+	for (int i = 0; i < vertCount; ++i)
+	{
+		for (; colorChange != mesh.colorChanges.end() && colorChange->vertex == i; ++colorChange)
+		{
+			if (!allowColorChange)
+				continue;
+
+			color = colorChange->color;
+			color.a = _color.a;
+			vertColor = color;
+		}
+
+		verts[i] = mesh.verts[i];
+		verts[i].color = vertColor;
+	}
+
+	primitiveTris.vb->Unlock();
+
+	primitiveTris.primitiveCount = vertCount - 2;
+}
+
+void FrankFont::BuildMesh(const char* _text, FontFlags flags, FontMesh& mesh) const
+{
+	const char* text = PreProcess(_text);
+	GetBounds(text, mesh.minPos, mesh.maxPos);
+	mesh.verts.clear();
+	mesh.colorChanges.clear();
+	mesh.tokenVersion = tokenVersion;
+	mesh.hasTokens = strchr(_text, tokenStart) != NULL;
+	mesh.animated = false;
+
 	float sizeScale = 1;
 	bool modeWave = false;
 	bool modeShake = false;
 	const float time = GamePauseTimer::GetTimeGlobal();
 
-	FontVertex* verts;
-	primitiveTris.vb->Lock(0, 0, (VOID**)&verts, D3DLOCK_DISCARD);
-
-	int vertCount = 0;
 	int textLength = strlen(text);
 	Vector2 position(0);
-	FontVertex* vert = &verts[0];
+	FontVertex vert;
+	vert.color = 0;
 
 	if (flags & FontFlag_CenterX)
 	{
@@ -316,29 +407,32 @@ void FrankFont::BuildTriStrip(const char* text, const Color& _color, FontFlags f
 				sizeScale += 0.25f;
 			else if (!strcmp(token, "small"))
 				sizeScale = Max(sizeScale - 0.25f, 0.25f);
-			else if (allowColorChange)
+			else
 			{
+				FontColorChange colorChange = { int(mesh.verts.size()), Color::White() };
 				if (!strcmp(token, "white"))
-					color = Color::White();
+					colorChange.color = Color::White();
 				else if (!strcmp(token, "black"))
-					color = Color::Black();
+					colorChange.color = Color::Black();
 				else if (!strcmp(token, "red"))
-					color = Color::Red();
+					colorChange.color = Color::Red();
 				else if (!strcmp(token, "orange"))
-					color = Color::Orange();
+					colorChange.color = Color::Orange();
 				else if (!strcmp(token, "yellow"))
-					color = Color::Yellow();
+					colorChange.color = Color::Yellow();
 				else if (!strcmp(token, "green"))
-					color = Color::Green();
+					colorChange.color = Color::Green();
 				else if (!strcmp(token, "blue"))
-					color = Color::Blue();
+					colorChange.color = Color::Blue();
 				else if (!strcmp(token, "purple"))
-					color = Color::Purple();
+					colorChange.color = Color::Purple();
 				else if (!strcmp(token, "magenta"))
-					color = Color::Magenta();
+					colorChange.color = Color::Magenta();
 				else if (!strcmp(token, "cyan"))
-					color = Color::Cyan();
-				color.a = _color.a;
+					colorChange.color = Color::Cyan();
+				else
+					continue;
+				mesh.colorChanges.push_back(colorChange);
 			}
 
 			continue;
@@ -358,6 +452,7 @@ void FrankFont::BuildTriStrip(const char* text, const Color& _color, FontFlags f
 		const Vector2 charLR = charDescriptor.position + charDescriptor.size;
 		
 		Vector2 offsetPosition(0);
+		mesh.animated |= modeWave || modeShake;
 		if (modeWave)
 		{
 			offsetPosition.y += 10*sinf(10*time + i);
@@ -380,59 +475,44 @@ void FrankFont::BuildTriStrip(const char* text, const Color& _color, FontFlags f
 		Vector3 vertPosition(0);
 		vertPosition.x = offsetPosition.x + sizeScale*(charDescriptor.offset.x);
 		vertPosition.y = offsetPosition.y + sizeScale*(-charDescriptor.size.y - charDescriptor.offset.y);
-		vert->position = vertPosition;
-		vert->textureCoords = charLL / charSet.scale;
-		vert->color = color;
-		++vert;
-		++vertCount;
+		vert.position = vertPosition;
+		vert.textureCoords = charLL / charSet.scale;
+		mesh.verts.push_back(vert);
 		
 		// degenerate tri
-		vert->position = vertPosition;
-		vert->textureCoords = charLL / charSet.scale;
-		vert->color = color;
-		++vert;
-		++vertCount;
+		vert.position = vertPosition;
+		vert.textureCoords = charLL / charSet.scale;
+		mesh.verts.push_back(vert);
 
 		// lower right
 		vertPosition.x = offsetPosition.x + sizeScale*(charDescriptor.size.x + charDescriptor.offset.x);
 		vertPosition.y = offsetPosition.y + sizeScale*(-charDescriptor.size.y - charDescriptor.offset.y);
-		vert->position = vertPosition;
-		vert->textureCoords = charLR / charSet.scale;
-		vert->color = color;
-		++vert;
-		++vertCount;
+		vert.position = vertPosition;
+		vert.textureCoords = charLR / charSet.scale;
+		mesh.verts.push_back(vert);
 		
 		// upper left
 		vertPosition.x = offsetPosition.x + sizeScale*(charDescriptor.offset.x);
 		vertPosition.y = offsetPosition.y + sizeScale*(-charDescriptor.offset.y);
-		vert->position = vertPosition;
-		vert->textureCoords = charUL / charSet.scale;
-		vert->color = color;
-		++vert;
-		++vertCount;
+		vert.position = vertPosition;
+		vert.textureCoords = charUL / charSet.scale;
+		mesh.verts.push_back(vert);
 
 		// upper right
 		vertPosition.x = offsetPosition.x + sizeScale*(charDescriptor.size.x + charDescriptor.offset.x);
 		vertPosition.y = offsetPosition.y + sizeScale*(-charDescriptor.offset.y);
-		vert->position = vertPosition;
-		vert->textureCoords = charUR / charSet.scale;
-		vert->color = color;
-		++vert;
-		++vertCount;
+		vert.position = vertPosition;
+		vert.textureCoords = charUR / charSet.scale;
+		mesh.verts.push_back(vert);
 
 		// degenerate tri
-		vert->position = vertPosition;
-		vert->textureCoords = charUR / charSet.scale;
-		vert->color = color;
-		++vert;
-		++vertCount;
+		vert.position = vertPosition;
+		vert.textureCoords = charUR / charSet.scale;
+		mesh.verts.push_back(vert);
 
 		position.x += sizeScale*(charDescriptor.advanceX);
 	}
 
-	primitiveTris.vb->Unlock();
-
-	primitiveTris.primitiveCount = vertCount - 2;
 }
 
 void FrankFont::GetBounds(const char* text, Vector2& minPos, Vector2& maxPos) const
@@ -685,6 +765,17 @@ bool FrankFont::ParseFont(istream& Stream, CharSet& CharSetDesc)
 	return true;
 }
 
+void FrankFont::SetReplaceToken(const char* token, const char* text)
+{
+	string& replaceText = tokenReplaceMap[token];
+	if (replaceText == text)
+		return;
+
+	// cached text that uses tokens must be rebuilt
+	replaceText = text;
+	++tokenVersion;
+}
+
 const char* FrankFont::PreProcess(const char* text)
 {
 	static string textOut;
@@ -7,6 +7,7 @@
 	- some code is from Promit's tutorial - http://www.gamedev.net/topic/330742-quick-tutorial-variable-width-bitmap-fonts/
 	- fonts are loaded from texture
 	- fonts can be rendered in world or screen space and scaled
+	- laid out text is cached per font, least recently used meshes are evicted
 */
 ////////////////////////////////////////////////////////////////////////////////////////
 
@@ -44,15 +45,23 @@ struct FrankFont
 	Box2AABB GetAABBox(const char* text, const XForm2& xf, float size, FontFlags flags = FontFlag_None) const;
 
 	void SetUsePointFilter(bool _usePointFilter) { usePointFilter = _usePointFilter; }
-	void SetExtraRightBounds(float _extraRightBounds) { extraRightBounds = _extraRightBounds; }
+	void SetExtraRightBounds(float _extraRightBounds) { if (extraRightBounds != _extraRightBounds) ClearMeshCache(); extraRightBounds = _extraRightBounds; }
 
-	static void SetReplaceToken(const char* token, const char* text) { tokenReplaceMap[token] = text; }
+	static void SetReplaceToken(const char* token, const char* text);
 	
 	static const char* PreProcess(const char* text);
 
 	static const char tokenStart;
 	static const char tokenEnd;
 
+	void ClearMeshCache() { meshCache.clear(); meshCacheMap.clear(); }
+	static void ResetMeshCacheStats() { meshCacheHitCount = 0; meshCacheMissCount = 0; }
+	static int GetMeshCacheHitCount() { return meshCacheHitCount; }
+	static int GetMeshCacheMissCount() { return meshCacheMissCount; }
+
+	static bool meshCacheEnable;	// reuse laid out text instead of rebuilding it every render
+	static int meshCacheSize;		// how many meshes each font keeps
+
 private:
 	
 	struct CharDescriptor
@@ -82,9 +91,31 @@ private:
 		Vector2 textureCoords;
 	};
 
+	// a color token in the text, applied from this vertex on
+	struct FontColorChange
+	{
+		int vertex;
+		Color color;
+	};
+
+	// laid out text, vertex colors are filled in when it is rendered
+	struct FontMesh
+	{
+		string key;
+		vector<FontVertex> verts;
+		vector<FontColorChange> colorChanges;
+		Vector2 minPos;
+		Vector2 maxPos;
+		UINT tokenVersion = 0;
+		bool hasTokens = false;		// text may change when replace tokens are set
+		bool animated = false;		// wave or shake moves the verts over time so it is rebuilt every render
+	};
+
 	void GetLineBounds(const char* text, float& minX, float& maxX) const;	
 	void GetBounds(const char* text, Vector2& minPos, Vector2& maxPos) const;
-	void BuildTriStrip(const char* text, const Color& color = Color::White(), FontFlags flags = FontFlag_None);
+	const FontMesh& GetMesh(const char* text, FontFlags flags) const;
+	void BuildMesh(const char* text, FontFlags flags, FontMesh& mesh) const;
+	void FillTriStrip(const FontMesh& mesh, const Color& color);
 
 	static bool ParseFont(istream& Stream, CharSet& CharSetDesc);
 
@@ -97,4 +128,12 @@ private:
 	float extraRightBounds = 0;
 
 	static unordered_map<string, string> tokenReplaceMap;
+	static UINT tokenVersion;
+
+	// most recently used mesh is at the front
+	mutable list<FontMesh> meshCache;
+	mutable unordered_map<string, list<FontMesh>::iterator> meshCacheMap;
+	mutable FontMesh uncachedMesh;
+	static int meshCacheHitCount;
+	static int meshCacheMissCount;
 };
@@ -22,6 +22,7 @@ struct CUSTOMVERTEX
 };
 
 #define D3DFVF_SimpleVertex (D3DFVF_XYZ|D3DFVF_DIFFUSE)
+#define D3DFVF_SpriteVertex (D3DFVF_XYZ|D3DFVF_DIFFUSE|D3DFVF_TEX1)
 
 bool g_usePointFiltering = false;
 ConsoleCommand(g_usePointFiltering, usePointFiltering);
@@ -34,6 +35,12 @@ ConsoleCommand(g_tileSetUVScale, tileSetUVScale);
 // interpolation used for rendering
 float g_interpolatePercent = 0;
 
+bool FrankRender::spriteBatchEnable = true;
+ConsoleCommand(FrankRender::spriteBatchEnable, spriteBatchEnable);
+
+bool FrankRender::stateCacheEnable = true;
+ConsoleCommand(FrankRender::stateCacheEnable, renderStateCache);
+
 ////////////////////////////////////////////////////////////////////////////////////////
 /*
 	Frank Engine Renderer Member Functions
@@ -82,6 +89,15 @@ void FrankRender::InitDeviceObjects()
 			D3DFVF_SimpleVertex,			// fvf
 			true							// dynamic
 		);
+		primitiveSprites.Create
+		(
+			0,								// primitiveCount
+			6*maxSpriteQuads,				// vertexCount
+			D3DPT_TRIANGLELIST,				// primitiveType
+			sizeof(SpriteVertex),			// stride
+			D3DFVF_SpriteVertex,			// fvf
+			true							// dynamic
+		);
 	}
 
 	if (DeferredRender::normalMappingEnable)
@@ -114,6 +130,9 @@ void FrankRender::DestroyDeviceObjects()
 	primitiveCube.SafeRelease();
 	primitiveLines.SafeRelease();
 	primitiveTris.SafeRelease();
+	primitiveSprites.SafeRelease();
+	spriteQuadCount = 0;
+	spriteTexture = NULL;
 	SAFE_RELEASE(normalMapConstantTable);
 	SAFE_RELEASE(normalMapShader);
 
@@ -133,12 +152,16 @@ bool FrankRender::BeginRender(bool needsClear, const Color& clearColor, DWORD cl
 void FrankRender::EndRender()
 {
 	ASSERT(isInRenderBlock);
+	FlushSprites(SpriteFlush_End);
 	isInRenderBlock = false;
 	DXUTGetD3D9Device()->EndScene();
 }
 
 void FrankRender::SetPointFilter(bool pointFilter)
 {
+	// sampler state is not tracked by the sprite batch
+	FlushSprites(SpriteFlush_State);
+
 	if (pointFilter)
 	{
 		DXUTGetD3D9Device()->SetSamplerState( 0, D3DSAMP_MINFILTER, D3DTEXF_POINT );
@@ -684,55 +707,55 @@ void FrankRender::RenderSimpleVerts()
 	{
 		// additive blend with full brightness
 		pd3dDevice->GetRenderState( D3DRS_AMBIENT, &savedAmbient );
-		pd3dDevice->SetRenderState( D3DRS_DESTBLEND, D3DBLEND_ONE );
+		SetRenderState( D3DRS_DESTBLEND, D3DBLEND_ONE );
 	}
 
 	Color color = Color::White();
 	if (DeferredRender::GetRenderPassIsNormalMap())
 	{
 		color = Color(0.5f, 0.5f, 1.0f, color.a);
-		pd3dDevice->SetTextureStageState(0, D3DTSS_COLOROP, D3DTOP_SELECTARG2);
-		pd3dDevice->SetTextureStageState(0, D3DTSS_ALPHAOP, D3DTOP_SELECTARG2);
+		SetTextureStageState(0, D3DTSS_COLOROP, D3DTOP_SELECTARG2);
+		SetTextureStageState(0, D3DTSS_ALPHAOP, D3DTOP_SELECTARG2);
 	}
 	else if (DeferredRender::GetRenderPassIsSpecular())
 	{
 		color = DeferredRender::SpecularRenderBlock::IsActive() ? Color::White(color.a) : Color::Black(color.a);
-		pd3dDevice->SetTextureStageState(0, D3DTSS_COLOROP, D3DTOP_SELECTARG2);
-		pd3dDevice->SetTextureStageState(0, D3DTSS_ALPHAOP, D3DTOP_SELECTARG2);
+		SetTextureStageState(0, D3DTSS_COLOROP, D3DTOP_SELECTARG2);
+		SetTextureStageState(0, D3DTSS_ALPHAOP, D3DTOP_SELECTARG2);
 	}
 	else if (DeferredRender::GetRenderPassIsEmissive())
 	{
 		makeBlack = (!simpleVertsAreAdditive && !DeferredRender::EmissiveRenderBlock::IsActive());
-		pd3dDevice->SetRenderState(D3DRS_LIGHTING, FALSE);
+		SetRenderState(D3DRS_LIGHTING, FALSE);
 	}
 	else if (!DeferredRender::GetRenderPassIsShadow() || DeferredRender::TransparentRenderBlock::IsActive())
 	{
 		// normally simple verts don't use directx lighting
-		pd3dDevice->SetRenderState(D3DRS_LIGHTING, FALSE);
+		SetRenderState(D3DRS_LIGHTING, FALSE);
 	}
 	else if (DeferredRender::GetRenderPassIsShadow())
 		makeBlack = true;
 	
-	pd3dDevice->SetRenderState( D3DRS_DIFFUSEMATERIALSOURCE,  D3DMCS_COLOR1 );
+	SetRenderState( D3DRS_DIFFUSEMATERIALSOURCE,  D3DMCS_COLOR1 );
 
 	RenderSimpleTriVerts(color, makeBlack);
 	RenderSimpleLineVerts(color, makeBlack);
 	
-	pd3dDevice->SetRenderState(D3DRS_LIGHTING, TRUE);
+	SetRenderState(D3DRS_LIGHTING, TRUE);
 	
 	if (DeferredRender::GetRenderPassIsNormalMap() || DeferredRender::GetRenderPassIsSpecular())
 	{
-		pd3dDevice->SetTextureStageState( 0, D3DTSS_COLOROP,   D3DTOP_MODULATE );
-		pd3dDevice->SetTextureStageState( 0, D3DTSS_ALPHAOP,   D3DTOP_MODULATE );
+		SetTextureStageState( 0, D3DTSS_COLOROP,   D3DTOP_MODULATE );
+		SetTextureStageState( 0, D3DTSS_ALPHAOP,   D3DTOP_MODULATE );
 	}
 
 	if (simpleVertsAreAdditive && !DeferredRender::GetRenderPassIsNormalMap())
 	{
-		pd3dDevice->SetRenderState( D3DRS_AMBIENT, savedAmbient );
-		pd3dDevice->SetRenderState( D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA );
+		SetRenderState( D3DRS_AMBIENT, savedAmbient );
+		SetRenderState( D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA );
 	}
 
-	pd3dDevice->SetRenderState( D3DRS_DIFFUSEMATERIALSOURCE,  D3DMCS_MATERIAL );
+	SetRenderState( D3DRS_DIFFUSEMATERIALSOURCE,  D3DMCS_MATERIAL );
 }
 
 void FrankRender::RenderSimpleLineVerts(const Color& color, bool makeBlack)
@@ -745,6 +768,7 @@ void FrankRender::RenderSimpleLineVerts(const Color& color, bool makeBlack)
 	}
 
 	totalSimpleVertsRendered += simpleVertLineCount;
+	DeferredRender::TrackShadowCasterVerts(simpleVertsLines, simpleVertLineCount, sizeof(SimpleVertex));
 	SimpleVertex* lockedVerts;
 	primitiveLines.vb->Lock(0, simpleVertLineCount, (VOID**)&lockedVerts, D3DLOCK_DISCARD);
 	for(int i = 0; i < simpleVertLineCount; ++i)
@@ -772,6 +796,7 @@ void FrankRender::RenderSimpleTriVerts(const Color& color, bool makeBlack, Textu
 	}
 	
 	totalSimpleVertsRendered += simpleVertTriCount;
+	DeferredRender::TrackShadowCasterVerts(simpleVertsTris, simpleVertTriCount, sizeof(SimpleVertex));
 	SimpleVertex* lockedVerts;
 	primitiveTris.vb->Lock(0, simpleVertTriCount, (VOID**)&lockedVerts, D3DLOCK_DISCARD);
 	for(int i = 0; i < simpleVertTriCount; ++i)
@@ -792,6 +817,7 @@ void FrankRender::RenderSimpleTriVerts(const Color& color, bool makeBlack, Textu
 void FrankRender::AddPointToLineVerts(const Vector2& position, DWORD color)
 {
 	ASSERT(position.IsFinite())
+	++renderCallCount;
 	if (simpleVertLineCount >= maxSimpleVerts - 8)
 	{
 		SimpleVertex vert1 = simpleVertsLines[simpleVertLineCount-1];
@@ -808,6 +834,7 @@ void FrankRender::AddPointToLineVerts(const Vector2& position, DWORD color)
 void FrankRender::AddPointToTriVerts(const Vector2& position, DWORD color)
 {
 	ASSERT(position.IsFinite())
+	++renderCallCount;
 	if (simpleVertTriCount >= maxSimpleVerts - 8)
 	{
 		SimpleVertex vert1 = simpleVertsTris[simpleVertTriCount-2];
@@ -1183,6 +1210,8 @@ void FrankRender::RenderScreenSpace
 	const RenderPrimitive& rp
 )
 {
+	FlushSprites();
+
 	const TextureWrapper& textureWrapper = textures[ti][TT_Diffuse];
 	if (textureWrapper.tileSheetTi != Texture_Invalid)
 	{
@@ -1191,8 +1220,8 @@ void FrankRender::RenderScreenSpace
 		IDirect3DDevice9* pd3dDevice = DXUTGetD3D9Device();
 		pd3dDevice->GetTextureStageState(0, D3DTSS_TEXTURETRANSFORMFLAGS, &oldTT0);
 		pd3dDevice->GetTextureStageState(1, D3DTSS_TEXTURETRANSFORMFLAGS, &oldTT1);
-		pd3dDevice->SetTextureStageState(0, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_COUNT2);
-		pd3dDevice->SetTextureStageState(1, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_COUNT2);
+		SetTextureStageState(0, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_COUNT2);
+		SetTextureStageState(1, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_COUNT2);
 
 		{
 			// set up the texture transform
@@ -1219,8 +1248,8 @@ void FrankRender::RenderScreenSpace
 			rp.fvf
 		);
 
-		pd3dDevice->SetTextureStageState(0, D3DTSS_TEXTURETRANSFORMFLAGS, oldTT0);
-		pd3dDevice->SetTextureStageState(1, D3DTSS_TEXTURETRANSFORMFLAGS, oldTT1);
+		SetTextureStageState(0, D3DTSS_TEXTURETRANSFORMFLAGS, oldTT0);
+		SetTextureStageState(1, D3DTSS_TEXTURETRANSFORMFLAGS, oldTT1);
 	}
 	else
 	{
@@ -1256,6 +1285,8 @@ void FrankRender::RenderScreenSpace
 
 	if (color.a == 0)
 		return;	// skip if there is no alpha
+
+	FlushSprites();
 	
 	// save the camera transforms
 	D3DXMATRIX viewMatrixOld, projectionMatrixOld;
@@ -1292,60 +1323,78 @@ void FrankRender::RenderTile
 )
 {
 	ASSERT(textures[ti][TT_Diffuse].tileSheetTi == Texture_Invalid); // tile's sheet should not be a tile in another sheet
-	ASSERT(g_tileSetUVScale > 0);
+	DeferredRender::TrackShadowCasterDraw(matrix, color, ti, tilePos, tileRotation, tileMirror);
+
+	if (CanBatchSprite(ti, rp, color))
+	{
+		const Matrix44 matrixUV = GetTileUVMatrix(tilePos, tileSize, tileRotation, tileMirror);
+		AddSprite(matrix, color, ti, &matrixUV);
+		return;
+	}
+
+	FlushSprites();
 
 	IDirect3DDevice9* pd3dDevice = DXUTGetD3D9Device();
 
-	pd3dDevice->SetTextureStageState(0, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_COUNT2);
-	pd3dDevice->SetTextureStageState(1, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_COUNT2);
+	SetTextureStageState(0, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_COUNT2);
+	SetTextureStageState(1, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_COUNT2);
 
 	{
-		// fix issue with texture filtering
-		const Vector2 inverseTileSize = 1.0f / Vector2(tileSize);
-		const Vector2 uvFix = (g_tileSetUVScale == 0)? Vector2(0) : Vector2(1 - g_tileSetUVScale) * inverseTileSize;
-
 		// set up the texture transform
-		const Vector2 scale = inverseTileSize - uvFix;
-		float rotation = float(tileRotation) * PI / 2;
+		const Matrix44 matrixUV = GetTileUVMatrix(tilePos, tileSize, tileRotation, tileMirror);
+		pd3dDevice->SetTransform(D3DTS_TEXTURE0, &matrixUV.GetD3DXMatrix());
+		pd3dDevice->SetTransform(D3DTS_TEXTURE1, &matrixUV.GetD3DXMatrix());
+	}
+
+	RenderInternal(matrix, color, ti, rp); 
 		
-		Matrix44 matrixScale;
-		if (tileMirror)
-		{
-			if (tileRotation % 2)
-				matrixScale = Matrix44::BuildScale(scale.x, -scale.y, 0);
-			else
-				matrixScale = Matrix44::BuildScale(-scale.x, scale.y, 0);
+	SetTextureStageState(0, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_DISABLE);
+	SetTextureStageState(1, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_DISABLE);
+}
 
-		}
-		else
-			matrixScale = Matrix44::BuildScale(scale.x, scale.y, 0);
-		Matrix44 matrixRotation = Matrix44::BuildRotateZ(rotation);
-		Matrix44 matrix = matrixRotation * matrixScale;
-		D3DMATRIX& d3dmatrix = matrix.GetD3DXMatrix();
+Matrix44 FrankRender::GetTileUVMatrix(const IntVector2& tilePos, const IntVector2& tileSize, const int tileRotation, const bool tileMirror) const
+{
+	ASSERT(g_tileSetUVScale > 0);
+
+	// fix issue with texture filtering
+	const Vector2 inverseTileSize = 1.0f / Vector2(tileSize);
+	const Vector2 uvFix = (g_tileSetUVScale == 0)? Vector2(0) : Vector2(1 - g_tileSetUVScale) * inverseTileSize;
+
+	const Vector2 scale = inverseTileSize - uvFix;
+	float rotation = float(tileRotation) * PI / 2;
 		
-		Vector2 tilePosFloat = Vector2(tilePos);
-		tilePosFloat += Vector2(0.5f);
-		if (tileMirror)
-		{
-			if (tileRotation % 2)
-				tilePosFloat -= g_tileSetUVScale * Vector2(1,-1) * Vector2(0.5f).Rotate(rotation);
-			else
-				tilePosFloat -= g_tileSetUVScale * Vector2(-1,1) * Vector2(0.5f).Rotate(rotation);
-		}
+	Matrix44 matrixScale;
+	if (tileMirror)
+	{
+		if (tileRotation % 2)
+			matrixScale = Matrix44::BuildScale(scale.x, -scale.y, 0);
 		else
-			tilePosFloat -= g_tileSetUVScale * Vector2(0.5f).Rotate(rotation);
-		tilePosFloat *= inverseTileSize;
+			matrixScale = Matrix44::BuildScale(-scale.x, scale.y, 0);
 
-		d3dmatrix._31 = tilePosFloat.x;
-		d3dmatrix._32 = tilePosFloat.y;
-		pd3dDevice->SetTransform(D3DTS_TEXTURE0, &d3dmatrix);
-		pd3dDevice->SetTransform(D3DTS_TEXTURE1, &d3dmatrix);
 	}
-
-	RenderInternal(matrix, color, ti, rp); 
+	else
+		matrixScale = Matrix44::BuildScale(scale.x, scale.y, 0);
+	Matrix44 matrixRotation = Matrix44::BuildRotateZ(rotation);
+	Matrix44 matrix = matrixRotation * matrixScale;
+	D3DMATRIX& d3dmatrix = matrix.GetD3DXMatrix();
 		
-	pd3dDevice->SetTextureStageState(0, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_DISABLE);
-	pd3dDevice->SetTextureStageState(1, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_DISABLE);
+	Vector2 tilePosFloat = Vector2(tilePos);
+	tilePosFloat += Vector2(0.5f);
+	if (tileMirror)
+	{
+		if (tileRotation % 2)
+			tilePosFloat -= g_tileSetUVScale * Vector2(1,-1) * Vector2(0.5f).Rotate(rotation);
+		else
+			tilePosFloat -= g_tileSetUVScale * Vector2(-1,1) * Vector2(0.5f).Rotate(rotation);
+	}
+	else
+		tilePosFloat -= g_tileSetUVScale * Vector2(0.5f).Rotate(rotation);
+	tilePosFloat *= inverseTileSize;
+
+	// texture transform uses the 3rd row as the offset for 2d uvs
+	d3dmatrix._31 = tilePosFloat.x;
+	d3dmatrix._32 = tilePosFloat.y;
+	return matrix;
 }
 
 void FrankRender::RenderScreenSpaceTile
@@ -1364,8 +1413,8 @@ void FrankRender::RenderScreenSpaceTile
 	IDirect3DDevice9* pd3dDevice = DXUTGetD3D9Device();
 	pd3dDevice->GetTextureStageState(0, D3DTSS_TEXTURETRANSFORMFLAGS, &oldTT0);
 	pd3dDevice->GetTextureStageState(1, D3DTSS_TEXTURETRANSFORMFLAGS, &oldTT1);
-	pd3dDevice->SetTextureStageState(0, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_COUNT2);
-	pd3dDevice->SetTextureStageState(1, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_COUNT2);
+	SetTextureStageState(0, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_COUNT2);
+	SetTextureStageState(1, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_COUNT2);
 	
 	{
 		// fix issue with texture filtering
@@ -1424,8 +1473,8 @@ void FrankRender::RenderScreenSpaceTile
 		rp.fvf
 	);
 
-	pd3dDevice->SetTextureStageState(0, D3DTSS_TEXTURETRANSFORMFLAGS, oldTT0);
-	pd3dDevice->SetTextureStageState(1, D3DTSS_TEXTURETRANSFORMFLAGS, oldTT1);
+	SetTextureStageState(0, D3DTSS_TEXTURETRANSFORMFLAGS, oldTT0);
+	SetTextureStageState(1, D3DTSS_TEXTURETRANSFORMFLAGS, oldTT1);
 }
 
 void FrankRender::Render
@@ -1438,9 +1487,12 @@ void FrankRender::Render
 	DWORD fvf
 )
 {
+	++renderCallCount;
 	if (primitiveCount <= 0)
 		return;
 
+	FlushSprites();
+
 	// set the world transform
 	IDirect3DDevice9* pd3dDevice = DXUTGetD3D9Device();
 	pd3dDevice->SetTransform(D3DTS_WORLD, &matrix.GetD3DXMatrix());
@@ -1463,13 +1515,260 @@ void FrankRender::Render
 {
 	ASSERT(ti < MAX_TEXTURE_COUNT);
 
+	// simple verts are tracked when they are flushed
+	if (&rp != &primitiveTris && &rp != &primitiveLines)
+		DeferredRender::TrackShadowCasterDraw(matrix, color, ti, IntVector2(0), tileRotation, tileMirror);
+
 	const TextureWrapper& textureWrapper = textures[ti][TT_Diffuse];
+	if (CanBatchSprite(ti, rp, color))
+	{
+		if (textureWrapper.tileSheetTi != Texture_Invalid)
+		{
+			const Matrix44 matrixUV = GetTileUVMatrix(textureWrapper.tilePos, textureWrapper.tileSize, tileRotation, tileMirror);
+			AddSprite(matrix, color, textureWrapper.tileSheetTi, &matrixUV);
+		}
+		else
+			AddSprite(matrix, color, ti);
+		return;
+	}
+
+	FlushSprites();
+
 	if (textureWrapper.tileSheetTi != Texture_Invalid)
 		RenderTile(textureWrapper.tilePos, textureWrapper.tileSize, matrix, color, textureWrapper.tileSheetTi, rp, tileRotation, tileMirror);
 	else
 		RenderInternal(matrix, color, ti, rp); 
 }
 
+////////////////////////////////////////////////////////////////////////////////////////
+/*
+	Sprite Batching
+*/
+////////////////////////////////////////////////////////////////////////////////////////
+
+// render states that must match for sprites to share a batch
+static const D3DRENDERSTATETYPE spriteBlendStates[] =
+{
+	D3DRS_ALPHABLENDENABLE,
+	D3DRS_SRCBLEND,
+	D3DRS_DESTBLEND,
+	D3DRS_BLENDOP
+};
+
+static const D3DRENDERSTATETYPE spriteRenderStates[] =
+{
+	D3DRS_LIGHTING,			// must be first, checked when building vertex colors
+	D3DRS_ALPHATESTENABLE,
+	D3DRS_ALPHAREF,
+	D3DRS_ALPHAFUNC,
+	D3DRS_AMBIENT,
+	D3DRS_ZENABLE,
+	D3DRS_ZWRITEENABLE,
+	D3DRS_CULLMODE
+};
+
+static const D3DTEXTURESTAGESTATETYPE spriteStageStates[] =
+{
+	D3DTSS_COLOROP,
+	D3DTSS_COLORARG1,
+	D3DTSS_ALPHAOP
+};
+
+static const int spriteBlendStateCount = sizeof(spriteBlendStates) / sizeof(spriteBlendStates[0]);
+static const int spriteRenderStateCount = sizeof(spriteRenderStates) / sizeof(spriteRenderStates[0]);
+static const int spriteStageStateCount = sizeof(spriteStageStates) / sizeof(spriteStageStates[0]);
+
+bool FrankRender::CanBatchSprite(TextureID ti, const RenderPrimitive& rp, const Color& color) const
+{
+	if (!spriteBatchEnable || spriteBatchDepth == 0 || &rp != &primitiveQuad || !primitiveSprites.vb)
+		return false;
+
+	// batched colors are packed into a vertex DWORD, overbright colors would be clamped before lighting
+	if (color.r < 0 || color.r > 1 || color.g < 0 || color.g > 1 || color.b < 0 || color.b > 1 || color.a < 0 || color.a > 1)
+		return false;
+
+	// only the plain diffuse path is batched, deferred passes that need extra textures or shaders draw normally
+	if (DeferredRender::GetRenderPassIsNormalMap() || DeferredRender::GetRenderPassIsSpecular())
+		return false;
+	if (DeferredRender::GetRenderPassIsDirectionalShadow() && !DeferredRender::BackgroundRenderBlock::IsActive())
+		return false;
+	if (DeferredRender::GetRenderPassIsShadow() && !DeferredRender::TransparentRenderBlock::IsActive())
+		return false;
+
+	const TextureID sheetTi = textures[ti][TT_Diffuse].tileSheetTi;
+	if (DeferredRender::GetRenderPassIsEmissive() && textures[sheetTi != Texture_Invalid? sheetTi : ti][TT_Emissive].texture)
+		return false;
+
+	return true;
+}
+
+void FrankRender::AddSprite(const Matrix44& matrix, const Color& color, TextureID ti, const Matrix44* matrixUV)
+{
+	ASSERT(isInRenderBlock);
+	ASSERT(color.IsFinite());
+	ASSERT(textures[ti][TT_Diffuse].tileSheetTi == Texture_Invalid);
+
+	if (color.a == 0)
+		return;	// skip if there is no alpha
+
+	LPDIRECT3DTEXTURE9 texture = textures[ti][TT_Diffuse].texture;
+	const SpriteState& state = GetSpriteState();
+
+	if (spriteQuadCount > 0)
+	{
+		if (texture != spriteTexture)
+			FlushSprites(SpriteFlush_Texture);
+		else if (memcmp(state.blendStates, spriteState.blendStates, sizeof(state.blendStates)))
+			FlushSprites(SpriteFlush_Blend);
+		else if (memcmp(&state, &spriteState, sizeof(state)))
+			FlushSprites(SpriteFlush_State);
+		else if (spriteQuadCount >= maxSpriteQuads)
+			FlushSprites(SpriteFlush_Full);
+	}
+
+	if (spriteQuadCount == 0)
+	{
+		spriteTexture = texture;
+		spriteState = state;
+	}
+
+	// the material color is carried per vertex, with lighting off the texture is drawn untinted like the unbatched path
+	const bool lightingEnabled = (state.renderStates[0] != FALSE);
+	const DWORD vertexColor = lightingEnabled? DWORD(color) : DWORD(Color::White());
+
+	// transform the quad on the cpu so sprites can share one draw
+	const Vector3 right = matrix.GetRight();
+	const Vector3 up = matrix.GetUp();
+	const Vector3 pos = matrix.GetPos();
+	const Vector3 positions[4] = { pos - right + up, pos + right + up, pos - right - up, pos + right - up };
+	Vector2 uvs[4] = { Vector2(0, 0), Vector2(1, 0), Vector2(0, 1), Vector2(1, 1) };
+	if (matrixUV)
+	{
+		// bake the tile's texture transform into the uvs
+		for (Vector2& uv : uvs)
+			uv = Vector2(matrixUV->TransformCoord(Vector3(uv.x, uv.y, 1)));
+	}
+
+	// two triangles per quad to match the quad primitive's strip order
+	static const int quadIndices[6] = { 0, 1, 2, 2, 1, 3 };
+	SpriteVertex* vertex = &spriteVerts[6*spriteQuadCount];
+	for (int i = 0; i < 6; ++i, ++vertex)
+	{
+		const int index = quadIndices[i];
+		vertex->position = positions[index];
+		vertex->color = vertexColor;
+		vertex->u = uvs[index].x;
+		vertex->v = uvs[index].y;
+	}
+
+	++spriteQuadCount;
+	++spriteBatchedCount;
+}
+
+void FrankRender::InvalidateStateCache()
+{
+	// the next set of each state will always go to the device
+	for (bool& valid : cachedRenderStateValid)
+		valid = false;
+	for (int i = 0; i < maxCachedTextureStages; ++i)
+	{
+		for (bool& valid : cachedStageStateValid[i])
+			valid = false;
+		cachedTextureValid[i] = false;
+	}
+	cachedMaterialValid = false;
+	spriteStateDirty = true;
+}
+
+void FrankRender::FlushSprites(SpriteFlushReason reason)
+{
+	if (spriteQuadCount == 0)
+		return;
+
+	ASSERT(reason < SpriteFlush_Count);
+	++spriteFlushCounts[reason];
+	++spriteDrawCount;
+
+	IDirect3DDevice9* pd3dDevice = DXUTGetD3D9Device();
+	
+	// the flush is often triggered by a state change, so put back the state the sprites were added with
+	const SpriteState currentState = GetSpriteState();
+	const bool restoreState = memcmp(&currentState, &spriteState, sizeof(currentState)) != 0;
+	if (restoreState)
+		SetSpriteState(spriteState);
+
+	SpriteVertex* lockedVerts;
+	if (SUCCEEDED(primitiveSprites.vb->Lock(0, 6*spriteQuadCount*sizeof(SpriteVertex), (VOID**)&lockedVerts, D3DLOCK_DISCARD)))
+	{
+		memcpy(lockedVerts, spriteVerts, 6*spriteQuadCount*sizeof(SpriteVertex));
+		primitiveSprites.vb->Unlock();
+
+		// vertices are already in world space and carry the material color
+		pd3dDevice->SetTransform(D3DTS_WORLD, &Matrix44::Identity().GetD3DXMatrix());
+		SetRenderState(D3DRS_AMBIENTMATERIALSOURCE, D3DMCS_COLOR1);
+		SetRenderState(D3DRS_DIFFUSEMATERIALSOURCE, D3DMCS_COLOR1);
+		SetTexture(0, spriteTexture);
+		pd3dDevice->SetStreamSource(0, primitiveSprites.vb, 0, primitiveSprites.stride);
+		pd3dDevice->SetFVF(primitiveSprites.fvf);
+		pd3dDevice->DrawPrimitive(primitiveSprites.primitiveType, 0, 2*spriteQuadCount);
+		SetRenderState(D3DRS_AMBIENTMATERIALSOURCE, D3DMCS_MATERIAL);
+		SetRenderState(D3DRS_DIFFUSEMATERIALSOURCE, D3DMCS_MATERIAL);
+	}
+
+	if (restoreState)
+		SetSpriteState(currentState);
+
+	spriteQuadCount = 0;
+}
+
+const FrankRender::SpriteState& FrankRender::GetSpriteState()
+{
+	// only read the state again after something was set
+	if (!spriteStateDirty)
+		return spriteCurrentState;
+
+	// use the state cache's copy when it has one, reading back from the device is slow
+	IDirect3DDevice9* pd3dDevice = DXUTGetD3D9Device();
+	SpriteState& state = spriteCurrentState;
+	for (int i = 0; i < spriteBlendStateCount; ++i)
+	{
+		const D3DRENDERSTATETYPE type = spriteBlendStates[i];
+		if (cachedRenderStateValid[type])
+			state.blendStates[i] = cachedRenderStates[type];
+		else
+			pd3dDevice->GetRenderState(type, &state.blendStates[i]);
+	}
+	for (int i = 0; i < spriteRenderStateCount; ++i)
+	{
+		const D3DRENDERSTATETYPE type = spriteRenderStates[i];
+		if (cachedRenderStateValid[type])
+			state.renderStates[i] = cachedRenderStates[type];
+		else
+			pd3dDevice->GetRenderState(type, &state.renderStates[i]);
+	}
+	for (int i = 0; i < spriteStageStateCount; ++i)
+	{
+		const D3DTEXTURESTAGESTATETYPE type = spriteStageStates[i];
+		if (cachedStageStateValid[0][type])
+			state.stageStates[i] = cachedStageStates[0][type];
+		else
+			pd3dDevice->GetTextureStageState(0, type, &state.stageStates[i]);
+	}
+
+	spriteStateDirty = false;
+	return state;
+}
+
+void FrankRender::SetSpriteState(const SpriteState& state)
+{
+	for (int i = 0; i < spriteBlendStateCount; ++i)
+		SetRenderState(spriteBlendStates[i], state.blendStates[i]);
+	for (int i = 0; i < spriteRenderStateCount; ++i)
+		SetRenderState(spriteRenderStates[i], state.renderStates[i]);
+	for (int i = 0; i < spriteStageStateCount; ++i)
+		SetTextureStageState(0, spriteStageStates[i], state.stageStates[i]);
+}
+
 inline void FrankRender::RenderInternal
 (
 	const Matrix44& matrix,
@@ -1481,6 +1780,7 @@ inline void FrankRender::RenderInternal
 	ASSERT(isInRenderBlock);
 	ASSERT(color.IsFinite());
 	ASSERT(ti < MAX_TEXTURE_COUNT);
+	++renderCallCount;
 	IDirect3DDevice9* pd3dDevice = DXUTGetD3D9Device();
 	LPDIRECT3DTEXTURE9 texture = textures[ti][TT_Diffuse].texture;
 
@@ -1512,7 +1812,7 @@ inline void FrankRender::RenderInternal
 		if (!textures[ti][TT_Normal].texture)
 		{
 			// if there is no normals just render z facing normals with texture's alpha
-			pd3dDevice->SetTextureStageState( 0, D3DTSS_COLOROP, D3DTOP_SELECTARG2 );
+			SetTextureStageState( 0, D3DTSS_COLOROP, D3DTOP_SELECTARG2 );
 
 			Render
 			(
@@ -1526,7 +1826,7 @@ inline void FrankRender::RenderInternal
 				rp.fvf
 			);
 
-			pd3dDevice->SetTextureStageState( 0, D3DTSS_COLOROP, D3DTOP_MODULATE );
+			SetTextureStageState( 0, D3DTSS_COLOROP, D3DTOP_MODULATE );
 			return;
 		}
 		
@@ -1574,7 +1874,7 @@ inline void FrankRender::RenderInternal
 		normalMapConstantTable->SetFloat(pd3dDevice, "diffuseNormalAlphaPercent", diffuseNormalAlphaPercent);
 
 		pd3dDevice->SetPixelShader(normalMapShader);
-		pd3dDevice->SetTexture(1, textures[ti][TT_Normal].texture);
+		SetTexture(1, textures[ti][TT_Normal].texture);
 
 		Render
 		(
@@ -1589,7 +1889,7 @@ inline void FrankRender::RenderInternal
 		);
 
 		pd3dDevice->SetPixelShader(NULL);
-		pd3dDevice->SetTexture(1, NULL);
+		SetTexture(1, NULL);
 		return;
 	}
 	else if (DeferredRender::GetRenderPassIsSpecular())
@@ -1616,9 +1916,9 @@ inline void FrankRender::RenderInternal
 		// if there is no specular map use black, otherwise just use alpha
 		const Color c = (!textures[ti][TT_Specular].texture && !isSpecularBlock)? Color(0.0f, 0.0f, 0.0f, color.a) : color;
 		
-		pd3dDevice->SetTexture(1, textures[ti][TT_Specular].texture);
-		pd3dDevice->SetTextureStageState( 1, D3DTSS_COLOROP, D3DTOP_SELECTARG1 );
-		pd3dDevice->SetTextureStageState( 1, D3DTSS_ALPHAOP, D3DTOP_MODULATE );
+		SetTexture(1, textures[ti][TT_Specular].texture);
+		SetTextureStageState( 1, D3DTSS_COLOROP, D3DTOP_SELECTARG1 );
+		SetTextureStageState( 1, D3DTSS_ALPHAOP, D3DTOP_MODULATE );
 
 		Render
 		(
@@ -1632,9 +1932,9 @@ inline void FrankRender::RenderInternal
 			rp.fvf
 		);
 
-		pd3dDevice->SetTexture(1, NULL);
-		pd3dDevice->SetTextureStageState( 1, D3DTSS_COLOROP, D3DTOP_DISABLE );
-		pd3dDevice->SetTextureStageState( 1, D3DTSS_ALPHAOP, D3DTOP_DISABLE );
+		SetTexture(1, NULL);
+		SetTextureStageState( 1, D3DTSS_COLOROP, D3DTOP_DISABLE );
+		SetTextureStageState( 1, D3DTSS_ALPHAOP, D3DTOP_DISABLE );
 		return;
 	}
 	else if (DeferredRender::GetRenderPassIsEmissive() && texture && textures[ti][TT_Emissive].texture)
@@ -1644,11 +1944,11 @@ inline void FrankRender::RenderInternal
 		if (oldAmbient != 0x00FFFFFF)
 		{
 			// hack: if we weren't using an emissive override, use the emissive texture if we have one
-			DXUTGetD3D9Device()->SetRenderState( D3DRS_AMBIENT, 0x00FFFFFF );
+			SetRenderState( D3DRS_AMBIENT, 0x00FFFFFF );
 		
-			pd3dDevice->SetTexture(1, textures[ti][TT_Emissive].texture);
-			pd3dDevice->SetTextureStageState( 1, D3DTSS_COLOROP,	D3DTOP_MODULATE );
-			pd3dDevice->SetTextureStageState( 1, D3DTSS_ALPHAOP,	D3DTOP_MODULATE );
+			SetTexture(1, textures[ti][TT_Emissive].texture);
+			SetTextureStageState( 1, D3DTSS_COLOROP,	D3DTOP_MODULATE );
+			SetTextureStageState( 1, D3DTSS_ALPHAOP,	D3DTOP_MODULATE );
 
 			Render
 			(
@@ -1662,10 +1962,10 @@ inline void FrankRender::RenderInternal
 				rp.fvf
 			);
 			
-			pd3dDevice->SetTexture(1, NULL);
-			DXUTGetD3D9Device()->SetRenderState( D3DRS_AMBIENT, oldAmbient );
-			pd3dDevice->SetTextureStageState( 1, D3DTSS_COLOROP, D3DTOP_DISABLE );
-			pd3dDevice->SetTextureStageState( 1, D3DTSS_ALPHAOP, D3DTOP_DISABLE );
+			SetTexture(1, NULL);
+			SetRenderState( D3DRS_AMBIENT, oldAmbient );
+			SetTextureStageState( 1, D3DTSS_COLOROP, D3DTOP_DISABLE );
+			SetTextureStageState( 1, D3DTSS_ALPHAOP, D3DTOP_DISABLE );
 			return;
 		}
 	}
@@ -1674,7 +1974,7 @@ inline void FrankRender::RenderInternal
 		// make it use the shadow color rather then the texture by default
 		Color shadowColor = DeferredRender::defaultShadowColor;
 		shadowColor.a *= color.a;
-		pd3dDevice->SetTextureStageState( 0, D3DTSS_COLOROP, D3DTOP_SELECTARG2 );
+		SetTextureStageState( 0, D3DTSS_COLOROP, D3DTOP_SELECTARG2 );
 		Render
 		(
 			matrix,
@@ -1686,7 +1986,7 @@ inline void FrankRender::RenderInternal
 			rp.stride,
 			rp.fvf
 		);
-		pd3dDevice->SetTextureStageState( 0, D3DTSS_COLOROP, D3DTOP_MODULATE );
+		SetTextureStageState( 0, D3DTSS_COLOROP, D3DTOP_MODULATE );
 		return;
 	}
 
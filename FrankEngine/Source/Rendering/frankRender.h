@@ -482,6 +482,61 @@ public: // tile rendering
 			ti
 		);
 	}
+
+public: // sprite batching
+
+	// quads rendered inside a sprite batch block are collected into one dynamic vertex buffer
+	// the batch is flushed when the texture or device state changes, when it fills up,
+	// or when anything else is drawn, so call sites do not need to change
+	struct SpriteBatchBlock
+	{
+		SpriteBatchBlock()	{ ++g_render->spriteBatchDepth; }
+		~SpriteBatchBlock()	{ if (--g_render->spriteBatchDepth == 0) g_render->FlushSprites(SpriteFlush_End); }
+	};
+
+	enum SpriteFlushReason
+	{
+		SpriteFlush_Texture,	// next sprite used a different texture
+		SpriteFlush_Blend,		// blend state changed
+		SpriteFlush_State,		// other render state changed
+		SpriteFlush_Full,		// vertex buffer filled up
+		SpriteFlush_Draw,		// something else was drawn
+		SpriteFlush_End,		// batch block ended
+		SpriteFlush_Count
+	};
+
+	// draw any batched sprites, must be called before changing device state that is not tracked by the batch
+	void FlushSprites(SpriteFlushReason reason = SpriteFlush_Draw);
+
+	void ResetSpriteStats() { spriteDrawCount = 0; spriteBatchedCount = 0; for (int &count : spriteFlushCounts) count = 0; }
+	int GetSpriteDrawCount() const { return spriteDrawCount; }
+	int GetSpriteBatchedCount() const { return spriteBatchedCount; }
+	int GetSpriteFlushCount(SpriteFlushReason reason) const { ASSERT(reason < SpriteFlush_Count); return spriteFlushCounts[reason]; }
+
+	// increases whenever anything is drawn or added to the simple verts, used to check if an object rendered immediately
+	UINT GetRenderCallCount() const { return renderCallCount; }
+
+	static bool spriteBatchEnable;	// toggles batching of quads rendered inside sprite batch blocks
+
+	///////////////////////////////////////////////////////
+	// render state cache
+
+	// device state setters that skip calls which would not change anything
+	// all engine state changes must go through these so the shadowed state stays correct
+	void SetRenderState(D3DRENDERSTATETYPE state, DWORD value);
+	void SetTextureStageState(DWORD stage, D3DTEXTURESTAGESTATETYPE type, DWORD value);
+	void SetTexture(DWORD stage, LPDIRECT3DTEXTURE9 texture);
+	void SetMaterial(const D3DMATERIAL9* material);
+
+	// forget the shadowed state, call after the device state is changed outside of the cache
+	void InvalidateStateCache();
+
+	void ResetStateStats() { stateSetsIssued = 0; stateSetsFiltered = 0; }
+	int GetStateSetsIssued() const { return stateSetsIssued; }
+	int GetStateSetsFiltered() const { return stateSetsFiltered; }
+
+	static bool stateCacheEnable;	// toggles filtering of redundant device state changes
+
 private:
 
 	struct TextureWrapper
@@ -596,8 +651,124 @@ private: // simple vert stuff
 	SimpleVertex simpleVertsTris[maxSimpleVerts];
 	int totalSimpleVertsRendered = 0;
 	bool simpleVertsAreAdditive = false;
+
+private: // sprite batch stuff
+
+	struct SpriteVertex
+	{
+		Vector3 position;
+		DWORD color;
+		float u, v;
+	};
+
+	// device state the batched sprites depend on, captured with the first sprite of a batch
+	struct SpriteState
+	{
+		DWORD blendStates[4];
+		DWORD renderStates[8];
+		DWORD stageStates[3];
+	};
+
+	bool CanBatchSprite(TextureID ti, const RenderPrimitive& rp, const Color& color) const;
+	void AddSprite(const Matrix44& matrix, const Color& color, TextureID ti, const Matrix44* matrixUV = NULL);
+	Matrix44 GetTileUVMatrix(const IntVector2& tilePos, const IntVector2& tileSize, const int tileRotation, const bool tileMirror) const;
+	const SpriteState& GetSpriteState();
+	void SetSpriteState(const SpriteState& state);
+
+	static const int maxSpriteQuads = 1000;
+	SpriteVertex spriteVerts[6*maxSpriteQuads];
+	RenderPrimitive primitiveSprites;
+	LPDIRECT3DTEXTURE9 spriteTexture = NULL;
+	SpriteState spriteState;
+	SpriteState spriteCurrentState;		// last state read, only read again when spriteStateDirty is set
+	bool spriteStateDirty = true;
+	int spriteQuadCount = 0;
+	int spriteBatchDepth = 0;
+	int spriteDrawCount = 0;
+	int spriteBatchedCount = 0;
+	int spriteFlushCounts[SpriteFlush_Count] = {};
+	UINT renderCallCount = 0;
+
+	static const int maxCachedRenderStates = 256;
+	static const int maxCachedTextureStages = 8;
+	static const int maxCachedStageStates = 33;
+	DWORD cachedRenderStates[maxCachedRenderStates];
+	bool cachedRenderStateValid[maxCachedRenderStates] = {};
+	DWORD cachedStageStates[maxCachedTextureStages][maxCachedStageStates];
+	bool cachedStageStateValid[maxCachedTextureStages][maxCachedStageStates] = {};
+	LPDIRECT3DTEXTURE9 cachedTextures[maxCachedTextureStages];
+	bool cachedTextureValid[maxCachedTextureStages] = {};
+	D3DMATERIAL9 cachedMaterial;
+	bool cachedMaterialValid = false;
+	int stateSetsIssued = 0;
+	int stateSetsFiltered = 0;
 };
 
+inline void FrankRender::SetRenderState(D3DRENDERSTATETYPE state, DWORD value)
+{
+	#ifndef FRANK_PLATFORM_WEB
+	ASSERT(state >= 0 && state < maxCachedRenderStates);
+	if (stateCacheEnable && cachedRenderStateValid[state] && cachedRenderStates[state] == value)
+	{
+		++stateSetsFiltered;
+		return;
+	}
+	cachedRenderStates[state] = value;
+	cachedRenderStateValid[state] = true;
+	++stateSetsIssued;
+	#endif
+	spriteStateDirty = true;
+	DXUTGetD3D9Device()->SetRenderState(state, value);
+}
+
+inline void FrankRender::SetTextureStageState(DWORD stage, D3DTEXTURESTAGESTATETYPE type, DWORD value)
+{
+	#ifndef FRANK_PLATFORM_WEB
+	ASSERT(stage < maxCachedTextureStages && type >= 0 && type < maxCachedStageStates);
+	if (stateCacheEnable && cachedStageStateValid[stage][type] && cachedStageStates[stage][type] == value)
+	{
+		++stateSetsFiltered;
+		return;
+	}
+	cachedStageStates[stage][type] = value;
+	cachedStageStateValid[stage][type] = true;
+	++stateSetsIssued;
+	#endif
+	spriteStateDirty = true;
+	DXUTGetD3D9Device()->SetTextureStageState(stage, type, value);
+}
+
+inline void FrankRender::SetTexture(DWORD stage, LPDIRECT3DTEXTURE9 texture)
+{
+	#ifndef FRANK_PLATFORM_WEB
+	ASSERT(stage < maxCachedTextureStages);
+	if (stateCacheEnable && cachedTextureValid[stage] && cachedTextures[stage] == texture)
+	{
+		++stateSetsFiltered;
+		return;
+	}
+	cachedTextures[stage] = texture;
+	cachedTextureValid[stage] = true;
+	++stateSetsIssued;
+	#endif
+	DXUTGetD3D9Device()->SetTexture(stage, texture);
+}
+
+inline void FrankRender::SetMaterial(const D3DMATERIAL9* material)
+{
+	#ifndef FRANK_PLATFORM_WEB
+	if (stateCacheEnable && cachedMaterialValid && memcmp(&cachedMaterial, material, sizeof(D3DMATERIAL9)) == 0)
+	{
+		++stateSetsFiltered;
+		return;
+	}
+	cachedMaterial = *material;
+	cachedMaterialValid = true;
+	++stateSetsIssued;
+	#endif
+	DXUTGetD3D9Device()->SetMaterial(material);
+}
+
 inline void FrankRender::Render
 (
 	const Matrix44& matrix,
@@ -610,6 +781,7 @@ inline void FrankRender::Render
 	DWORD fvf
 )
 {
+	++renderCallCount;
 	#ifdef FRANK_PLATFORM_WEB
 	// phase 5: draw through the GL backend (material-color path, current device state)
 	extern void FrankWebRenderRawPrimitive(const Matrix44& matrix, const Color& color, FrankWebTexture* texture,
@@ -624,6 +796,9 @@ inline void FrankRender::Render
 	if (color.a == 0)
 		return;	// skip if there is no alpha
 
+	// batched sprites must draw before anything rendered after them
+	FlushSprites();
+
 	IDirect3DDevice9* pd3dDevice = DXUTGetD3D9Device();
 
 	// set the world transform
@@ -637,10 +812,10 @@ inline void FrankRender::Render
 		{0, 0, 0, 0},
 		{0, 0, 0, 0}, 0
 	};
-	pd3dDevice->SetMaterial(&material);
+	SetMaterial(&material);
 
 	// set up the texture
-	pd3dDevice->SetTexture(0, texture);
+	SetTexture(0, texture);
 
 	// render the primitive
     pd3dDevice->SetStreamSource(0, vb, 0, stride);
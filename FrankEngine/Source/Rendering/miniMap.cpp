@@ -190,13 +190,13 @@ void MiniMap::RenderMiniMap()
 		textureMatrixD3D._31 = mPos.x;
 		textureMatrixD3D._32 = mPos.y;
 		pd3dDevice->SetTransform(D3DTS_TEXTURE1, &textureMatrixD3D);
-		pd3dDevice->SetTextureStageState( 1, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_COUNT2);
-		pd3dDevice->SetTextureStageState( 1, D3DTSS_COLOROP,	D3DTOP_MODULATE );
-		pd3dDevice->SetTextureStageState( 1, D3DTSS_COLORARG1,	D3DTA_TEXTURE );
-		pd3dDevice->SetTextureStageState( 1, D3DTSS_COLORARG2,	D3DTA_CURRENT );
-		pd3dDevice->SetTextureStageState( 1, D3DTSS_ALPHAOP,	D3DTOP_MODULATE );
-		pd3dDevice->SetTextureStageState( 1, D3DTSS_ALPHAARG1,	D3DTA_TEXTURE );
-		pd3dDevice->SetTextureStageState( 1, D3DTSS_ALPHAARG2,	D3DTA_CURRENT );
+		g_render->SetTextureStageState( 1, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_COUNT2);
+		g_render->SetTextureStageState( 1, D3DTSS_COLOROP,	D3DTOP_MODULATE );
+		g_render->SetTextureStageState( 1, D3DTSS_COLORARG1,	D3DTA_TEXTURE );
+		g_render->SetTextureStageState( 1, D3DTSS_COLORARG2,	D3DTA_CURRENT );
+		g_render->SetTextureStageState( 1, D3DTSS_ALPHAOP,	D3DTOP_MODULATE );
+		g_render->SetTextureStageState( 1, D3DTSS_ALPHAARG1,	D3DTA_TEXTURE );
+		g_render->SetTextureStageState( 1, D3DTSS_ALPHAARG2,	D3DTA_CURRENT );
 		pd3dDevice->SetSamplerState( 1, D3DSAMP_ADDRESSU,		D3DTADDRESS_BORDER );
 		pd3dDevice->SetSamplerState( 1, D3DSAMP_ADDRESSV,		D3DTADDRESS_BORDER );
 		pd3dDevice->SetSamplerState( 1, D3DSAMP_ADDRESSW,		D3DTADDRESS_BORDER );
@@ -206,21 +206,21 @@ void MiniMap::RenderMiniMap()
 		pd3dDevice->SetSamplerState( 0, D3DSAMP_MINFILTER,		D3DTEXF_POINT );
 		pd3dDevice->SetSamplerState( 0, D3DSAMP_MAGFILTER,		D3DTEXF_POINT );
 		pd3dDevice->SetSamplerState( 0, D3DSAMP_MIPFILTER,		D3DTEXF_NONE );
-		pd3dDevice->SetTexture(1, mapShowFull ? mapFullTexture : mapHiddenTexture);
+		g_render->SetTexture(1, mapShowFull ? mapFullTexture : mapHiddenTexture);
 	}
 
-	pd3dDevice->SetRenderState( D3DRS_SRCBLEND,				D3DBLEND_SRCALPHA);
-	pd3dDevice->SetRenderState( D3DRS_DESTBLEND,			D3DBLEND_ONE);
+	g_render->SetRenderState( D3DRS_SRCBLEND,				D3DBLEND_SRCALPHA);
+	g_render->SetRenderState( D3DRS_DESTBLEND,			D3DBLEND_ONE);
 	
 	RenderMapQuad(mapRenderSettings.worldCenter, Vector2(mapRenderSettings.worldZoom), Color::White(mapRenderSettings.alpha), GetMaskTexture());
 
 	// set stuff back to normal
-	pd3dDevice->SetTextureStageState( 1, D3DTSS_COLOROP,	D3DTOP_DISABLE );
-	pd3dDevice->SetTextureStageState( 1, D3DTSS_ALPHAOP,	D3DTOP_DISABLE );
-	pd3dDevice->SetTextureStageState( 1, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_DISABLE);
-	pd3dDevice->SetTexture(1, NULL);
-	pd3dDevice->SetRenderState( D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
-	pd3dDevice->SetRenderState( D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
+	g_render->SetTextureStageState( 1, D3DTSS_COLOROP,	D3DTOP_DISABLE );
+	g_render->SetTextureStageState( 1, D3DTSS_ALPHAOP,	D3DTOP_DISABLE );
+	g_render->SetTextureStageState( 1, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_DISABLE);
+	g_render->SetTexture(1, NULL);
+	g_render->SetRenderState( D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
+	g_render->SetRenderState( D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
 	pd3dDevice->SetSamplerState( 1, D3DSAMP_ADDRESSU,		D3DTADDRESS_WRAP );
 	pd3dDevice->SetSamplerState( 1, D3DSAMP_ADDRESSV,		D3DTADDRESS_WRAP );
 	pd3dDevice->SetSamplerState( 1, D3DSAMP_ADDRESSW,		D3DTADDRESS_WRAP );
@@ -231,8 +231,6 @@ void MiniMap::RenderMiniMap()
 void MiniMap::RenderLargeMap()
 {
 	{
-		IDirect3DDevice9* pd3dDevice = DXUTGetD3D9Device();
-	
 		// draw a border around the outside 
 		RenderMapQuad(XForm2(0), Vector2(mapRenderSettings.worldZoom * 1.05f), Color::Grey(mapRenderSettings.alpha*0.5f), Texture_Invalid, Color::Black(mapRenderSettings.alpha*0.5f));
 
@@ -377,7 +375,7 @@ void MiniMap::RenderWorldSpace(const XForm2& xf, const Vector2& size, const Colo
 		textureMatrix.GetD3DXMatrix()._32 = mPos.y;
 
 		pd3dDevice->SetTransform(D3DTS_TEXTURE0, &textureMatrix.GetD3DXMatrix());
-		pd3dDevice->SetTextureStageState( 0, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_COUNT2);
+		g_render->SetTextureStageState( 0, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_COUNT2);
 		pd3dDevice->SetSamplerState( 0, D3DSAMP_ADDRESSU,		D3DTADDRESS_BORDER );
 		pd3dDevice->SetSamplerState( 0, D3DSAMP_ADDRESSV,		D3DTADDRESS_BORDER );
 		pd3dDevice->SetSamplerState( 0, D3DSAMP_ADDRESSW,		D3DTADDRESS_BORDER );
@@ -386,7 +384,7 @@ void MiniMap::RenderWorldSpace(const XForm2& xf, const Vector2& size, const Colo
 	g_render->RenderQuad(xf, size, color, showFull ? mapFullTexture : mapHiddenTexture);
 
 	// set stuff back to normal
-	pd3dDevice->SetTextureStageState( 0, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_DISABLE);
+	g_render->SetTextureStageState( 0, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_DISABLE);
 	pd3dDevice->SetSamplerState( 0, D3DSAMP_ADDRESSU,		D3DTADDRESS_WRAP );
 	pd3dDevice->SetSamplerState( 0, D3DSAMP_ADDRESSV,		D3DTADDRESS_WRAP );
 	pd3dDevice->SetSamplerState( 0, D3DSAMP_ADDRESSW,		D3DTADDRESS_WRAP );
@@ -407,7 +405,7 @@ void MiniMap::RenderMapHiddenToTexture()
 #endif
 	MapRenderBlock mapRenderBlock(mapHiddenTexture);
 	
-	DXUTGetD3D9Device()->SetTextureStageState(0, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_DISABLE);
+	g_render->SetTextureStageState(0, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_DISABLE);
 	
 	// render the full texture down first
 	g_render->RenderQuad(XForm2(Vector2(-0.5f, 0.5f)), 0.5f*Vector2(Terrain::fullSize*Terrain::patchSize), Color::White(), mapFullTexture);
@@ -607,34 +605,34 @@ MiniMap::MapRenderBlock::MapRenderBlock(LPDIRECT3DTEXTURE9 texture, bool needsCl
 	pd3dDevice->SetTransform(D3DTS_VIEW, &viewMatrix);
 
 	// Set up the textures
-	pd3dDevice->SetTextureStageState( 0, D3DTSS_COLOROP,	D3DTOP_MODULATE );
-	pd3dDevice->SetTextureStageState( 0, D3DTSS_COLORARG1,	D3DTA_TEXTURE );
-	pd3dDevice->SetTextureStageState( 0, D3DTSS_COLORARG2,	D3DTA_DIFFUSE );
-	pd3dDevice->SetTextureStageState( 0, D3DTSS_ALPHAOP,	D3DTOP_MODULATE );
-	pd3dDevice->SetTextureStageState( 0, D3DTSS_ALPHAARG1,	D3DTA_TEXTURE );
-	pd3dDevice->SetTextureStageState( 0, D3DTSS_ALPHAARG2,	D3DTA_DIFFUSE );
+	g_render->SetTextureStageState( 0, D3DTSS_COLOROP,	D3DTOP_MODULATE );
+	g_render->SetTextureStageState( 0, D3DTSS_COLORARG1,	D3DTA_TEXTURE );
+	g_render->SetTextureStageState( 0, D3DTSS_COLORARG2,	D3DTA_DIFFUSE );
+	g_render->SetTextureStageState( 0, D3DTSS_ALPHAOP,	D3DTOP_MODULATE );
+	g_render->SetTextureStageState( 0, D3DTSS_ALPHAARG1,	D3DTA_TEXTURE );
+	g_render->SetTextureStageState( 0, D3DTSS_ALPHAARG2,	D3DTA_DIFFUSE );
 	pd3dDevice->SetSamplerState( 0, D3DSAMP_ADDRESSU,		D3DTADDRESS_WRAP );
 	pd3dDevice->SetSamplerState( 0, D3DSAMP_ADDRESSV,		D3DTADDRESS_WRAP );
 	pd3dDevice->SetSamplerState( 0, D3DSAMP_ADDRESSW,		D3DTADDRESS_WRAP );
 	pd3dDevice->SetSamplerState( 0, D3DSAMP_MINFILTER,		D3DTEXF_POINT );
 	pd3dDevice->SetSamplerState( 0, D3DSAMP_MAGFILTER,		D3DTEXF_POINT );
 	pd3dDevice->SetSamplerState( 0, D3DSAMP_MIPFILTER,		D3DTEXF_NONE );
-	pd3dDevice->SetRenderState( D3DRS_SRCBLEND,				D3DBLEND_SRCALPHA);
-	pd3dDevice->SetRenderState( D3DRS_DESTBLEND,			D3DBLEND_INVSRCALPHA);
+	g_render->SetRenderState( D3DRS_SRCBLEND,				D3DBLEND_SRCALPHA);
+	g_render->SetRenderState( D3DRS_DESTBLEND,			D3DBLEND_INVSRCALPHA);
 
 	// Set miscellaneous render states
-	pd3dDevice->SetRenderState( D3DRS_ALPHABLENDENABLE,		TRUE);
-	pd3dDevice->SetRenderState( D3DRS_ALPHATESTENABLE,		FALSE); 
-	pd3dDevice->SetRenderState( D3DRS_DITHERENABLE,			FALSE );
-	pd3dDevice->SetRenderState( D3DRS_SPECULARENABLE,		FALSE );
-	pd3dDevice->SetRenderState( D3DRS_ZENABLE,				FALSE);
-	pd3dDevice->SetRenderState( D3DRS_ZWRITEENABLE,			FALSE);
-	pd3dDevice->SetRenderState( D3DRS_LIGHTING,				TRUE);
-	pd3dDevice->SetRenderState( D3DRS_AMBIENT,				0x00FFFFFF);
-	pd3dDevice->SetRenderState( D3DRS_CULLMODE,				D3DCULL_NONE);
+	g_render->SetRenderState( D3DRS_ALPHABLENDENABLE,		TRUE);
+	g_render->SetRenderState( D3DRS_ALPHATESTENABLE,		FALSE); 
+	g_render->SetRenderState( D3DRS_DITHERENABLE,			FALSE );
+	g_render->SetRenderState( D3DRS_SPECULARENABLE,		FALSE );
+	g_render->SetRenderState( D3DRS_ZENABLE,				FALSE);
+	g_render->SetRenderState( D3DRS_ZWRITEENABLE,			FALSE);
+	g_render->SetRenderState( D3DRS_LIGHTING,				TRUE);
+	g_render->SetRenderState( D3DRS_AMBIENT,				0x00FFFFFF);
+	g_render->SetRenderState( D3DRS_CULLMODE,				D3DCULL_NONE);
 
 	// set up texture transforming
-	pd3dDevice->SetTextureStageState(0, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_COUNT2);
+	g_render->SetTextureStageState(0, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_COUNT2);
 }
 
 MiniMap::MapRenderBlock::~MapRenderBlock()
@@ -643,10 +641,10 @@ MiniMap::MapRenderBlock::~MapRenderBlock()
 		return;
 
 	IDirect3DDevice9* pd3dDevice = DXUTGetD3D9Device();
-	pd3dDevice->SetTextureStageState(0, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_DISABLE);
-	pd3dDevice->SetRenderState(D3DRS_ALPHABLENDENABLE, TRUE);
-	pd3dDevice->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
-	pd3dDevice->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
+	g_render->SetTextureStageState(0, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_DISABLE);
+	g_render->SetRenderState(D3DRS_ALPHABLENDENABLE, TRUE);
+	g_render->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
+	g_render->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
 
 	g_render->EndRender();
 
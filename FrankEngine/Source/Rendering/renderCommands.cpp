@@ -0,0 +1,307 @@
+////////////////////////////////////////////////////////////////////////////////////////
+/*
+	Frank Engine Render Commands
+	Copyright 2018 Frank Force - http://www.frankforce.com
+*/
+////////////////////////////////////////////////////////////////////////////////////////
+
+#include "frankEngine.h"
+#include "../rendering/renderCommands.h"
+
+////////////////////////////////////////////////////////////////////////////////////////
+/*
+	Render Command Globals
+*/
+////////////////////////////////////////////////////////////////////////////////////////
+
+RenderCommandBuffer g_renderCommands;
+
+bool RenderCommandBuffer::enable = true;
+ConsoleCommand(RenderCommandBuffer::enable, renderCommandEnable);
+
+bool RenderCommandBuffer::sortEnable = true;
+ConsoleCommand(RenderCommandBuffer::sortEnable, renderCommandSort);
+
+bool RenderCommandBuffer::replayEnable = true;
+ConsoleCommand(RenderCommandBuffer::replayEnable, renderCommandReplay);
+
+ConsoleFunction(renderCommandCapture)
+{
+	// grab the commands from the next execute and print a summary
+	g_renderCommands.captureNext = true;
+	GetDebugConsole().AddLine(L"Capturing render commands from next execute.");
+}
+
+ConsoleFunction(renderCommandStats)
+{
+	const vector<RenderCommand>& commands = g_renderCommands.capturedCommands;
+	if (commands.empty())
+	{
+		GetDebugConsole().AddLine(L"No render commands captured, use renderCommandCapture first.");
+		return;
+	}
+
+	set<TextureID> textures;
+	int additiveCount = 0;
+	for (const RenderCommand& command : commands)
+	{
+		textures.insert(command.ti);
+		if (command.flags & RenderCommand_Additive)
+			++additiveCount;
+	}
+
+	GetDebugConsole().AddFormatted(L"Captured %d render commands, %d textures, %d additive.", int(commands.size()), int(textures.size()), additiveCount);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+/*
+	Render Command Buffer Member Functions
+*/
+////////////////////////////////////////////////////////////////////////////////////////
+
+UINT64 RenderCommandBuffer::BuildSortKey(int renderGroup, BYTE flags, TextureID ti)
+{
+	// render group | blend flags | texture, the whole texture id is kept so different textures never share a key
+	// commands with the same key keep the order they were added in
+	const WORD group = WORD(Cap(renderGroup, -0x8000, 0x7FFF) + 0x8000);
+	return (UINT64(group) << 48) | (UINT64(flags) << 40) | UINT64(uint32_t(ti));
+}
+
+RenderCommand& RenderCommandBuffer::AddQuad(int renderGroup, const XForm2& xf, const Vector2& size, const Color& color, TextureID ti, BYTE flags)
+{
+	// camera and alpha are checked when the command executes because a recorded command is used by several passes
+	RenderCommand command;
+	command.sortKey = BuildSortKey(renderGroup, flags, ti);
+	command.xf = xf;
+	command.size = size;
+	command.color = color;
+	command.ti = ti;
+	command.flags = flags;
+	command.tilePos = ByteVector2(0);
+	command.tileSize = ByteVector2(0);
+	command.passMask = 0;
+	command.emissiveScale = 1;
+	command.shadowAlphaScale = 1;
+	command.shadowCaster = DeferredRender::GetShadowCasterId();
+	commands.push_back(command);
+	return commands.back();
+}
+
+RenderCommand& RenderCommandBuffer::AddTile(int renderGroup, const ByteVector2& tilePos, const ByteVector2& tileSize, const XForm2& xf, const Vector2& size, const Color& color, TextureID ti, BYTE flags)
+{
+	RenderCommand command;
+	command.sortKey = BuildSortKey(renderGroup, flags, ti);
+	command.xf = xf;
+	command.size = size;
+	command.color = color;
+	command.ti = ti;
+	command.flags = flags;
+	command.tilePos = tilePos;
+	command.tileSize = tileSize;
+	command.passMask = 0;
+	command.emissiveScale = 1;
+	command.shadowAlphaScale = 1;
+	command.shadowCaster = DeferredRender::GetShadowCasterId();
+	commands.push_back(command);
+	return commands.back();
+}
+
+void RenderCommandBuffer::Append(RenderCommandBuffer& other)
+{
+	commands.insert(commands.end(), other.commands.begin(), other.commands.end());
+	other.Clear();
+}
+
+int RenderCommandBuffer::CountTextureChanges(vector<RenderCommand>::const_iterator first, vector<RenderCommand>::const_iterator last)
+{
+	int changes = 0;
+	TextureID lastTexture = Texture_Invalid;
+	for (vector<RenderCommand>::const_iterator it = first; it != last; ++it)
+	{
+		if (it->ti != lastTexture)
+			++changes;
+		lastTexture = it->ti;
+	}
+	return changes;
+}
+
+void RenderCommandBuffer::Execute()
+{
+	if (commands.empty())
+		return;
+
+	textureChangesUnsorted += CountTextureChanges(commands.begin(), commands.end());
+	if (sortEnable)
+	{
+		// stable so commands with the same key keep the order they were added
+		stable_sort(commands.begin(), commands.end(), [](const RenderCommand& a, const RenderCommand& b) { return a.sortKey < b.sortKey; });
+	}
+
+	ExecuteCommands(commands.begin(), commands.end());
+	commands.clear();
+}
+
+void RenderCommandBuffer::Execute(int renderGroup)
+{
+	vector<FrameGroup>::iterator groupIt = frameGroups.begin();
+	for (; groupIt != frameGroups.end(); ++groupIt)
+	{
+		if (groupIt->renderGroup == renderGroup)
+			break;
+	}
+
+	if (groupIt == frameGroups.end() || groupIt->first == groupIt->last)
+	{
+		Execute();
+		return;
+	}
+
+	FrameGroup& group = *groupIt;
+	const vector<RenderCommand>::iterator first = frameCommands.begin() + group.first;
+	const vector<RenderCommand>::iterator last = frameCommands.begin() + group.last;
+	if (!group.sorted)
+	{
+		// recorded commands only need to be sorted once per frame
+		textureChangesUnsorted += CountTextureChanges(first, last);
+		if (sortEnable)
+			stable_sort(first, last, [](const RenderCommand& a, const RenderCommand& b) { return a.sortKey < b.sortKey; });
+		group.sorted = true;
+	}
+	replayedCount += group.last - group.first;
+
+	if (commands.empty())
+	{
+		ExecuteCommands(first, last);
+		return;
+	}
+
+	// combine with this pass's commands so they sort together
+	commands.insert(commands.end(), first, last);
+	Execute();
+}
+
+RenderCommandBuffer::FrameMode RenderCommandBuffer::BeginFrameRender(UINT frame)
+{
+	if (!replayEnable || !CanRecord())
+	{
+		frameCommands.clear();
+		frameGroups.clear();
+		recordedFrame = 0;
+		return FrameMode_Immediate;
+	}
+
+	if (frame == recordedFrame)
+		return FrameMode_Replay;
+
+	frameCommands.clear();
+	frameGroups.clear();
+	recordedFrame = frame;
+	return FrameMode_Record;
+}
+
+bool RenderCommandBuffer::KeepForReplay(int renderGroup, int firstCommand, bool renderedImmediately)
+{
+	ASSERT(firstCommand <= int(commands.size()));
+	if (renderedImmediately || firstCommand == int(commands.size()))
+		return false;
+
+	// objects that draw nothing may still draw in other passes, so only objects with commands for every pass are kept
+	for (vector<RenderCommand>::const_iterator it = commands.begin() + firstCommand; it != commands.end(); ++it)
+	{
+		if (!it->passMask)
+			return false;
+	}
+
+	if (frameGroups.empty() || frameGroups.back().renderGroup != renderGroup)
+	{
+		FrameGroup group = { renderGroup, int(frameCommands.size()), int(frameCommands.size()), false };
+		frameGroups.push_back(group);
+	}
+
+	frameCommands.insert(frameCommands.end(), commands.begin() + firstCommand, commands.end());
+	commands.erase(commands.begin() + firstCommand, commands.end());
+	frameGroups.back().last = int(frameCommands.size());
+	++recordedObjectCount;
+	return true;
+}
+
+void RenderCommandBuffer::ExecuteCommands(vector<RenderCommand>::const_iterator first, vector<RenderCommand>::const_iterator last)
+{
+	FrankProfilerEntryDefine(L"RenderCommandBuffer::Execute()", Color::White(), 5);
+
+	++executeCallCount;
+	executedCount += int(last - first);
+	textureChangesSorted += CountTextureChanges(first, last);
+
+	if (captureNext)
+	{
+		capturedCommands.assign(first, last);
+		captureNext = false;
+	}
+
+	// quads from the whole list can share sprite batches
+	FrankRender::SpriteBatchBlock spriteBatchBlock;
+
+	// render each run of commands that uses the same render blocks
+	vector<RenderCommand>::const_iterator runFirst = first;
+	for (vector<RenderCommand>::const_iterator it = first; it != last; ++it)
+	{
+		if (it->flags == runFirst->flags)
+			continue;
+
+		ExecuteRun(runFirst, it);
+		++flagChanges;
+		runFirst = it;
+	}
+	ExecuteRun(runFirst, last);
+}
+
+void RenderCommandBuffer::ExecuteRun(vector<RenderCommand>::const_iterator first, vector<RenderCommand>::const_iterator last)
+{
+	const BYTE flags = first->flags;
+	DeferredRender::BackgroundRenderBlock backgroundRenderBlock((flags & RenderCommand_Background) != 0);
+	DeferredRender::TransparentRenderBlock transparentRenderBlock((flags & RenderCommand_Transparent) != 0);
+	DeferredRender::SpecularRenderBlock specularRenderBlock((flags & RenderCommand_Specular) != 0);
+	DeferredRender::EmissiveRenderBlock emissiveRenderBlock((flags & RenderCommand_Emissive) != 0);
+	DeferredRender::AdditiveRenderBlock additiveRenderBlock((flags & RenderCommand_Additive) != 0);
+
+	const BYTE passBit = RenderCommand::GetPassBit(DeferredRender::GetRenderPass());
+	const bool isEmissivePass = DeferredRender::GetRenderPassIsEmissive();
+	const bool isShadowPass = DeferredRender::GetRenderPassIsShadow();
+	const bool isGatheringShadowCasters = DeferredRender::IsGatheringShadowCasters();
+	for (vector<RenderCommand>::const_iterator it = first; it != last; ++it)
+	{
+		const RenderCommand& command = *it;
+		if (command.passMask && !(command.passMask & passBit))
+			continue;
+
+		UINT64 shadowCasterKey = 0;
+		if (isGatheringShadowCasters)
+		{
+			// let cached lights notice casters that change without moving
+			UINT64 key = FrankUtil::HashData(&command.xf, sizeof(command.xf));
+			key = FrankUtil::HashData(&command.size, sizeof(command.size), key);
+			key = FrankUtil::HashData(&command.color, sizeof(command.color), key);
+			key = FrankUtil::HashData(&command.ti, sizeof(command.ti), key);
+			key = FrankUtil::HashData(&command.tilePos, sizeof(command.tilePos), key);
+			key = FrankUtil::HashData(&command.shadowAlphaScale, sizeof(command.shadowAlphaScale), key);
+			shadowCasterKey = key;
+		}
+		if (isShadowPass)
+			DeferredRender::BeginShadowCaster(shadowCasterKey, command.shadowCaster);
+
+		Color color = command.color;
+		if (isEmissivePass)
+			color *= command.emissiveScale;
+		if (isShadowPass)
+			color.a *= command.shadowAlphaScale;
+
+		if (command.tileSize.x > 0 && command.tileSize.y > 0)
+			g_render->RenderTile(command.tilePos, command.tileSize, command.xf, command.size, color, command.ti);
+		else
+			g_render->RenderQuad(command.xf, command.size, color, command.ti);
+	}
+
+	if (isShadowPass)
+		DeferredRender::EndShadowCaster();
+}
@@ -0,0 +1,128 @@
+////////////////////////////////////////////////////////////////////////////////////////
+/*
+	Frank Engine Render Commands
+	Copyright 2018 Frank Force - http://www.frankforce.com
+
+	- objects can emit quads as compact commands instead of drawing them immediately
+	- commands are sorted by render group, blend and texture then executed together
+	- commands are plain data so they can be recorded into separate buffers and appended
+	- objects that only emit commands with a pass mask are recorded once per frame and replayed in each pass
+*/
+////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+extern class RenderCommandBuffer g_renderCommands;
+
+// render blocks a command is drawn with, the order here is the blend order in the sort key
+enum RenderCommandFlags
+{
+	RenderCommand_Background	= (1 << 0),
+	RenderCommand_Transparent	= (1 << 1),
+	RenderCommand_Specular		= (1 << 2),
+	RenderCommand_Emissive		= (1 << 3),
+	RenderCommand_Additive		= (1 << 4),
+};
+
+struct RenderCommand
+{
+	UINT64 sortKey;
+	XForm2 xf;
+	Vector2 size;
+	Color color;
+	TextureID ti;
+	BYTE flags;
+	ByteVector2 tilePos;
+	ByteVector2 tileSize;	// zero if not rendering a tile
+	BYTE passMask;			// passes the command is replayed in, zero if it is only for the current pass
+	float emissiveScale;	// color scale applied in the emissive pass
+	float shadowAlphaScale;	// alpha scale applied in shadow passes
+	UINT shadowCaster;		// id of the caster that recorded it, so lights count each caster once
+
+	static const BYTE passMaskAll = 0xFF;
+	static BYTE GetPassBit(DeferredRender::RenderPass pass) { return BYTE(1 << pass); }
+};
+
+class RenderCommandBuffer
+{
+public:
+
+	// commands can only be added inside a record block, otherwise objects should draw immediately
+	struct RecordBlock
+	{
+		RecordBlock()	{ ++g_renderCommands.recordDepth; }
+		~RecordBlock()	{ if (--g_renderCommands.recordDepth == 0) g_renderCommands.Execute(); }
+	};
+
+	bool CanRecord() const { return enable && recordDepth > 0; }
+
+	// returns the new command so callers can set the pass info, the reference is only valid until the next add
+	RenderCommand& AddQuad(int renderGroup, const XForm2& xf, const Vector2& size, const Color& color, TextureID ti, BYTE flags = 0);
+	RenderCommand& AddTile(int renderGroup, const ByteVector2& tilePos, const ByteVector2& tileSize, const XForm2& xf, const Vector2& size, const Color& color, TextureID ti, BYTE flags = 0);
+
+	// move another buffer's commands into this one, used to combine buffers recorded separately
+	void Append(RenderCommandBuffer& other);
+
+	// sort and render all commands then clear the buffer
+	void Execute();
+	void Clear() { commands.clear(); }
+	int GetCommandCount() const { return int(commands.size()); }
+
+	// the first object render of each frame records, later passes in the same frame replay
+	enum FrameMode
+	{
+		FrameMode_Immediate,	// frame replay is off, render every object
+		FrameMode_Record,		// render every object and keep replayable commands
+		FrameMode_Replay,		// skip replayable objects, their commands are executed with their render group
+	};
+	FrameMode BeginFrameRender(UINT frame);
+
+	// call after an object renders while recording, moves its commands into the frame list if they work for every pass
+	// returns true if the object can be skipped for the rest of the frame
+	bool KeepForReplay(int renderGroup, int firstCommand, bool renderedImmediately);
+
+	// execute commands along with the recorded frame commands for a render group
+	void Execute(int renderGroup);
+
+	void ResetStats() { executedCount = 0; executeCallCount = 0; textureChangesUnsorted = 0; textureChangesSorted = 0; flagChanges = 0; recordedObjectCount = 0; replayedObjectCount = 0; replayedCount = 0; }
+
+	static bool enable;				// lets objects emit render commands rather then draw immediately
+	static bool sortEnable;			// sort commands before executing them
+	static bool replayEnable;		// record objects once per frame and replay their commands in later passes
+
+	// per frame stats
+	int executedCount = 0;
+	int executeCallCount = 0;
+	int textureChangesUnsorted = 0;
+	int textureChangesSorted = 0;
+	int flagChanges = 0;
+	int recordedObjectCount = 0;
+	int replayedObjectCount = 0;
+	int replayedCount = 0;
+
+	// copy of the commands from the next execute, for profiling
+	bool captureNext = false;
+	vector<RenderCommand> capturedCommands;
+
+private:
+
+	static UINT64 BuildSortKey(int renderGroup, BYTE flags, TextureID ti);
+	static int CountTextureChanges(vector<RenderCommand>::const_iterator first, vector<RenderCommand>::const_iterator last);
+	static void ExecuteRun(vector<RenderCommand>::const_iterator first, vector<RenderCommand>::const_iterator last);
+	void ExecuteCommands(vector<RenderCommand>::const_iterator first, vector<RenderCommand>::const_iterator last);
+
+	vector<RenderCommand> commands;
+	int recordDepth = 0;
+
+	// commands recorded this frame, stored in contiguous runs per render group
+	struct FrameGroup
+	{
+		int renderGroup;
+		int first;
+		int last;
+		bool sorted;
+	};
+	vector<RenderCommand> frameCommands;
+	vector<FrameGroup> frameGroups;
+	UINT recordedFrame = 0;
+};
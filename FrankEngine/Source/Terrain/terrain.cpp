@@ -10,11 +10,12 @@
 #include "../terrain/terrain.h"
 #include "../editor/objectEditor.h"
 #include <fstream>
+#include <chrono>
 
 ////////////////////////////////////////////////////////////////////////////////////////
 
 // terrain settings
-int Terrain::dataVersion				= 12;
+int Terrain::dataVersion				= 13;
 IntVector2 Terrain::fullSize			= IntVector2(20);	// how many patches per terrain
 int Terrain::patchSize					= 16;				// how many tiles per patch
 int Terrain::patchLayers				= 2;				// how many layers per patch
@@ -48,6 +49,10 @@ bool Terrain::enableStreaming = true;
 bool Terrain::streamDebug = false;
 ConsoleCommandSimple(bool, terrainDebug, false);
 
+// spread stub object creation across frames when patches stream in
+float Terrain::spawnTimeBudget = 2;
+ConsoleCommand(Terrain::spawnTimeBudget, spawnTimeBudget);
+
 // set the handle to a large enough value to cover any objects we might create on startup
 static const GameObjectHandle firstStartHandle = 10000; 
 
@@ -111,6 +116,8 @@ Terrain::Terrain(const Vector2& pos) :
 
 Terrain::~Terrain()
 {
+	WaitForSave();
+
 	for(int x=0; x<fullSize.x; ++x)
 	for(int y=0; y<fullSize.y; ++y)
 		delete GetPatch(x,y);
@@ -189,6 +196,23 @@ void Terrain::UpdateActiveWindow()
 		}
 	}
 
+	if (!saveGameDeltas.empty())
+	{
+		// apply save game changes before patches become visible or active
+		if (enableStreaming)
+		{
+			const int w = Max(windowSize, renderWindowSize);
+			for(int i=streamWindowPatch.x-w; i<=streamWindowPatch.x+w; ++i)
+			for(int j=streamWindowPatch.y-w; j<=streamWindowPatch.y+w; ++j)
+			{
+				if (IsPatchIndexValid(IntVector2(i,j)))
+					ApplySaveGameDelta(i + fullSize.x*j);
+			}
+		}
+		else
+			ApplySaveGameDeltas();
+	}
+
 	if (enableStreaming)
 	{
 		// make physics in the current window active
@@ -218,7 +242,10 @@ void Terrain::UpdateActiveWindow()
 		}
 	}
 
-	UpdateStreaming();
+	// everything must be spawned right away on reset so the world starts complete
+	UpdateSpawnQueue(wasReset || !enableStreaming);
+
+	UpdateStreaming(windowMoved, IntVector2(x2, y2), w2);
 	wasReset = false;
 }
 
@@ -241,6 +268,74 @@ void Terrain::OnWorldReset()
 	// make UpdateActiveWindow() take its reset path (Load() normally does this, but it is only
 	// called on reset when autoSaveTerrain is set)
 	wasReset = true;
+	ClearSpawnQueue();
+}
+
+void Terrain::QueueStubSpawn(TerrainPatch& patch, const GameObjectStub& stub)
+{
+	// the window can move several times before a stub spawns
+	if (!spawnQueueHandles.insert(stub.handle).second)
+		return;
+
+	SpawnRequest request;
+	request.patch = &patch;
+	request.handle = stub.handle;
+	request.position = stub.xf.position;
+	request.distanceSquared = 0;
+	spawnQueue.push_back(request);
+}
+
+void Terrain::UpdateSpawnQueue(bool spawnAll)
+{
+	if (spawnQueue.empty())
+		return;
+
+	FrankProfilerEntryDefine(L"Terrain::UpdateSpawnQueue()", Color::White(), 6);
+
+	// closest objects are most likely to matter for gameplay so they spawn first
+	const Vector2 streamCenter = g_gameControlBase->GetStreamCenter();
+	for (vector<SpawnRequest>::iterator it = spawnQueue.begin(); it != spawnQueue.end(); ++it)
+		it->distanceSquared = (it->position - streamCenter).LengthSquared();
+	sort(spawnQueue.begin(), spawnQueue.end(), SpawnRequest::SortCompare);
+
+	const chrono::steady_clock::time_point startTime = chrono::steady_clock::now();
+	const double timeBudget = spawnTimeBudget;
+	bool firstSpawn = true;
+	while (!spawnQueue.empty())
+	{
+		// always spawn at least one object per update so the queue can't stall
+		if (!spawnAll && !firstSpawn && timeBudget > 0 && chrono::duration<double, milli>(chrono::steady_clock::now() - startTime).count() > timeBudget)
+			break;
+		firstSpawn = false;
+
+		const SpawnRequest request = spawnQueue.back();
+		spawnQueue.pop_back();
+		spawnQueueHandles.erase(request.handle);
+
+		// patch may have streamed out or stub may have been removed since it was queued
+		TerrainPatch& patch = *request.patch;
+		if (!patch.HasActiveObjects())
+			continue;
+		if (g_objectManager.GetObjectFromHandle(request.handle))
+			continue;
+		GameObjectStub* stub = patch.GetStub(request.handle);
+		if (!stub)
+			continue;
+
+		const ObjectTypeInfo& objectInfo = stub->GetObjectInfo();
+		if (objectInfo.IsSerializable())
+		{
+			// only load seralizable if fully in the stream window
+			if (enableStreaming && !streamWindow.FullyContains(stub->GetAABB()))
+				continue;
+
+			// seralizeable objects are removed as they are spawned
+			stub->BuildObject();
+			patch.RemoveStub(stub);
+		}
+		else
+			stub->BuildObject();
+	}
 }
 
 void Terrain::UpdatePost()
@@ -258,13 +353,14 @@ void Terrain::UpdatePost()
 		if (patch->needsPhysicsRebuild)
 		{
 			g_terrainRender.RefereshCached(*patch);
+			DeferredRender::InvalidateLightCache(patch->GetAABB());
 			patch->SetActivePhysics(false);
 			patch->SetActivePhysics(true);
 		}
 	}
 }
 
-void Terrain::UpdateStreaming()
+void Terrain::UpdateStreaming(bool windowMoved, const IntVector2& lastWindowPatch, int lastWindowSize)
 {
 	if (!enableStreaming)
 		return;
@@ -272,11 +368,35 @@ void Terrain::UpdateStreaming()
 	if (streamDebug)
 		streamWindow.RenderDebug();
 
-	// for all world objects
-	const GameObjectHashTable& objects = g_objectManager.GetObjects();
-	for (GameObjectHashTable::const_iterator it = objects.begin(); it != objects.end(); ++it)
+	if (wasReset)
 	{
-		GameObject* gameObject = it->second;
+		// check everything and clear out stale entries in the index
+		for(int i=0; i<fullSize.x; ++i)
+		for(int j=0; j<fullSize.y; ++j)
+			QueueStreamCheck(GetPatch(i,j)->streamObjects);
+		QueueStreamCheck(outsideStreamObjects);
+	}
+	else if (windowMoved)
+	{
+		// only objects in the last window could have been moved out of it
+		for(int i=lastWindowPatch.x-lastWindowSize; i<=lastWindowPatch.x+lastWindowSize; ++i)
+		for(int j=lastWindowPatch.y-lastWindowSize; j<=lastWindowPatch.y+lastWindowSize; ++j)
+		{
+			TerrainPatch* patch = GetPatch(i,j);
+			if (patch)
+				QueueStreamCheck(patch->streamObjects);
+		}
+		QueueStreamCheck(outsideStreamObjects);
+	}
+
+	// only objects that changed patches or moved near the window edge need to be checked
+	for (vector<GameObjectHandle>::iterator it = streamCheckList.begin(); it != streamCheckList.end(); ++it)
+	{
+		GameObject* gameObject = g_objectManager.GetObjectFromHandle(*it);
+		if (!gameObject)
+			continue;
+
+		gameObject->SetFlag(GameObject::ObjectFlag_StreamCheck, false);
 
 		if (gameObject->HasParent())
 			continue;	// only stream out top level objects
@@ -295,6 +415,10 @@ void Terrain::UpdateStreaming()
 			TerrainPatch* patch = GetPatch(gameObject->GetPosWorld());
 			if (patch)
 			{
+				// the patch must be up to date with the save game before the stub goes into it
+				const IntVector2 patchIndex = GetPatchIndex(gameObject->GetPosWorld());
+				ApplySaveGameDelta(patchIndex.x + fullSize.x*patchIndex.y);
+
 				const GameObjectStub stub = gameObject->Serialize();
 				patch->AddStub(stub);
 			}
@@ -302,6 +426,90 @@ void Terrain::UpdateStreaming()
 
 		gameObject->StreamOut();
 	}
+	streamCheckList.clear();
+}
+
+void Terrain::UpdateStreamIndex(GameObject& object)
+{
+	if (!enableStreaming || &object == this)
+		return;
+
+	const IntVector2 patchIndex = GetPatchIndex(object.GetPosWorld());
+	if (object.GetFlag(GameObject::ObjectFlag_StreamIndexed) && patchIndex == object.streamPatchIndex)
+	{
+		// objects can only leave the window without changing patches if they move near the edge
+		// note: this assumes objects are smaller then a patch
+		if (object.GetXFWorld() == object.GetXFWorldLast() || !IsStreamWindowEdge(patchIndex))
+			return;
+	}
+	else
+	{
+		// move the entry from the old patch to the new one
+		RemoveStreamIndex(object);
+		vector<GameObjectHandle>& streamObjects = GetStreamObjects(patchIndex);
+		object.SetFlag(GameObject::ObjectFlag_StreamIndexed, true);
+		object.streamPatchIndex = patchIndex;
+		object.streamSlot = int(streamObjects.size());
+		streamObjects.push_back(object.GetHandle());
+	}
+
+	QueueStreamCheck(object);
+}
+
+void Terrain::RemoveStreamIndex(GameObject& object)
+{
+	if (!object.GetFlag(GameObject::ObjectFlag_StreamIndexed))
+		return;
+
+	object.SetFlag(GameObject::ObjectFlag_StreamIndexed, false);
+	vector<GameObjectHandle>& streamObjects = GetStreamObjects(object.streamPatchIndex);
+	const int slot = object.streamSlot;
+	ASSERT(slot < int(streamObjects.size()) && streamObjects[slot] == object.GetHandle());
+	if (slot >= int(streamObjects.size()) || streamObjects[slot] != object.GetHandle())
+		return;
+
+	// move the last entry into the empty slot
+	streamObjects[slot] = streamObjects.back();
+	streamObjects.pop_back();
+	if (slot < int(streamObjects.size()))
+	{
+		GameObject* movedObject = g_objectManager.GetObjectFromHandle(streamObjects[slot]);
+		ASSERT(movedObject);
+		if (movedObject)
+			movedObject->streamSlot = slot;
+	}
+}
+
+vector<GameObjectHandle>& Terrain::GetStreamObjects(const IntVector2& patchIndex)
+{
+	TerrainPatch* patch = GetPatch(patchIndex.x, patchIndex.y);
+	return patch? patch->streamObjects : outsideStreamObjects;
+}
+
+void Terrain::QueueStreamCheck(GameObject& object)
+{
+	if (object.GetFlag(GameObject::ObjectFlag_StreamCheck))
+		return;
+
+	object.SetFlag(GameObject::ObjectFlag_StreamCheck, true);
+	streamCheckList.push_back(object.GetHandle());
+}
+
+void Terrain::QueueStreamCheck(const vector<GameObjectHandle>& streamObjects)
+{
+	// objects leave the index when they change patches or are deleted so every entry is live
+	for (vector<GameObjectHandle>::const_iterator it = streamObjects.begin(); it != streamObjects.end(); ++it)
+	{
+		GameObject* object = g_objectManager.GetObjectFromHandle(*it);
+		ASSERT(object);
+		if (object)
+			QueueStreamCheck(*object);
+	}
+}
+
+bool Terrain::IsStreamWindowEdge(const IntVector2& patchIndex) const
+{
+	return abs(patchIndex.x - streamWindowPatch.x) >= windowSize || abs(patchIndex.y - streamWindowPatch.y) >= windowSize;
 }
 
 /*
@@ -358,77 +566,245 @@ void Terrain::Convert()
 	outTerrainFile.close();
 }*/
 
+static void WriteSaveData(vector<char>& data, const void* source, size_t size)
+{
+	data.insert(data.end(), (const char*)source, (const char*)source + size);
+}
+
+static void WriteSaveDataStub(vector<char>& data, const GameObjectStub& stub)
+{
+	WriteSaveData(data, &stub.type,		sizeof(stub.type));
+	WriteSaveData(data, &stub.xf,		sizeof(stub.xf));
+	WriteSaveData(data, &stub.size,		sizeof(stub.size));
+	WriteSaveData(data, &stub.handle,	sizeof(stub.handle));
+
+	int attributesLength = strlen(stub.attributes) + 1;
+	WriteSaveData(data, &attributesLength, sizeof(attributesLength));
+	WriteSaveData(data, stub.attributes, attributesLength);
+}
+
+void TerrainPatch::SaveData(vector<char>& data) const
+{
+	// fast write out the tile data
+	WriteSaveData(data, tiles, sizeof(TerrainTile) * Terrain::patchSize * Terrain::patchSize * Terrain::patchLayers);
+
+	// save out the object stubs
+	unsigned int stubCount = objectStubs.size();
+	WriteSaveData(data, &stubCount, sizeof(stubCount));
+	for (list<GameObjectStub>::const_iterator it = objectStubs.begin(); it != objectStubs.end(); ++it) 
+		WriteSaveDataStub(data, *it);
+}
+
 bool Terrain::Save(const WCHAR* filename)
 {
-	ofstream outTerrainFile(FRANK_FILENAME(filename), ios::out | ios::binary);
-	if (outTerrainFile.fail())
-		return false;
+	// only one save can be in flight at a time
+	WaitForSave();
+
+	// patches that have not streamed in yet still need their save game changes
+	ApplySaveGameDeltas();
+
+	SaveJob& job = saveJob;
+	job = SaveJob();
+	job.filename = filename;
 
 	// write out the data version
 	const char version = (char)(dataVersion);
-	outTerrainFile.write(&version, 1);
+	WriteSaveData(job.header, &version, 1);
 
 	// save player position
 	playerEditorStartPos = g_gameControlBase->GetPlayer()? g_gameControlBase->GetPlayer()->GetPosWorld() : Vector2(0);
-	outTerrainFile.write((const char *)&playerEditorStartPos.x,	sizeof(float));
-	outTerrainFile.write((const char *)&playerEditorStartPos.y,	sizeof(float));
+	WriteSaveData(job.header, &playerEditorStartPos.x, sizeof(float));
+	WriteSaveData(job.header, &playerEditorStartPos.y, sizeof(float));
 	
-	outTerrainFile.write((const char *)&fullSize.x, sizeof(fullSize.x));
-	outTerrainFile.write((const char *)&fullSize.y, sizeof(fullSize.y));
-	outTerrainFile.write((const char *)&patchSize, sizeof(patchSize));
-	outTerrainFile.write((const char *)&patchLayers, sizeof(patchLayers));
+	WriteSaveData(job.header, &fullSize.x, sizeof(fullSize.x));
+	WriteSaveData(job.header, &fullSize.y, sizeof(fullSize.y));
+	WriteSaveData(job.header, &patchSize, sizeof(patchSize));
+	WriteSaveData(job.header, &patchLayers, sizeof(patchLayers));
 
 	// save the next handle
-	outTerrainFile.write((const char *)&startHandle, sizeof(startHandle));
+	WriteSaveData(job.header, &startHandle, sizeof(startHandle));
 
-	for(int x=0; x<fullSize.x; ++x)
-	for(int y=0; y<fullSize.y; ++y)
+	const UINT patchCount = fullSize.x * fullSize.y;
+	SaveFile& saveFile = saveFiles[filename];
+	if (saveFile.patchHash.size() != patchCount)
 	{
-		const TerrainPatch& patch = *GetPatch(x,y);
-		
-		// fast write out the tile data
-		outTerrainFile.write((const char *)patch.tiles, sizeof(TerrainTile) * patchSize * patchSize * patchLayers);
+		saveFile.patchHash.assign(patchCount, 0);
+		saveFile.patchRevision.assign(patchCount, 0);
+		saveFile.patchOffset.assign(patchCount, 0);
+		saveFile.patchDataSize.assign(patchCount, 0);
+		saveFile.isValid = false;
+	}
+	saveFile.playerEditorStartPos = playerEditorStartPos;
+	saveFile.startHandle = startHandle;
 
-		// separate write out the tile data
-		/*for(int l=0; l<patchLayers; ++l)
-		for(int j=0; j<patchSize; ++j)
-		for(int k=0; k<patchSize; ++k)
-		{
-			const TerrainTile& tile = patch.GetTileLocal(j, k, l);
+	// snapshot patches that changed since the last time this file was saved
+	// only patches marked dirty are hashed, the hash catches changes that were undone
+	vector<char> data;
+	for(UINT i = 0; i < patchCount; ++i)
+	{
+		const UINT revision = patches[i]->GetSaveRevision();
+		if (saveFile.isValid && revision == saveFile.patchRevision[i])
+			continue;
 
-			outTerrainFile << tile.GetEdgeData();
-			outTerrainFile << tile.GetSurfaceData(0);
-			outTerrainFile << tile.GetSurfaceData(1);
-			outTerrainFile << tile.GetTileSet();
-		}*/
+		data.clear();
+		patches[i]->SaveData(data);
+		const UINT64 hash = FrankUtil::HashData(&data[0], data.size());
+		saveFile.patchRevision[i] = revision;
+		if (saveFile.isValid && hash == saveFile.patchHash[i])
+			continue;
 
-		// save out the object stubs
-		unsigned int stubCount = patch.objectStubs.size();
-		outTerrainFile.write((const char *)&stubCount, sizeof(stubCount));
-		for (list<GameObjectStub>::const_iterator it = patch.objectStubs.begin(); it != patch.objectStubs.end(); ++it) 
-		{       
-			const GameObjectStub& stub = *it;
+		saveFile.patchHash[i] = hash;
+		job.dirtyPatches.push_back(i);
+		job.dirtyPatchData.push_back(data);
+	}
+	job.saveFile = &saveFile;
+
+#ifdef FRANK_PLATFORM_WEB
+	// no threads on web, just write it out now
+	WriteSaveJob(job);
+	const bool succeeded = job.succeeded;
+	FinishSave();
+	return succeeded;
+#else
+	// the file is written on another thread so the editor doesn't stall
+	saveThreadDone = false;
+	saveThread = thread([this]() { WriteSaveJob(saveJob); saveThreadDone = true; });
+	return true;
+#endif
+}
 
-			outTerrainFile.write((const char *)&stub.type,		sizeof(stub.type));
-			outTerrainFile.write((const char *)&stub.xf,		sizeof(stub.xf));
-			outTerrainFile.write((const char *)&stub.size,		sizeof(stub.size));
-			outTerrainFile.write((const char *)&stub.handle,	sizeof(stub.handle));
+void Terrain::UpdateSave()
+{
+#ifndef FRANK_PLATFORM_WEB
+	// clean up when the save thread is done
+	if (saveThread.joinable() && saveThreadDone)
+	{
+		saveThread.join();
+		FinishSave();
+	}
+#endif
+}
 
-			int attributesLength = strlen(stub.attributes) + 1;
-			outTerrainFile.write((const char *)&attributesLength, sizeof(attributesLength));
-			outTerrainFile.write((const char *)&stub.attributes, attributesLength);
+void Terrain::WaitForSave()
+{
+#ifndef FRANK_PLATFORM_WEB
+	if (saveThread.joinable())
+	{
+		saveThread.join();
+		FinishSave();
+	}
+#endif
+}
+
+void Terrain::FinishSave()
+{
+	if (!saveJob.succeeded)
+		g_debugMessageSystem.AddError(L"Terrain save error: '%s'", saveJob.filename.c_str());
+
+	// release the snapshot
+	saveJob = SaveJob();
+}
+
+static void WriteSaveIndex(ostream& file, const vector<UINT>& patchOffset, const vector<UINT>& patchDataSize)
+{
+	for(UINT i = 0; i < patchOffset.size(); ++i)
+	{
+		file.write((const char *)&patchOffset[i], sizeof(UINT));
+		file.write((const char *)&patchDataSize[i], sizeof(UINT));
+	}
+}
+
+void Terrain::WriteSaveJob(SaveJob& job)
+{
+	// note: this is called from the save thread, it must only touch the job
+	SaveFile& saveFile = *job.saveFile;
+	job.succeeded = WriteSaveFile(job);
+	saveFile.isValid = job.succeeded;
+}
+
+bool Terrain::WriteSaveFile(SaveJob& job)
+{
+	SaveFile& saveFile = *job.saveFile;
+	const UINT patchCount = saveFile.patchHash.size();
+
+	// gather all the patch data, unchanged patches are read from the old file
+	vector< vector<char> > patchData(patchCount);
+	for(UINT j = 0; j < job.dirtyPatches.size(); ++j)
+		patchData[job.dirtyPatches[j]].swap(job.dirtyPatchData[j]);
+	if (job.dirtyPatches.size() < patchCount)
+	{
+		ifstream oldFile(FRANK_FILENAME(job.filename.c_str()), ios::in | ios::binary);
+		for(UINT i = 0; i < patchCount && !oldFile.fail(); ++i)
+		{
+			if (!patchData[i].empty())
+				continue;
+
+			patchData[i].resize(saveFile.patchDataSize[i]);
+			oldFile.seekg(saveFile.patchOffset[i]);
+			oldFile.read(&patchData[i][0], saveFile.patchDataSize[i]);
 		}
+
+		if (oldFile.fail())
+			return false;
 	}
 
-	outTerrainFile.close();
-	return true;
+	// write to a temp file and swap it in so a crash never leaves a half written file
+	const wstring tempFilename = job.filename + L".tmp";
+	ofstream file(FRANK_FILENAME(tempFilename.c_str()), ios::out | ios::binary);
+	if (file.fail())
+		return false;
+
+	// patches are packed in order after the index
+	UINT offset = job.header.size() + 2*sizeof(UINT)*patchCount;
+	for(UINT i = 0; i < patchCount; ++i)
+	{
+		saveFile.patchOffset[i] = offset;
+		saveFile.patchDataSize[i] = patchData[i].size();
+		offset += patchData[i].size();
+	}
+
+	file.write(&job.header[0], job.header.size());
+	WriteSaveIndex(file, saveFile.patchOffset, saveFile.patchDataSize);
+	for(UINT i = 0; i < patchCount; ++i)
+		file.write(&patchData[i][0], patchData[i].size());
+
+	file.close();
+	if (file.fail())
+		return false;
+
+	return MoveFileEx(tempFilename.c_str(), job.filename.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
 }
 
 bool Terrain::Load(const WCHAR* filename)
 {
+	// make sure the file is done being written
+	WaitForSave();
+
 	wasReset = true;
 	g_editor.ResetEditor();
 
+	unordered_map<wstring, SaveFile>::iterator saveFileIt = saveFiles.find(filename);
+	if (saveFileIt != saveFiles.end() && saveFileIt->second.isValid)
+	{
+		// skip reading the file if it matches the terrain, this happens when reloading after auto save
+		const SaveFile& saveFile = saveFileIt->second;
+		bool isSaved = true;
+		for(UINT i = 0; i < saveFile.patchRevision.size() && isSaved; ++i)
+			isSaved = (patches[i]->GetSaveRevision() == saveFile.patchRevision[i]);
+
+		if (isSaved)
+		{
+			OnWorldReset();
+			playerEditorStartPos = saveFile.playerEditorStartPos;
+			ResetStartHandle(saveFile.startHandle);
+			SetSaveGameBase();
+			return true;
+		}
+	}
+
+	// this file will need to be fully rewritten unless it is indexed
+	saveFiles.erase(filename);
+
 	ifstream inTerrainFile(FRANK_FILENAME(filename), ios::in | ios::binary);
 
 	if (inTerrainFile.fail())
@@ -445,6 +821,13 @@ bool Terrain::Load(const WCHAR* filename)
 		separateXYsize = false;
 	}
 
+	bool isIndexed = true;
+	if (version == 12)
+	{
+		version = 13; // handle converting to indexed patches
+		isIndexed = false;
+	}
+
 	if (version != dataVersion)
 	{
 		g_debugMessageSystem.AddError(L"Local terrain file version mismatch.  Using built in terrain.");
@@ -478,10 +861,24 @@ bool Terrain::Load(const WCHAR* filename)
 	// read in next handle
 	inTerrainFile.read((char *)&startHandle, sizeof(startHandle));
 
+	// read in where each patch is stored
+	const UINT patchCount = fullSize.x * fullSize.y;
+	vector<UINT> patchOffset(patchCount, 0), patchDataSize(patchCount, 0);
+	if (isIndexed)
+	{
+		for(UINT i = 0; i < patchCount; ++i)
+		{
+			inTerrainFile.read((char *)&patchOffset[i], sizeof(UINT));
+			inTerrainFile.read((char *)&patchDataSize[i], sizeof(UINT));
+		}
+	}
+
 	for(int x=0; x<fullSizeIn.x; ++x)
 	for(int y=0; y<fullSizeIn.y; ++y)
 	{
 		TerrainPatch& patch = *GetPatch(x,y);
+		if (isIndexed)
+			inTerrainFile.seekg(patchOffset[x + fullSize.x * y]);
 		
 		// fast read in the tile data
 		inTerrainFile.read((char *)patch.tiles, sizeof(TerrainTile) * patchSizeIn * patchSizeIn * patchLayersIn);
@@ -549,8 +946,30 @@ bool Terrain::Load(const WCHAR* filename)
 		}
 	}
 
+	if (isIndexed && !inTerrainFile.fail())
+	{
+		// keep track of what is in the file so the next save only writes changed patches
+		SaveFile& saveFile = saveFiles[filename];
+		saveFile.patchOffset = patchOffset;
+		saveFile.patchDataSize = patchDataSize;
+		saveFile.patchHash.resize(patchCount);
+		saveFile.patchRevision.resize(patchCount);
+		vector<char> data;
+		for(UINT i = 0; i < patchCount; ++i)
+		{
+			data.clear();
+			patches[i]->SaveData(data);
+			saveFile.patchHash[i] = FrankUtil::HashData(&data[0], data.size());
+			saveFile.patchRevision[i] = patches[i]->GetSaveRevision();
+		}
+		saveFile.playerEditorStartPos = playerEditorStartPos;
+		saveFile.startHandle = startHandle;
+		saveFile.isValid = true;
+	}
+
 	inTerrainFile.close();
 	ResetStartHandle(startHandle);
+	SetSaveGameBase();
 	return true;
 }
 
@@ -580,6 +999,13 @@ bool Terrain::LoadFromResource(const WCHAR* filename)
 		separateXYsize = false;
 	}
 
+	bool isIndexed = true;
+	if (version == 12)
+	{
+		version = 13; // handle converting to indexed patches
+		isIndexed = false;
+	}
+
 	if (version != dataVersion)
 	{
 		g_debugMessageSystem.AddError(L"Built in terrain version mismatch.  Using clear terrain.");
@@ -614,10 +1040,17 @@ bool Terrain::LoadFromResource(const WCHAR* filename)
 	startHandle = *(GameObjectHandle*)(dataPointer);
 	dataPointer += sizeof(startHandle);
 
+	// indexed files store offset and size for each patch
+	const UINT* patchIndex = (const UINT*)(dataPointer);
+	if (isIndexed)
+		dataPointer += 2 * sizeof(UINT) * fullSize.x * fullSize.y;
+
 	for(int x=0; x<fullSize.x; ++x)
 	for(int y=0; y<fullSize.y; ++y)
 	{
 		TerrainPatch& patch = *GetPatch(x,y);
+		if (isIndexed)
+			dataPointer = (BYTE*)pMem + patchIndex[2 * (x + fullSize.x * y)];
 
 		// read in the tile data
 		const int dataSize = sizeof(TerrainTile) * patchSize * patchSize * patchLayers;
@@ -661,11 +1094,373 @@ bool Terrain::LoadFromResource(const WCHAR* filename)
 	UnlockResource(hMem);
 	FreeResource(hRes);
 	ResetStartHandle(startHandle);
+	SetSaveGameBase();
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+/*
+	Save Games
+
+	- the terrain as it was loaded is kept as the base for save games
+	- saving the terrain file does not change the base, deltas stay relative to what was loaded
+	- save games only store changed tiles and serializable objects per patch
+	- changes are applied to patches lazily as they come into the stream window
+*/
+////////////////////////////////////////////////////////////////////////////////////////
+
+static const char saveGameVersion = 2;
+
+static bool ReadSaveData(const vector<char>& data, size_t& offset, void* dest, size_t size)
+{
+	if (offset + size > data.size())
+		return false;
+
+	memcpy(dest, &data[offset], size);
+	offset += size;
+	return true;
+}
+
+static bool ReadSaveDataStub(const vector<char>& data, size_t& offset, GameObjectStub& stub)
+{
+	int attributesLength = 0;
+	if (!ReadSaveData(data, offset, &stub.type,		sizeof(stub.type)) ||
+		!ReadSaveData(data, offset, &stub.xf,		sizeof(stub.xf)) ||
+		!ReadSaveData(data, offset, &stub.size,		sizeof(stub.size)) ||
+		!ReadSaveData(data, offset, &stub.handle,	sizeof(stub.handle)) ||
+		!ReadSaveData(data, offset, &attributesLength, sizeof(attributesLength)))
+		return false;
+
+	if (attributesLength < 0 || attributesLength > GameObjectStub::attributesLength)
+		return false;
+	if (!ReadSaveData(data, offset, stub.attributes, attributesLength))
+		return false;
+
+	stub.attributes[GameObjectStub::attributesLength - 1] = 0;
+	return true;
+}
+
+void Terrain::SetSaveGameBase()
+{
+	// keep a copy of the loaded terrain so save games only need to store changes
+	const int tileCount = patchSize*patchSize*patchLayers;
+	saveGameBaseStubs.clear();
+	saveGameDeltas.clear();
+	for(int i = 0; i < fullSize.x*fullSize.y; ++i)
+	{
+		TerrainPatch& patch = *patches[i];
+		memcpy(patch.baseTiles, patch.tiles, sizeof(TerrainTile)*tileCount);
+
+		for (list<GameObjectStub>::const_iterator it = patch.objectStubs.begin(); it != patch.objectStubs.end(); ++it) 
+		{
+			const GameObjectStub& stub = *it;
+			if (!stub.HasObjectInfo() || !stub.GetObjectInfo().IsSerializable())
+				continue;
+
+			SaveGameBaseStub& baseStub = saveGameBaseStubs[stub.handle];
+			baseStub.patchIndex = i;
+			baseStub.stub = stub;
+		}
+	}
+}
+
+void Terrain::RestoreSaveGameBase()
+{
+	const int tileCount = patchSize*patchSize*patchLayers;
+	for(int i = 0; i < fullSize.x*fullSize.y; ++i)
+	{
+		TerrainPatch& patch = *patches[i];
+		if (memcmp(patch.tiles, patch.baseTiles, sizeof(TerrainTile)*tileCount) != 0)
+		{
+			memcpy(patch.tiles, patch.baseTiles, sizeof(TerrainTile)*tileCount);
+			patch.RebuildPhysics();
+			g_terrainRender.RefereshCached(patch);
+			DeferredRender::InvalidateLightCache(patch.GetAABB());
+		}
+
+		// serializable stubs are put back from the base below
+		for (list<GameObjectStub>::iterator it = patch.objectStubs.begin(); it != patch.objectStubs.end(); ) 
+		{
+			if (it->HasObjectInfo() && it->GetObjectInfo().IsSerializable())
+			{
+				it = patch.objectStubs.erase(it);
+				patch.MarkSaveDirty();
+			}
+			else
+				++it;
+		}
+	}
+
+	for (unordered_map<GameObjectHandle, SaveGameBaseStub>::const_iterator it = saveGameBaseStubs.begin(); it != saveGameBaseStubs.end(); ++it) 
+		patches[it->second.patchIndex]->AddStub(it->second.stub);
+
+	saveGameDeltas.clear();
+}
+
+void Terrain::ApplySaveGameDelta(int patchIndex)
+{
+	unordered_map<int, SaveGameDelta>::iterator deltaIt = saveGameDeltas.find(patchIndex);
+	if (deltaIt == saveGameDeltas.end())
+		return;
+
+	const SaveGameDelta& delta = deltaIt->second;
+	TerrainPatch& patch = *patches[patchIndex];
+	if (!delta.tiles.empty())
+	{
+		for (vector< pair<UINT, TerrainTile> >::const_iterator it = delta.tiles.begin(); it != delta.tiles.end(); ++it) 
+			patch.tiles[it->first] = it->second;
+		patch.RebuildPhysics();
+		g_terrainRender.RefereshCached(patch);
+		DeferredRender::InvalidateLightCache(patch.GetAABB());
+	}
+
+	for (vector<GameObjectHandle>::const_iterator it = delta.removedStubs.begin(); it != delta.removedStubs.end(); ++it) 
+		patch.RemoveStub(*it);
+
+	for (list<GameObjectStub>::const_iterator it = delta.stubs.begin(); it != delta.stubs.end(); ++it) 
+	{
+		// replace the base version of the stub if there is one
+		patch.RemoveStub(it->handle);
+		patch.AddStub(*it);
+	}
+
+	saveGameDeltas.erase(deltaIt);
+}
+
+void Terrain::ApplySaveGameDeltas()
+{
+	while (!saveGameDeltas.empty())
+		ApplySaveGameDelta(saveGameDeltas.begin()->first);
+}
+
+bool Terrain::SaveGame(const WCHAR* filename)
+{
+	// patches that have not streamed in yet still have changes from the last save game
+	ApplySaveGameDeltas();
+
+	const int patchCount = fullSize.x*fullSize.y;
+	const int tileCount = patchSize*patchSize*patchLayers;
+	vector<SaveGameDelta> deltas(patchCount);
+
+	// find changed tiles
+	for(int i = 0; i < patchCount; ++i)
+	{
+		const TerrainPatch& patch = *patches[i];
+		if (memcmp(patch.tiles, patch.baseTiles, sizeof(TerrainTile)*tileCount) == 0)
+			continue;
+
+		for(int j = 0; j < tileCount; ++j)
+		{
+			if (memcmp(&patch.tiles[j], &patch.baseTiles[j], sizeof(TerrainTile)) != 0)
+				deltas[i].tiles.push_back(pair<UINT, TerrainTile>((UINT)j, patch.tiles[j]));
+		}
+	}
+
+	// serializable objects are either still stubs or have been spawned and removed from their patch
+	unordered_map<GameObjectHandle, int> currentStubPatch;
+	vector< pair<int, GameObjectStub> > currentStubs;
+	for(int i = 0; i < patchCount; ++i)
+	{
+		const TerrainPatch& patch = *patches[i];
+		for (list<GameObjectStub>::const_iterator it = patch.objectStubs.begin(); it != patch.objectStubs.end(); ++it) 
+		{
+			if (it->HasObjectInfo() && it->GetObjectInfo().IsSerializable())
+				currentStubs.push_back(pair<int, GameObjectStub>(i, *it));
+		}
+	}
+	for (GameObjectHashTable::iterator it = g_objectManager.GetObjects().begin(); it != g_objectManager.GetObjects().end(); ++it)
+	{
+		const GameObject& object = *it->second;
+		if (object.HasParent() || object.IsDestroyed())
+			continue;
+
+		const ObjectTypeInfo* type = object.GetObjectInfo();
+		if (!type || !type->IsSerializable())
+			continue;
+
+		// objects outside the terrain are lost just like when they stream out
+		const IntVector2 patchIndex = GetPatchIndex(object.GetPosWorld());
+		if (IsPatchIndexValid(patchIndex))
+			currentStubs.push_back(pair<int, GameObjectStub>(patchIndex.x + fullSize.x*patchIndex.y, object.Serialize()));
+	}
+
+	// store stubs that are new or have changed
+	for (vector< pair<int, GameObjectStub> >::iterator it = currentStubs.begin(); it != currentStubs.end(); ++it) 
+	{
+		GameObjectStub& stub = it->second;
+		currentStubPatch[stub.handle] = it->first;
+
+		unordered_map<GameObjectHandle, SaveGameBaseStub>::const_iterator baseIt = saveGameBaseStubs.find(stub.handle);
+		if (baseIt != saveGameBaseStubs.end())
+		{
+			const SaveGameBaseStub& baseStub = baseIt->second;
+			if (baseStub.patchIndex == it->first && baseStub.stub.type == stub.type && baseStub.stub.xf == stub.xf && 
+				baseStub.stub.size == stub.size && strcmp(baseStub.stub.attributes, stub.attributes) == 0)
+				continue;
+
+			// serialized objects don't write attributes, keep the ones they were built from
+			if (!stub.attributes[0])
+				strncpy_s(stub.attributes, baseStub.stub.attributes, GameObjectStub::attributesLength);
+		}
+
+		deltas[it->first].stubs.push_back(stub);
+	}
+
+	// remove base stubs that are gone or moved to another patch
+	for (unordered_map<GameObjectHandle, SaveGameBaseStub>::const_iterator it = saveGameBaseStubs.begin(); it != saveGameBaseStubs.end(); ++it) 
+	{
+		unordered_map<GameObjectHandle, int>::const_iterator currentIt = currentStubPatch.find(it->first);
+		if (currentIt == currentStubPatch.end() || currentIt->second != it->second.patchIndex)
+			deltas[it->second.patchIndex].removedStubs.push_back(it->first);
+	}
+
+	// write out header
+	vector<char> data;
+	WriteSaveData(data, &saveGameVersion, 1);
+	WriteSaveData(data, &fullSize.x, sizeof(fullSize.x));
+	WriteSaveData(data, &fullSize.y, sizeof(fullSize.y));
+	WriteSaveData(data, &patchSize, sizeof(patchSize));
+	WriteSaveData(data, &patchLayers, sizeof(patchLayers));
+	const GameObjectHandle nextHandle = GameObject::GetNextUniqueHandleValue();
+	WriteSaveData(data, &nextHandle, sizeof(nextHandle));
+
+	// write out only patches that changed
+	UINT deltaCount = 0;
+	for(int i = 0; i < patchCount; ++i)
+		deltaCount += (!deltas[i].tiles.empty() || !deltas[i].removedStubs.empty() || !deltas[i].stubs.empty());
+	WriteSaveData(data, &deltaCount, sizeof(deltaCount));
+
+	for(int i = 0; i < patchCount; ++i)
+	{
+		const SaveGameDelta& delta = deltas[i];
+		if (delta.tiles.empty() && delta.removedStubs.empty() && delta.stubs.empty())
+			continue;
+
+		WriteSaveData(data, &i, sizeof(i));
+
+		UINT count = delta.tiles.size();
+		WriteSaveData(data, &count, sizeof(count));
+		for (vector< pair<UINT, TerrainTile> >::const_iterator it = delta.tiles.begin(); it != delta.tiles.end(); ++it) 
+		{
+			WriteSaveData(data, &it->first, sizeof(it->first));
+			WriteSaveData(data, &it->second, sizeof(it->second));
+		}
+
+		count = delta.removedStubs.size();
+		WriteSaveData(data, &count, sizeof(count));
+		if (count > 0)
+			WriteSaveData(data, &delta.removedStubs[0], sizeof(GameObjectHandle) * count);
+
+		count = delta.stubs.size();
+		WriteSaveData(data, &count, sizeof(count));
+		for (list<GameObjectStub>::const_iterator it = delta.stubs.begin(); it != delta.stubs.end(); ++it) 
+			WriteSaveDataStub(data, *it);
+	}
+
+	ofstream outFile(FRANK_FILENAME(filename), ios::out | ios::binary);
+	if (outFile.fail())
+		return false;
+
+	outFile.write(&data[0], data.size());
+	outFile.close();
+	return !outFile.fail();
+}
+
+bool Terrain::LoadGame(const WCHAR* filename)
+{
+	ifstream inFile(FRANK_FILENAME(filename), ios::in | ios::binary | ios::ate);
+	if (inFile.fail())
+		return false;
+
+	vector<char> data((size_t)inFile.tellg());
+	inFile.seekg(0);
+	if (!data.empty())
+		inFile.read(&data[0], data.size());
+	inFile.close();
+
+	// check the header matches this terrain
+	size_t offset = 0;
+	char version = 0;
+	IntVector2 fullSizeIn;
+	int patchSizeIn = 0, patchLayersIn = 0;
+	GameObjectHandle nextHandle = 0;
+	UINT deltaCount = 0;
+	if (!ReadSaveData(data, offset, &version, 1) || version != saveGameVersion)
+	{
+		g_debugMessageSystem.AddError(L"Save game version mismatch.");
+		return false;
+	}
+	ReadSaveData(data, offset, &fullSizeIn.x, sizeof(fullSizeIn.x));
+	ReadSaveData(data, offset, &fullSizeIn.y, sizeof(fullSizeIn.y));
+	ReadSaveData(data, offset, &patchSizeIn, sizeof(patchSizeIn));
+	ReadSaveData(data, offset, &patchLayersIn, sizeof(patchLayersIn));
+	ReadSaveData(data, offset, &nextHandle, sizeof(nextHandle));
+	if (!ReadSaveData(data, offset, &deltaCount, sizeof(deltaCount)) ||
+		fullSizeIn.x != fullSize.x || fullSizeIn.y != fullSize.y || patchSizeIn != patchSize || patchLayersIn != patchLayers)
+	{
+		g_debugMessageSystem.AddError(L"Save game terrain size mismatch.");
+		return false;
+	}
+
+	// read in the changes, they are applied as patches stream in
+	const int patchCount = fullSize.x*fullSize.y;
+	const int tileCount = patchSize*patchSize*patchLayers;
+	unordered_map<int, SaveGameDelta> deltas;
+	bool isValid = true;
+	for (UINT i = 0; i < deltaCount && isValid; ++i)
+	{
+		int patchIndex = 0;
+		UINT count = 0;
+		isValid = ReadSaveData(data, offset, &patchIndex, sizeof(patchIndex)) && patchIndex >= 0 && patchIndex < patchCount;
+		SaveGameDelta& delta = deltas[patchIndex];
+
+		isValid = isValid && ReadSaveData(data, offset, &count, sizeof(count));
+		for (UINT j = 0; j < count && isValid; ++j)
+		{
+			pair<UINT, TerrainTile> tile;
+			isValid = ReadSaveData(data, offset, &tile.first, sizeof(tile.first)) && 
+				ReadSaveData(data, offset, &tile.second, sizeof(tile.second)) && tile.first < (UINT)tileCount;
+			delta.tiles.push_back(tile);
+		}
+
+		isValid = isValid && ReadSaveData(data, offset, &count, sizeof(count));
+		for (UINT j = 0; j < count && isValid; ++j)
+		{
+			GameObjectHandle handle = GameObject::invalidHandle;
+			isValid = ReadSaveData(data, offset, &handle, sizeof(handle));
+			delta.removedStubs.push_back(handle);
+		}
+
+		isValid = isValid && ReadSaveData(data, offset, &count, sizeof(count));
+		for (UINT j = 0; j < count && isValid; ++j)
+		{
+			GameObjectStub stub;
+			isValid = ReadSaveDataStub(data, offset, stub);
+			delta.stubs.push_back(stub);
+		}
+	}
+
+	if (!isValid)
+	{
+		g_debugMessageSystem.AddError(L"Save game file is corrupt.");
+		return false;
+	}
+
+	RestoreSaveGameBase();
+	saveGameDeltas.swap(deltas);
+
+	// objects created since the terrain was loaded may be in the save game
+	if (nextHandle > GameObject::GetNextUniqueHandleValue())
+		GameObject::SetNextUniqueHandleValue(nextHandle);
+
+	OnWorldReset();
 	return true;
 }
 
 void Terrain::Clear()
 {
+	ClearSpawnQueue();
+	saveGameDeltas.clear();
 	for(int x=0; x<fullSize.x; ++x)
 	for(int y=0; y<fullSize.y; ++y)
 	{
@@ -763,9 +1558,24 @@ int Terrain::SetSurfaceIndex(const Vector2& pos, BYTE surface, int layer)
 	const Vector2 offset = pos - GetTilePos(x, y);
 	int side = tile->GetSurfaceSide(offset);
 	tile->SetSurfaceData(side, surface);
+	MarkSaveDirty(pos);
 	return side;
 }
 
+void Terrain::MarkSaveDirty(const Vector2& pos) const
+{
+	TerrainPatch* patch = GetPatch(pos);
+	if (patch)
+		patch->MarkSaveDirty();
+}
+
+void Terrain::MarkSaveDirty(int x, int y) const
+{
+	TerrainPatch* patch = GetPatch(x / patchSize, y / patchSize);
+	if (patch)
+		patch->MarkSaveDirty();
+}
+
 TerrainTile* Terrain::GetConnectedTileA(int x, int y, int &x2, int &y2, int layer)
 {
 	const TerrainTile* tile = GetTile(x, y, layer);
@@ -1058,7 +1868,7 @@ GameMaterialIndex Terrain::DeformTile(const Vector2& startPos, const Vector2& di
 	if (!tile || tile->IsAreaClear())
 		return GMI_Invalid;
 	
-	const int surfaceData = (int)(raycastResult.hitFixture->GetUserData());
+	const int surfaceData = (int)(intptr_t)(raycastResult.hitFixture->GetUserData());
 	const GameSurfaceInfo& gsi = GameSurfaceInfo::Get(surfaceData);
 	const GameMaterialIndex gmiHit = gsi.materialIndex;
 	if (!terrainAlwaysDestructible && (gsi.materialIndex != gmi || !gsi.IsDestructible()))
@@ -1260,12 +2070,14 @@ void Terrain::CheckForErrors()
 						ASSERT(false); // stub has handle greater it should
 						stub.handle = GameObject::GetNextUniqueHandleValue();
 						GameObject::SetNextUniqueHandleValue(stub.handle + 1);
+						patch.MarkSaveDirty();
 					}
 					if (stub.handle == stub2.handle && &stub != &stub2)
 					{
 						ASSERT(false); // duplicate handles should not happen
 						stub.handle = GameObject::GetNextUniqueHandleValue();
 						GameObject::SetNextUniqueHandleValue(stub.handle + 1);
+						patch.MarkSaveDirty();
 					}
 				}
 			}
@@ -1300,6 +2112,7 @@ void Terrain::CleanUpTiles()
 		}
 		if (tile->IsFull())
 			tile->SetSurfaceData(0, 0);
+		MarkSaveDirty(x, y);
 	}
 	
 	g_editor.SaveState();
@@ -1311,17 +2124,22 @@ void Terrain::CleanUpTiles()
 */
 ////////////////////////////////////////////////////////////////////////////////////////
 
+UINT TerrainPatch::nextSaveRevision = 0;
+
 // Terrain patch constructor
 // note: terrain patches are not be added to the world!
 TerrainPatch::TerrainPatch(const Vector2& pos) :
 	GameObject(pos, NULL, GameObjectType(0), false),
 	activePhysics(false),
 	activeObjects(false),
-	needsPhysicsRebuild(false)
+	needsPhysicsRebuild(false),
+	saveRevision(0)
 {
 	tiles = new TerrainTile[Terrain::patchLayers * Terrain::patchSize * Terrain::patchSize];
+	baseTiles = new TerrainTile[Terrain::patchLayers * Terrain::patchSize * Terrain::patchSize];
 
 	Clear();
+	memcpy(baseTiles, tiles, sizeof(TerrainTile) * Terrain::patchLayers * Terrain::patchSize * Terrain::patchSize);
 
 	// terrain layer render handles rendering
 	SetVisible(false);
@@ -1330,6 +2148,7 @@ TerrainPatch::TerrainPatch(const Vector2& pos) :
 TerrainPatch::~TerrainPatch()
 {
 	delete [] tiles;
+	delete [] baseTiles;
 }
 
 void TerrainPatch::Clear()
@@ -1350,6 +2169,7 @@ void TerrainPatch::ClearTileData(int layer)
 		// reset tiles
 		GetTileLocal(x, y, layer).MakeClear();
 	}
+	MarkSaveDirty();
 }
 	
 
@@ -1363,12 +2183,14 @@ void TerrainPatch::ClearTileData()
 		// reset tiles
 		GetTileLocal(x, y, l).MakeClear();
 	}
+	MarkSaveDirty();
 }
 
 void TerrainPatch::ClearObjectStubs()
 {
 	// clear the object stub list
 	objectStubs.clear();
+	MarkSaveDirty();
 }
 
 void TerrainPatch::SetActivePhysics(bool _activePhysics)
@@ -1398,11 +2220,9 @@ void TerrainPatch::SetActiveObjects(bool _activeObjects, bool windowMoved)
 	{
 		// update serialize objects when window moves or patch first becomes active
 		const Box2AABB streamWindowAABB = g_terrain->GetStreamWindow();
-		for (list<GameObjectStub>::iterator it = objectStubs.begin(); it != objectStubs.end(); ) 
+		for (list<GameObjectStub>::iterator it = objectStubs.begin(); it != objectStubs.end(); ++it) 
 		{       
 			const GameObjectStub& stub = *it;
-			list<GameObjectStub>::iterator itLast = it;
-			++it;
 
 			// check if it already exists
 			GameObject* object = g_objectManager.GetObjectFromHandle(stub.handle);
@@ -1420,11 +2240,8 @@ void TerrainPatch::SetActiveObjects(bool _activeObjects, bool windowMoved)
 			if (Terrain::enableStreaming && !streamWindowAABB.FullyContains(stub.GetAABB()))
 				continue;
 
-			// create the object from the stub
-			stub.BuildObject();
-			
-			// seralizeable objects are removed as they are spawned
-			objectStubs.erase(itLast);
+			// queue the object to be created from the stub, it is removed when spawned
+			g_terrain->QueueStubSpawn(*this, stub);
 		}
 	}
 
@@ -1450,8 +2267,8 @@ void TerrainPatch::SetActiveObjects(bool _activeObjects, bool windowMoved)
 			if (objectInfo.IsSerializable())
 				continue;
 
-			// create the object from the stub
-			stub.BuildObject();
+			// queue the object to be created from the stub
+			g_terrain->QueueStubSpawn(*this, stub);
 		}
 
 		// do tile create callbacks
@@ -1781,6 +2598,7 @@ bool TerrainPatch::RemoveStub(GameObjectHandle handle)
 			continue;
 
 		objectStubs.erase(it);
+		MarkSaveDirty();
 		return true;
 	}
 
@@ -1814,6 +2632,29 @@ ConsoleFunction(loadTerrain)
 		GetDebugConsole().AddFormatted(L"Terrain load error");
 }
 
+ConsoleFunction(saveGame)
+{
+	if (!g_terrain)
+		return;
+
+	if (g_terrain->SaveGame(text.c_str()))
+		GetDebugConsole().AddFormatted(L"Game saved to '%s'", text.c_str());
+	else
+		GetDebugConsole().AddFormatted(L"Game save error");
+}
+
+ConsoleFunction(loadGame)
+{
+	if (!g_terrain || !g_gameControlBase)
+		return;
+
+	g_gameControlBase->Reset();
+	if (g_terrain->LoadGame(text.c_str()))
+		GetDebugConsole().AddFormatted(L"Game loaded from '%s'", text.c_str());
+	else
+		GetDebugConsole().AddFormatted(L"Game load error");
+}
+
 ConsoleFunction(clearTerrain)
 {
 	if (!g_terrain)
@@ -1860,6 +2701,7 @@ ConsoleFunction(replaceTile)
 			tile->SetSurfaceData(0, s1 + (newTileIDStart - oldTileIDStart));
 			if (newTileSet != -1)
 				tile->SetTileSet(newTileSet);
+			g_terrain->MarkSaveDirty(x, y);
 		}
 		const int s2 = tile->GetSurfaceData(1);
 		if ((tile->GetTileSet() == oldTileSet || oldTileSet == -1) && s2 >= oldTileIDStart && s2 <= oldTileIDEnd)
@@ -1868,6 +2710,7 @@ ConsoleFunction(replaceTile)
 			tile->SetSurfaceData(1, s2 + (newTileIDStart - oldTileIDStart));
 			if (newTileSet != -1)
 				tile->SetTileSet(newTileSet);
+			g_terrain->MarkSaveDirty(x, y);
 		}
 	}
 
@@ -1910,11 +2753,13 @@ ConsoleFunction(replaceObjectTypes)
 					patch->RemoveStub(&stub);
 				else
 					stub.type = GameObjectType(newObjectType);
+				patch->MarkSaveDirty();
 			}
 			else if (stub.GetObjectInfo().GetType() == newObjectType && newObjectType > 0)
 			{
 				++replaceCount;
 				stub.type = GameObjectType(oldObjectType);
+				patch->MarkSaveDirty();
 			}
 		}
 	}
@@ -1972,7 +2817,7 @@ ConsoleFunction(terrainImportStubs)
 
 	for(int x=0; x<Terrain::fullSize.x; ++x)
 	for(int y=0; y<Terrain::fullSize.y; ++y)
-		g_terrain->GetPatch(x, y)->GetStubs().clear();
+		g_terrain->GetPatch(x, y)->ClearObjectStubs();
 	
 	int highestHandle = 0;
 	while (!inFile.eof())
@@ -12,6 +12,11 @@
 #include "../objects/gameObject.h"
 #include "../terrain/terrainTile.h"
 #include "../terrain/terrainSurface.h"
+#include <unordered_map>
+#ifndef FRANK_PLATFORM_WEB
+#include <thread>
+#include <atomic>
+#endif
 
 ////////////////////////////////////////////////////////////////////////////////////////
 // terrain defines
@@ -29,7 +34,7 @@ public:
 	static bool IsTileIndexValid(int x, int y, int layer = 0);
 	bool GetTileLocalIsSolid(int x, int y) const;
 	Vector2 GetTilePos(int x, int y) const { return GetPosWorld() + TerrainTile::GetSize() * Vector2((float)x, (float)y); }
-	void RebuildPhysics() { needsPhysicsRebuild = true; }
+	void RebuildPhysics() { needsPhysicsRebuild = true; MarkSaveDirty(); }
 	Vector2 GetCenter() const;
 	Box2AABB GetAABB() const;
 
@@ -66,8 +71,16 @@ public: // internal engine functions
 	void CreatePolyPhysicsBody();
 	void CreateEdgePhysicsBody();
 
+	// write tiles and stubs in the terrain file format
+	void SaveData(vector<char>& data) const;
+
+	// must be called when tiles or stubs are changed through pointers so the next save writes this patch
+	void MarkSaveDirty() { saveRevision = ++nextSaveRevision; }
+	UINT GetSaveRevision() const { return saveRevision; }
+
 	GameObjectStub* AddStub(const GameObjectStub& stub) 
 	{ 
+		MarkSaveDirty();
 		objectStubs.push_back(stub); 
 		return &objectStubs.back();
 	}
@@ -78,6 +91,7 @@ public: // internal engine functions
 		{       
 			if (stub == &(*it))
 			{
+				MarkSaveDirty();
 				objectStubs.erase(it);
 				return true;
 			}
@@ -95,11 +109,16 @@ public: // internal engine functions
 public: // data members
 
 	TerrainTile *tiles;
+	TerrainTile *baseTiles;	// tiles as they were loaded, save games only store changes from this
 	list<GameObjectStub> objectStubs;
+	vector<GameObjectHandle> streamObjects;	// objects indexed in this patch for streaming
 	
 	bool activePhysics;
 	bool activeObjects;
 	bool needsPhysicsRebuild;
+	UINT saveRevision;				// changes whenever the tiles or stubs change
+
+	static UINT nextSaveRevision;
 };
 
 class Terrain : public GameObject
@@ -150,6 +169,17 @@ public:
 	void UpdateActiveWindow();
 	void OnWorldReset();
 	void UpdatePost();
+
+	// stub objects are queued when patches become active and spawned over several frames
+	void QueueStubSpawn(TerrainPatch& patch, const GameObjectStub& stub);
+	void ClearSpawnQueue() { spawnQueue.clear(); spawnQueueHandles.clear(); }
+	int GetSpawnQueueSize() const { return (int)spawnQueue.size(); }
+
+	// called when object transforms update to track which patch it is in
+	void UpdateStreamIndex(GameObject& object);
+
+	// called when an object is deleted so its patch does not keep the handle
+	void RemoveStreamIndex(GameObject& object);
 	
 	IntVector2 GetTileIndex(const Vector2& pos) const;
 	Vector2 GetTilePos(int x, int y) const { return GetPosWorld() + TerrainTile::GetSize() * Vector2((float)x, (float)y); }
@@ -161,6 +191,8 @@ public:
 	int GetSurfaceSide(const Vector2& pos, int layer = 0) const;
 	BYTE GetSurfaceIndex(const Vector2& pos, int layer = 0) const;
 	int SetSurfaceIndex(const Vector2& pos, BYTE surface, int layer = 0);
+	void MarkSaveDirty(const Vector2& pos) const;
+	void MarkSaveDirty(int x, int y) const;		// x and y are tile indices like GetTile
 	
 	bool Deform(const Vector2& pos, float radius, GameMaterialIndex gmi, float randomness = 0.1f);
 	bool Deform(const Vector2& pos, float radius, const list<GameMaterialIndex>& gmiList, float randomness = 0.1f);
@@ -177,6 +209,15 @@ public:
 	bool Load(const WCHAR* filename);
 	void Clear();
 
+	// saving is finished on a background thread, these sync the main thread with it
+	void UpdateSave();
+	void WaitForSave();
+
+	// save games only store tiles and serializable objects that changed since the terrain was loaded
+	// the world should be reset before loading so objects are rebuilt from the restored stubs
+	bool SaveGame(const WCHAR* filename);
+	bool LoadGame(const WCHAR* filename);
+
 	TerrainTile* GetConnectedTileA(int x, int y, int &x2, int &y2, int layer = 0);
 	TerrainTile* GetConnectedTileB(int x, int y, int &x2, int &y2, int layer = 0);
 	TerrainTile* GetConnectedTileA(int x, int y) { int x2, y2; return GetConnectedTileA(x, y, x2, y2); }
@@ -239,6 +280,7 @@ public: // settings
 	static bool combineTileShapes;			// optimization to combine physics shapes for tiles
 	static bool enableStreaming;			// streaming of objects and physics for the window around the player
 	static bool streamDebug;				// show streaming debug overlay
+	static float spawnTimeBudget;			// max ms per update to spend spawning stub objects (0 = no limit)
 	static int maxProxies;					// limit on how many terrain proxies can be made
 	static bool isCircularPlanet;			// should terrain be treated like a circular planet?
 	static bool terrainAlwaysDestructible;	// allow any kind of terrain to be destroyed
@@ -251,9 +293,85 @@ public: // settings
 
 private:
 	
-	void UpdateStreaming();
+	void UpdateStreaming(bool windowMoved, const IntVector2& lastWindowPatch, int lastWindowSize);
+	void UpdateSpawnQueue(bool spawnAll);
+	void QueueStreamCheck(GameObject& object);
+	void QueueStreamCheck(const vector<GameObjectHandle>& streamObjects);
+	vector<GameObjectHandle>& GetStreamObjects(const IntVector2& patchIndex);
+	bool IsStreamWindowEdge(const IntVector2& patchIndex) const;
 	bool LoadFromResource(const WCHAR* filename);
+
+	struct SpawnRequest
+	{
+		TerrainPatch* patch;
+		GameObjectHandle handle;
+		Vector2 position;				// stub position when queued so sorting doesn't need to search for the stub
+		float distanceSquared;
+
+		static bool SortCompare(const SpawnRequest& first, const SpawnRequest& second) { return first.distanceSquared > second.distanceSquared; }
+	};
 	
+	vector<SpawnRequest> spawnQueue;
+	set<GameObjectHandle> spawnQueueHandles;			// handles in the spawn queue so they are not queued twice
+	vector<GameObjectHandle> streamCheckList;			// objects that need to check if they should stream out
+	vector<GameObjectHandle> outsideStreamObjects;		// objects indexed outside of the terrain
+
+	// info about a saved terrain file so only changed patches need to be written
+	struct SaveFile
+	{
+		vector<UINT64> patchHash;		// hash of each patch as it was last saved
+		vector<UINT> patchRevision;		// save revision of each patch as it was last saved
+		vector<UINT> patchOffset;		// where each patch is stored in the file
+		vector<UINT> patchDataSize;		// size of each patch in the file
+		Vector2 playerEditorStartPos;	// header info from the file
+		GameObjectHandle startHandle = 0;
+		bool isValid = false;			// if false the whole file must be rewritten
+	};
+
+	// snapshot of the terrain to be written by the save thread
+	struct SaveJob
+	{
+		wstring filename;
+		vector<char> header;
+		vector<int> dirtyPatches;
+		vector< vector<char> > dirtyPatchData;
+		SaveFile* saveFile = NULL;
+		bool succeeded = true;
+	};
+
+	static void WriteSaveJob(SaveJob& job);
+	static bool WriteSaveFile(SaveJob& job);
+	void FinishSave();
+
+	// changes from the base terrain for a patch, applied when the patch streams in
+	struct SaveGameDelta
+	{
+		vector< pair<UINT, TerrainTile> > tiles;	// changed tiles by index
+		vector<GameObjectHandle> removedStubs;		// base stubs that are no longer in this patch
+		list<GameObjectStub> stubs;					// new or changed serializable stubs
+	};
+
+	// serializable stub as it was when the terrain was loaded
+	struct SaveGameBaseStub
+	{
+		int patchIndex;
+		GameObjectStub stub;
+	};
+
+	void SetSaveGameBase();
+	void RestoreSaveGameBase();
+	void ApplySaveGameDelta(int patchIndex);
+	void ApplySaveGameDeltas();
+
+	unordered_map<GameObjectHandle, SaveGameBaseStub> saveGameBaseStubs;
+	unordered_map<int, SaveGameDelta> saveGameDeltas;
+
+	unordered_map<wstring, SaveFile> saveFiles;
+	SaveJob saveJob;
+#ifndef FRANK_PLATFORM_WEB
+	thread saveThread;
+	atomic<bool> saveThreadDone {false};
+#endif
 	IntVector2 streamWindowPatch;
 	IntVector2 streamWindowPatchLast;
 	int streamWindowSizeLast;
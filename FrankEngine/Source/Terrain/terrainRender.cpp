@@ -27,16 +27,19 @@ ConsoleCommand(TerrainRender::enableRender, terrainRender)
 bool TerrainRender::showEdgePoints = false;
 ConsoleCommand(TerrainRender::showEdgePoints, showEdgePoints)
 	
-float TerrainRender::textureWrapScale = 8;
-ConsoleCommand(TerrainRender::textureWrapScale, terrainTextureWrapScale)
-
-bool TerrainRender::foregroundLayerOcculsion = false;
-ConsoleCommand(TerrainRender::foregroundLayerOcculsion, foregroundLayerOcculsion)
-	
-// only update one cache per frame to prevent frame spike
+// only update a few patches per frame to prevent frame spike
 bool TerrainRender::limitCacheUpdate = true;
 ConsoleCommand(TerrainRender::limitCacheUpdate, limitCacheUpdate)
 
+int TerrainRender::cacheUpdateLimit = 2;		// how many patches can be cached per frame when limited
+ConsoleCommand(TerrainRender::cacheUpdateLimit, terrainCacheUpdateLimit)
+
+int TerrainRender::cachePatchBudget = 0;		// how many patches can be cached, 0 is render window plus one ring
+ConsoleCommand(TerrainRender::cachePatchBudget, terrainCachePatchBudget)
+
+int TerrainRender::cachePrefetchDistance = 1;	// how many patches ahead of the render window to cache when moving
+ConsoleCommand(TerrainRender::cachePrefetchDistance, terrainCachePrefetchDistance)
+
 bool TerrainRender::cacheEnable = true;
 ConsoleCommand(TerrainRender::cacheEnable, terrainCacheEnable)
 
@@ -62,9 +65,16 @@ TerrainRender::TerrainRender()
 	renderTexture = NULL;
 	tileBuffers = NULL;
 	tileBufferCount = 0;
+	arenaSlotVertexCount = 0;
 	renderedPrimitiveCount = 0;
 	renderedBatchCount = 0;
 	cacheNeedsFullRefresh = true;
+	cacheHitCount = 0;
+	cacheMissCount = 0;
+	cacheEvictCount = 0;
+	cacheUpdateCount = 0;
+	lastCacheWindowPatch = IntVector2(0);
+	lastCachePos = Vector2(0);
 }
 
 TerrainRender::~TerrainRender()
@@ -77,47 +87,23 @@ void TerrainRender::Update()
 	if (!enableRender || !cacheEnable || !g_gameControlBase->IsGameplayMode())
 	{
 		for (int k = 0; k < tileBufferCount; ++k)
-		for (int l = 0; l < Terrain::patchLayers; ++l)
-			UncacheTilesPrimitives(k, l);
+			UncachePatch(k);
 
 		return;
 	}
 
-	// get current position
-	const Vector2& pos = g_gameControlBase->GetStreamCenter();
-	const IntVector2 patchIndex = g_terrain->GetPatchIndex(pos);
-
-	// get the render widnow size
-	int window = Terrain::renderWindowSize;
-	int i1 =patchIndex.x-window;
-	int i2 =patchIndex.x+window;
-	int j1 =patchIndex.y-window;
-	int j2 =patchIndex.y+window;
-
-	// check if window size changed and trigger device reset
+	// check if window size or budget changed and trigger device reset
+	const int window = Terrain::renderWindowSize;
 	static int lastWindow = window;
-	if (lastWindow != window)
+	static int lastBudget = cachePatchBudget;
+	if (lastWindow != window || lastBudget != cachePatchBudget)
 	{
 		DXUTResetDevice();
 		lastWindow = window;
+		lastBudget = cachePatchBudget;
 	}
 
-	for (int k = 0; k < tileBufferCount; ++k)
-	{
-		// uncache tiles no longer in the window
-		const TerrainPatch* patch = tileBuffers[k].patch;
-		if (!patch)
-			continue;
-		
-		const Vector2 centerPatchPos = patch->GetCenter();
-		const IntVector2 checkPatchIndex = g_terrain->GetPatchIndex(centerPatchPos);
-		if (checkPatchIndex.x < i1 || checkPatchIndex.x > i2 || checkPatchIndex.y < j1 || checkPatchIndex.y > j2)
-		{
-			for (int l = 0; l < Terrain::patchLayers; ++l)
-				UncacheTilesPrimitives(k, l);
-		}
-	}
-
+	// patches that leave the window stay cached until their slot is needed
 	UpdateCache();
 }
 	
@@ -125,100 +111,318 @@ void TerrainRender::ClearCache()
 {
 	// clear cache
 	for (int k = 0; k < tileBufferCount; ++k)
-	for (int l = 0; l < Terrain::patchLayers; ++l)
-		UncacheTilesPrimitives(k, l);
+		UncachePatch(k);
 
 	cacheNeedsFullRefresh = true;
+	cacheHitCount = 0;
+	cacheMissCount = 0;
+	cacheEvictCount = 0;
 }
 
 void TerrainRender::UpdateCache()
 {
 	// must have a player to refresh the cache
-	if (!g_gameControlBase->GetPlayer())
+	if (!g_gameControlBase->GetPlayer() || tileBufferCount == 0)
 		return;
 
+	FrankProfilerEntryDefine(L"TerrainRender::UpdateCache()", Color::White(), 5);
+	++cacheUpdateCount;
+
 	// get current position
 	const Vector2& pos = g_gameControlBase->GetStreamCenter();
 	const IntVector2 patchOffset = g_terrain->GetPatchIndex(pos);
 
 	// get the render widnow size
-	int window = Terrain::renderWindowSize;
-	int i1 = patchOffset.x-window;
-	int i2 = patchOffset.x+window;
-	int j1 = patchOffset.y-window;
-	int j2 = patchOffset.y+window;
-
-	// loop over all the patches and tiles in the window
-	for(int i=i1; i<=i2; ++i)
-	for(int j=j1; j<=j2; ++j)
+	const int window = Terrain::renderWindowSize;
+
+	// prefetch patches on the sides of the window we are moving towards
+	const int prefetch = cacheNeedsFullRefresh? 0 : Max(cachePrefetchDistance, 0);
+	const IntVector2 moveDirection(GetSign(pos.x - lastCachePos.x), GetSign(pos.y - lastCachePos.y));
+
+	// loop over patches in rings around the center so the closest are cached first
+	vector<const TerrainPatch*> missingPatches;
+	for(int r=0; r<=window+prefetch; ++r)
+	for(int i=-r; i<=r; ++i)
+	for(int j=-r; j<=r; ++j)
 	{
-		if (!g_terrain->IsPatchIndexValid(IntVector2(i,j)))
+		if (abs(i) != r && abs(j) != r)
 			continue;
-		
-		const TerrainPatch& patch = *g_terrain->GetPatch(i, j);
 
-		// check if patch is cached
-		bool cached = false;
-		for (int k = 0; k < tileBufferCount; ++k)
+		const IntVector2 index = patchOffset + IntVector2(i,j);
+		if (!g_terrain->IsPatchIndexValid(index))
+			continue;
+
+		const bool inWindow = (r <= window);
+		if (!inWindow && !(i*moveDirection.x > window || j*moveDirection.y > window))
+			continue;
+
+		const TerrainPatch& patch = *g_terrain->GetPatch(index.x, index.y);
+		const int slot = GetCacheSlot(patch);
+		if (slot >= 0)
+			TouchCacheSlot(slot);
+		else
+			missingPatches.push_back(&patch);
+
+		// count hits and misses when patches enter the window
+		const bool isNew = cacheNeedsFullRefresh || abs(index.x - lastCacheWindowPatch.x) > window || abs(index.y - lastCacheWindowPatch.y) > window;
+		if (inWindow && isNew)
 		{
-			if (&patch == tileBuffers[k].patch)
-			{
-				cached = true;
-				break;
-			}
+			if (slot >= 0)
+				++cacheHitCount;
+			else
+				++cacheMissCount;
 		}
-		if (!cached)
+	}
+
+	lastCacheWindowPatch = patchOffset;
+	lastCachePos = pos;
+
+	int jobCount = 0;
+	for (vector<const TerrainPatch*>::iterator it = missingPatches.begin(); it != missingPatches.end(); ++it)
+	{
+		// opt: only rebuild a few patches per update
+		if (limitCacheUpdate && !cacheNeedsFullRefresh && it - missingPatches.begin() >= cacheUpdateLimit)
+			break;
+
+		const int slot = AllocateCacheSlot();
+		if (slot < 0)
+			break;
+
+		CachePatch(slot, **it);
+		for (int l = 0; l < Terrain::patchLayers; ++l)
 		{
-			// cache the patch in an open slot
-			for (int k = 0; k < tileBufferCount; ++k)
-			{
-				if (!tileBuffers[k].patch)
-				{
-					for (int l = 0; l < Terrain::patchLayers; ++l)
-						CacheTilesPrimitives(k, patch, l);
-					break;
-				}
-			}
+			if (jobCount >= (int)cacheJobs.size())
+				cacheJobs.resize(jobCount + 1);
 
-			// opt: only rebuild one patch per update
-			if (limitCacheUpdate && !cacheNeedsFullRefresh)
-				return;
+			CacheJob& job = cacheJobs[jobCount++];
+			job.patch = *it;
+			job.tileBufferIndex = slot;
+			job.layer = l;
 		}
 	}
 
+	if (jobCount > 0)
+	{
+		// generate verts on worker threads then upload them here
+		vector<CacheJob> jobs;
+		jobs.swap(cacheJobs);
+		jobs.resize(jobCount);
+		BuildCacheJobs(jobs, cacheThreadCount);
+		for (vector<CacheJob>::iterator it = jobs.begin(); it != jobs.end(); ++it)
+			UploadTilesPrimitives(it->tileBufferIndex, *it->patch, it->layer, it->staging);
+		jobs.swap(cacheJobs);
+	}
+
 	cacheNeedsFullRefresh = false;
 }
 
+int TerrainRender::GetCacheSlot(const TerrainPatch& patch) const
+{
+	unordered_map<const TerrainPatch*, int>::const_iterator it = patchSlots.find(&patch);
+	return (it == patchSlots.end())? -1 : it->second;
+}
+
+int TerrainRender::AllocateCacheSlot()
+{
+	if (freeSlots.empty())
+	{
+		// evict the least recently used patch unless it was needed this update
+		if (slotLRU.empty() || slotLastUsed[slotLRU.back()] == cacheUpdateCount)
+			return -1;
+
+		UncachePatch(slotLRU.back());
+		++cacheEvictCount;
+	}
+
+	const int slot = freeSlots.back();
+	freeSlots.pop_back();
+	return slot;
+}
+
+void TerrainRender::CachePatch(int slot, const TerrainPatch& patch)
+{
+	// just claim the slot, the verts are built by the cache jobs
+	patchSlots[&patch] = slot;
+	slotLRU.push_front(slot);
+	slotLRUIterators[slot] = slotLRU.begin();
+	slotLastUsed[slot] = cacheUpdateCount;
+}
+
+void TerrainRender::UncachePatch(int slot)
+{
+	const TerrainPatch* patch = tileBuffers[slot].patch;
+	if (!patch)
+		return;
+
+	for (int l = 0; l < Terrain::patchLayers; ++l)
+		UncacheTilesPrimitives(slot, l);
+
+	patchSlots.erase(patch);
+	slotLRU.erase(slotLRUIterators[slot]);
+	freeSlots.push_back(slot);
+}
+
+void TerrainRender::TouchCacheSlot(int slot)
+{
+	slotLRU.splice(slotLRU.begin(), slotLRU, slotLRUIterators[slot]);
+	slotLastUsed[slot] = cacheUpdateCount;
+}
+
 bool TerrainRender::IsPatchCached(TerrainPatch& patch)
 {
 	if (!cacheEnable)
 		return true;
 
-	// check if patch is cached
-	for (int k = 0; k < tileBufferCount; ++k)
+	return GetCacheSlot(patch) >= 0;
+}
+
+void TerrainRender::RefereshCached(TerrainPatch& patch)
+{
+	const int slot = GetCacheSlot(patch);
+	if (slot < 0)
+		return;
+
+	// find which tiles changed since the patch was cached
+	// layers are checked together because foreground tiles can occlude the background
+	const int layerTileCount = Terrain::patchSize*Terrain::patchSize;
+	vector<bool> dirtyTiles(layerTileCount, false);
+	bool anyDirty = false;
+	for (int l = 0; l < Terrain::patchLayers; ++l)
 	{
-		if (&patch == tileBuffers[k].patch)
-			return true;
+		const vector<TerrainTile>& cachedTiles = tileBufferTiles[slot + l*tileBufferCount];
+		if ((int)cachedTiles.size() != layerTileCount)
+		{
+			dirtyTiles.assign(layerTileCount, true);
+			anyDirty = true;
+			break;
+		}
+
+		const TerrainTile* tiles = &patch.tiles[l*layerTileCount];
+		for (int t = 0; t < layerTileCount; ++t)
+		{
+			if (memcmp(&cachedTiles[t], &tiles[t], sizeof(TerrainTile)) != 0)
+			{
+				dirtyTiles[t] = true;
+				anyDirty = true;
+			}
+		}
 	}
 
-	return false;
+	if (!anyDirty)
+		return;
+
+	for (int l = 0; l < Terrain::patchLayers; ++l)
+		RefreshCachedLayer(slot, patch, l, dirtyTiles);
 }
 
-void TerrainRender::RefereshCached(TerrainPatch& patch)
+void TerrainRender::RefreshCachedLayer(int tileBufferIndex, const TerrainPatch& patch, int layer, const vector<bool>& dirtyTiles)
 {
-	// check if patch is cached
-	for (int k = 0; k < tileBufferCount; ++k)
+	const int index = tileBufferIndex + layer*tileBufferCount;
+	const CachedTileBuffer& tileBuffer = tileBuffers[index];
+	const int layerTileCount = Terrain::patchSize*Terrain::patchSize;
+	const int groupCount = Min(tileBuffer.groupCount, (int)CachedTileBuffer::maxGroups);
+	if ((int)tileBufferTiles[index].size() != layerTileCount)
 	{
-		if (&patch == tileBuffers[k].patch)
+		CacheTilesPrimitives(tileBufferIndex, patch, layer);
+		return;
+	}
+
+	// find the groups that held the changed tiles and the groups they are in now
+	vector<bool> groupIsDirty(groupCount, false);
+	bool layoutChanged = false;
+	for (int t = 0; t < layerTileCount && !layoutChanged; ++t)
+	{
+		if (!dirtyTiles[t])
+			continue;
+
+		const TerrainTile& oldTile = tileBufferTiles[index][t];
+		const TerrainTile& newTile = patch.tiles[layer*layerTileCount + t];
+		for (int side = 0; side < 2; ++side)
 		{
-			for (int l = 0; l < Terrain::patchLayers; ++l)
+			if (oldTile.GetSurfaceData(side))
 			{
-				UncacheTilesPrimitives(k, l);
-				CacheTilesPrimitives(k, patch, l);
+				// old surfaces may not have been rendered so it is ok if they have no group
+				const int group = FindRenderGroup(tileBuffer.renderGroups, groupCount, oldTile.GetTileSet(), oldTile.GetSurfaceData(side));
+				if (group >= 0)
+					groupIsDirty[group] = true;
+			}
+
+			if (newTile.GetSurfaceData(side) && newTile.GetSurfaceHasArea(side))
+			{
+				// new surfaces without a group need a full rebuild
+				const int group = FindRenderGroup(tileBuffer.renderGroups, groupCount, newTile.GetTileSet(), newTile.GetSurfaceData(side));
+				if (group >= 0)
+					groupIsDirty[group] = true;
+				else if (Terrain::tileSetCount == 0 || newTile.GetTileSet() < Terrain::tileSetCount)
+					layoutChanged = true;
 			}
-			break;
 		}
 	}
+
+	vector<CachedTileBuffer::TileRenderGroup> dirtyGroups;
+	for (int g = 0; g < groupCount; ++g)
+	{
+		if (groupIsDirty[g])
+			dirtyGroups.push_back(tileBuffer.renderGroups[g]);
+	}
+
+	// rebuild only the dirty groups
+	CacheStaging staging;
+	if (!layoutChanged && !dirtyGroups.empty())
+	{
+		BuildTilesPrimitives(staging, patch, layer, &dirtyGroups);
+
+		// the rebuilt groups must line up with the old ones or the layout changed
+		layoutChanged = (staging.groupCount != (int)dirtyGroups.size());
+		for (int i = 0; i < staging.groupCount && !layoutChanged; ++i)
+			layoutChanged = (FindRenderGroup(&dirtyGroups[i], 1, staging.renderGroups[i].tileSet, staging.renderGroups[i].surfaceID) < 0);
+	}
+
+	if (layoutChanged)
+	{
+		CacheTilesPrimitives(tileBufferIndex, patch, layer);
+		return;
+	}
+
+	// splice the rebuilt groups in with the unchanged verts
+	vector<TERRAIN_VERTEX>& vertices = tileBufferVertices[index];
+	vector<TERRAIN_VERTEX> oldVertices;
+	oldVertices.swap(vertices);
+	CachedTileBuffer& cachedBuffer = tileBuffers[index];
+	vector<int> changedGroups;		// dirty groups that stayed in place
+	int firstMovedVertex = -1;		// verts from here on have shifted
+	int dirtyGroupIndex = 0;
+	for (int g = 0; g < groupCount; ++g)
+	{
+		CachedTileBuffer::TileRenderGroup& group = cachedBuffer.renderGroups[g];
+		const UINT startVertex = vertices.size();
+		UINT vertexCount = group.vertexCount;
+		if (groupIsDirty[g])
+		{
+			const CachedTileBuffer::TileRenderGroup& newGroup = staging.renderGroups[dirtyGroupIndex++];
+			vertices.insert(vertices.end(), staging.vertices.begin() + newGroup.startVertex, staging.vertices.begin() + newGroup.startVertex + newGroup.vertexCount);
+			vertexCount = newGroup.vertexCount;
+		}
+		else
+			vertices.insert(vertices.end(), oldVertices.begin() + group.startVertex, oldVertices.begin() + group.startVertex + group.vertexCount);
+
+		if (firstMovedVertex < 0 && (startVertex != group.startVertex || vertexCount != group.vertexCount))
+			firstMovedVertex = startVertex;
+		else if (firstMovedVertex < 0 && groupIsDirty[g])
+			changedGroups.push_back(g);
+
+		group.startVertex = startVertex;
+		group.vertexCount = vertexCount;
+	}
+
+	const TerrainTile* layerTiles = &patch.tiles[layer*layerTileCount];
+	tileBufferTiles[index].assign(layerTiles, layerTiles + layerTileCount);
+
+	// write the changed verts straight into the slot's range of the arena
+	for (vector<int>::const_iterator it = changedGroups.begin(); it != changedGroups.end(); ++it)
+		WriteArenaVertices(tileBufferIndex, layer, cachedBuffer.renderGroups[*it].startVertex, cachedBuffer.renderGroups[*it].vertexCount);
+	if (firstMovedVertex >= 0)
+		WriteArenaVertices(tileBufferIndex, layer, firstMovedVertex, vertices.size() - firstMovedVertex);
 }
 
 void TerrainRender::Render(const Terrain& terrain, const Vector2 &pos, int layer, float alpha)
@@ -230,45 +434,44 @@ void TerrainRender::Render(const Terrain& terrain, const Vector2 &pos, int layer
 		return;
 	
 	IDirect3DDevice9* pd3dDevice = DXUTGetD3D9Device();
-	pd3dDevice->SetRenderState(D3DRS_ALPHATESTENABLE, FALSE); 
-	//pd3dDevice->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
-	//pd3dDevice->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
-	pd3dDevice->SetRenderState(D3DRS_ZENABLE, FALSE);
-	pd3dDevice->SetRenderState(D3DRS_ZWRITEENABLE, FALSE);
-	pd3dDevice->SetRenderState(D3DRS_CULLMODE, D3DCULL_NONE);
+	g_render->SetRenderState(D3DRS_ALPHATESTENABLE, FALSE); 
+	//g_render->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
+	//g_render->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
+	g_render->SetRenderState(D3DRS_ZENABLE, FALSE);
+	g_render->SetRenderState(D3DRS_ZWRITEENABLE, FALSE);
+	g_render->SetRenderState(D3DRS_CULLMODE, D3DCULL_NONE);
 	pd3dDevice->SetSamplerState( 0, D3DSAMP_ADDRESSU, D3DTADDRESS_WRAP );
 	pd3dDevice->SetSamplerState( 0, D3DSAMP_ADDRESSV, D3DTADDRESS_WRAP );
 
 	// hack: this seems to fix weird flicker issue with diffuse render
 	const DWORD d3dLighting = (!enableDiffuseLighting && !DeferredRender::GetRenderPass() && g_gameControlBase->IsGameplayMode()) ? FALSE : TRUE;
-	pd3dDevice->SetRenderState(D3DRS_LIGHTING, d3dLighting);
+	g_render->SetRenderState(D3DRS_LIGHTING, d3dLighting);
 
 	// should this always be true?
-	//pd3dDevice->SetRenderState(D3DRS_LIGHTING, TRUE);
+	//g_render->SetRenderState(D3DRS_LIGHTING, TRUE);
 	
-	pd3dDevice->SetTextureStageState( 0, D3DTSS_COLOROP,   D3DTOP_MODULATE );
-	pd3dDevice->SetTextureStageState( 0, D3DTSS_COLORARG1, D3DTA_TEXTURE );
-	pd3dDevice->SetTextureStageState( 0, D3DTSS_COLORARG2, D3DTA_DIFFUSE );
-	pd3dDevice->SetTextureStageState( 0, D3DTSS_ALPHAOP,   D3DTOP_MODULATE );
-	pd3dDevice->SetTextureStageState( 0, D3DTSS_ALPHAARG1, D3DTA_TEXTURE );
-	pd3dDevice->SetTextureStageState( 0, D3DTSS_ALPHAARG2, D3DTA_DIFFUSE );
+	g_render->SetTextureStageState( 0, D3DTSS_COLOROP,   D3DTOP_MODULATE );
+	g_render->SetTextureStageState( 0, D3DTSS_COLORARG1, D3DTA_TEXTURE );
+	g_render->SetTextureStageState( 0, D3DTSS_COLORARG2, D3DTA_DIFFUSE );
+	g_render->SetTextureStageState( 0, D3DTSS_ALPHAOP,   D3DTOP_MODULATE );
+	g_render->SetTextureStageState( 0, D3DTSS_ALPHAARG1, D3DTA_TEXTURE );
+	g_render->SetTextureStageState( 0, D3DTSS_ALPHAARG2, D3DTA_DIFFUSE );
 
 	static DWORD savedAmbient = 0;
 	pd3dDevice->GetRenderState( D3DRS_AMBIENT, &savedAmbient );
 	if (DeferredRender::GetRenderPassIsShadow() || DeferredRender::GetRenderPassIsEmissive())
 	{
 		// terrain handles it's own render pass ambient stuff
-		pd3dDevice->SetRenderState(D3DRS_AMBIENT, Color::White());
+		g_render->SetRenderState(D3DRS_AMBIENT, Color::White());
 	}
 	
 	// what is this for?
 	// if disabled some stuff alpha channel is wrong
-	pd3dDevice->SetTextureStageState( 1, D3DTSS_TEXCOORDINDEX, 0 );
+	g_render->SetTextureStageState( 1, D3DTSS_TEXCOORDINDEX, 0 );
 
 	if (cacheEnable && g_gameControlBase->IsGameplayMode())
 	{
-		for (int k = 0; k < tileBufferCount; ++k)
-			RenderCached(k, layer, alpha);
+		RenderCached(layer, alpha);
 	}
 	else
 	{
@@ -294,167 +497,141 @@ void TerrainRender::Render(const Terrain& terrain, const Vector2 &pos, int layer
 		
 	}
 
-	pd3dDevice->SetRenderState(D3DRS_AMBIENT, savedAmbient);
-	pd3dDevice->SetTextureStageState( 0, D3DTSS_COLOROP,   D3DTOP_MODULATE);
-	pd3dDevice->SetRenderState(D3DRS_LIGHTING, TRUE);
+	g_render->SetRenderState(D3DRS_AMBIENT, savedAmbient);
+	g_render->SetTextureStageState( 0, D3DTSS_COLOROP,   D3DTOP_MODULATE);
+	g_render->SetRenderState(D3DRS_LIGHTING, TRUE);
 }
 
 void TerrainRender::UncacheTilesPrimitives(int tileBufferIndex, int layer)
 {
+	// the slot's range in the arena is left as is until it is reused
 	CachedTileBuffer& tileBuffer = tileBuffers[tileBufferIndex + layer*tileBufferCount];
 	tileBuffer.patch = NULL;
 }
 
 void TerrainRender::CacheTilesPrimitives(int tileBufferIndex, const TerrainPatch& patch, int layer)
 {
+	CacheStaging staging;
+	BuildTilesPrimitives(staging, patch, layer);
+	UploadTilesPrimitives(tileBufferIndex, patch, layer, staging);
+}
+
+void TerrainRender::UploadTilesPrimitives(int tileBufferIndex, const TerrainPatch& patch, int layer, const CacheStaging& staging)
+{
+	// keep a cpu copy of the verts so refreshes can reuse unchanged groups
 	CachedTileBuffer& tileBuffer = tileBuffers[tileBufferIndex + layer*tileBufferCount];
 	tileBuffer.patch = &patch;
+	tileBufferVertices[tileBufferIndex + layer*tileBufferCount] = staging.vertices;
+	const TerrainTile* layerTiles = &patch.tiles[layer*Terrain::patchSize*Terrain::patchSize];
+	tileBufferTiles[tileBufferIndex + layer*tileBufferCount].assign(layerTiles, layerTiles + Terrain::patchSize*Terrain::patchSize);
+	memcpy(tileBuffer.renderGroups, staging.renderGroups, sizeof(staging.renderGroups));
+	tileBuffer.groupCount = staging.groupCount;
+
+	// only this slot's range of the arena is written
+	WriteArenaVertices(tileBufferIndex, layer, 0, staging.vertices.size());
+}
 
-	struct SurfaceEdgeTile
-	{
-		SurfaceEdgeTile(Vector2 _pos, BYTE surface, BYTE edge, BYTE _tileSet, BYTE _rotation, bool _mirror) : pos(_pos), surfaceData(surface), edgeData(edge), tileSet(_tileSet), rotation(_rotation), mirror(_mirror) {}
+void TerrainRender::WriteArenaVertices(int tileBufferIndex, int layer, UINT startVertex, UINT vertexCount)
+{
+	const vector<TERRAIN_VERTEX>& vertices = tileBufferVertices[tileBufferIndex + layer*tileBufferCount];
+	ASSERT(startVertex + vertexCount <= vertices.size() && vertices.size() <= arenaSlotVertexCount);
+	if (vertexCount == 0 || vertices.size() > arenaSlotVertexCount)
+		return;
 
-		static bool SortCompare(const SurfaceEdgeTile& first, const SurfaceEdgeTile& second) 
-		{ 
-			if (first.tileSet != second.tileSet)
-				return (first.tileSet < second.tileSet);
-			
-			const GameSurfaceInfo& s1 = GameSurfaceInfo::Get(first.surfaceData);
-			const GameSurfaceInfo& s2 = GameSurfaceInfo::Get(second.surfaceData);
-			return s1 < s2;
-		}
+	// lock just this part of the slot's range, the rest of the arena is untouched
+	FrankRender::RenderPrimitive& rp = arenas[layer].rp;
+	const UINT offset = (tileBufferIndex*arenaSlotVertexCount + startVertex) * sizeof(TERRAIN_VERTEX);
+	TERRAIN_VERTEX* lockedVerts;
+	if (!SUCCEEDED(rp.vb->Lock(offset, vertexCount * sizeof(TERRAIN_VERTEX), (VOID**)&lockedVerts, 0)))
+		return;
 
-		Vector2 pos;
-		BYTE surfaceData;
-		BYTE edgeData;
-		BYTE tileSet;
-		BYTE rotation;
-		bool mirror;
-	};
-		
-	// create a list of all the tile surfaces in this patch
-	list<SurfaceEdgeTile> tileList;
-	for(int xPatch=0; xPatch<Terrain::patchSize; ++xPatch)
-	for(int yPatch=0; yPatch<Terrain::patchSize; ++yPatch)
+	memcpy(lockedVerts, &vertices[startVertex], vertexCount * sizeof(TERRAIN_VERTEX));
+	rp.vb->Unlock();
+}
+
+static bool RenderGroupSortCompare(const TerrainRender::CachedTileBuffer::TileRenderGroup& first, const TerrainRender::CachedTileBuffer::TileRenderGroup& second)
+{
+	if (first.tileSet != second.tileSet)
+		return (first.tileSet < second.tileSet);
+
+	const GameSurfaceInfo& s1 = GameSurfaceInfo::Get(first.surfaceID);
+	const GameSurfaceInfo& s2 = GameSurfaceInfo::Get(second.surfaceID);
+	return s1 < s2;
+}
+
+void TerrainRender::RenderCached(int layer, float alpha)
+{
+	if (layer < 0 || layer >= (int)arenas.size())
+		return;
+
+	TerrainArena& arena = arenas[layer];
+	arena.draws.clear();
+
+	// gather render groups from every cached patch that is on screen
+	for (int k = 0; k < tileBufferCount; ++k)
 	{
-		const TerrainTile& tile = patch.GetTileLocal(xPatch, yPatch, layer);
-		if (tile.IsClear())
-			continue; // skip clear tiles
+		const CachedTileBuffer& tileBuffer = tileBuffers[k + layer*tileBufferCount];
+		if (!tileBuffer.patch)
+			continue;
 
-		if (Terrain::tileSetCount > 0 && tile.GetTileSet() >= Terrain::tileSetCount)
-			continue;	// tileset out of range
+		// do a camera test on the full patch
+		if (!g_cameraBase->CameraTest(tileBuffer.patch->GetAABB()))
+			continue;
 
-		if (foregroundLayerOcculsion && layer == 1)
+		for (int i = 0; i < tileBuffer.groupCount && i < CachedTileBuffer::maxGroups; ++i)
 		{
-			// check if background tiles are completely blocked by foreground tile
-			const TerrainTile& tile0 = patch.GetTileLocal(xPatch, yPatch, 0);
-			const GameSurfaceInfo& surfaceInfo = GameSurfaceInfo::Get(tile0.GetSurfaceData(0));
-			if (tile0.IsFull() && !tile0.IsClear() && (surfaceInfo.flags & GSI_ForegroundOcclude))
+			CachedTileBuffer::TileRenderGroup draw = tileBuffer.renderGroups[i];
+			if (draw.vertexCount <= 2)
 				continue;
+
+			draw.startVertex += k*arenaSlotVertexCount;
+			arena.draws.push_back(draw);
 		}
-			
-		const Vector2 pos = patch.GetTilePos(xPatch, yPatch);
-		const BYTE surface0 = tile.GetSurfaceData(0);
-		if (surface0 && tile.GetSurfaceHasArea(0))
-			tileList.push_back(SurfaceEdgeTile(pos, surface0, tile.GetEdgeData(), tile.GetTileSet(), tile.GetRotation(), tile.GetMirror())); 
-			
-		const BYTE surface1 = tile.GetSurfaceData(1);
-		if (surface1 && tile.GetSurfaceHasArea(1))
-			tileList.push_back(SurfaceEdgeTile(pos, surface1, tile.GetInvertedEdgeData(), tile.GetTileSet(), tile.GetRotation(), tile.GetMirror())); 
 	}
-		
-	// sort list by surface info type
-	tileList.sort(SurfaceEdgeTile::SortCompare);
 
-	// clear out the tile buffer
-	for (int i = 0; i < CachedTileBuffer::maxGroups; ++i)
-		tileBuffer.renderGroups[i].vertexCount = 0;
-
-	// iterate through list and build vertex buffer
-	TERRAIN_VERTEX* lockedVerts;
-	if (!SUCCEEDED(tileBuffer.rp.vb->Lock(0, 0, (VOID**)&lockedVerts, D3DLOCK_DISCARD)))
+	if (arena.draws.empty() || !arena.rp.vb || !arena.ib)
 		return;
 
-	int vertexIndex = 0;
-	tileBuffer.groupCount = 0;
-	BYTE lastSurfaceData = 0;
-	BYTE lastTileSet = 0;
-	bool first = true;
+	// groups that render the same way are drawn together
+	stable_sort(arena.draws.begin(), arena.draws.end(), RenderGroupSortCompare);
 
-	for (list<SurfaceEdgeTile>::iterator it = tileList.begin(); it != tileList.end(); ++it) 
+	// each slot has its own range of the arena so visible ranges never touch
+	// tiles start and end with degenerate tris so the ranges of a batch can be joined with indices
+	arena.batches.clear();
+	arena.indices.clear();
+	for (UINT i = 0; i < arena.draws.size(); )
 	{
-		SurfaceEdgeTile& tile = *it;
-
-		// get vert list for the tile
-		const Vector2 *edgeVerts = NULL;
-		int vertexCount;
-		TerrainTile::GetVertList(edgeVerts, vertexCount, tile.edgeData);
-		const BYTE surfaceData = tile.surfaceData;
-		const BYTE rotation = tile.rotation;
-		const bool mirror = tile.mirror;
-		const GameSurfaceInfo& surfaceInfo = GameSurfaceInfo::Get(tile.surfaceData);
-		const GameSurfaceInfo& lastSurfaceInfo = GameSurfaceInfo::Get(lastSurfaceData);
-
-		// check if it's a new group
-		if (first || !surfaceInfo.IsSameRenderGroup(lastSurfaceInfo) || tile.tileSet != lastTileSet )
+		const CachedTileBuffer::TileRenderGroup& first = arena.draws[i];
+		const GameSurfaceInfo& surfaceInfo = GameSurfaceInfo::Get(first.surfaceID);
+
+		TerrainArena::Batch batch;
+		batch.firstDraw = i;
+		batch.startIndex = arena.indices.size();
+		UINT minVertex = first.startVertex;
+		UINT maxVertex = first.startVertex;
+		do
 		{
-			// init the new group
-			first = false;
-			++tileBuffer.groupCount;
-			CachedTileBuffer::TileRenderGroup& tileRenderGroup = tileBuffer.renderGroups[tileBuffer.groupCount-1];
-			tileRenderGroup.startVertex = vertexIndex;
-			tileRenderGroup.tileSet = tile.tileSet;
-			tileRenderGroup.surfaceID = surfaceData;
-			lastSurfaceData = surfaceData;
-			lastTileSet = tile.tileSet;
-		}
-			
-		CachedTileBuffer::TileRenderGroup& tileRenderGroup = tileBuffer.renderGroups[tileBuffer.groupCount-1];
-		
-		// degenerate tri on start
-		SetupVert(&lockedVerts[vertexIndex++], tile.pos + edgeVerts[0], edgeVerts[0], surfaceInfo, surfaceData, rotation, mirror);
-		SetupVert(&lockedVerts[vertexIndex++], tile.pos + edgeVerts[0], edgeVerts[0], surfaceInfo, surfaceData, rotation, mirror);
-			
-		int leftPos = vertexCount-1;
-		int rightPos = 1;
-		while (1)
-		{
-			Vector2 edgeVert = edgeVerts[rightPos++];
-			Vector2 pos = tile.pos + edgeVert;
-			SetupVert(&lockedVerts[vertexIndex++], pos, edgeVert, surfaceInfo, surfaceData, rotation, mirror);
-			if (rightPos > leftPos)
-			{
-				// degerate tri on ends
-				SetupVert(&lockedVerts[vertexIndex++], pos, edgeVert, surfaceInfo, surfaceData, rotation, mirror);
-				break;
-			}
-				
-			edgeVert = edgeVerts[leftPos--];
-			pos = tile.pos + edgeVert;
-			SetupVert(&lockedVerts[vertexIndex++], pos, edgeVert, surfaceInfo, surfaceData, rotation, mirror);
-			if (leftPos < rightPos)
-			{
-				// degerate tri on ends
-				SetupVert(&lockedVerts[vertexIndex++], pos, edgeVert, surfaceInfo, surfaceData, rotation, mirror);
-				break;
-			}
+			const CachedTileBuffer::TileRenderGroup& draw = arena.draws[i];
+			for (UINT v = draw.startVertex; v < draw.startVertex + draw.vertexCount; ++v)
+				arena.indices.push_back(v);
+			minVertex = Min(minVertex, draw.startVertex);
+			maxVertex = Max(maxVertex, draw.startVertex + draw.vertexCount);
+			++i;
 		}
+		while (i < arena.draws.size() && arena.draws[i].tileSet == first.tileSet && GameSurfaceInfo::Get(arena.draws[i].surfaceID).IsSameRenderGroup(surfaceInfo));
 
-		tileRenderGroup.vertexCount += vertexCount + 2;
+		batch.drawCount = i - batch.firstDraw;
+		batch.indexCount = arena.indices.size() - batch.startIndex;
+		batch.minVertex = minVertex;
+		batch.vertexRange = maxVertex - minVertex;
+		arena.batches.push_back(batch);
 	}
-	tileBuffer.rp.vb->Unlock();
-}
-
-void TerrainRender::RenderCached(int tileBufferIndex, int layer, float alpha)
-{
-	const CachedTileBuffer& tileBuffer = tileBuffers[tileBufferIndex + layer*tileBufferCount];
 
-	if (!tileBuffer.patch)
-		return;
-
-	// do a camera test on the full patch
-	if (!g_cameraBase->CameraTest(tileBuffer.patch->GetAABB()))
+	UINT* lockedIndices = NULL;
+	if (!SUCCEEDED(arena.ib->Lock(0, arena.indices.size() * sizeof(UINT), (VOID**)&lockedIndices, D3DLOCK_DISCARD)))
 		return;
+	memcpy(lockedIndices, &arena.indices[0], arena.indices.size() * sizeof(UINT));
+	arena.ib->Unlock();
 
 	IDirect3DDevice9* pd3dDevice = DXUTGetD3D9Device();
 	const DeferredRender::RenderPass renderPass = DeferredRender::GetRenderPass();
@@ -465,18 +642,17 @@ void TerrainRender::RenderCached(int tileBufferIndex, int layer, float alpha)
 	pd3dDevice->SetTransform(D3DTS_WORLD, &matrixIdentity);
 
 	// set the primitive
-	pd3dDevice->SetStreamSource(0, tileBuffer.rp.vb, 0, tileBuffer.rp.stride);
-	pd3dDevice->SetFVF(tileBuffer.rp.fvf);
+	pd3dDevice->SetStreamSource(0, arena.rp.vb, 0, arena.rp.stride);
+	pd3dDevice->SetFVF(arena.rp.fvf);
+	pd3dDevice->SetIndices(arena.ib);
 
-	for (int i = 0; i < CachedTileBuffer::maxGroups; ++i)
+	for (vector<TerrainArena::Batch>::const_iterator it = arena.batches.begin(); it != arena.batches.end(); ++it)
 	{
-		// push out a render for each tile group
-		const CachedTileBuffer::TileRenderGroup& tileRenderGroup = tileBuffer.renderGroups[i];
+		// set up the render state once for each group of tiles across all visible patches
+		const TerrainArena::Batch& batch = *it;
+		const CachedTileBuffer::TileRenderGroup& tileRenderGroup = arena.draws[batch.firstDraw];
 		const GameSurfaceInfo& surfaceInfo = GameSurfaceInfo::Get(tileRenderGroup.surfaceID);
 
-		if (tileRenderGroup.vertexCount <= 2)
-			continue;
-
 		// set the texture
 		LPDIRECT3DTEXTURE9 texture = NULL;
 		if (Terrain::tileSetCount > 0)
@@ -516,10 +692,10 @@ void TerrainRender::RenderCached(int tileBufferIndex, int layer, float alpha)
 				else
 					texture = g_render->GetTexture(surfaceInfo.ti, false);
 				
-				pd3dDevice->SetTextureStageState( 0, D3DTSS_COLOROP,   D3DTOP_SELECTARG2 );
-				pd3dDevice->SetTextureStageState( 0, D3DTSS_COLORARG2, D3DTA_DIFFUSE );
-				pd3dDevice->SetTextureStageState( 0, D3DTSS_ALPHAOP,   D3DTOP_SELECTARG1 );
-				pd3dDevice->SetTextureStageState( 0, D3DTSS_ALPHAARG1, D3DTA_TEXTURE );
+				g_render->SetTextureStageState( 0, D3DTSS_COLOROP,   D3DTOP_SELECTARG2 );
+				g_render->SetTextureStageState( 0, D3DTSS_COLORARG2, D3DTA_DIFFUSE );
+				g_render->SetTextureStageState( 0, D3DTSS_ALPHAOP,   D3DTOP_SELECTARG1 );
+				g_render->SetTextureStageState( 0, D3DTSS_ALPHAARG1, D3DTA_TEXTURE );
 			}
 			else if (DeferredRender::GetRenderPassIsEmissive() || DeferredRender::GetRenderPassIsSpecular() || DeferredRender::GetRenderPassIsNormalMap())
 			{
@@ -535,18 +711,18 @@ void TerrainRender::RenderCached(int tileBufferIndex, int layer, float alpha)
 				else
 					textureDiffuse = g_render->GetTexture(surfaceInfo.ti, false);
 					
-				pd3dDevice->SetTexture( 1, textureDiffuse );
-				pd3dDevice->SetTextureStageState( 1, D3DTSS_COLOROP,   D3DTOP_SELECTARG2 );
-				pd3dDevice->SetTextureStageState( 1, D3DTSS_COLORARG2, D3DTA_CURRENT );
-				pd3dDevice->SetTextureStageState( 1, D3DTSS_ALPHAOP,   D3DTOP_MODULATE );
-				pd3dDevice->SetTextureStageState( 1, D3DTSS_ALPHAARG1, D3DTA_TEXTURE );
-				pd3dDevice->SetTextureStageState( 1, D3DTSS_ALPHAARG2, D3DTA_CURRENT );
+				g_render->SetTexture( 1, textureDiffuse );
+				g_render->SetTextureStageState( 1, D3DTSS_COLOROP,   D3DTOP_SELECTARG2 );
+				g_render->SetTextureStageState( 1, D3DTSS_COLORARG2, D3DTA_CURRENT );
+				g_render->SetTextureStageState( 1, D3DTSS_ALPHAOP,   D3DTOP_MODULATE );
+				g_render->SetTextureStageState( 1, D3DTSS_ALPHAARG1, D3DTA_TEXTURE );
+				g_render->SetTextureStageState( 1, D3DTSS_ALPHAARG2, D3DTA_CURRENT );
 			}
 			else
 				color = Color::White();
 		}
 
-		pd3dDevice->SetTexture(0, texture);
+		g_render->SetTexture(0, texture);
 
 		const D3DMATERIAL9 material =
 		{
@@ -555,12 +731,12 @@ void TerrainRender::RenderCached(int tileBufferIndex, int layer, float alpha)
 			{0, 0, 0, 0},
 			{0, 0, 0, 0}, 0
 		};
-		pd3dDevice->SetMaterial(&material);
+		g_render->SetMaterial(&material);
 		
 		if (terrainRenderBatchDebug == 0 || (terrainRenderBatchDebug == renderedBatchCount && DeferredRender::GetRenderPass() == 0))
 		{
-			UINT primitiveCount = tileRenderGroup.vertexCount - 2;
-			pd3dDevice->DrawPrimitive(tileBuffer.rp.primitiveType, tileRenderGroup.startVertex, primitiveCount);
+			const UINT primitiveCount = batch.indexCount - 2;
+			pd3dDevice->DrawIndexedPrimitive(arena.rp.primitiveType, 0, batch.minVertex, batch.vertexRange, batch.startIndex, primitiveCount);
 			renderedPrimitiveCount += primitiveCount;
 		}
 		if (DeferredRender::GetRenderPass() == 0)
@@ -568,15 +744,15 @@ void TerrainRender::RenderCached(int tileBufferIndex, int layer, float alpha)
 
 		{
 			// set stuff back to normal
-			pd3dDevice->SetTextureStageState( 0, D3DTSS_COLOROP,   D3DTOP_MODULATE );
-			pd3dDevice->SetTextureStageState( 0, D3DTSS_COLORARG1, D3DTA_TEXTURE );
-			pd3dDevice->SetTextureStageState( 0, D3DTSS_COLORARG2, D3DTA_DIFFUSE );
-			pd3dDevice->SetTextureStageState( 0, D3DTSS_ALPHAOP,   D3DTOP_MODULATE );
-			pd3dDevice->SetTextureStageState( 0, D3DTSS_ALPHAARG1, D3DTA_TEXTURE );
-			pd3dDevice->SetTextureStageState( 0, D3DTSS_ALPHAARG2, D3DTA_DIFFUSE );
-			pd3dDevice->SetTextureStageState( 1, D3DTSS_COLOROP,   D3DTOP_DISABLE );
-			pd3dDevice->SetTextureStageState( 1, D3DTSS_ALPHAOP,   D3DTOP_DISABLE );
-			pd3dDevice->SetTexture( 1, NULL );
+			g_render->SetTextureStageState( 0, D3DTSS_COLOROP,   D3DTOP_MODULATE );
+			g_render->SetTextureStageState( 0, D3DTSS_COLORARG1, D3DTA_TEXTURE );
+			g_render->SetTextureStageState( 0, D3DTSS_COLORARG2, D3DTA_DIFFUSE );
+			g_render->SetTextureStageState( 0, D3DTSS_ALPHAOP,   D3DTOP_MODULATE );
+			g_render->SetTextureStageState( 0, D3DTSS_ALPHAARG1, D3DTA_TEXTURE );
+			g_render->SetTextureStageState( 0, D3DTSS_ALPHAARG2, D3DTA_DIFFUSE );
+			g_render->SetTextureStageState( 1, D3DTSS_COLOROP,   D3DTOP_DISABLE );
+			g_render->SetTextureStageState( 1, D3DTSS_ALPHAOP,   D3DTOP_DISABLE );
+			g_render->SetTexture( 1, NULL );
 		}
 	}
 }
@@ -587,8 +763,8 @@ void TerrainRender::RenderTiles(TerrainTile* tiles, const Vector2& pos, int widt
 	IDirect3DDevice9* pd3dDevice = DXUTGetD3D9Device();
 	
 	// set up texture transforming
-	pd3dDevice->SetTextureStageState(0, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_COUNT2);
-	pd3dDevice->SetTextureStageState(1, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_COUNT2);
+	g_render->SetTextureStageState(0, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_COUNT2);
+	g_render->SetTextureStageState(1, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_COUNT2);
 	pd3dDevice->SetSamplerState( 0, D3DSAMP_ADDRESSU, D3DTADDRESS_WRAP );
 	pd3dDevice->SetSamplerState( 0, D3DSAMP_ADDRESSV, D3DTADDRESS_WRAP );
 	const Vector2 halfOffset = Vector2(0.5f * TerrainTile::GetSize());
@@ -657,8 +833,8 @@ void TerrainRender::RenderTiles(TerrainTile* tiles, const Vector2& pos, int widt
 		}
 	}
 
-	pd3dDevice->SetTextureStageState(0, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_DISABLE);
-	pd3dDevice->SetTextureStageState(1, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_DISABLE);
+	g_render->SetTextureStageState(0, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_DISABLE);
+	g_render->SetTextureStageState(1, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_DISABLE);
 
 	g_render->RenderSimpleVerts();
 }
@@ -669,12 +845,11 @@ void TerrainRender::RenderSlow(const TerrainPatch& patch, int layer, float alpha
 	if (cameraTest && !g_cameraBase->CameraTest(patch.GetAABB()))
 		return;
 
-	IDirect3DDevice9* pd3dDevice = DXUTGetD3D9Device();
 	const DeferredRender::RenderPass renderPass = DeferredRender::GetRenderPass();
 
 	// set up texture transforming
-	pd3dDevice->SetTextureStageState(0, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_COUNT2);
-	pd3dDevice->SetTextureStageState(1, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_COUNT2);
+	g_render->SetTextureStageState(0, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_COUNT2);
+	g_render->SetTextureStageState(1, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_COUNT2);
 	const Vector2 halfOffset = Vector2(0.5f * TerrainTile::GetSize());
 
 	for(int xPatch=0; xPatch<Terrain::patchSize; ++xPatch)
@@ -731,8 +906,8 @@ void TerrainRender::RenderSlow(const TerrainPatch& patch, int layer, float alpha
 		}
 	}
 
-	pd3dDevice->SetTextureStageState(0, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_DISABLE);
-	pd3dDevice->SetTextureStageState(1, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_DISABLE);
+	g_render->SetTextureStageState(0, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_DISABLE);
+	g_render->SetTextureStageState(1, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_DISABLE);
 }
 
 void TerrainRender::RenderToTexture(const Terrain& terrain, RenderToTileCallback preCallback, RenderToTileCallback postCallback)
@@ -769,18 +944,18 @@ void TerrainRender::RenderToTexture(const Terrain& terrain, RenderToTileCallback
 		D3DXMatrixIdentity(&viewMatrix);
 		pd3dDevice->SetTransform(D3DTS_VIEW, &viewMatrix);
 		
-		pd3dDevice->SetRenderState(D3DRS_ALPHABLENDENABLE, TRUE);
-		pd3dDevice->SetRenderState(D3DRS_ALPHATESTENABLE, FALSE); 
-		pd3dDevice->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
-		pd3dDevice->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
+		g_render->SetRenderState(D3DRS_ALPHABLENDENABLE, TRUE);
+		g_render->SetRenderState(D3DRS_ALPHATESTENABLE, FALSE); 
+		g_render->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
+		g_render->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
 
 		// Set up the textures
-		pd3dDevice->SetTextureStageState( 0, D3DTSS_COLOROP,   D3DTOP_MODULATE );
-		pd3dDevice->SetTextureStageState( 0, D3DTSS_COLORARG1, D3DTA_TEXTURE );
-		pd3dDevice->SetTextureStageState( 0, D3DTSS_COLORARG2, D3DTA_DIFFUSE );
-		pd3dDevice->SetTextureStageState( 0, D3DTSS_ALPHAOP,   D3DTOP_MODULATE );
-		pd3dDevice->SetTextureStageState( 0, D3DTSS_ALPHAARG1, D3DTA_TEXTURE );
-		pd3dDevice->SetTextureStageState( 0, D3DTSS_ALPHAARG2, D3DTA_DIFFUSE );
+		g_render->SetTextureStageState( 0, D3DTSS_COLOROP,   D3DTOP_MODULATE );
+		g_render->SetTextureStageState( 0, D3DTSS_COLORARG1, D3DTA_TEXTURE );
+		g_render->SetTextureStageState( 0, D3DTSS_COLORARG2, D3DTA_DIFFUSE );
+		g_render->SetTextureStageState( 0, D3DTSS_ALPHAOP,   D3DTOP_MODULATE );
+		g_render->SetTextureStageState( 0, D3DTSS_ALPHAARG1, D3DTA_TEXTURE );
+		g_render->SetTextureStageState( 0, D3DTSS_ALPHAARG2, D3DTA_DIFFUSE );
 		pd3dDevice->SetSamplerState( 0, D3DSAMP_MINFILTER, D3DTEXF_LINEAR );
 		pd3dDevice->SetSamplerState( 0, D3DSAMP_MAGFILTER, D3DTEXF_LINEAR );
 		pd3dDevice->SetSamplerState( 0, D3DSAMP_MIPFILTER, D3DTEXF_LINEAR );
@@ -791,25 +966,25 @@ void TerrainRender::RenderToTexture(const Terrain& terrain, RenderToTileCallback
 		pd3dDevice->SetSamplerState( 0, D3DSAMP_MAGFILTER, D3DTEXF_LINEAR );
 		pd3dDevice->SetSamplerState( 0, D3DSAMP_MIPFILTER, D3DTEXF_LINEAR );
 
-		pd3dDevice->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
-		pd3dDevice->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
+		g_render->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
+		g_render->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
 
 		// Set miscellaneous render states
-		pd3dDevice->SetRenderState( D3DRS_DITHERENABLE,   FALSE );
-		pd3dDevice->SetRenderState( D3DRS_SPECULARENABLE, FALSE );
-		pd3dDevice->SetRenderState( D3DRS_AMBIENT,        0x00FFFFFF );
-		pd3dDevice->SetRenderState( D3DRS_ALPHABLENDENABLE, FALSE);
-		pd3dDevice->SetRenderState( D3DRS_ZENABLE, FALSE);
-		pd3dDevice->SetRenderState( D3DRS_ZWRITEENABLE, FALSE);
-		pd3dDevice->SetRenderState( D3DRS_LIGHTING, TRUE);
-		pd3dDevice->SetRenderState( D3DRS_CULLMODE, D3DCULL_NONE);
-		pd3dDevice->SetRenderState( D3DRS_ALPHATESTENABLE, FALSE);
+		g_render->SetRenderState( D3DRS_DITHERENABLE,   FALSE );
+		g_render->SetRenderState( D3DRS_SPECULARENABLE, FALSE );
+		g_render->SetRenderState( D3DRS_AMBIENT,        0x00FFFFFF );
+		g_render->SetRenderState( D3DRS_ALPHABLENDENABLE, FALSE);
+		g_render->SetRenderState( D3DRS_ZENABLE, FALSE);
+		g_render->SetRenderState( D3DRS_ZWRITEENABLE, FALSE);
+		g_render->SetRenderState( D3DRS_LIGHTING, TRUE);
+		g_render->SetRenderState( D3DRS_CULLMODE, D3DCULL_NONE);
+		g_render->SetRenderState( D3DRS_ALPHATESTENABLE, FALSE);
 
 		if (preCallback)
 			preCallback();
 
 		// set up texture transforming
-		pd3dDevice->SetTextureStageState(0, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_COUNT2);
+		g_render->SetTextureStageState(0, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_COUNT2);
 
 		// render all the tiles
 		for(int i=0; i<Terrain::fullSize.x; ++i)
@@ -847,10 +1022,10 @@ void TerrainRender::RenderToTexture(const Terrain& terrain, RenderToTileCallback
 			}
 		}
 
-		pd3dDevice->SetTextureStageState(0, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_DISABLE);
-		pd3dDevice->SetRenderState(D3DRS_ALPHABLENDENABLE, TRUE);
-		pd3dDevice->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
-		pd3dDevice->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
+		g_render->SetTextureStageState(0, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_DISABLE);
+		g_render->SetRenderState(D3DRS_ALPHABLENDENABLE, TRUE);
+		g_render->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
+		g_render->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
 
 		if (postCallback)
 			postCallback();
@@ -897,23 +1072,39 @@ void TerrainRender::InitDeviceObjects()
 		rp.vb->Unlock();
 	} 
 
-	const int patchVertCount = Terrain::patchSize*Terrain::patchSize*(TERRAIN_TILE_MAX_VERTS+2)*2;
+	// each slot has a fixed range in the arena big enough for both surfaces of every tile
+	arenaSlotVertexCount = Terrain::patchSize*Terrain::patchSize*(TERRAIN_TILE_MAX_VERTS+2)*2;
 	const int tileBufferWidth = Terrain::renderWindowSize * 2 + 1;
-	tileBufferCount = tileBufferWidth*tileBufferWidth;
+	const int budget = (cachePatchBudget > 0)? cachePatchBudget : (tileBufferWidth+2)*(tileBufferWidth+2);
+	tileBufferCount = Max(budget, tileBufferWidth*tileBufferWidth);
 	tileBuffers = new CachedTileBuffer[tileBufferCount*Terrain::patchLayers];
-	for (int i = 0; i < tileBufferCount*Terrain::patchLayers; ++i)
+	tileBufferVertices.assign(tileBufferCount*Terrain::patchLayers, vector<TERRAIN_VERTEX>());
+	tileBufferTiles.assign(tileBufferCount*Terrain::patchLayers, vector<TerrainTile>());
+
+	// each layer has one arena large enough to hold every slot
+	arenas.resize(Terrain::patchLayers);
+	for (int l = 0; l < Terrain::patchLayers; ++l)
 	{
-		tileBuffers[i].rp.Create
+		arenas[l].rp.Create
 		(
-			0,							// primitiveCount
-			patchVertCount,				// vertexCount
-			D3DPT_TRIANGLESTRIP,		// primitiveType
-			sizeof(TERRAIN_VERTEX),		// stride
-			D3DFVF_TERRAIN_VERTEX,		// fvf
-			true						// dynamic
+			0,									// primitiveCount
+			arenaSlotVertexCount*tileBufferCount,	// vertexCount
+			D3DPT_TRIANGLESTRIP,				// primitiveType
+			sizeof(TERRAIN_VERTEX),				// stride
+			D3DFVF_TERRAIN_VERTEX,				// fvf
+			true								// dynamic
 		);
+		arenas[l].draws.clear();
 
+		// slot ranges never overlap so the visible ranges never need more indices than the arena has verts
+		const UINT indexCount = arenaSlotVertexCount*tileBufferCount;
+		DXUTGetD3D9Device()->CreateIndexBuffer(indexCount*sizeof(UINT), D3DUSAGE_WRITEONLY|D3DUSAGE_DYNAMIC, D3DFMT_INDEX32, D3DPOOL_DEFAULT, &arenas[l].ib, NULL);
+	}
+
+	for (int i = 0; i < tileBufferCount*Terrain::patchLayers; ++i)
+	{
 		tileBuffers[i].patch = NULL;
+		tileBuffers[i].groupCount = 0;
 
 		// clear render groups
 		for (int j = 0; j < CachedTileBuffer::maxGroups; ++j)
@@ -926,6 +1117,15 @@ void TerrainRender::InitDeviceObjects()
 		}
 	}
 
+	// all slots start out free
+	patchSlots.clear();
+	slotLRU.clear();
+	slotLRUIterators.assign(tileBufferCount, slotLRU.end());
+	slotLastUsed.assign(tileBufferCount, 0);
+	freeSlots.clear();
+	for (int i = tileBufferCount-1; i >= 0; --i)
+		freeSlots.push_back(i);
+
 	ClearCache();
 }
 
@@ -936,12 +1136,24 @@ void TerrainRender::DestroyDeviceObjects()
 
 	SAFE_RELEASE(renderTexture);
 	
-	for (int i = 0; i < tileBufferCount*Terrain::patchLayers; ++i)
-		tileBuffers[i].rp.SafeRelease();
+	for (vector<TerrainArena>::iterator it = arenas.begin(); it != arenas.end(); ++it)
+	{
+		it->rp.SafeRelease();
+		SAFE_RELEASE(it->ib);
+	}
+	arenas.clear();
+	tileBufferVertices.clear();
+	tileBufferTiles.clear();
 	tileBufferCount = 0;
 
 	delete [] tileBuffers;
 	tileBuffers = NULL;
+
+	patchSlots.clear();
+	slotLRU.clear();
+	slotLRUIterators.clear();
+	slotLastUsed.clear();
+	freeSlots.clear();
 }
 
 void TerrainRender::BuildTriStrip(TERRAIN_VERTEX* vertices, FrankRender::RenderPrimitive& rp, int tileIndex)
@@ -1043,45 +1255,6 @@ inline void TerrainRender::RenderTile(const Vector2& position, const BYTE edgeIn
 	}
 }
 
-inline void TerrainRender::SetupVert(TERRAIN_VERTEX* vertex, const Vector2& worldPos, const Vector2& localPos, const GameSurfaceInfo& surfaceInfo, const BYTE surfaceID, const BYTE tileRotation, bool tileMirror)
-{
-	if (Terrain::tileSetCount > 0 || g_render->GetTextureTileSheet(surfaceInfo.ti))
-	{
-		// tile set mode
-		float rotation = float(tileRotation) * PI / 2;
-
-		Vector2 localPos2 = Vector2(localPos.x, TerrainTile::GetSize() - localPos.y);
-		localPos2 -= Vector2(0.5f);
-		if (tileMirror)
-			localPos2.x *= -1;
-		localPos2 = localPos2.Rotate(rotation);
-		localPos2 += Vector2(0.5f);
-
-		if (g_tileSetUVScale > 0)
-		{
-			// hack: scale uvs when non point filtered
-			const Vector2 offset(TerrainTile::GetSize()/2);
-			localPos2 -= offset;
-			localPos2 *= g_tileSetUVScale;
-			localPos2 += offset;
-		}
-			
-		const ByteVector2 tileSize(16, 16);
-		const ByteVector2 tilePos(surfaceID % 16, surfaceID / 16);
-		const Vector2 scale = 1.0f / (TerrainTile::GetSize() * Vector2(tileSize));
-		const Vector2 tilePosFloat = localPos2 * scale + Vector2(tilePos) / Vector2(tileSize);
-
-		vertex->position = Vector3(worldPos.x, worldPos.y, 0);
-		vertex->textureCoords = tilePosFloat;
-	}
-	else
-	{
-		vertex->position = Vector3(worldPos.x, worldPos.y, 0);
-		const Vector2 texturePos = worldPos / (TerrainTile::GetSize()*surfaceInfo.textureWrapSize*textureWrapScale);
-		vertex->textureCoords = texturePos * Vector2(1, -1);
-	}
-}
-
 inline void TerrainRender::SetupVertUnwrapped(TERRAIN_VERTEX* vertex, const Vector2& pos)
 {
 	vertex->position = Vector3(pos.x, pos.y, 0);
@@ -5,12 +5,19 @@
 	
 	- renders tile based terrain
 	- caches verts to optimize rendering
+	- cached patches are kept in a fixed set of slots with lru eviction
+	- patch verts are generated on worker threads, only the upload happens on the main thread
+	- each cache slot has a fixed range in its layer's arena so caching a patch only writes that range
+	- visible patches are camera tested and their groups are drawn together by render group
+	- refreshing a cached patch only rebuilds render groups that contain changed tiles
+	  and writes them over the old ones in the patch's range of the arena
 */
 ////////////////////////////////////////////////////////////////////////////////////////
 
 #pragma once
 
 #include "../terrain/terrainTile.h"
+#include <unordered_map>
 
 extern class TerrainRender g_terrainRender;
 
@@ -36,13 +43,14 @@ public:
 	void RefereshCached(TerrainPatch& patch);
 	bool IsPatchCached(TerrainPatch& patch);
 
+	// time cpu vertex generation for every patch in the terrain, does not touch the device
+	double BenchmarkVertexGeneration(int threadCount, int& vertexCount);
+
 	void RenderTile(const Vector2& position, const BYTE edgeIndex, const BYTE surfaceID, const BYTE tileSet, const GameSurfaceInfo& surfaceInfo, const Color& color, const BYTE tileRotation, bool tileMirror);
 	void RenderSlow(const TerrainPatch& patch, int layer = 0, float alpha = 1, const Vector2& offset = Vector2(0), bool cameraTest = true);
 
 	struct CachedTileBuffer
 	{
-		FrankRender::RenderPrimitive rp;
-		
 		static const int maxGroups = 512;
 		struct TileRenderGroup
 		{
@@ -58,11 +66,22 @@ public:
 	
 	int renderedPrimitiveCount;
 	int renderedBatchCount;
+
+	// cache stats since the cache was last cleared
+	int GetCachedPatchCount() const	{ return patchSlots.size(); }
+	int GetCacheSlotCount() const	{ return tileBufferCount; }
+	int cacheHitCount;
+	int cacheMissCount;
+	int cacheEvictCount;
 	
 	static bool enableRender;
 	static bool showEdgePoints;
 	static bool foregroundLayerOcculsion;
 	static bool limitCacheUpdate;
+	static int cacheUpdateLimit;
+	static int cachePatchBudget;
+	static int cachePrefetchDistance;
+	static int cacheThreadCount;
 	static bool useAlpha;
 	static bool cacheEnable;
 	static bool enableDiffuseLighting;
@@ -79,17 +98,83 @@ private:
 	};
 
 	void BuildTriStrip(TERRAIN_VERTEX* vertices, FrankRender::RenderPrimitive& rp, int tileIndex);
+	// cpu side verts for a patch layer before they are uploaded
+	struct CacheStaging
+	{
+		vector<TERRAIN_VERTEX> vertices;
+		CachedTileBuffer::TileRenderGroup renderGroups[CachedTileBuffer::maxGroups];
+		int groupCount;
+	};
+
+	struct CacheJob
+	{
+		const TerrainPatch* patch;
+		int tileBufferIndex;
+		int layer;
+		CacheStaging staging;
+	};
+
 	void CacheTilesPrimitives(int tileBufferIndex, const TerrainPatch& patch, int layer);
+	void BuildTilesPrimitives(CacheStaging& staging, const TerrainPatch& patch, int layer, const vector<CachedTileBuffer::TileRenderGroup>* onlyGroups = NULL) const;
+	void RefreshCachedLayer(int tileBufferIndex, const TerrainPatch& patch, int layer, const vector<bool>& dirtyTiles);
+	void UploadTilesPrimitives(int tileBufferIndex, const TerrainPatch& patch, int layer, const CacheStaging& staging);
+	void BuildCacheJobs(vector<CacheJob>& jobs, int threadCount) const;
+	static int FindRenderGroup(const CachedTileBuffer::TileRenderGroup* groups, int groupCount, BYTE tileSet, BYTE surfaceID);
+
+	// one vertex buffer per layer that holds the verts for every cache slot
+	struct TerrainArena
+	{
+		// visible groups that render the same way, drawn with one indexed draw
+		struct Batch
+		{
+			UINT firstDraw;
+			UINT drawCount;
+			UINT startIndex;
+			UINT indexCount;
+			UINT minVertex;
+			UINT vertexRange;
+		};
+
+		TerrainArena() : ib(NULL) {}
+
+		FrankRender::RenderPrimitive rp;
+		LPDIRECT3DINDEXBUFFER9 ib;							// rebuilt each render to join the visible ranges
+		vector<CachedTileBuffer::TileRenderGroup> draws;	// reused each render for the visible groups
+		vector<Batch> batches;
+		vector<UINT> indices;
+	};
+
+	void WriteArenaVertices(int tileBufferIndex, int layer, UINT startVertex, UINT vertexCount);
 	void UncacheTilesPrimitives(int tileBufferIndex, int layer);
-	void RenderCached(int tileBufferIndex, int layer, float alpha);
+	void RenderCached(int layer, float alpha);
+
+	int GetCacheSlot(const TerrainPatch& patch) const;
+	int AllocateCacheSlot();
+	void CachePatch(int slot, const TerrainPatch& patch);
+	void UncachePatch(int slot);
+	void TouchCacheSlot(int slot);
 
 	FrankRender::RenderPrimitive tilePrimitives[TERRAIN_UNIQUE_TILE_COUNT];
 	CachedTileBuffer* tileBuffers;
 	int tileBufferCount;
 	bool cacheNeedsFullRefresh;
+
+	unordered_map<const TerrainPatch*, int> patchSlots;	// which slot each cached patch is in
+	list<int> slotLRU;									// used slots, most recently used first
+	vector<list<int>::iterator> slotLRUIterators;		// where each used slot is in the lru list
+	vector<UINT> slotLastUsed;							// cache update when each slot was last needed
+	vector<int> freeSlots;
+	vector<CacheJob> cacheJobs;							// reused so staging memory is not reallocated
+	vector< vector<TERRAIN_VERTEX> > tileBufferVertices;	// cpu copy of verts for each tile buffer
+	vector< vector<TerrainTile> > tileBufferTiles;		// tiles each tile buffer was built from
+	vector<TerrainArena> arenas;						// one per layer
+	UINT arenaSlotVertexCount;							// size of each slot's range in the arena
+	UINT cacheUpdateCount;
+	IntVector2 lastCacheWindowPatch;
+	Vector2 lastCachePos;
 	LPDIRECT3DTEXTURE9 renderTexture;
 
-	void SetupVert(TERRAIN_VERTEX* vertex, const Vector2& worldPos, const Vector2& localPos, const GameSurfaceInfo& surfaceInfo, const BYTE surfaceID, const BYTE tileRotation, bool tileMirror);
+	void SetupVert(TERRAIN_VERTEX* vertex, const Vector2& worldPos, const Vector2& localPos, const GameSurfaceInfo& surfaceInfo, const BYTE surfaceID, const BYTE tileRotation, bool tileMirror) const;
 	void SetupVertUnwrapped(TERRAIN_VERTEX* vertex, const Vector2& pos);
 };
 
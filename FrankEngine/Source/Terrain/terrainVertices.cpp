@@ -0,0 +1,283 @@
+////////////////////////////////////////////////////////////////////////////////////////
+/*
+	Terrain Vertices
+	Copyright 2013 Frank Force - http://www.frankforce.com
+
+	- cpu side vertex generation for cached terrain patches
+	- nothing here touches the device so it can run on worker threads
+	- also built for web and headless so the vertex benchmark works everywhere
+*/
+////////////////////////////////////////////////////////////////////////////////////////
+
+#include "frankEngine.h"
+#include "../terrain/terrain.h"
+#include "../terrain/terrainRender.h"
+#include <chrono>
+
+float TerrainRender::textureWrapScale = 8;
+ConsoleCommand(TerrainRender::textureWrapScale, terrainTextureWrapScale)
+
+bool TerrainRender::foregroundLayerOcculsion = false;
+ConsoleCommand(TerrainRender::foregroundLayerOcculsion, foregroundLayerOcculsion)
+
+int TerrainRender::cacheThreadCount = 0;		// how many threads generate patch verts, 0 uses all cores
+ConsoleCommand(TerrainRender::cacheThreadCount, terrainCacheThreadCount)
+
+ConsoleFunction(terrainVertexBenchmark)
+{
+	if (!g_terrain)
+		return;
+
+	// compare single thread vertex generation to all worker threads
+	const int threadCount = JobPool::GetThreadCount(TerrainRender::cacheThreadCount);
+	int vertexCount = 0;
+	const double singleTime = g_terrainRender.BenchmarkVertexGeneration(1, vertexCount);
+	const double threadedTime = g_terrainRender.BenchmarkVertexGeneration(threadCount, vertexCount);
+	if (singleTime <= 0 || threadedTime <= 0)
+		return;
+
+	GetDebugConsole().AddFormatted(L"Terrain verts: %d", vertexCount);
+	GetDebugConsole().AddFormatted(L"1 thread: %.0f verts/s", vertexCount / singleTime);
+	GetDebugConsole().AddFormatted(L"%d threads: %.0f verts/s, %.0f per core", threadCount, vertexCount / threadedTime, vertexCount / (threadedTime * threadCount));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+/*
+	Member functions
+*/
+////////////////////////////////////////////////////////////////////////////////////////
+
+void TerrainRender::BuildCacheJobs(vector<CacheJob>& jobs, int threadCount) const
+{
+	// each job builds one patch layer
+	g_jobPool.Run(jobs.size(), [this, &jobs](int i)
+	{
+		BuildTilesPrimitives(jobs[i].staging, *jobs[i].patch, jobs[i].layer);
+	}, threadCount);
+}
+
+double TerrainRender::BenchmarkVertexGeneration(int threadCount, int& vertexCount)
+{
+	vector<CacheJob> jobs(Terrain::fullSize.x * Terrain::fullSize.y * Terrain::patchLayers);
+	int jobIndex = 0;
+	for(int i=0; i<Terrain::fullSize.x; ++i)
+	for(int j=0; j<Terrain::fullSize.y; ++j)
+	for (int l = 0; l < Terrain::patchLayers; ++l)
+	{
+		CacheJob& job = jobs[jobIndex++];
+		job.patch = g_terrain->GetPatch(i, j);
+		job.tileBufferIndex = 0;
+		job.layer = l;
+	}
+
+	const chrono::steady_clock::time_point startTime = chrono::steady_clock::now();
+	BuildCacheJobs(jobs, threadCount);
+	const double time = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+
+	vertexCount = 0;
+	for (vector<CacheJob>::const_iterator it = jobs.begin(); it != jobs.end(); ++it)
+		vertexCount += it->staging.vertices.size();
+	return time;
+}
+
+int TerrainRender::FindRenderGroup(const CachedTileBuffer::TileRenderGroup* groups, int groupCount, BYTE tileSet, BYTE surfaceID)
+{
+	for (int i = 0; i < groupCount; ++i)
+	{
+		if (groups[i].tileSet == tileSet && GameSurfaceInfo::Get(groups[i].surfaceID).IsSameRenderGroup(GameSurfaceInfo::Get(surfaceID)))
+			return i;
+	}
+
+	return -1;
+}
+
+void TerrainRender::BuildTilesPrimitives(CacheStaging& staging, const TerrainPatch& patch, int layer, const vector<CachedTileBuffer::TileRenderGroup>* onlyGroups) const
+{
+	// note: this may be called from worker threads so it must only read shared data
+
+	struct SurfaceEdgeTile
+	{
+		SurfaceEdgeTile(Vector2 _pos, BYTE surface, BYTE edge, BYTE _tileSet, BYTE _rotation, bool _mirror) : pos(_pos), surfaceData(surface), edgeData(edge), tileSet(_tileSet), rotation(_rotation), mirror(_mirror) {}
+
+		static bool SortCompare(const SurfaceEdgeTile& first, const SurfaceEdgeTile& second) 
+		{ 
+			if (first.tileSet != second.tileSet)
+				return (first.tileSet < second.tileSet);
+			
+			const GameSurfaceInfo& s1 = GameSurfaceInfo::Get(first.surfaceData);
+			const GameSurfaceInfo& s2 = GameSurfaceInfo::Get(second.surfaceData);
+			return s1 < s2;
+		}
+
+		Vector2 pos;
+		BYTE surfaceData;
+		BYTE edgeData;
+		BYTE tileSet;
+		BYTE rotation;
+		bool mirror;
+	};
+		
+	// create a list of all the tile surfaces in this patch
+	list<SurfaceEdgeTile> tileList;
+	for(int xPatch=0; xPatch<Terrain::patchSize; ++xPatch)
+	for(int yPatch=0; yPatch<Terrain::patchSize; ++yPatch)
+	{
+		const TerrainTile& tile = patch.GetTileLocal(xPatch, yPatch, layer);
+		if (tile.IsClear())
+			continue; // skip clear tiles
+
+		if (Terrain::tileSetCount > 0 && tile.GetTileSet() >= Terrain::tileSetCount)
+			continue;	// tileset out of range
+
+		if (foregroundLayerOcculsion && layer == 1)
+		{
+			// check if background tiles are completely blocked by foreground tile
+			const TerrainTile& tile0 = patch.GetTileLocal(xPatch, yPatch, 0);
+			const GameSurfaceInfo& surfaceInfo = GameSurfaceInfo::Get(tile0.GetSurfaceData(0));
+			if (tile0.IsFull() && !tile0.IsClear() && (surfaceInfo.flags & GSI_ForegroundOcclude))
+				continue;
+		}
+			
+		const Vector2 pos = patch.GetTilePos(xPatch, yPatch);
+		// skip surfaces not in the groups being rebuilt
+		const BYTE surface0 = tile.GetSurfaceData(0);
+		const BYTE surface1 = tile.GetSurfaceData(1);
+		const bool useSurface0 = !onlyGroups || FindRenderGroup(&(*onlyGroups)[0], onlyGroups->size(), tile.GetTileSet(), surface0) >= 0;
+		const bool useSurface1 = !onlyGroups || FindRenderGroup(&(*onlyGroups)[0], onlyGroups->size(), tile.GetTileSet(), surface1) >= 0;
+
+		if (surface0 && useSurface0 && tile.GetSurfaceHasArea(0))
+			tileList.push_back(SurfaceEdgeTile(pos, surface0, tile.GetEdgeData(), tile.GetTileSet(), tile.GetRotation(), tile.GetMirror())); 
+			
+		if (surface1 && useSurface1 && tile.GetSurfaceHasArea(1))
+			tileList.push_back(SurfaceEdgeTile(pos, surface1, tile.GetInvertedEdgeData(), tile.GetTileSet(), tile.GetRotation(), tile.GetMirror())); 
+	}
+		
+	// sort list by surface info type
+	tileList.sort(SurfaceEdgeTile::SortCompare);
+
+	// clear out the staging buffer
+	for (int i = 0; i < CachedTileBuffer::maxGroups; ++i)
+		staging.renderGroups[i].vertexCount = 0;
+	staging.groupCount = 0;
+
+	// count verts so they can be written straight into the staging buffer
+	int totalVertexCount = 0;
+	for (list<SurfaceEdgeTile>::iterator it = tileList.begin(); it != tileList.end(); ++it) 
+	{
+		const Vector2 *edgeVerts = NULL;
+		int vertexCount;
+		TerrainTile::GetVertList(edgeVerts, vertexCount, it->edgeData);
+		totalVertexCount += vertexCount + 2;
+	}
+	staging.vertices.resize(totalVertexCount);
+	if (totalVertexCount == 0)
+		return;
+
+	// iterate through list and build vertex buffer
+	TERRAIN_VERTEX* lockedVerts = &staging.vertices[0];
+	int vertexIndex = 0;
+	BYTE lastSurfaceData = 0;
+	BYTE lastTileSet = 0;
+	bool first = true;
+
+	for (list<SurfaceEdgeTile>::iterator it = tileList.begin(); it != tileList.end(); ++it) 
+	{
+		SurfaceEdgeTile& tile = *it;
+
+		// get vert list for the tile
+		const Vector2 *edgeVerts = NULL;
+		int vertexCount;
+		TerrainTile::GetVertList(edgeVerts, vertexCount, tile.edgeData);
+		const BYTE surfaceData = tile.surfaceData;
+		const BYTE rotation = tile.rotation;
+		const bool mirror = tile.mirror;
+		const GameSurfaceInfo& surfaceInfo = GameSurfaceInfo::Get(tile.surfaceData);
+		const GameSurfaceInfo& lastSurfaceInfo = GameSurfaceInfo::Get(lastSurfaceData);
+
+		// check if it's a new group
+		if (first || !surfaceInfo.IsSameRenderGroup(lastSurfaceInfo) || tile.tileSet != lastTileSet )
+		{
+			// init the new group
+			first = false;
+			++staging.groupCount;
+			CachedTileBuffer::TileRenderGroup& tileRenderGroup = staging.renderGroups[staging.groupCount-1];
+			tileRenderGroup.startVertex = vertexIndex;
+			tileRenderGroup.tileSet = tile.tileSet;
+			tileRenderGroup.surfaceID = surfaceData;
+			lastSurfaceData = surfaceData;
+			lastTileSet = tile.tileSet;
+		}
+			
+		CachedTileBuffer::TileRenderGroup& tileRenderGroup = staging.renderGroups[staging.groupCount-1];
+		
+		// degenerate tri on start
+		SetupVert(&lockedVerts[vertexIndex++], tile.pos + edgeVerts[0], edgeVerts[0], surfaceInfo, surfaceData, rotation, mirror);
+		SetupVert(&lockedVerts[vertexIndex++], tile.pos + edgeVerts[0], edgeVerts[0], surfaceInfo, surfaceData, rotation, mirror);
+			
+		int leftPos = vertexCount-1;
+		int rightPos = 1;
+		while (1)
+		{
+			Vector2 edgeVert = edgeVerts[rightPos++];
+			Vector2 pos = tile.pos + edgeVert;
+			SetupVert(&lockedVerts[vertexIndex++], pos, edgeVert, surfaceInfo, surfaceData, rotation, mirror);
+			if (rightPos > leftPos)
+			{
+				// degerate tri on ends
+				SetupVert(&lockedVerts[vertexIndex++], pos, edgeVert, surfaceInfo, surfaceData, rotation, mirror);
+				break;
+			}
+				
+			edgeVert = edgeVerts[leftPos--];
+			pos = tile.pos + edgeVert;
+			SetupVert(&lockedVerts[vertexIndex++], pos, edgeVert, surfaceInfo, surfaceData, rotation, mirror);
+			if (leftPos < rightPos)
+			{
+				// degerate tri on ends
+				SetupVert(&lockedVerts[vertexIndex++], pos, edgeVert, surfaceInfo, surfaceData, rotation, mirror);
+				break;
+			}
+		}
+
+		tileRenderGroup.vertexCount += vertexCount + 2;
+	}
+}
+
+void TerrainRender::SetupVert(TERRAIN_VERTEX* vertex, const Vector2& worldPos, const Vector2& localPos, const GameSurfaceInfo& surfaceInfo, const BYTE surfaceID, const BYTE tileRotation, bool tileMirror) const
+{
+	if (Terrain::tileSetCount > 0 || g_render->GetTextureTileSheet(surfaceInfo.ti))
+	{
+		// tile set mode
+		float rotation = float(tileRotation) * PI / 2;
+
+		Vector2 localPos2 = Vector2(localPos.x, TerrainTile::GetSize() - localPos.y);
+		localPos2 -= Vector2(0.5f);
+		if (tileMirror)
+			localPos2.x *= -1;
+		localPos2 = localPos2.Rotate(rotation);
+		localPos2 += Vector2(0.5f);
+
+		if (g_tileSetUVScale > 0)
+		{
+			// hack: scale uvs when non point filtered
+			const Vector2 offset(TerrainTile::GetSize()/2);
+			localPos2 -= offset;
+			localPos2 *= g_tileSetUVScale;
+			localPos2 += offset;
+		}
+			
+		const ByteVector2 tileSize(16, 16);
+		const ByteVector2 tilePos(surfaceID % 16, surfaceID / 16);
+		const Vector2 scale = 1.0f / (TerrainTile::GetSize() * Vector2(tileSize));
+		const Vector2 tilePosFloat = localPos2 * scale + Vector2(tilePos) / Vector2(tileSize);
+
+		vertex->position = Vector3(worldPos.x, worldPos.y, 0);
+		vertex->textureCoords = tilePosFloat;
+	}
+	else
+	{
+		vertex->position = Vector3(worldPos.x, worldPos.y, 0);
+		const Vector2 texturePos = worldPos / (TerrainTile::GetSize()*surfaceInfo.textureWrapSize*textureWrapScale);
+		vertex->textureCoords = texturePos * Vector2(1, -1);
+	}
+}
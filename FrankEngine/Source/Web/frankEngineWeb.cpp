@@ -16,8 +16,12 @@
 #error frankEngineWeb.cpp is web-build only
 #endif
 
+#ifdef FRANK_WEB_HEADLESS
+#include "webHeadless.h"
+#else
 #include <emscripten.h>
 #include <emscripten/html5.h>
+#endif
 #include <ctime>
 
 //--------------------------------------------------------------------------------------
@@ -50,7 +54,13 @@ static void WebRunUrlConsoleCommands()
 	// belt and braces: the JS above clears this too, but an uninitialized buffer here
 	// gets parsed as console commands, so never rely on the other side for it
 	char cvars[1024] = {0};
+#ifdef FRANK_WEB_HEADLESS
+	// headless runs take the same command string from the environment
+	if (const char* environmentCvars = getenv("FRANK_CVARS"))
+		strncpy(cvars, environmentCvars, sizeof(cvars) - 1);
+#else
 	WebJsGetUrlCvars(cvars, sizeof(cvars));
+#endif
 
 	for (char* command = cvars; *command; )
 	{
@@ -397,6 +407,8 @@ static void FrankEngineWebFrame()
 		WebGridRenderEarly();	// mode 3: grid into its own fbo, verified at end of frame
 
 		g_render->ResetTotalSimpleVertsRendered();
+		g_renderCommands.ResetStats();
+		FrankFont::ResetMeshCacheStats();
 		FrankWebRenderBegin();				// reset device state, bind canvas + viewport
 		g_gameControlBase->SetupRender();	// DeferredRender::GlobalUpdate renders the light fbos
 		FrankWebRenderBegin();				// re-bind the canvas (mirrors the backbuffer restore)
@@ -17,8 +17,12 @@
 #error webGui.cpp is web-build only
 #endif
 
+#ifdef FRANK_WEB_HEADLESS
+#include "webHeadless.h"
+#else
 #include <emscripten.h>
 #include <emscripten/html5.h>
+#endif
 #include <cstdarg>
 #include <algorithm>
 
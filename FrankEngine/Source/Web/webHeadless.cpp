@@ -0,0 +1,315 @@
+////////////////////////////////////////////////////////////////////////////////////////
+/*
+	Frank Engine Web Headless
+	Copyright 2013 Frank Force - http://www.frankforce.com
+
+	- null WebGL2 device, every call is counted against the current render pass
+	- fixed step main loop, the frame count is set with the webHeadlessFrames cvar
+	- prints draws, state changes, uploads and cpu time per frame when the run ends
+	- FRANK_CVARS in the environment works like ?cvar= on the url
+*/
+////////////////////////////////////////////////////////////////////////////////////////
+
+#include "../frankEngine.h"
+
+#ifndef FRANK_WEB_HEADLESS
+#error webHeadless.cpp is headless-build only
+#endif
+
+#include "webHeadless.h"
+#include <chrono>
+
+ConsoleCommandSimple(int, webHeadlessFrames, 600);			// frames to run before printing stats and exiting
+ConsoleCommandSimple(bool, webHeadlessFrameLog, false);		// print stats for every frame
+
+////////////////////////////////////////////////////////////////////////////////////////
+// stats
+////////////////////////////////////////////////////////////////////////////////////////
+
+struct WebHeadlessPassStats
+{
+	int draws = 0;
+	int vertices = 0;
+	int stateChanges = 0;
+	int uploads = 0;
+
+	void Add(const WebHeadlessPassStats& other)
+	{
+		draws += other.draws;
+		vertices += other.vertices;
+		stateChanges += other.stateChanges;
+		uploads += other.uploads;
+	}
+};
+
+static const int webHeadlessPassCount = DeferredRender::RenderPass_specular + 1;
+static const char* webHeadlessPassNames[webHeadlessPassCount] = { "diffuse", "emissive", "lightShadow", "directionalShadow", "vision", "normals", "specular" };
+static WebHeadlessPassStats webHeadlessFrameStats[webHeadlessPassCount];
+static WebHeadlessPassStats webHeadlessTotalStats[webHeadlessPassCount];
+static double webHeadlessTime = 0;		// simulated clock in milliseconds, steps a fixed 60 hz per frame
+
+static WebHeadlessPassStats& WebHeadlessGetStats()
+{
+	const int pass = DeferredRender::GetRenderPass();
+	ASSERT(pass >= 0 && pass < webHeadlessPassCount);
+	return webHeadlessFrameStats[pass];
+}
+
+static void WebHeadlessStateChange()	{ ++WebHeadlessGetStats().stateChanges; }
+static void WebHeadlessUpload()			{ ++WebHeadlessGetStats().uploads; }
+
+static void WebHeadlessPrintFrame(int frame, double cpuMs)
+{
+	WebHeadlessPassStats frameTotal;
+	for (const WebHeadlessPassStats& stats : webHeadlessFrameStats)
+		frameTotal.Add(stats);
+	printf("headless frame %d: cpu %.3f ms, draws %d, vertices %d, state changes %d, uploads %d\n",
+		frame, cpuMs, frameTotal.draws, frameTotal.vertices, frameTotal.stateChanges, frameTotal.uploads);
+}
+
+static void WebHeadlessPrintReport(int frameCount, double cpuTotalMs, double cpuMinMs, double cpuMaxMs)
+{
+	if (frameCount <= 0)
+		return;
+
+	printf("headless report: %d frames, cpu ms per frame avg %.3f min %.3f max %.3f\n", frameCount, cpuTotalMs / frameCount, cpuMinMs, cpuMaxMs);
+	printf("%-18s %10s %10s %10s %10s\n", "pass", "draws", "vertices", "states", "uploads");
+
+	WebHeadlessPassStats total;
+	for (int i = 0; i < webHeadlessPassCount; ++i)
+	{
+		const WebHeadlessPassStats& stats = webHeadlessTotalStats[i];
+		total.Add(stats);
+		printf("%-18s %10.1f %10.1f %10.1f %10.1f\n", webHeadlessPassNames[i],
+			stats.draws / (float)frameCount, stats.vertices / (float)frameCount, stats.stateChanges / (float)frameCount, stats.uploads / (float)frameCount);
+	}
+	printf("%-18s %10.1f %10.1f %10.1f %10.1f\n", "total",
+		total.draws / (float)frameCount, total.vertices / (float)frameCount, total.stateChanges / (float)frameCount, total.uploads / (float)frameCount);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+// emscripten
+////////////////////////////////////////////////////////////////////////////////////////
+
+void emscripten_set_main_loop(em_callback_func func, int fps, int simulateInfiniteLoop)
+{
+	printf("headless: running %d frames\n", webHeadlessFrames);
+
+	double cpuTotalMs = 0, cpuMinMs = 0, cpuMaxMs = 0;
+	int frame = 0;
+	for (; frame < webHeadlessFrames; ++frame)
+	{
+		for (WebHeadlessPassStats& stats : webHeadlessFrameStats)
+			stats = WebHeadlessPassStats();
+
+		const chrono::steady_clock::time_point startTime = chrono::steady_clock::now();
+		func();
+		const double cpuMs = chrono::duration<double, milli>(chrono::steady_clock::now() - startTime).count();
+
+		cpuTotalMs += cpuMs;
+		cpuMinMs = (frame == 0)? cpuMs : Min(cpuMinMs, cpuMs);
+		cpuMaxMs = Max(cpuMaxMs, cpuMs);
+		for (int i = 0; i < webHeadlessPassCount; ++i)
+			webHeadlessTotalStats[i].Add(webHeadlessFrameStats[i]);
+
+		if (webHeadlessFrameLog)
+			WebHeadlessPrintFrame(frame, cpuMs);
+
+		webHeadlessTime += 1000.0 / 60.0;
+	}
+
+	WebHeadlessPrintReport(frame, cpuTotalMs, cpuMinMs, cpuMaxMs);
+}
+
+void emscripten_force_exit(int status) { exit(status); }
+
+double emscripten_get_now() { return webHeadlessTime; }
+
+char* emscripten_get_preloaded_image_data(const char* path, int* w, int* h)
+{
+	// only the size is read from the file, pixels are plain white
+	FILE* file = fopen(path, "rb");
+	if (!file)
+		return NULL;
+
+	unsigned char header[24] = {0};
+	const size_t readSize = fread(header, 1, sizeof(header), file);
+	fclose(file);
+
+	*w = *h = 1;
+	const unsigned char pngSignature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	if (readSize == sizeof(header) && memcmp(header, pngSignature, sizeof(pngSignature)) == 0)
+	{
+		// big endian width and height from the IHDR chunk
+		*w = (header[16] << 24) | (header[17] << 16) | (header[18] << 8) | header[19];
+		*h = (header[20] << 24) | (header[21] << 16) | (header[22] << 8) | header[23];
+	}
+
+	const size_t size = size_t(*w) * size_t(*h) * 4;
+	char* pixels = (char*)malloc(size);
+	memset(pixels, 0xFF, size);
+	return pixels;
+}
+
+void emscripten_webgl_init_context_attributes(EmscriptenWebGLContextAttributes* attributes)
+{
+	*attributes = EmscriptenWebGLContextAttributes();
+	attributes->majorVersion = 2;
+}
+
+EMSCRIPTEN_WEBGL_CONTEXT_HANDLE emscripten_webgl_create_context(const char* target, const EmscriptenWebGLContextAttributes* attributes) { return 1; }
+EMSCRIPTEN_RESULT emscripten_webgl_make_context_current(EMSCRIPTEN_WEBGL_CONTEXT_HANDLE context) { return EMSCRIPTEN_RESULT_SUCCESS; }
+
+////////////////////////////////////////////////////////////////////////////////////////
+// null gl device
+////////////////////////////////////////////////////////////////////////////////////////
+
+static GLuint webHeadlessNextName = 0;
+static GLint webHeadlessViewport[4] = {0};
+static GLint webHeadlessFramebuffer = 0;
+static GLuint webHeadlessPackBuffer = 0;
+static GLuint webHeadlessActiveTexture = 0;
+static GLuint webHeadlessBoundTextures[16] = {0};
+static vector<char> webHeadlessMappedBuffer;
+
+static void WebHeadlessGenNames(GLsizei n, GLuint* names)
+{
+	for (GLsizei i = 0; i < n; ++i)
+		names[i] = ++webHeadlessNextName;
+}
+
+void glEnable(GLenum cap)																{ WebHeadlessStateChange(); }
+void glDisable(GLenum cap)																{ WebHeadlessStateChange(); }
+void glBlendFunc(GLenum sfactor, GLenum dfactor)										{ WebHeadlessStateChange(); }
+void glBlendEquation(GLenum mode)														{ WebHeadlessStateChange(); }
+void glColorMask(GLboolean red, GLboolean green, GLboolean blue, GLboolean alpha)		{ WebHeadlessStateChange(); }
+void glClearColor(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha)				{ WebHeadlessStateChange(); }
+void glClear(GLbitfield mask)															{ ++WebHeadlessGetStats().draws; }
+const GLubyte* glGetString(GLenum name)													{ return (const GLubyte*)"headless"; }
+GLenum glGetError()																		{ return GL_NO_ERROR; }
+void glFlush()																			{}
+void glFinish()																			{}
+
+void glViewport(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+	WebHeadlessStateChange();
+	webHeadlessViewport[0] = x;
+	webHeadlessViewport[1] = y;
+	webHeadlessViewport[2] = width;
+	webHeadlessViewport[3] = height;
+}
+
+void glGetIntegerv(GLenum pname, GLint* data)
+{
+	if (pname == GL_VIEWPORT)
+		memcpy(data, webHeadlessViewport, sizeof(webHeadlessViewport));
+	else if (pname == GL_FRAMEBUFFER_BINDING)
+		*data = webHeadlessFramebuffer;
+	else if (pname == GL_TEXTURE_BINDING_2D)
+		*data = webHeadlessBoundTextures[webHeadlessActiveTexture];
+	else
+		*data = 0;
+}
+
+void glGenTextures(GLsizei n, GLuint* textures)											{ WebHeadlessGenNames(n, textures); }
+void glDeleteTextures(GLsizei n, const GLuint* textures)								{}
+void glTexParameteri(GLenum target, GLenum pname, GLint param)							{ WebHeadlessStateChange(); }
+void glGenerateMipmap(GLenum target)													{ WebHeadlessUpload(); }
+void glGenSamplers(GLsizei count, GLuint* samplers)										{ WebHeadlessGenNames(count, samplers); }
+void glBindSampler(GLuint unit, GLuint sampler)											{ WebHeadlessStateChange(); }
+void glSamplerParameteri(GLuint sampler, GLenum pname, GLint param)						{ WebHeadlessStateChange(); }
+
+void glActiveTexture(GLenum texture)
+{
+	WebHeadlessStateChange();
+	webHeadlessActiveTexture = (texture - GL_TEXTURE0) & 15;
+}
+
+void glBindTexture(GLenum target, GLuint texture)
+{
+	WebHeadlessStateChange();
+	webHeadlessBoundTextures[webHeadlessActiveTexture] = texture;
+}
+
+void glTexImage2D(GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const void* pixels)
+{
+	WebHeadlessUpload();
+}
+
+void glGenFramebuffers(GLsizei n, GLuint* framebuffers)									{ WebHeadlessGenNames(n, framebuffers); }
+void glDeleteFramebuffers(GLsizei n, const GLuint* framebuffers)						{}
+void glFramebufferTexture2D(GLenum target, GLenum attachment, GLenum textarget, GLuint texture, GLint level) { WebHeadlessStateChange(); }
+GLenum glCheckFramebufferStatus(GLenum target)											{ return GL_FRAMEBUFFER_COMPLETE; }
+
+void glBindFramebuffer(GLenum target, GLuint framebuffer)
+{
+	WebHeadlessStateChange();
+	if (target != GL_READ_FRAMEBUFFER)
+		webHeadlessFramebuffer = framebuffer;
+}
+
+void glBlitFramebuffer(GLint srcX0, GLint srcY0, GLint srcX1, GLint srcY1, GLint dstX0, GLint dstY0, GLint dstX1, GLint dstY1, GLbitfield mask, GLenum filter)
+{
+	++WebHeadlessGetStats().draws;
+}
+
+void glReadPixels(GLint x, GLint y, GLsizei width, GLsizei height, GLenum format, GLenum type, void* pixels)
+{
+	// reads into client memory get zeros, reads into a pack buffer are dropped
+	if (webHeadlessPackBuffer || !pixels)
+		return;
+	const int channels = (format == GL_RGB)? 3 : 4;
+	memset(pixels, 0, size_t(width) * size_t(height) * channels);
+}
+
+void glGenBuffers(GLsizei n, GLuint* buffers)											{ WebHeadlessGenNames(n, buffers); }
+void glBufferData(GLenum target, GLsizeiptr size, const void* data, GLenum usage)		{ WebHeadlessUpload(); }
+void glBufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void* data)	{ WebHeadlessUpload(); }
+void glGenVertexArrays(GLsizei n, GLuint* arrays)										{ WebHeadlessGenNames(n, arrays); }
+void glBindVertexArray(GLuint array)													{ WebHeadlessStateChange(); }
+void glEnableVertexAttribArray(GLuint index)											{ WebHeadlessStateChange(); }
+void glDisableVertexAttribArray(GLuint index)											{ WebHeadlessStateChange(); }
+void glVertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const void* pointer) { WebHeadlessStateChange(); }
+void glVertexAttrib2f(GLuint index, GLfloat x, GLfloat y)								{ WebHeadlessStateChange(); }
+
+void glBindBuffer(GLenum target, GLuint buffer)
+{
+	WebHeadlessStateChange();
+	if (target == GL_PIXEL_PACK_BUFFER)
+		webHeadlessPackBuffer = buffer;
+}
+
+void* glMapBufferRange(GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access)
+{
+	webHeadlessMappedBuffer.assign(size_t(length), 0);
+	return webHeadlessMappedBuffer.data();
+}
+
+GLuint glCreateShader(GLenum type)														{ return ++webHeadlessNextName; }
+void glShaderSource(GLuint shader, GLsizei count, const GLchar* const* string, const GLint* length) {}
+void glCompileShader(GLuint shader)														{}
+void glGetShaderiv(GLuint shader, GLenum pname, GLint* params)							{ *params = (pname == GL_COMPILE_STATUS)? GL_TRUE : 0; }
+void glGetShaderInfoLog(GLuint shader, GLsizei bufSize, GLsizei* length, GLchar* infoLog) { if (length) *length = 0; if (infoLog && bufSize > 0) infoLog[0] = 0; }
+GLuint glCreateProgram()																{ return ++webHeadlessNextName; }
+void glAttachShader(GLuint program, GLuint shader)										{}
+void glLinkProgram(GLuint program)														{}
+void glGetProgramiv(GLuint program, GLenum pname, GLint* params)						{ *params = (pname == GL_LINK_STATUS)? GL_TRUE : 0; }
+void glGetProgramInfoLog(GLuint program, GLsizei bufSize, GLsizei* length, GLchar* infoLog) { if (length) *length = 0; if (infoLog && bufSize > 0) infoLog[0] = 0; }
+void glUseProgram(GLuint program)														{ WebHeadlessStateChange(); }
+GLint glGetUniformLocation(GLuint program, const GLchar* name)							{ return 0; }
+void glUniform1i(GLint location, GLint v0)												{ WebHeadlessStateChange(); }
+void glUniform1f(GLint location, GLfloat v0)											{ WebHeadlessStateChange(); }
+void glUniform4f(GLint location, GLfloat v0, GLfloat v1, GLfloat v2, GLfloat v3)		{ WebHeadlessStateChange(); }
+void glUniform4fv(GLint location, GLsizei count, const GLfloat* value)					{ WebHeadlessStateChange(); }
+void glUniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat* value) { WebHeadlessStateChange(); }
+
+void glDrawArrays(GLenum mode, GLint first, GLsizei count)
+{
+	WebHeadlessPassStats& stats = WebHeadlessGetStats();
+	++stats.draws;
+	stats.vertices += count;
+}
+
+GLsync glFenceSync(GLenum condition, GLbitfield flags)									{ return (GLsync)1; }
+GLenum glClientWaitSync(GLsync sync, GLbitfield flags, GLuint64 timeout)				{ return GL_ALREADY_SIGNALED; }
+void glDeleteSync(GLsync sync)															{}
@@ -0,0 +1,386 @@
+////////////////////////////////////////////////////////////////////////////////////////
+/*
+	Frank Engine Web Headless
+	Copyright 2013 Frank Force - http://www.frankforce.com
+
+	- null stand-ins for the emscripten, WebGL2 and OpenAL apis the web files use
+	- built with FRANK_WEB_HEADLESS by a native compiler from the same portable TU set
+	- every gl call is accepted, counted against the current render pass and discarded
+	- the main loop runs a fixed number of frames then prints draw, state and cpu stats
+*/
+////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#ifndef FRANK_WEB_HEADLESS
+#error webHeadless.h is headless-build only
+#endif
+
+#include <stdint.h>
+
+////////////////////////////////////////////////////////////////////////////////////////
+// emscripten.h
+////////////////////////////////////////////////////////////////////////////////////////
+
+// js bodies are dropped, the generated functions return a default value
+#define EM_JS(ret, name, params, ...)	extern "C" ret name params { return ret(); }
+#define EM_ASM(...)						((void)0)
+#define EM_ASM_INT(...)					(0)
+
+typedef void (*em_callback_func)(void);
+
+void emscripten_set_main_loop(em_callback_func func, int fps, int simulateInfiniteLoop);
+void emscripten_force_exit(int status);
+double emscripten_get_now();
+char* emscripten_get_preloaded_image_data(const char* path, int* w, int* h);
+
+////////////////////////////////////////////////////////////////////////////////////////
+// emscripten/html5.h
+////////////////////////////////////////////////////////////////////////////////////////
+
+typedef int EM_BOOL;
+typedef int EMSCRIPTEN_RESULT;
+#define EM_TRUE		1
+#define EM_FALSE	0
+
+#define EMSCRIPTEN_RESULT_SUCCESS		0
+#define EMSCRIPTEN_RESULT_DEFERRED		1
+#define EMSCRIPTEN_RESULT_NOT_SUPPORTED	-1
+#define EMSCRIPTEN_EVENT_TARGET_WINDOW	((const char*)2)
+
+#define EMSCRIPTEN_EVENT_KEYDOWN	2
+#define EMSCRIPTEN_EVENT_KEYUP		3
+#define EMSCRIPTEN_EVENT_MOUSEDOWN	5
+#define EMSCRIPTEN_EVENT_MOUSEUP	6
+#define EMSCRIPTEN_EVENT_MOUSEMOVE	8
+
+#define EMSCRIPTEN_FULLSCREEN_SCALE_ASPECT			2
+#define EMSCRIPTEN_FULLSCREEN_CANVAS_SCALE_NONE		0
+#define EMSCRIPTEN_FULLSCREEN_FILTERING_DEFAULT		0
+
+struct EmscriptenKeyboardEvent
+{
+	double timestamp;
+	unsigned long location;
+	EM_BOOL ctrlKey, shiftKey, altKey, metaKey, repeat;
+	unsigned long charCode, keyCode, which;
+	char key[32], code[32], charValue[32], locale[32];
+};
+
+struct EmscriptenMouseEvent
+{
+	double timestamp;
+	long screenX, screenY, clientX, clientY;
+	EM_BOOL ctrlKey, shiftKey, altKey, metaKey;
+	unsigned short button, buttons;
+	long movementX, movementY, targetX, targetY, canvasX, canvasY, padding;
+};
+
+struct EmscriptenWheelEvent
+{
+	EmscriptenMouseEvent mouse;
+	double deltaX, deltaY, deltaZ;
+	unsigned long deltaMode;
+};
+
+struct EmscriptenFocusEvent { char nodeName[128]; char id[128]; };
+struct EmscriptenVisibilityChangeEvent { EM_BOOL hidden; int visibilityState; };
+
+struct EmscriptenFullscreenChangeEvent
+{
+	EM_BOOL isFullscreen, fullscreenEnabled;
+	char nodeName[128], id[128];
+	int elementWidth, elementHeight, screenWidth, screenHeight;
+};
+
+typedef EM_BOOL (*em_canvasresized_callback_func)(int eventType, const void* reserved, void* userData);
+struct EmscriptenFullscreenStrategy
+{
+	int scaleMode;
+	int canvasResolutionScaleMode;
+	int filteringMode;
+	em_canvasresized_callback_func canvasResizedCallback;
+	void* canvasResizedCallbackUserData;
+};
+
+struct EmscriptenGamepadEvent
+{
+	double timestamp;
+	int numAxes, numButtons;
+	double axis[64];
+	double analogButton[64];
+	EM_BOOL digitalButton[64];
+	EM_BOOL connected;
+	long index;
+	char id[64], mapping[64];
+};
+
+typedef int EMSCRIPTEN_WEBGL_CONTEXT_HANDLE;
+struct EmscriptenWebGLContextAttributes
+{
+	EM_BOOL alpha, depth, stencil, antialias, premultipliedAlpha, preserveDrawingBuffer;
+	int powerPreference;
+	EM_BOOL failIfMajorPerformanceCaveat;
+	int majorVersion, minorVersion;
+	EM_BOOL enableExtensionsByDefault, explicitSwapControl;
+};
+
+typedef EM_BOOL (*em_key_callback_func)(int eventType, const EmscriptenKeyboardEvent* e, void* userData);
+typedef EM_BOOL (*em_mouse_callback_func)(int eventType, const EmscriptenMouseEvent* e, void* userData);
+typedef EM_BOOL (*em_wheel_callback_func)(int eventType, const EmscriptenWheelEvent* e, void* userData);
+typedef EM_BOOL (*em_focus_callback_func)(int eventType, const EmscriptenFocusEvent* e, void* userData);
+typedef EM_BOOL (*em_visibilitychange_callback_func)(int eventType, const EmscriptenVisibilityChangeEvent* e, void* userData);
+
+// there are no input events without a browser, callbacks are never called
+inline EMSCRIPTEN_RESULT emscripten_set_keydown_callback(const char*, void*, EM_BOOL, em_key_callback_func)				{ return EMSCRIPTEN_RESULT_SUCCESS; }
+inline EMSCRIPTEN_RESULT emscripten_set_keyup_callback(const char*, void*, EM_BOOL, em_key_callback_func)				{ return EMSCRIPTEN_RESULT_SUCCESS; }
+inline EMSCRIPTEN_RESULT emscripten_set_mousedown_callback(const char*, void*, EM_BOOL, em_mouse_callback_func)			{ return EMSCRIPTEN_RESULT_SUCCESS; }
+inline EMSCRIPTEN_RESULT emscripten_set_mouseup_callback(const char*, void*, EM_BOOL, em_mouse_callback_func)			{ return EMSCRIPTEN_RESULT_SUCCESS; }
+inline EMSCRIPTEN_RESULT emscripten_set_mousemove_callback(const char*, void*, EM_BOOL, em_mouse_callback_func)			{ return EMSCRIPTEN_RESULT_SUCCESS; }
+inline EMSCRIPTEN_RESULT emscripten_set_wheel_callback(const char*, void*, EM_BOOL, em_wheel_callback_func)				{ return EMSCRIPTEN_RESULT_SUCCESS; }
+inline EMSCRIPTEN_RESULT emscripten_set_blur_callback(const char*, void*, EM_BOOL, em_focus_callback_func)				{ return EMSCRIPTEN_RESULT_SUCCESS; }
+inline EMSCRIPTEN_RESULT emscripten_set_visibilitychange_callback(void*, EM_BOOL, em_visibilitychange_callback_func)		{ return EMSCRIPTEN_RESULT_SUCCESS; }
+inline EMSCRIPTEN_RESULT emscripten_sample_gamepad_data()																{ return EMSCRIPTEN_RESULT_NOT_SUPPORTED; }
+inline EMSCRIPTEN_RESULT emscripten_get_gamepad_status(int, EmscriptenGamepadEvent*)									{ return EMSCRIPTEN_RESULT_NOT_SUPPORTED; }
+inline EMSCRIPTEN_RESULT emscripten_get_fullscreen_status(EmscriptenFullscreenChangeEvent* e)							{ *e = EmscriptenFullscreenChangeEvent(); return EMSCRIPTEN_RESULT_SUCCESS; }
+inline EMSCRIPTEN_RESULT emscripten_request_fullscreen_strategy(const char*, EM_BOOL, const EmscriptenFullscreenStrategy*) { return EMSCRIPTEN_RESULT_NOT_SUPPORTED; }
+inline EMSCRIPTEN_RESULT emscripten_exit_fullscreen()																	{ return EMSCRIPTEN_RESULT_SUCCESS; }
+inline double emscripten_get_device_pixel_ratio()																		{ return 1; }
+
+// there is no canvas to measure, so the backbuffer keeps the size the game asked for
+inline EMSCRIPTEN_RESULT emscripten_get_element_css_size(const char*, double* width, double* height) { *width = *height = 0; return EMSCRIPTEN_RESULT_NOT_SUPPORTED; }
+
+void emscripten_webgl_init_context_attributes(EmscriptenWebGLContextAttributes* attributes);
+EMSCRIPTEN_WEBGL_CONTEXT_HANDLE emscripten_webgl_create_context(const char* target, const EmscriptenWebGLContextAttributes* attributes);
+EMSCRIPTEN_RESULT emscripten_webgl_make_context_current(EMSCRIPTEN_WEBGL_CONTEXT_HANDLE context);
+
+////////////////////////////////////////////////////////////////////////////////////////
+// GLES3/gl3.h
+////////////////////////////////////////////////////////////////////////////////////////
+
+typedef unsigned int GLenum;
+typedef unsigned int GLuint;
+typedef int GLint;
+typedef int GLsizei;
+typedef unsigned int GLbitfield;
+typedef unsigned char GLboolean;
+typedef float GLfloat;
+typedef char GLchar;
+typedef unsigned char GLubyte;
+typedef intptr_t GLintptr;
+typedef intptr_t GLsizeiptr;
+typedef uint64_t GLuint64;
+typedef struct __GLsync* GLsync;
+
+#define GL_FALSE						0
+#define GL_TRUE							1
+#define GL_NO_ERROR						0
+#define GL_INVALID_OPERATION			0x0502
+#define GL_ZERO							0
+#define GL_ONE							1
+#define GL_SRC_COLOR					0x0300
+#define GL_ONE_MINUS_SRC_COLOR			0x0301
+#define GL_SRC_ALPHA					0x0302
+#define GL_ONE_MINUS_SRC_ALPHA			0x0303
+#define GL_DST_ALPHA					0x0304
+#define GL_ONE_MINUS_DST_ALPHA			0x0305
+#define GL_DST_COLOR					0x0306
+#define GL_ONE_MINUS_DST_COLOR			0x0307
+#define GL_FUNC_ADD						0x8006
+#define GL_MIN							0x8007
+#define GL_MAX							0x8008
+#define GL_FUNC_SUBTRACT				0x800A
+#define GL_FUNC_REVERSE_SUBTRACT		0x800B
+#define GL_LINES						0x0001
+#define GL_LINE_STRIP					0x0003
+#define GL_TRIANGLES					0x0004
+#define GL_TRIANGLE_STRIP				0x0005
+#define GL_TRIANGLE_FAN					0x0006
+#define GL_CULL_FACE					0x0B44
+#define GL_DEPTH_TEST					0x0B71
+#define GL_VIEWPORT						0x0BA2
+#define GL_BLEND						0x0BE2
+#define GL_SCISSOR_TEST					0x0C11
+#define GL_TEXTURE_2D					0x0DE1
+#define GL_UNSIGNED_BYTE				0x1401
+#define GL_FLOAT						0x1406
+#define GL_RGB							0x1907
+#define GL_RGBA							0x1908
+#define GL_RENDERER						0x1F01
+#define GL_NEAREST						0x2600
+#define GL_LINEAR						0x2601
+#define GL_LINEAR_MIPMAP_LINEAR			0x2703
+#define GL_TEXTURE_MAG_FILTER			0x2800
+#define GL_TEXTURE_MIN_FILTER			0x2801
+#define GL_TEXTURE_WRAP_S				0x2802
+#define GL_TEXTURE_WRAP_T				0x2803
+#define GL_REPEAT						0x2901
+#define GL_COLOR_BUFFER_BIT				0x00004000
+#define GL_CLAMP_TO_EDGE				0x812F
+#define GL_MIRRORED_REPEAT				0x8370
+#define GL_RGB8							0x8051
+#define GL_RGBA8						0x8058
+#define GL_TEXTURE0						0x84C0
+#define GL_TEXTURE1						0x84C1
+#define GL_TEXTURE2						0x84C2
+#define GL_TEXTURE_BINDING_2D			0x8069
+#define GL_ARRAY_BUFFER					0x8892
+#define GL_STREAM_READ					0x88E1
+#define GL_STATIC_DRAW					0x88E4
+#define GL_DYNAMIC_DRAW					0x88E8
+#define GL_PIXEL_PACK_BUFFER			0x88EB
+#define GL_FRAGMENT_SHADER				0x8B30
+#define GL_VERTEX_SHADER				0x8B31
+#define GL_COMPILE_STATUS				0x8B81
+#define GL_LINK_STATUS					0x8B82
+#define GL_READ_FRAMEBUFFER				0x8CA8
+#define GL_DRAW_FRAMEBUFFER				0x8CA9
+#define GL_FRAMEBUFFER_BINDING			0x8CA6
+#define GL_FRAMEBUFFER_COMPLETE			0x8CD5
+#define GL_COLOR_ATTACHMENT0			0x8CE0
+#define GL_FRAMEBUFFER					0x8D40
+#define GL_MAP_READ_BIT					0x0001
+#define GL_SYNC_GPU_COMMANDS_COMPLETE	0x9117
+#define GL_ALREADY_SIGNALED				0x911A
+#define GL_CONDITION_SATISFIED			0x911C
+
+// state
+void glEnable(GLenum cap);
+void glDisable(GLenum cap);
+void glBlendFunc(GLenum sfactor, GLenum dfactor);
+void glBlendEquation(GLenum mode);
+void glColorMask(GLboolean red, GLboolean green, GLboolean blue, GLboolean alpha);
+void glViewport(GLint x, GLint y, GLsizei width, GLsizei height);
+void glClearColor(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha);
+void glClear(GLbitfield mask);
+void glGetIntegerv(GLenum pname, GLint* data);
+const GLubyte* glGetString(GLenum name);
+GLenum glGetError();
+void glFlush();
+void glFinish();
+
+// textures and samplers
+void glGenTextures(GLsizei n, GLuint* textures);
+void glDeleteTextures(GLsizei n, const GLuint* textures);
+void glActiveTexture(GLenum texture);
+void glBindTexture(GLenum target, GLuint texture);
+void glTexParameteri(GLenum target, GLenum pname, GLint param);
+void glTexImage2D(GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const void* pixels);
+void glGenerateMipmap(GLenum target);
+void glGenSamplers(GLsizei count, GLuint* samplers);
+void glBindSampler(GLuint unit, GLuint sampler);
+void glSamplerParameteri(GLuint sampler, GLenum pname, GLint param);
+
+// framebuffers
+void glGenFramebuffers(GLsizei n, GLuint* framebuffers);
+void glDeleteFramebuffers(GLsizei n, const GLuint* framebuffers);
+void glBindFramebuffer(GLenum target, GLuint framebuffer);
+void glFramebufferTexture2D(GLenum target, GLenum attachment, GLenum textarget, GLuint texture, GLint level);
+GLenum glCheckFramebufferStatus(GLenum target);
+void glBlitFramebuffer(GLint srcX0, GLint srcY0, GLint srcX1, GLint srcY1, GLint dstX0, GLint dstY0, GLint dstX1, GLint dstY1, GLbitfield mask, GLenum filter);
+void glReadPixels(GLint x, GLint y, GLsizei width, GLsizei height, GLenum format, GLenum type, void* pixels);
+
+// buffers and vertex arrays
+void glGenBuffers(GLsizei n, GLuint* buffers);
+void glBindBuffer(GLenum target, GLuint buffer);
+void glBufferData(GLenum target, GLsizeiptr size, const void* data, GLenum usage);
+void glBufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void* data);
+void* glMapBufferRange(GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access);
+void glGenVertexArrays(GLsizei n, GLuint* arrays);
+void glBindVertexArray(GLuint array);
+void glEnableVertexAttribArray(GLuint index);
+void glDisableVertexAttribArray(GLuint index);
+void glVertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const void* pointer);
+void glVertexAttrib2f(GLuint index, GLfloat x, GLfloat y);
+
+// shaders
+GLuint glCreateShader(GLenum type);
+void glShaderSource(GLuint shader, GLsizei count, const GLchar* const* string, const GLint* length);
+void glCompileShader(GLuint shader);
+void glGetShaderiv(GLuint shader, GLenum pname, GLint* params);
+void glGetShaderInfoLog(GLuint shader, GLsizei bufSize, GLsizei* length, GLchar* infoLog);
+GLuint glCreateProgram();
+void glAttachShader(GLuint program, GLuint shader);
+void glLinkProgram(GLuint program);
+void glGetProgramiv(GLuint program, GLenum pname, GLint* params);
+void glGetProgramInfoLog(GLuint program, GLsizei bufSize, GLsizei* length, GLchar* infoLog);
+void glUseProgram(GLuint program);
+GLint glGetUniformLocation(GLuint program, const GLchar* name);
+void glUniform1i(GLint location, GLint v0);
+void glUniform1f(GLint location, GLfloat v0);
+void glUniform4f(GLint location, GLfloat v0, GLfloat v1, GLfloat v2, GLfloat v3);
+void glUniform4fv(GLint location, GLsizei count, const GLfloat* value);
+void glUniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat* value);
+
+// draws
+void glDrawArrays(GLenum mode, GLint first, GLsizei count);
+
+// sync
+GLsync glFenceSync(GLenum condition, GLbitfield flags);
+GLenum glClientWaitSync(GLsync sync, GLbitfield flags, GLuint64 timeout);
+void glDeleteSync(GLsync sync);
+
+////////////////////////////////////////////////////////////////////////////////////////
+// AL/al.h and AL/alc.h
+////////////////////////////////////////////////////////////////////////////////////////
+
+typedef int ALint;
+typedef unsigned int ALuint;
+typedef int ALenum;
+typedef int ALsizei;
+typedef float ALfloat;
+typedef char ALboolean;
+typedef struct ALCdevice_struct ALCdevice;
+typedef struct ALCcontext_struct ALCcontext;
+
+#define AL_FALSE					0
+#define AL_TRUE						1
+#define AL_NO_ERROR					0
+#define AL_SOURCE_RELATIVE			0x202
+#define AL_PITCH					0x1003
+#define AL_POSITION					0x1004
+#define AL_VELOCITY					0x1006
+#define AL_LOOPING					0x1007
+#define AL_BUFFER					0x1009
+#define AL_GAIN						0x100A
+#define AL_ORIENTATION				0x100F
+#define AL_SOURCE_STATE				0x1010
+#define AL_PLAYING					0x1012
+#define AL_PAUSED					0x1013
+#define AL_STOPPED					0x1014
+#define AL_BUFFERS_QUEUED			0x1015
+#define AL_BUFFERS_PROCESSED		0x1016
+#define AL_REFERENCE_DISTANCE		0x1020
+#define AL_ROLLOFF_FACTOR			0x1021
+#define AL_MAX_DISTANCE				0x1023
+#define AL_FORMAT_MONO8				0x1100
+#define AL_FORMAT_MONO16			0x1101
+#define AL_FORMAT_STEREO8			0x1102
+#define AL_FORMAT_STEREO16			0x1103
+#define AL_INVERSE_DISTANCE_CLAMPED	0xD002
+
+// sound plays silently, sources report stopped so nothing waits on them
+inline ALuint WebHeadlessGenALName()											{ static ALuint name = 0; return ++name; }
+inline ALCdevice* alcOpenDevice(const char*)									{ return (ALCdevice*)1; }
+inline ALCcontext* alcCreateContext(ALCdevice*, const ALint*)					{ return (ALCcontext*)1; }
+inline ALboolean alcMakeContextCurrent(ALCcontext*)								{ return AL_TRUE; }
+inline ALenum alGetError()														{ return AL_NO_ERROR; }
+inline void alDistanceModel(ALenum)												{}
+inline void alDopplerFactor(ALfloat)											{}
+inline void alListener3f(ALenum, ALfloat, ALfloat, ALfloat)						{}
+inline void alListenerfv(ALenum, const ALfloat*)								{}
+inline void alGenSources(ALsizei n, ALuint* sources)							{ for (int i = 0; i < n; ++i) sources[i] = WebHeadlessGenALName(); }
+inline void alDeleteSources(ALsizei, const ALuint*)								{}
+inline void alGenBuffers(ALsizei n, ALuint* buffers)							{ for (int i = 0; i < n; ++i) buffers[i] = WebHeadlessGenALName(); }
+inline void alDeleteBuffers(ALsizei, const ALuint*)								{}
+inline void alBufferData(ALuint, ALenum, const void*, ALsizei, ALsizei)			{}
+inline void alSourcef(ALuint, ALenum, ALfloat)									{}
+inline void alSource3f(ALuint, ALenum, ALfloat, ALfloat, ALfloat)				{}
+inline void alSourcei(ALuint, ALenum, ALint)									{}
+inline void alGetSourcei(ALuint, ALenum param, ALint* value)					{ *value = (param == AL_SOURCE_STATE)? AL_STOPPED : 0; }
+inline void alSourcePlay(ALuint)												{}
+inline void alSourcePause(ALuint)												{}
+inline void alSourceStop(ALuint)												{}
+inline void alSourceRewind(ALuint)												{}
+inline void alSourceQueueBuffers(ALuint, ALsizei, const ALuint*)				{}
+inline void alSourceUnqueueBuffers(ALuint, ALsizei n, ALuint* buffers)			{ for (int i = 0; i < n; ++i) buffers[i] = 0; }
@@ -23,9 +23,13 @@
 #error webRender.cpp is web-build only
 #endif
 
+#ifdef FRANK_WEB_HEADLESS
+#include "webHeadless.h"
+#else
 #include <emscripten.h>
 #include <emscripten/html5.h>
 #include <GLES3/gl3.h>
+#endif
 #include <algorithm>
 
 ////////////////////////////////////////////////////////////////////////////////////////
@@ -210,6 +214,7 @@ struct WebChunkPool
 		return first;
 	}
 };
+const int WebChunkPool::bufferBytes;	// Min takes it by reference, so it needs storage
 static WebChunkPool webStreamPool;	// pos3 + packed color (16 bytes)
 static WebChunkPool webTexPool;		// pos3 + uv + packed color (24 bytes)
 
@@ -1437,6 +1442,12 @@ void FrankRender::EndRender()
 	isInRenderBlock = false;
 }
 
+void FrankRender::FlushSprites(SpriteFlushReason reason)
+{
+	// the web backend draws quads as they come, nothing is ever batched
+	spriteQuadCount = 0;
+}
+
 void FrankRender::SetPointFilter(bool pointFilter)
 {
 	// same sampler-state writes the d3d path makes; captured and applied at draw
@@ -1446,6 +1457,22 @@ void FrankRender::SetPointFilter(bool pointFilter)
 	DXUTGetD3D9Device()->SetSamplerState(0, D3DSAMP_MIPFILTER, pointFilter ? 0 : 2);
 }
 
+Vector2 FrankRender::WorldSpaceToScreenSpace(const Vector2& p)
+{
+	// same math as the d3d path, view and projection come from the captured device transforms
+	IDirect3DDevice9* pd3dDevice = DXUTGetD3D9Device();
+	Matrix44 matrixView;
+	Matrix44 matrixProjection;
+	pd3dDevice->GetTransform( D3DTS_VIEW, &matrixView.GetD3DXMatrix() );
+	pd3dDevice->GetTransform( D3DTS_PROJECTION, &matrixProjection.GetD3DXMatrix() );
+
+	const Matrix44 matrixFinal = matrixView * matrixProjection;
+	Vector2 localPos(matrixFinal.TransformCoord(p));
+	localPos += Vector2(1, -1);
+	localPos *= Vector2(0.5f*g_backBufferWidth, -0.5f*g_backBufferHeight);
+	return localPos;
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////
 // blend + color pipeline rules from the captured device state
 ////////////////////////////////////////////////////////////////////////////////////////
@@ -2956,6 +2983,7 @@ void FrankWebRenderRawPrimitive(const Matrix44& matrix, const Color& color, Fran
 // RenderQuadSimple links through this overload (only reached by normal-mapping paths)
 void FrankRender::Render(const Matrix44& matrix, LPDIRECT3DVERTEXBUFFER9 vb, int primitiveCount, D3DPRIMITIVETYPE primitiveType, UINT stride, DWORD fvf)
 {
+	++renderCallCount;
 	FrankWebRenderRawPrimitive(matrix, Color::White(), FrankWebGetDeviceState().textures[0], vb, primitiveCount, primitiveType, stride, fvf);
 }
 
@@ -3383,6 +3411,7 @@ static bool WebAdjustForRenderPass(TextureID ti, const Color& colorIn, Color& co
 
 void FrankRender::Render(const Matrix44& matrix, const Color& color, TextureID ti, const RenderPrimitive& rp, const int tileRotation, const bool tileMirror)
 {
+	++renderCallCount;
 	if (!webGLContext || color.a == 0)
 		return;
 	ASSERT(ti < MAX_TEXTURE_COUNT);
@@ -3393,6 +3422,7 @@ void FrankRender::Render(const Matrix44& matrix, const Color& color, TextureID t
 		RenderTile(tw.tilePos, tw.tileSize, matrix, color, tw.tileSheetTi, rp, tileRotation, tileMirror);
 		return;
 	}
+	DeferredRender::TrackShadowCasterDraw(matrix, color, ti, IntVector2(0), tileRotation, tileMirror);
 
 	FrankWebTexture* tex0 = tw.texture;
 	FrankWebTexture* tex1 = NULL;
@@ -3427,8 +3457,10 @@ void FrankRender::Render(const Matrix44& matrix, const Color& color, TextureID t
 
 void FrankRender::RenderTile(const IntVector2& tilePos, const IntVector2& tileSize, const Matrix44& matrix, const Color& color, TextureID ti, const RenderPrimitive& rp, int tileRotation, bool tileMirror)
 {
+	++renderCallCount;
 	if (!webGLContext || color.a == 0)
 		return;
+	DeferredRender::TrackShadowCasterDraw(matrix, color, ti, tilePos, tileRotation, tileMirror);
 
 	FrankWebTexture* tex0 = textures[ti][TT_Diffuse].texture;
 	FrankWebTexture* tex1 = NULL;
@@ -3456,6 +3488,7 @@ void FrankRender::RenderTile(const IntVector2& tilePos, const IntVector2& tileSi
 
 void FrankRender::RenderScreenSpace(const Matrix44& matrix, const Color& color, TextureID ti, const RenderPrimitive& rp)
 {
+	++renderCallCount;
 	if (!webGLContext || color.a == 0)
 		return;
 
@@ -3668,6 +3701,7 @@ void FrankRender::RenderSimpleLineVerts(const Color& color, bool makeBlack)
 		return;
 	}
 	totalSimpleVertsRendered += simpleVertLineCount;
+	DeferredRender::TrackShadowCasterVerts(simpleVertsLines, simpleVertLineCount, sizeof(SimpleVertex));
 	static WebStreamVertex converted[maxSimpleVerts];
 	for (int i = 0; i < simpleVertLineCount; ++i)
 	{
@@ -3692,6 +3726,7 @@ void FrankRender::RenderSimpleTriVerts(const Color& color, bool makeBlack, Textu
 		return;
 	}
 	totalSimpleVertsRendered += simpleVertTriCount;
+	DeferredRender::TrackShadowCasterVerts(simpleVertsTris, simpleVertTriCount, sizeof(SimpleVertex));
 	static WebStreamVertex converted[maxSimpleVerts];
 	for (int i = 0; i < simpleVertTriCount; ++i)
 	{
@@ -3739,6 +3774,7 @@ void FrankRender::SetSimpleVertsAreAdditive(bool additive)
 
 void FrankRender::AddPointToLineVerts(const Vector2& position, DWORD color)
 {
+	++renderCallCount;
 	if (simpleVertLineCount >= maxSimpleVerts - 8)
 	{
 		SimpleVertex vert1 = simpleVertsLines[simpleVertLineCount-1];
@@ -3753,6 +3789,7 @@ void FrankRender::AddPointToLineVerts(const Vector2& position, DWORD color)
 
 void FrankRender::AddPointToTriVerts(const Vector2& position, DWORD color)
 {
+	++renderCallCount;
 	if (simpleVertTriCount >= maxSimpleVerts - 8)
 	{
 		SimpleVertex vert1 = simpleVertsTris[simpleVertTriCount-2];
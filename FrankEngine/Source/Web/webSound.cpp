@@ -22,9 +22,13 @@
 #error webSound.cpp is web-build only
 #endif
 
+#ifdef FRANK_WEB_HEADLESS
+#include "webHeadless.h"
+#else
 #include <AL/al.h>
 #include <AL/alc.h>
 #include <emscripten.h>
+#endif
 
 static ALCdevice* webALDevice = NULL;
 static ALCcontext* webALContext = NULL;
@@ -12,6 +12,7 @@
 ////////////////////////////////////////////////////////////////////////////////////////
 
 #include "../frankEngine.h"
+#include "../editor/objectEditor.h"
 
 #ifndef FRANK_PLATFORM_WEB
 #error webStubs.cpp is web-build only
@@ -37,6 +38,7 @@ void DebugRender::InitDeviceObjects() {}
 void DebugRender::DestroyDeviceObjects() {}
 void DebugRender::RenderPoint(const Vector3& point, const Color& color, float scale, float time) {}
 void DebugRender::RenderLine(const Vector3& start, const Vector3& end, const Color& color, float time) {}
+void DebugRender::RenderLine(const Line2& line, const Color& color, float time) {}
 void DebugRender::RenderBox(const XForm2& xf, const Vector2& size, const Color& color, float time) {}
 void DebugRender::RenderBox(const XForm2& xf, const Box2AABB& box, const Color& color, float time) {}
 void DebugRender::RenderBox(const Box2AABB& box, const Color& color, float time) {}
@@ -60,6 +62,10 @@ void DebugRender::ImmediateRenderTextScreenSpace(const Vector2& position, const
 // GuiBase (guiBase.cpp)
 GuiBase::GuiBase() {}
 
+//--------------------------------------------------------------------------------------
+// ObjectEditor (objectEditor.cpp) - terrain stub picking reads the radius
+float ObjectEditor::zeroStubRadius = 0.25f;	// matches objectEditor.cpp default
+
 //--------------------------------------------------------------------------------------
 // TerrainRender / MiniMap (terrainRender.cpp, miniMap.cpp)
 DebugRender::DebugRender() {}
@@ -68,7 +74,6 @@ TerrainRender::TerrainRender() {}
 TerrainRender::~TerrainRender() {}
 // TerrainLayerRender::Render() lives in webRender.cpp as of phase 4
 bool TerrainRender::enableDiffuseLighting = true;
-float TerrainRender::textureWrapScale = 8;	// matches terrainRender.cpp default
 void TerrainRender::Update() {}
 // ClearCache / RefereshCached are real on web now - they invalidate the static terrain
 // vertex cache in webRender.cpp (the window-based eviction Update() does on windows is
@@ -309,6 +309,9 @@ HRESULT CALLBACK OnD3D9ResetDevice( IDirect3DDevice9* pd3dDevice,
 	g_backBufferHeight = pBackBufferSurfaceDesc->Height;
 	g_aspectRatio = (float)g_backBufferWidth / (float)g_backBufferHeight;
 
+	// device state goes back to defaults after a reset
+	g_render->InvalidateStateCache();
+
 	if (g_gameControlBase)
 	{
 		g_gameControlBase->InitDeviceObjects();
@@ -468,16 +471,23 @@ void CALLBACK OnD3D9FrameRender( IDirect3DDevice9* pd3dDevice, double fTime, flo
 
 	// reset verts rendered for debug info
 	g_render->ResetTotalSimpleVertsRendered();
+	g_render->ResetSpriteStats();
+	g_render->ResetStateStats();
+	g_renderCommands.ResetStats();
+	FrankFont::ResetMeshCacheStats();
 	g_terrainRender.renderedPrimitiveCount = 0;
 	g_terrainRender.renderedBatchCount = 0;
 
+	// dxut and d3dx objects may change device state outside of the cache between frames
+	g_render->InvalidateStateCache();
+
 	// Set up the textures
-	pd3dDevice->SetTextureStageState( 0, D3DTSS_COLOROP,	D3DTOP_MODULATE );
-	pd3dDevice->SetTextureStageState( 0, D3DTSS_COLORARG1,	D3DTA_TEXTURE );
-	pd3dDevice->SetTextureStageState( 0, D3DTSS_COLORARG2,	D3DTA_DIFFUSE );
-	pd3dDevice->SetTextureStageState( 0, D3DTSS_ALPHAOP,	D3DTOP_MODULATE );
-	pd3dDevice->SetTextureStageState( 0, D3DTSS_ALPHAARG1,	D3DTA_TEXTURE );
-	pd3dDevice->SetTextureStageState( 0, D3DTSS_ALPHAARG2,	D3DTA_DIFFUSE );
+	g_render->SetTextureStageState( 0, D3DTSS_COLOROP,	D3DTOP_MODULATE );
+	g_render->SetTextureStageState( 0, D3DTSS_COLORARG1,	D3DTA_TEXTURE );
+	g_render->SetTextureStageState( 0, D3DTSS_COLORARG2,	D3DTA_DIFFUSE );
+	g_render->SetTextureStageState( 0, D3DTSS_ALPHAOP,	D3DTOP_MODULATE );
+	g_render->SetTextureStageState( 0, D3DTSS_ALPHAARG1,	D3DTA_TEXTURE );
+	g_render->SetTextureStageState( 0, D3DTSS_ALPHAARG2,	D3DTA_DIFFUSE );
 	pd3dDevice->SetSamplerState( 0, D3DSAMP_MINFILTER,		D3DTEXF_LINEAR );
 	pd3dDevice->SetSamplerState( 0, D3DSAMP_MAGFILTER,		D3DTEXF_LINEAR );
 	pd3dDevice->SetSamplerState( 0, D3DSAMP_MIPFILTER,		D3DTEXF_LINEAR );
@@ -487,25 +497,25 @@ void CALLBACK OnD3D9FrameRender( IDirect3DDevice9* pd3dDevice, double fTime, flo
 	pd3dDevice->SetSamplerState( 1, D3DSAMP_MINFILTER,		D3DTEXF_LINEAR );
 	pd3dDevice->SetSamplerState( 1, D3DSAMP_MAGFILTER,		D3DTEXF_LINEAR );
 	pd3dDevice->SetSamplerState( 1, D3DSAMP_MIPFILTER,		D3DTEXF_LINEAR );
-	pd3dDevice->SetRenderState( D3DRS_SRCBLEND,				D3DBLEND_SRCALPHA );
-	pd3dDevice->SetRenderState( D3DRS_DESTBLEND,			D3DBLEND_INVSRCALPHA );
-	pd3dDevice->SetRenderState( D3DRS_BLENDOP,				D3DBLENDOP_ADD );
+	g_render->SetRenderState( D3DRS_SRCBLEND,				D3DBLEND_SRCALPHA );
+	g_render->SetRenderState( D3DRS_DESTBLEND,			D3DBLEND_INVSRCALPHA );
+	g_render->SetRenderState( D3DRS_BLENDOP,				D3DBLENDOP_ADD );
 
 	pd3dDevice->SetSamplerState( 0, D3DSAMP_MIPMAPLODBIAS, *(DWORD*)&mipBias );
 	pd3dDevice->SetSamplerState( 1, D3DSAMP_MIPMAPLODBIAS, *(DWORD*)&mipBias );
 	pd3dDevice->SetSamplerState( 2, D3DSAMP_MIPMAPLODBIAS, *(DWORD*)&mipBias );
 
 	// Set miscellaneous render states
-	pd3dDevice->SetRenderState( D3DRS_DITHERENABLE,			FALSE );
-	pd3dDevice->SetRenderState( D3DRS_SPECULARENABLE,		FALSE );
-	pd3dDevice->SetRenderState( D3DRS_ALPHABLENDENABLE,		TRUE);
-	pd3dDevice->SetRenderState( D3DRS_ZENABLE,				FALSE);
-	pd3dDevice->SetRenderState( D3DRS_ZWRITEENABLE,			FALSE);
-	pd3dDevice->SetRenderState( D3DRS_LIGHTING,				TRUE);
-	pd3dDevice->SetRenderState( D3DRS_ALPHATESTENABLE,		FALSE);
-	pd3dDevice->SetRenderState( D3DRS_AMBIENT,				0x00FFFFFF );
-	pd3dDevice->SetRenderState( D3DRS_CULLMODE,				D3DCULL_NONE);
-	pd3dDevice->SetRenderState( D3DRS_DIFFUSEMATERIALSOURCE,D3DMCS_MATERIAL  );
+	g_render->SetRenderState( D3DRS_DITHERENABLE,			FALSE );
+	g_render->SetRenderState( D3DRS_SPECULARENABLE,		FALSE );
+	g_render->SetRenderState( D3DRS_ALPHABLENDENABLE,		TRUE);
+	g_render->SetRenderState( D3DRS_ZENABLE,				FALSE);
+	g_render->SetRenderState( D3DRS_ZWRITEENABLE,			FALSE);
+	g_render->SetRenderState( D3DRS_LIGHTING,				TRUE);
+	g_render->SetRenderState( D3DRS_ALPHATESTENABLE,		FALSE);
+	g_render->SetRenderState( D3DRS_AMBIENT,				0x00FFFFFF );
+	g_render->SetRenderState( D3DRS_CULLMODE,				D3DCULL_NONE);
+	g_render->SetRenderState( D3DRS_DIFFUSEMATERIALSOURCE,D3DMCS_MATERIAL  );
 
 	if (g_gameControlBase)
 	{
@@ -541,7 +551,7 @@ void CALLBACK OnD3D9FrameRender( IDirect3DDevice9* pd3dDevice, double fTime, flo
 				CDXUTPerfEventGenerator( DXUT_PERFEVENTCOLOR, L"GameGui::Render()" );
 				FrankProfilerEntryDefine(L"GameGui::Render()", Color::White(), 1);
 				DXUT_BeginPerfEvent( DXUT_PERFEVENTCOLOR, L"HUD / Stats" ); // These events are to help PIX identify what the code is doing
-				pd3dDevice->SetRenderState(D3DRS_LIGHTING, TRUE);
+				g_render->SetRenderState(D3DRS_LIGHTING, TRUE);
 				if (g_gameControlBase->IsGameplayMode())
 					V(g_guiBase->Render(fElapsedTime))
 				V(g_editorGui.Render(fElapsedTime))
@@ -129,6 +129,7 @@ const GameDamageType GameDamageType_Default = GameDamageType(0);
 #include "rendering/frankFont.h"
 #include "rendering/deferredRender.h"
 #include "rendering/miniMap.h"
+#include "rendering/renderCommands.h"
 #include "gui/guiBase.h"
 #ifndef FRANK_PLATFORM_WEB
 #include "gui/editorGui.h"
@@ -149,6 +150,7 @@ const GameDamageType GameDamageType_Default = GameDamageType(0);
 #include "objects/weapon.h"
 #include "physics/physics.h"
 #include "physics/physicsRender.h"
+#include "physics/visibilityPolygon.h"
 #include "sound/soundControl.h"
 #include "sound/musicControl.h"
 #include "terrain/terrain.h"
@@ -156,3 +158,4 @@ const GameDamageType GameDamageType_Default = GameDamageType(0);
 #include "terrain/terrainSurface.h"
 #include "terrain/terrainTile.h"
 #include "core/frankUtil.h"
+#include "core/jobPool.h"
@@ -531,6 +531,9 @@ void GameControlBase::UpdateFrameInternal(float delta)
 
 	g_debugRender.Update(delta);
 
+	if (g_terrain)
+		g_terrain->UpdateSave();
+
 	if (!paused)
 	{
 		g_objectManager.SaveLastWorldTransforms();
@@ -550,6 +553,7 @@ void GameControlBase::UpdateFrameInternal(float delta)
 		g_input->SaveCamerXF();
 		
 		g_objectManager.Update();
+		ParticleEmitter::SimulateParticles();
 	}
 
 	// check gamepad
@@ -581,6 +585,7 @@ void GameControlBase::UpdateFrameInternal(float delta)
 			g_objectManager.SaveLastWorldTransforms();
 			resetWorldXForms = false;
 			g_terrainRender.ClearCache();
+			DeferredRender::ClearLightCache();
 		}
 
 		g_input->SaveCamerXF();
@@ -915,10 +920,45 @@ void GameControlBase::RenderDebugText()
 			//g_textHelper->DrawFormattedTextLine( L"start handle: %d", g_terrain->GetStartHandle());
 			g_textHelper->DrawFormattedTextLine( L"largest block: %d / %d", g_objectManager.GetLargestObjectSize(), g_objectManager.GetBlockSize());
 			g_textHelper->DrawFormattedTextLine( L"particles: %d / %d", ParticleEmitter::GetTotalEmitterCount(), ParticleEmitter::GetTotalParticleCount());
+			if (ParticleEmitter::particleDebug)
+			{
+				g_textHelper->DrawFormattedTextLine( L"particle storage: %dk  dropped  ambient: %d  normal: %d  critical: %d",
+					ParticleEmitter::GetTotalParticleCapacity() * ParticleArrays::GetBytesPerParticle() / 1024,
+					ParticleEmitter::GetDroppedParticleCount(ParticlePriority::Ambient),
+					ParticleEmitter::GetDroppedParticleCount(ParticlePriority::Normal),
+					ParticleEmitter::GetDroppedParticleCount(ParticlePriority::Critical));
+			}
 			g_textHelper->DrawFormattedTextLine( L"lights: %d / %d", DeferredRender::GetSimpleLightCount(), DeferredRender::GetDynamicLightCount());
 			g_textHelper->DrawFormattedTextLine( L"sounds: %d", g_sound->GetSoundObjectCount());
 			g_textHelper->DrawFormattedTextLine( L"simple verts: %d", g_render->GetTotalSimpleVertsRendered());
+			if (g_render->GetSpriteBatchedCount() > 0)
+			{
+				g_textHelper->DrawFormattedTextLine( L"sprites: %d  draws: %d", g_render->GetSpriteBatchedCount(), g_render->GetSpriteDrawCount());
+				g_textHelper->DrawFormattedTextLine( L"sprite flush  texture: %d  blend: %d  state: %d  full: %d  draw: %d  end: %d",
+					g_render->GetSpriteFlushCount(FrankRender::SpriteFlush_Texture),
+					g_render->GetSpriteFlushCount(FrankRender::SpriteFlush_Blend),
+					g_render->GetSpriteFlushCount(FrankRender::SpriteFlush_State),
+					g_render->GetSpriteFlushCount(FrankRender::SpriteFlush_Full),
+					g_render->GetSpriteFlushCount(FrankRender::SpriteFlush_Draw),
+					g_render->GetSpriteFlushCount(FrankRender::SpriteFlush_End));
+			}
+			if (g_renderCommands.executedCount > 0)
+				g_textHelper->DrawFormattedTextLine( L"render commands: %d  executes: %d  texture changes: %d -> %d  block changes: %d", g_renderCommands.executedCount, g_renderCommands.executeCallCount, g_renderCommands.textureChangesUnsorted, g_renderCommands.textureChangesSorted, g_renderCommands.flagChanges);
+			if (g_render->GetStateSetsIssued() > 0)
+				g_textHelper->DrawFormattedTextLine( L"render states: issued: %d  filtered: %d", g_render->GetStateSetsIssued(), g_render->GetStateSetsFiltered());
+			if (g_renderCommands.recordedObjectCount > 0)
+				g_textHelper->DrawFormattedTextLine( L"render replay: recorded objects: %d  skipped objects: %d  replayed commands: %d", g_renderCommands.recordedObjectCount, g_renderCommands.replayedObjectCount, g_renderCommands.replayedCount);
+			if (DeferredRender::GetLightCacheSize() > 0)
+				g_textHelper->DrawFormattedTextLine( L"light cache: %d  hit: %d  miss: %d", DeferredRender::GetLightCacheSize(), DeferredRender::GetLightCacheHitCount(), DeferredRender::GetLightCacheMissCount());
+			if (DeferredRender::lightScheduleEnable)
+				g_textHelper->DrawFormattedTextLine( L"light refresh: %d  stale: %d  deferred: %d", DeferredRender::GetLightRefreshCount(), DeferredRender::GetLightRefreshStaleCount(), DeferredRender::GetLightRefreshDeferredCount());
+			if (FrankFont::GetMeshCacheHitCount() + FrankFont::GetMeshCacheMissCount() > 0)
+				g_textHelper->DrawFormattedTextLine( L"font meshes: hit: %d  miss: %d", FrankFont::GetMeshCacheHitCount(), FrankFont::GetMeshCacheMissCount());
 			g_textHelper->DrawFormattedTextLine( L"terrain batches: %d", g_terrainRender.renderedBatchCount);
+			if (g_terrainRender.GetCacheSlotCount() > 0)
+				g_textHelper->DrawFormattedTextLine( L"terrain cache: %d / %d  hit: %d  miss: %d  evict: %d", g_terrainRender.GetCachedPatchCount(), g_terrainRender.GetCacheSlotCount(), g_terrainRender.cacheHitCount, g_terrainRender.cacheMissCount, g_terrainRender.cacheEvictCount);
+			if (g_terrain && g_terrain->GetSpawnQueueSize() > 0)
+				g_textHelper->DrawFormattedTextLine( L"spawn queue: %d", g_terrain->GetSpawnQueueSize());
 			if (GetPathFinding())
 				g_textHelper->DrawFormattedTextLine( L"pathfind cost: %d", GetPathFinding()->GetPathFindCostLastFrame());
 			//g_textHelper->DrawFormattedTextLine( L"terrain prims/batches: %d / %d", g_terrainRender.renderedPrimitiveCount, g_terrainRender.renderedBatchCount);
@@ -525,9 +525,9 @@ void GameControl::RenderDebugText()
 		g_textHelper->DrawFormattedTextLine( L"Health: %.1f / %.1f", g_player->GetHealth(),  g_player->GetMaxHealth());
 		g_textHelper->DrawFormattedTextLine( L"Time: %.2f", g_player->GetLifeTime());
 
-		//float lightValue = 0;
-		//DeferredRender::GetLightValue(g_input->GetMousePosWorldSpace(), lightValue);
-		//g_textHelper->DrawFormattedTextLine( L"Light Value Test: %.2f", lightValue);
+		float lightValue = 0;
+		DeferredRender::GetLightValue(g_input->GetMousePosWorldSpace(), lightValue);
+		g_textHelper->DrawFormattedTextLine( L"Light Value Test: %.2f", lightValue);
 	}
 	g_textHelper->End();
 }
\ No newline at end of file
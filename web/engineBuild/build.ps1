@@ -1,20 +1,29 @@
 # Phase 2/3 web engine build - compiles the engine's portable TU list (plus Box2D,
 # stubs, web shell, TestGame) under em++ with FRANK_PLATFORM_WEB.
-# Usage: build.ps1 [-compileOnly] [-only <name>]   (-only compiles a single TU by substring)
+# Usage: build.ps1 [-compileOnly] [-only <name>] [-headless]   (-only compiles a single TU by substring)
+# -headless builds the same TUs natively ($env:CXX/$env:CC, default clang) against the null
+# WebGL/OpenAL/emscripten shims in Web\webHeadless.h - run testGameHeadless from TestGame\ to
+# get draws, state changes and cpu time per frame (FRANK_CVARS="webHeadlessFrames 300" etc)
 param(
     [switch]$compileOnly,
-    [string]$only = ""
+    [string]$only = "",
+    [switch]$headless
 )
 $ErrorActionPreference = "Continue"
 
 $buildDir = $PSScriptRoot
 $engineRoot = Resolve-Path (Join-Path $buildDir "..\..")
 $src = Join-Path $engineRoot "FrankEngine\Source"
-$outDir = Join-Path $buildDir "build"
+$outDir = Join-Path $buildDir $(if ($headless) { "buildHeadless" } else { "build" })
 if (-not (Test-Path $outDir)) { New-Item -ItemType Directory $outDir | Out-Null }
 
 $env:EMSDK_PYTHON = "c:\dev\tools\emsdk\python\3.13.3_64bit\python.exe"
 $empp = "c:\dev\tools\emsdk\upstream\emscripten\em++.exe"
+$emcc = $empp
+if ($headless) {
+    $empp = $(if ($env:CXX) { $env:CXX } else { "clang++" })
+    $emcc = $(if ($env:CC) { $env:CC } else { "clang" })
+}
 
 # engine TUs compiled for web (renderer/sound/input/gui/editor/shell excluded - stubbed)
 $engineSources = @(
@@ -24,6 +33,7 @@ $engineSources = @(
     "Core\inputControl.cpp",
     "Core\debugMessage.cpp",
     "Core\frankUtil.cpp",
+    "Core\jobPool.cpp",
     "Core\pathFindingBase.cpp",
     "Core\perlinNoise.cpp",
     "Core\frankProfiler.cpp",
@@ -39,14 +49,17 @@ $engineSources = @(
     "Objects\weapon.cpp",
     "Physics\physics.cpp",
     "Physics\physicsRender.cpp",
+    "Physics\visibilityPolygon.cpp",
     "Rendering\deferredRender.cpp",
     "Rendering\frankFont.cpp",
     "Rendering\miniMap.cpp",
+    "Rendering\renderCommands.cpp",
     "Sound\soundControl.cpp",
     "Sound\musicControl.cpp",
     "Terrain\terrain.cpp",
     "Terrain\terrainTile.cpp",
-    "Terrain\terrainSurface.cpp"
+    "Terrain\terrainSurface.cpp",
+    "Terrain\terrainVertices.cpp"
 )
 
 $flags = @(
@@ -59,6 +72,10 @@ $flags = @(
     "-Wno-inconsistent-missing-override", "-Wno-writable-strings", "-Wno-dangling-else",
     "-Wno-nonportable-include-path"
 )
+if ($headless) {
+    # box2d calls the global isfinite, which only libc++ gets from cmath
+    $flags += @("-DFRANK_WEB_HEADLESS", "-include", "math.h")
+}
 
 $failed = 0
 $compiled = 0
@@ -90,7 +107,7 @@ foreach ($c in $oggCSources) {
     $obj = Join-Path $outDir ("ogg_" + [IO.Path]::GetFileNameWithoutExtension($c) + ".o")
     $oggObjs += $obj
     if ((Test-Path $obj) -and ((Get-Item $obj).LastWriteTime -gt (Get-Item $c).LastWriteTime)) { continue }
-    & $empp -c -x c $c @oggFlags -o $obj
+    & $emcc -c -x c $c @oggFlags -o $obj
     if ($LASTEXITCODE -ne 0) { Write-Host "FAILED: $c"; exit 1 }
 }
 
@@ -103,6 +120,7 @@ $webSources = @(
     (Join-Path $src "Web\webSound.cpp"),
     (Join-Path $src "Web\frankEngineWeb.cpp")
 )
+if ($headless) { $webSources += (Join-Path $src "Web\webHeadless.cpp") }
 # gameGUI.cpp is DXUT-dialog based; the web build compiles gameGUIWeb.cpp instead
 $testGameSources = Get-ChildItem (Join-Path $engineRoot "TestGame\Source") -Recurse -Filter *.cpp |
     Where-Object { $_.Name -ne "gameGUI.cpp" } | ForEach-Object { $_.FullName }
@@ -110,6 +128,17 @@ $testGameSources = Get-ChildItem (Join-Path $engineRoot "TestGame\Source") -Recu
 $objs = Get-ChildItem $outDir -Filter *.o | ForEach-Object { $_.FullName }
 $linkInputs = @($objs) + $box2dSources + $webSources + $testGameSources
 
+# native link: no preload, data is read from the working directory like the windows build
+if ($headless) {
+    & $empp @linkInputs @flags `
+        -I (Join-Path $engineRoot "TestGame\Source") `
+        -I (Join-Path $engineRoot "TestGame\Source\objects") `
+        -o (Join-Path $outDir "testGameHeadless")
+    if ($LASTEXITCODE -ne 0) { Write-Host "link FAILED"; exit 1 }
+    Write-Host ("link OK - run {0} from {1}" -f (Join-Path $outDir "testGameHeadless"), (Join-Path $engineRoot "TestGame"))
+    exit 0
+}
+
 & $empp @linkInputs @flags `
     -I (Join-Path $engineRoot "TestGame\Source") `
     -I (Join-Path $engineRoot "TestGame\Source\objects") `